@@ -0,0 +1,415 @@
+/**
+ * @file alias.c
+ * @brief Aliases: `alias`, `unalias`, and their expansion in commands.
+ *
+ * Aliases live in a chained hash table, like variables. An alias is
+ * examined once, when it is defined: the lexer finds the command word of
+ * its value (for chains such as `alias l=ll`) and whether the value is
+ * more than a simple command or pipeline (`a; b`, `a && b`, `if ...`).
+ * Expanding a command then costs one token of lexing and one hash lookup
+ * per alias in the chain.
+ *
+ * Expansion happens in interactive shells (as in other shells, scripts do
+ * not use aliases), when a simple command or pipeline runs and before it
+ * is split into arguments: each command word that is an unquoted word
+ * naming an alias is replaced by the alias value. A quoted or escaped word (`\ls`)
+ * bypasses the alias. Each alias is expanded at most once per command, so
+ * `alias ls='ls -F'` and loops between aliases terminate.
+ *
+ * @author Abdelhamid
+ * @date 2025-12-14
+ */
+
+#include "shell.h"
+
+/** @brief Number of hash buckets (power of two). */
+#define ALIAS_BUCKETS 256
+
+/** @brief Longest chain of aliases expanded in one command. */
+#define MAX_ALIAS_DEPTH 32
+
+/**
+ * @brief One alias.
+ */
+struct alias {
+  char *name;         /**< Alias name. */
+  char *value;        /**< Replacement text. */
+  int word_start;     /**< Offset of the command word in `value`, or -1. */
+  int word_end;       /**< Offset just past the command word. */
+  int compound;       /**< Non-zero if `value` is more than a pipeline. */
+  struct alias *next; /**< Next alias in the same bucket. */
+};
+
+/** @brief The alias table. */
+static struct alias *alias_table[ALIAS_BUCKETS];
+
+/**
+ * @brief Bucket index for an alias name (FNV-1a).
+ */
+static unsigned alias_bucket(const char *name, size_t len) {
+  unsigned h = 2166136261u;
+  for (size_t i = 0; i < len; i++) {
+    h ^= (unsigned char)name[i];
+    h *= 16777619u;
+  }
+  return h & (ALIAS_BUCKETS - 1);
+}
+
+/**
+ * @brief Finds an alias by name (`len` bytes, not NUL-terminated).
+ */
+static struct alias *find_alias(const char *name, size_t len) {
+  for (struct alias *a = alias_table[alias_bucket(name, len)]; a;
+       a = a->next) {
+    if (strncmp(a->name, name, len) == 0 && a->name[len] == '\0')
+      return a;
+  }
+  return NULL;
+}
+
+/**
+ * @brief Returns non-zero if `name` is an alias.
+ */
+int is_alias(const char *name) {
+  return find_alias(name, strlen(name)) != NULL;
+}
+
+/**
+ * @brief Checks whether a token is a word made only of literal characters
+ *        (so it can name an alias).
+ */
+static int plain_word(const char *s, const struct token *tok) {
+  if (tok->type != TOK_WORD || tok->len == 0)
+    return 0;
+  for (int i = tok->start; i < tok->start + tok->len; i++) {
+    if (strchr("\\'\"$`*?[=", s[i]))
+      return 0;
+  }
+  return 1;
+}
+
+/**
+ * @brief Finds the command word of a command text: the first word that is
+ *        not a `NAME=value` assignment.
+ *
+ * @return int 1 if found (in `tok`), 0 if the command has none.
+ */
+static int command_word(const char *text, struct token *tok) {
+  char word[256];
+  int pos = 0;
+
+  while (lex_token(text, &pos, tok) == TOK_WORD) {
+    if (tok->len >= (int)sizeof(word))
+      return 1;
+    memcpy(word, text + tok->start, tok->len);
+    word[tok->len] = '\0';
+    if (!is_assignment(word))
+      return 1;
+  }
+  return 0;
+}
+
+/**
+ * @brief Checks whether an alias value needs the compiler: it has list
+ *        operators, or starts a compound command.
+ */
+static int value_is_compound(const char *value) {
+  static const char *const keywords[] = {"if",   "while", "until", "for",
+                                         "case", "{",     "!",     NULL};
+  struct token tok;
+  int pos = 0, first = 1;
+
+  while (lex_token(value, &pos, &tok) != TOK_END) {
+    if (tok.type == TOK_OP) {
+      if (is_operator(tok.op, ";") || is_operator(tok.op, "&") ||
+          is_operator(tok.op, "&&") || is_operator(tok.op, "||") ||
+          is_operator(tok.op, "\n") || is_operator(tok.op, "(") ||
+          is_operator(tok.op, ")"))
+        return 1;
+    } else if (first) {
+      for (int i = 0; keywords[i]; i++) {
+        if ((int)strlen(keywords[i]) == tok.len &&
+            strncmp(value + tok.start, keywords[i], tok.len) == 0)
+          return 1;
+      }
+    }
+    first = 0;
+  }
+  return 0;
+}
+
+/**
+ * @brief Defines (or redefines) an alias.
+ */
+static void define_alias(const char *name, size_t len, const char *value) {
+  struct alias *a = find_alias(name, len);
+  struct token tok;
+
+  if (!a) {
+    unsigned b = alias_bucket(name, len);
+    a = calloc(1, sizeof(struct alias));
+    if (!a) {
+      fprintf(stderr, "shell: allocation error\n");
+      exit(EXIT_FAILURE);
+    }
+    a->name = strndup(name, len);
+    a->next = alias_table[b];
+    alias_table[b] = a;
+  } else {
+    free(a->value);
+  }
+  a->value = strdup(value);
+  a->compound = value_is_compound(value);
+  a->word_start = -1;
+  if (command_word(value, &tok) && plain_word(value, &tok)) {
+    a->word_start = tok.start;
+    a->word_end = tok.start + tok.len;
+  }
+}
+
+/**
+ * @brief Removes an alias.
+ * @return int 0 on success, -1 if there is no such alias.
+ */
+static int remove_alias(const char *name) {
+  struct alias **link = &alias_table[alias_bucket(name, strlen(name))];
+  for (; *link; link = &(*link)->next) {
+    struct alias *a = *link;
+    if (strcmp(a->name, name) == 0) {
+      *link = a->next;
+      free(a->name);
+      free(a->value);
+      free(a);
+      return 0;
+    }
+  }
+  return -1;
+}
+
+/**
+ * @brief Joins three strings into a new one.
+ */
+static char *join3(const char *a, size_t a_len, const char *b, size_t b_len,
+                   const char *c) {
+  size_t c_len = strlen(c);
+  char *s = malloc(a_len + b_len + c_len + 1);
+  if (!s) {
+    fprintf(stderr, "shell: allocation error\n");
+    exit(EXIT_FAILURE);
+  }
+  memcpy(s, a, a_len);
+  memcpy(s + a_len, b, b_len);
+  memcpy(s + a_len + b_len, c, c_len + 1);
+  return s;
+}
+
+/**
+ * @brief Expands an alias, and the aliases its value starts with.
+ *
+ * @param a The alias.
+ * @param compound Set to non-zero if a value in the chain is compound.
+ * @return char* The replacement text (free it).
+ */
+static char *expand_chain(struct alias *a, int *compound) {
+  struct alias *seen[MAX_ALIAS_DEPTH];
+  int depth = 0;
+
+  // The result is `head` + the value of `a` + `tail`. While the value's
+  // own command word names another alias, the words around it move into
+  // `head` and `tail`, and that alias is expanded in turn.
+  char *head = strdup("");
+  char *tail = strdup("");
+  for (;;) {
+    seen[depth++] = a;
+    *compound |= a->compound;
+    struct alias *b = NULL;
+    if (a->word_start >= 0 && depth < MAX_ALIAS_DEPTH)
+      b = find_alias(a->value + a->word_start, a->word_end - a->word_start);
+    for (int i = 0; b && i < depth; i++) {
+      if (seen[i] == b)
+        b = NULL;
+    }
+    if (!b)
+      break;
+    char *h = join3(head, strlen(head), a->value, a->word_start, "");
+    char *t = join3(a->value + a->word_end, strlen(a->value + a->word_end),
+                    "", 0, tail);
+    free(head);
+    free(tail);
+    head = h;
+    tail = t;
+    a = b;
+  }
+  char *s = join3(head, strlen(head), a->value, strlen(a->value), tail);
+  free(head);
+  free(tail);
+  return s;
+}
+
+/**
+ * @brief Expands aliases in the command words of a simple command or
+ *        pipeline.
+ *
+ * @param text The command text.
+ * @param compound Set to non-zero if the result must go through the
+ *        compiler (an alias value with `;`, `&&`, `if`...).
+ * @return char* The expanded text (free it), or NULL if no alias applies.
+ */
+char *alias_expand(const char *text, int *compound) {
+  char word[256];
+  struct token tok;
+  int pos = 0, copied = 0, command = 1, target = 0;
+  char *out = NULL;
+
+  if (!interactive)
+    return NULL;
+  *compound = 0;
+  while (lex_token(text, &pos, &tok) != TOK_END) {
+    if (tok.type == TOK_OP) {
+      if (is_operator(tok.op, "\n"))
+        break; // here-document bodies follow
+      if (is_operator(tok.op, "|") || is_operator(tok.op, "|&"))
+        command = 1;
+      else
+        target = 1; // a redirection: its target is not a command word
+      continue;
+    }
+    if (target || !command) {
+      target = 0;
+      continue;
+    }
+    if (tok.len < (int)sizeof(word)) {
+      memcpy(word, text + tok.start, tok.len);
+      word[tok.len] = '\0';
+      if (is_assignment(word))
+        continue; // the command word comes after assignments
+    }
+    command = 0;
+    struct alias *a =
+        plain_word(text, &tok) ? find_alias(text + tok.start, tok.len) : NULL;
+    if (!a)
+      continue;
+    char *value = expand_chain(a, compound);
+    char *next = join3(out ? out : "", out ? strlen(out) : 0,
+                       text + copied, tok.start - copied, value);
+    free(value);
+    free(out);
+    out = next;
+    copied = tok.start + tok.len;
+  }
+  if (!out)
+    return NULL;
+  char *s = join3(out, strlen(out), "", 0, text + copied);
+  free(out);
+  return s;
+}
+
+/**
+ * @brief Prints an alias in a form that can be read back.
+ */
+static void print_alias(const struct alias *a) {
+  printf("alias %s='", a->name);
+  for (const char *p = a->value; *p; p++) {
+    if (*p == '\'')
+      printf("'\\''");
+    else
+      putchar(*p);
+  }
+  printf("'\n");
+}
+
+/**
+ * @brief Orders aliases by name (for qsort).
+ */
+static int compare_aliases(const void *x, const void *y) {
+  return strcmp((*(struct alias *const *)x)->name,
+                (*(struct alias *const *)y)->name);
+}
+
+/* =========================================================================
+ *                          Built-in Command Implementations
+ * ========================================================================= */
+
+/**
+ * @brief Defines or prints aliases.
+ *
+ * Usage: `alias [name[=value]...]`. Without arguments, prints every alias
+ * (sorted by name); `alias name` prints one.
+ *
+ * @param args Null-terminated array of arguments.
+ * @return int Always returns 1 to continue execution.
+ */
+int shell_alias(char **args) {
+  if (!args[1]) {
+    int n = 0;
+    for (int b = 0; b < ALIAS_BUCKETS; b++) {
+      for (struct alias *a = alias_table[b]; a; a = a->next)
+        n++;
+    }
+    struct alias **all = malloc((n + 1) * sizeof(struct alias *));
+    if (!all) {
+      fprintf(stderr, "shell: allocation error\n");
+      exit(EXIT_FAILURE);
+    }
+    n = 0;
+    for (int b = 0; b < ALIAS_BUCKETS; b++) {
+      for (struct alias *a = alias_table[b]; a; a = a->next)
+        all[n++] = a;
+    }
+    qsort(all, n, sizeof(struct alias *), compare_aliases);
+    for (int i = 0; i < n; i++)
+      print_alias(all[i]);
+    free(all);
+    return 1;
+  }
+
+  for (int i = 1; args[i]; i++) {
+    char *eq = strchr(args[i], '=');
+    size_t len = eq ? (size_t)(eq - args[i]) : strlen(args[i]);
+    if (len == 0 || strcspn(args[i], " \t\n\\'\"$`/|&;<>()") < len) {
+      fprintf(stderr, "shell: alias: '%s': invalid alias name\n", args[i]);
+      last_status = 1;
+    } else if (eq) {
+      define_alias(args[i], len, eq + 1);
+    } else {
+      struct alias *a = find_alias(args[i], len);
+      if (a) {
+        print_alias(a);
+      } else {
+        fprintf(stderr, "shell: alias: %s: not found\n", args[i]);
+        last_status = 1;
+      }
+    }
+  }
+  return 1;
+}
+
+/**
+ * @brief Removes aliases.
+ *
+ * Usage: `unalias name...` or `unalias -a` (all).
+ *
+ * @param args Null-terminated array of arguments.
+ * @return int Always returns 1 to continue execution.
+ */
+int shell_unalias(char **args) {
+  if (!args[1]) {
+    fprintf(stderr, "unalias: usage: unalias [-a] name...\n");
+    last_status = 2;
+    return 1;
+  }
+  if (strcmp(args[1], "-a") == 0) {
+    for (int b = 0; b < ALIAS_BUCKETS; b++) {
+      while (alias_table[b])
+        remove_alias(alias_table[b]->name);
+    }
+    return 1;
+  }
+  for (int i = 1; args[i]; i++) {
+    if (remove_alias(args[i]) != 0) {
+      fprintf(stderr, "shell: unalias: %s: not found\n", args[i]);
+      last_status = 1;
+    }
+  }
+  return 1;
+}
@@ -0,0 +1,488 @@
+/**
+ * @file arith.c
+ * @brief Arithmetic expansion: `$(( expression ))`.
+ *
+ * Expressions use 64-bit signed integers and the C operators (unary
+ * `+ - ! ~`, `* / %`, `+ -`, `<< >>`, comparisons, `== !=`, `& ^ |`,
+ * `&& ||`, `?:`, assignments `= += -= *= /= %= <<= >>= &= ^= |=` and
+ * `++`/`--`). Bare names refer to shell variables.
+ *
+ * The parser is a precedence-climbing parser that builds a small AST.
+ * Parsed ASTs are cached by expression text, so a `$((i + 1))` inside a
+ * loop body is parsed once and only evaluated on later iterations (the
+ * variable is looked up at evaluation time, not baked into the tree).
+ *
+ * @author Abdelhamid
+ * @date 2025-12-14
+ */
+
+#include "shell.h"
+#include <ctype.h>
+
+/** @brief Number of cached expressions kept before the cache is reset. */
+#define ARITH_CACHE_SIZE 256
+
+/**
+ * @brief AST node kinds.
+ */
+enum arith_kind {
+  A_NUM,     /**< Integer literal. */
+  A_VAR,     /**< Variable reference. */
+  A_UNARY,   /**< Unary operator (`op` holds the operator). */
+  A_BINARY,  /**< Binary operator. */
+  A_ASSIGN,  /**< Assignment (`op` holds "=" or the compound operator). */
+  A_PREINC,  /**< `++x` / `--x` (`op` is "+" or "-"). */
+  A_POSTINC, /**< `x++` / `x--`. */
+  A_TERNARY  /**< `a ? b : c`. */
+};
+
+/**
+ * @brief One AST node.
+ */
+struct arith_node {
+  enum arith_kind kind;
+  char op[4];             /**< Operator text. */
+  long long value;        /**< A_NUM: the value. */
+  char *name;             /**< A_VAR / assignments: the variable name. */
+  struct arith_node *a;   /**< First operand. */
+  struct arith_node *b;   /**< Second operand. */
+  struct arith_node *c;   /**< Third operand (ternary). */
+};
+
+/**
+ * @brief A cached, parsed expression.
+ */
+struct arith_entry {
+  char *text;              /**< Expression source (cache key). */
+  struct arith_node *root; /**< Parsed tree, or NULL on syntax error. */
+};
+
+/** @brief Expression cache (hash table with linear probing). */
+static struct arith_entry arith_cache[ARITH_CACHE_SIZE * 2];
+
+/** @brief Number of entries in `arith_cache`. */
+static int arith_cache_len = 0;
+
+/**
+ * @brief Parser state.
+ */
+struct arith_parser {
+  const char *s; /**< Expression text. */
+  int pos;       /**< Current position. */
+  int error;     /**< Set on a syntax error. */
+};
+
+/**
+ * @brief Binary operators with their precedence (higher binds tighter).
+ *
+ * Longer operators come first so `<<` is not read as `<`.
+ */
+static const struct {
+  const char *op;
+  int prec;
+} binary_ops[] = {{"<<", 9}, {">>", 9}, {"<=", 8}, {">=", 8}, {"==", 7},
+                  {"!=", 7}, {"&&", 3}, {"||", 2}, {"*", 11}, {"/", 11},
+                  {"%", 11}, {"+", 10}, {"-", 10}, {"<", 8},  {">", 8},
+                  {"&", 6},  {"^", 5},  {"|", 4}};
+
+/** @brief Compound assignment operators. */
+static const char *assign_ops[] = {"<<=", ">>=", "+=", "-=", "*=", "/=",
+                                   "%=",  "&=",  "^=", "|=", "="};
+
+static struct arith_node *parse_expr(struct arith_parser *p);
+
+/**
+ * @brief Allocates a zeroed node.
+ */
+static struct arith_node *new_node(enum arith_kind kind) {
+  struct arith_node *n = calloc(1, sizeof(struct arith_node));
+  if (!n) {
+    fprintf(stderr, "shell: allocation error\n");
+    exit(EXIT_FAILURE);
+  }
+  n->kind = kind;
+  return n;
+}
+
+/**
+ * @brief Frees a tree.
+ */
+static void free_node(struct arith_node *n) {
+  if (!n)
+    return;
+  free_node(n->a);
+  free_node(n->b);
+  free_node(n->c);
+  free(n->name);
+  free(n);
+}
+
+/**
+ * @brief Skips whitespace.
+ */
+static void skip_ws(struct arith_parser *p) {
+  while (isspace((unsigned char)p->s[p->pos]))
+    p->pos++;
+}
+
+/**
+ * @brief Consumes `tok` if it comes next.
+ * @return int 1 if consumed, 0 otherwise.
+ */
+static int accept(struct arith_parser *p, const char *tok) {
+  size_t n = strlen(tok);
+  skip_ws(p);
+  if (strncmp(p->s + p->pos, tok, n) == 0) {
+    p->pos += (int)n;
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * @brief Parses a primary: number, variable, parenthesized expression,
+ * unary operator or increment/decrement.
+ */
+static struct arith_node *parse_unary(struct arith_parser *p) {
+  struct arith_node *n;
+  skip_ws(p);
+  const char *s = p->s + p->pos;
+
+  if ((s[0] == '+' || s[0] == '-') && s[1] == s[0]) {
+    p->pos += 2;
+    skip_ws(p);
+    int start = p->pos;
+    while (isalnum((unsigned char)p->s[p->pos]) || p->s[p->pos] == '_')
+      p->pos++;
+    if (p->pos == start) {
+      p->error = 1;
+      return NULL;
+    }
+    n = new_node(A_PREINC);
+    n->op[0] = s[0];
+    n->name = strndup(p->s + start, p->pos - start);
+    return n;
+  }
+  if (s[0] == '+' || s[0] == '-' || s[0] == '!' || s[0] == '~') {
+    p->pos++;
+    n = new_node(A_UNARY);
+    n->op[0] = s[0];
+    n->a = parse_unary(p);
+    return n;
+  }
+  if (s[0] == '(') {
+    p->pos++;
+    n = parse_expr(p);
+    if (!accept(p, ")"))
+      p->error = 1;
+    return n;
+  }
+  if (isdigit((unsigned char)s[0])) {
+    char *end;
+    n = new_node(A_NUM);
+    n->value = strtoll(s, &end, 0); // decimal, 0x hex, 0 octal
+    p->pos += (int)(end - s);
+    return n;
+  }
+  if (isalpha((unsigned char)s[0]) || s[0] == '_') {
+    int start = p->pos;
+    while (isalnum((unsigned char)p->s[p->pos]) || p->s[p->pos] == '_')
+      p->pos++;
+    n = new_node(A_VAR);
+    n->name = strndup(p->s + start, p->pos - start);
+
+    // Postfix ++ / --
+    skip_ws(p);
+    const char *t = p->s + p->pos;
+    if ((t[0] == '+' || t[0] == '-') && t[1] == t[0]) {
+      p->pos += 2;
+      n->kind = A_POSTINC;
+      n->op[0] = t[0];
+      return n;
+    }
+
+    // Assignment (but not the comparison ==)
+    for (size_t k = 0; k < sizeof(assign_ops) / sizeof(assign_ops[0]); k++) {
+      size_t len = strlen(assign_ops[k]);
+      if (strncmp(t, assign_ops[k], len) == 0 &&
+          !(len == 1 && t[1] == '=')) {
+        p->pos += (int)len;
+        struct arith_node *as = new_node(A_ASSIGN);
+        strncpy(as->op, assign_ops[k], len - 1); // "" for plain '='
+        as->name = n->name;
+        n->name = NULL;
+        free_node(n);
+        as->a = parse_expr(p);
+        return as;
+      }
+    }
+    return n;
+  }
+  p->error = 1;
+  return NULL;
+}
+
+/**
+ * @brief Precedence climbing over the binary operators.
+ *
+ * @param p Parser state.
+ * @param min_prec Lowest precedence accepted at this level.
+ * @return struct arith_node* The parsed subtree.
+ */
+static struct arith_node *parse_binary(struct arith_parser *p, int min_prec) {
+  struct arith_node *lhs = parse_unary(p);
+
+  for (;;) {
+    skip_ws(p);
+    const char *s = p->s + p->pos;
+    int found = -1;
+    for (size_t k = 0; k < sizeof(binary_ops) / sizeof(binary_ops[0]); k++) {
+      size_t len = strlen(binary_ops[k].op);
+      if (strncmp(s, binary_ops[k].op, len) == 0) {
+        // `a << = b`-style compound assignments are not binary operators
+        if (s[len] == '=' && strcmp(binary_ops[k].op, "<=") != 0 &&
+            strcmp(binary_ops[k].op, ">=") != 0 &&
+            strcmp(binary_ops[k].op, "==") != 0 &&
+            strcmp(binary_ops[k].op, "!=") != 0)
+          break;
+        found = (int)k;
+        break;
+      }
+    }
+    if (found < 0 || binary_ops[found].prec < min_prec)
+      return lhs;
+
+    p->pos += (int)strlen(binary_ops[found].op);
+    struct arith_node *n = new_node(A_BINARY);
+    strcpy(n->op, binary_ops[found].op);
+    n->a = lhs;
+    // All binary operators are left-associative
+    n->b = parse_binary(p, binary_ops[found].prec + 1);
+    lhs = n;
+  }
+}
+
+/**
+ * @brief Parses a full expression (including the ternary operator).
+ */
+static struct arith_node *parse_expr(struct arith_parser *p) {
+  struct arith_node *cond = parse_binary(p, 2);
+  if (accept(p, "?")) {
+    struct arith_node *n = new_node(A_TERNARY);
+    n->a = cond;
+    n->b = parse_expr(p);
+    if (!accept(p, ":"))
+      p->error = 1;
+    n->c = parse_expr(p);
+    return n;
+  }
+  return cond;
+}
+
+/**
+ * @brief Reads a variable as an integer (unset or non-numeric is 0).
+ */
+static long long var_number(const char *name) {
+  const char *v = var_get(name);
+  return v ? strtoll(v, NULL, 0) : 0;
+}
+
+/**
+ * @brief Stores an integer in a variable.
+ */
+static void set_number(const char *name, long long value) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%lld", value);
+  var_set(name, buf);
+}
+
+/**
+ * @brief Applies a binary operator.
+ *
+ * @param op Operator text.
+ * @param x Left operand.
+ * @param y Right operand.
+ * @param error Set on division by zero.
+ * @return long long The result.
+ */
+static long long apply(const char *op, long long x, long long y, int *error) {
+  // Overflow wraps around (computed unsigned): signed overflow is undefined
+  unsigned long long ux = (unsigned long long)x, uy = (unsigned long long)y;
+
+  switch (op[0]) {
+  case '*':
+    return (long long)(ux * uy);
+  case '/':
+  case '%':
+    if (y == 0) {
+      *error = 1;
+      return 0;
+    }
+    // LLONG_MIN / -1 overflows (and traps): wrap around instead
+    if (y == -1)
+      return op[0] == '/' ? (long long)(0ull - ux) : 0;
+    return op[0] == '/' ? x / y : x % y;
+  case '+':
+    return (long long)(ux + uy);
+  case '-':
+    return (long long)(ux - uy);
+  case '<':
+    // Shift counts are taken modulo 64, as bash does on x86-64
+    if (op[1] == '<')
+      return (long long)(ux << (y & 63));
+    return op[1] == '=' ? x <= y : x < y;
+  case '>':
+    if (op[1] == '>')
+      return x >> (y & 63);
+    return op[1] == '=' ? x >= y : x > y;
+  case '=':
+    return x == y;
+  case '!':
+    return x != y;
+  case '&':
+    return x & y;
+  case '^':
+    return x ^ y;
+  case '|':
+    return x | y;
+  }
+  return 0;
+}
+
+/**
+ * @brief Evaluates a tree.
+ *
+ * @param n The tree.
+ * @param error Set on division by zero.
+ * @return long long The value.
+ */
+static long long eval(struct arith_node *n, int *error) {
+  long long x, y;
+
+  switch (n->kind) {
+  case A_NUM:
+    return n->value;
+  case A_VAR:
+    return var_number(n->name);
+  case A_UNARY:
+    x = eval(n->a, error);
+    switch (n->op[0]) {
+    case '-':
+      return (long long)(0ull - (unsigned long long)x);
+    case '!':
+      return !x;
+    case '~':
+      return ~x;
+    }
+    return x;
+  case A_BINARY:
+    // Short-circuit logical operators
+    if (strcmp(n->op, "&&") == 0)
+      return eval(n->a, error) && eval(n->b, error);
+    if (strcmp(n->op, "||") == 0)
+      return eval(n->a, error) || eval(n->b, error);
+    x = eval(n->a, error);
+    y = eval(n->b, error);
+    return apply(n->op, x, y, error);
+  case A_ASSIGN:
+    y = eval(n->a, error);
+    if (n->op[0])
+      y = apply(n->op, var_number(n->name), y, error);
+    set_number(n->name, y);
+    return y;
+  case A_PREINC:
+    x = apply(n->op, var_number(n->name), 1, error);
+    set_number(n->name, x);
+    return x;
+  case A_POSTINC:
+    x = var_number(n->name);
+    set_number(n->name, apply(n->op, x, 1, error));
+    return x;
+  case A_TERNARY:
+    return eval(n->a, error) ? eval(n->b, error) : eval(n->c, error);
+  }
+  return 0;
+}
+
+/**
+ * @brief Returns the cached tree for `text`, parsing it on a miss.
+ *
+ * @param text Expression source.
+ * @param error Set if the expression does not parse.
+ * @return struct arith_node* The tree (owned by the cache), or NULL.
+ */
+static struct arith_node *arith_lookup(const char *text, int *error) {
+  unsigned long h = 5381;
+  for (const char *c = text; *c; c++)
+    h = h * 33 + (unsigned char)*c;
+
+  int size = ARITH_CACHE_SIZE * 2;
+  int slot = (int)(h % size);
+  while (arith_cache[slot].text) {
+    if (strcmp(arith_cache[slot].text, text) == 0) {
+      if (!arith_cache[slot].root)
+        *error = 1;
+      return arith_cache[slot].root;
+    }
+    slot = (slot + 1) % size;
+  }
+
+  struct arith_parser p = {text, 0, 0};
+  struct arith_node *root = parse_expr(&p);
+  skip_ws(&p);
+  if (p.error || p.s[p.pos] != '\0') {
+    free_node(root);
+    root = NULL;
+    *error = 1;
+  }
+
+  // Keep the table at most half full: start over when it fills up
+  if (arith_cache_len == ARITH_CACHE_SIZE) {
+    for (int i = 0; i < size; i++) {
+      free(arith_cache[i].text);
+      free_node(arith_cache[i].root);
+      arith_cache[i].text = NULL;
+      arith_cache[i].root = NULL;
+    }
+    arith_cache_len = 0;
+    slot = (int)(h % size);
+  }
+  arith_cache[slot].text = strdup(text);
+  arith_cache[slot].root = root;
+  arith_cache_len++;
+  return root;
+}
+
+/**
+ * @brief Evaluates an arithmetic expression.
+ *
+ * An empty expression evaluates to 0. Errors (syntax, division by zero)
+ * are reported on stderr and also yield 0.
+ *
+ * @param text Expression source (already `$`-expanded).
+ * @param result Receives the value.
+ * @return int 0 on success, -1 on error.
+ */
+int arith_eval(const char *text, long long *result) {
+  int error = 0;
+  const char *t = text;
+
+  *result = 0;
+  while (isspace((unsigned char)*t))
+    t++;
+  if (*t == '\0')
+    return 0;
+
+  struct arith_node *root = arith_lookup(text, &error);
+  if (error) {
+    fprintf(stderr, "shell: %s: arithmetic syntax error\n", text);
+    return -1;
+  }
+  *result = eval(root, &error);
+  if (error) {
+    fprintf(stderr, "shell: %s: division by zero\n", text);
+    *result = 0;
+    return -1;
+  }
+  return 0;
+}
@@ -3,7 +3,7 @@
  * @brief Implementation of built-in shell commands.
  *
  * This file contains the function implementations for all the built-in
- * commands supported by the shell (e.g., cd, exit, help, history) and
+ * commands supported by the shell (e.g., exit, help, history, count) and
  * the lookup tables (arrays) used to map command names to their
  * corresponding functions.
  *
@@ -24,19 +24,55 @@ int shell_count(char **args);
 int shell_cp(char **args);
 int shell_mv(char **args);
 int shell_rm(char **args);
+int shell_pushd(char **args);
+int shell_popd(char **args);
+int shell_dirs(char **args);
+int shell_z(char **args);
+int shell_export(char **args);
+int shell_unset(char **args);
+int shell_read(char **args);
+int shell_true(char **args);
+int shell_false(char **args);
+int shell_echo(char **args);
+int shell_test(char **args);
+int shell_break(char **args);
+int shell_continue(char **args);
+int shell_return(char **args);
+int shell_local(char **args);
+int shell_shift(char **args);
+int shell_exec(char **args);
+int shell_dag(char **args);
+int shell_memo(char **args);
+int shell_source(char **args);
+int shell_alias(char **args);
+int shell_unalias(char **args);
+int shell_stats(char **args);
+int shell_set(char **args);
 
 /**
  * @brief Array of built-in command names.
  */
-char *builtin_str[] = {"cd",      "exit",  "help", "clear", "about",
-                       "history", "count", "cp",   "mv",    "rm"};
+char *builtin_str[] = {"cd",      "exit",     "help",   "clear", "about",
+                       "history", "count",    "cp",     "mv",    "rm",
+                       "pushd",   "popd",     "dirs",   "z",     "export",
+                       "unset",   "read",     "true",   "false", ":",
+                       "echo",    "test",     "[",      "break", "continue",
+                       "return",  "local",    "shift",  "exec",  "dag",
+                       "memo",    "source",   ".",      "alias", "unalias",
+                       "stats",   "set"};
 
 /**
  * @brief Array of function pointers corresponding to built-in commands.
  */
 int (*builtin_func[])(char **) = {
     &shell_cd,      &shell_exit,  &shell_help, &shell_clear, &shell_about,
-    &shell_history, &shell_count, &shell_cp,   &shell_mv,    &shell_rm};
+    &shell_history, &shell_count, &shell_cp,   &shell_mv,    &shell_rm,
+    &shell_pushd,   &shell_popd,  &shell_dirs, &shell_z,     &shell_export,
+    &shell_unset,   &shell_read,  &shell_true, &shell_false, &shell_true,
+    &shell_echo,    &shell_test,  &shell_test, &shell_break, &shell_continue,
+    &shell_return,  &shell_local, &shell_shift, &shell_exec,  &shell_dag,
+    &shell_memo,    &shell_source, &shell_source, &shell_alias,
+    &shell_unalias, &shell_stats, &shell_set};
 
 /**
  * @brief Calculates the number of registered built-in commands.
@@ -48,35 +84,17 @@ int shell_num_builtins() { return sizeof(builtin_str) / sizeof(char *); }
  *                          Built-in Command Implementations
  * ========================================================================= */
 
-/**
- * @brief Changes the current working directory.
- *
- * Checks if the directory argument is provided and uses the `chdir()`
- * system call to change the directory. Prints an error if the directory
- * is invalid or accessed improperly.
- *
- * @param args Null-terminated array of arguments (args[1] is the path).
- * @return int Always returns 1 to continue execution.
- */
-int shell_cd(char **args) {
-  if (args[1] == NULL) {
-    fprintf(stderr, "shell: expected argument to \"cd\"\n");
-  } else {
-    if (chdir(args[1]) != 0) {
-      perror("shell");
-    }
-  }
-  return 1;
-}
-
 /**
  * @brief Exits the shell program.
  *
- * @param args Null-terminated array of arguments (unused).
+ * Usage: `exit [status]`; without a status, the shell exits with the
+ * status of the last command.
+ *
+ * @param args Null-terminated array of arguments.
  * @return int Returns 0 to signal the main loop to terminate.
  */
 int shell_exit(char **args) {
-  (void)args; // unused
+  last_status = args[1] ? atoi(args[1]) & 0xff : previous_status;
   return 0;
 }
 
@@ -126,7 +144,7 @@ int shell_clear(char **args) {
  */
 int shell_about(char **args) {
   (void)args; // unused
-  printf("Custom Shell v1.0\n");
+  printf("Custom Shell v" SHELL_VERSION "\n");
   printf("Developed for the Terminal Project.\n");
   return 1;
 }
@@ -145,60 +163,287 @@ int shell_history(char **args) {
   return 1;
 }
 
+/** @brief `count` column flags (any combination may be selected). */
+#define COUNT_LINES 1
+#define COUNT_WORDS 2
+#define COUNT_CHARS 4
+
+/**
+ * @brief One input of the `count` command and its results.
+ */
+struct count_job {
+  char *path;      /**< File name, or "-" for standard input. */
+  long long lines; /**< Newline characters seen. */
+  long long words; /**< Words (runs of non-whitespace) seen. */
+  long long chars; /**< Bytes read. */
+  int error;       /**< errno of a failed open/read, 0 on success. */
+};
+
+/**
+ * @brief Growable list of `count` jobs.
+ */
+struct count_list {
+  struct count_job *jobs;
+  int len;
+  int cap;
+};
+
+/**
+ * @brief Appends a job for `path` to the list (takes ownership of `path`).
+ * @param list The job list.
+ * @param path Heap-allocated file name.
+ */
+static void count_add(struct count_list *list, char *path) {
+  if (list->len == list->cap) {
+    list->cap = list->cap ? list->cap * 2 : 16;
+    list->jobs = realloc(list->jobs, list->cap * sizeof(struct count_job));
+    if (!list->jobs) {
+      fprintf(stderr, "shell: allocation error\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  memset(&list->jobs[list->len], 0, sizeof(struct count_job));
+  list->jobs[list->len++].path = path;
+}
+
+#ifndef _WIN32
 /**
- * @brief Detailed statistics of a file: lines, words, and characters.
+ * @brief Recursively collects regular files below `dir`.
  *
- * Opens the specified file and iterates through it character by character,
- * counting newlines, spaces (state machine for words), and total bytes.
+ * Entries are visited in sorted order (scandir + alphasort) so the report
+ * is stable from run to run. Symbolic links are not followed.
  *
- * @param args Null-terminated array of arguments (args[1] is filename).
- * @return int 1 to continue execution.
+ * @param list The job list to append to.
+ * @param dir Directory to walk.
  */
-int shell_count(char **args) {
-  if (args[1] == NULL) {
-    fprintf(stderr, "shell: expected argument to \"count\"\n");
-    return 1;
+static void count_walk(struct count_list *list, const char *dir) {
+  struct dirent **names;
+  int n = scandir(dir, &names, NULL, alphasort);
+  if (n < 0) {
+    fprintf(stderr, "shell: count: %s: %s\n", dir, strerror(errno));
+    return;
   }
 
-  FILE *fp = fopen(args[1], "r");
-  if (fp == NULL) {
-    perror("shell");
-    return 1;
+  for (int i = 0; i < n; i++) {
+    char *name = names[i]->d_name;
+    if (strcmp(name, ".") != 0 && strcmp(name, "..") != 0) {
+      size_t size = strlen(dir) + strlen(name) + 2;
+      char *path = malloc(size);
+      struct stat st;
+      snprintf(path, size, "%s/%s", dir, name);
+      if (fs_stat(path, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+        free(path);
+      } else if (S_ISDIR(st.st_mode)) {
+        count_walk(list, path);
+        free(path);
+      } else if (S_ISREG(st.st_mode)) {
+        count_add(list, path);
+      } else {
+        free(path);
+      }
+    }
+    free(names[i]);
   }
+  free(names);
+}
+#endif
 
-  int lines = 0;
-  int words = 0;
-  int chars = 0;
+/**
+ * @brief Counts lines, words and bytes read from a descriptor into a job.
+ *
+ * Reads with large `read()` calls and runs the word state machine over the
+ * buffer.
+ *
+ * @param job The job to fill in.
+ * @param fd The input, read to its end.
+ */
+static void count_fd(struct count_job *job, int fd) {
   int state = 0; // 0: whitespace, 1: word
-  char c;
+  char buffer[65536];
+  long n;
 
-  while ((c = fgetc(fp)) != EOF) {
-    chars++;
-    if (c == '\n') {
-      lines++;
+  while ((n = read(fd, buffer, sizeof(buffer))) > 0) {
+    job->chars += n;
+    for (long i = 0; i < n; i++) {
+      char c = buffer[i];
+      if (c == '\n') {
+        job->lines++;
+      }
+
+      // Word counting logic
+      if (c == ' ' || c == '\n' || c == '\t') {
+        state = 0;
+      } else if (state == 0) {
+        state = 1;
+        job->words++;
+      }
     }
+  }
+  if (n < 0) {
+    job->error = errno;
+  }
+  stats_add(STAT_BUILTIN_BYTES, (uint64_t)job->chars);
+}
 
-    // Word counting logic
-    if (c == ' ' || c == '\n' || c == '\t') {
-      state = 0;
-    } else if (state == 0) {
-      state = 1;
-      words++;
+/**
+ * @brief Counts lines, words and bytes of a single file job.
+ *
+ * Runs on a pool worker thread, so it only touches its own job entry.
+ * Standard input (`-`) is skipped: it is counted on the calling thread,
+ * since several workers reading it at once would split it at random.
+ *
+ * @param idx Index of the job.
+ * @param ctx Pointer to the `count_list`.
+ */
+static void count_one(int idx, void *ctx) {
+  struct count_job *job = &((struct count_list *)ctx)->jobs[idx];
+
+  if (strcmp(job->path, "-") == 0)
+    return;
+  int fd = fs_open(job->path, O_RDONLY, 0);
+  if (fd < 0) {
+    job->error = errno;
+    return;
+  }
+  count_fd(job, fd);
+  close(fd);
+}
+
+/**
+ * @brief Prints one row of the `count` report.
+ * @param flags Selected COUNT_* columns.
+ * @param lines Line count.
+ * @param words Word count.
+ * @param chars Byte count.
+ * @param name Row label, or NULL for none.
+ */
+static void count_print(int flags, long long lines, long long words,
+                        long long chars, const char *name) {
+  const char *sep = "";
+  if (flags & COUNT_LINES) {
+    printf("%8lld", lines);
+    sep = " ";
+  }
+  if (flags & COUNT_WORDS) {
+    printf("%s%8lld", sep, words);
+    sep = " ";
+  }
+  if (flags & COUNT_CHARS) {
+    printf("%s%8lld", sep, chars);
+  }
+  if (name) {
+    printf(" %s", name);
+  }
+  printf("\n");
+}
+
+/**
+ * @brief Counts lines, words and characters of files, trees or stdin.
+ *
+ * Usage: `count [-l] [-w] [-c] [-r] [file|dir|-]...`
+ *
+ * - `-l`, `-w`, `-c` select the columns to print (default: all three).
+ * - `-r` descends into directory operands and counts every regular file.
+ * - `-` (or no operand at all) reads standard input, so `count` can be
+ *   used at the end of a pipeline.
+ *
+ * Files are counted in parallel on the worker pool (one thread per CPU);
+ * standard input is read by the shell's thread before them. Rows are printed in command-line order (directory contents sorted
+ * by name), followed by a total row when more than one input was counted.
+ *
+ * @param args Null-terminated array of arguments.
+ * @return int 1 to continue execution.
+ */
+int shell_count(char **args) {
+  struct count_list list = {NULL, 0, 0};
+  int flags = 0;
+  int recursive = 0;
+  int i = 1;
+
+  // Parse options
+  for (; args[i] != NULL && args[i][0] == '-' && args[i][1] != '\0'; i++) {
+    if (strcmp(args[i], "--") == 0) {
+      i++;
+      break;
+    }
+    for (char *opt = args[i] + 1; *opt; opt++) {
+      if (*opt == 'l') {
+        flags |= COUNT_LINES;
+      } else if (*opt == 'w') {
+        flags |= COUNT_WORDS;
+      } else if (*opt == 'c') {
+        flags |= COUNT_CHARS;
+      } else if (*opt == 'r') {
+        recursive = 1;
+      } else {
+        fprintf(stderr, "shell: count: invalid option -- '%c'\n", *opt);
+        fprintf(stderr, "usage: count [-lwcr] [file|dir|-]...\n");
+        return 1;
+      }
     }
   }
+  if (flags == 0) {
+    flags = COUNT_LINES | COUNT_WORDS | COUNT_CHARS;
+  }
 
-  printf("Lines: %d\n", lines);
-  printf("Words: %d\n", words);
-  printf("Chars: %d\n", chars);
+  // Collect the inputs
+  if (args[i] == NULL) {
+    count_add(&list, strdup("-"));
+  }
+  for (; args[i] != NULL; i++) {
+    struct stat st;
+    if (strcmp(args[i], "-") != 0 && fs_stat(args[i], &st, 0) == 0 &&
+        S_ISDIR(st.st_mode)) {
+#ifndef _WIN32
+      if (recursive) {
+        count_walk(&list, args[i]);
+        continue;
+      }
+#endif
+      fprintf(stderr, "shell: count: %s: Is a directory\n", args[i]);
+      continue;
+    }
+    count_add(&list, strdup(args[i]));
+  }
 
-  fclose(fp);
+  // Standard input in order, once: a second `-` finds it at its end
+  for (i = 0; i < list.len; i++) {
+    if (strcmp(list.jobs[i].path, "-") == 0)
+      count_fd(&list.jobs[i], STDIN_FILENO);
+  }
+  pool_run(list.len, count_one, &list, 0);
+
+  // Report in deterministic (input) order
+  long long lines = 0, words = 0, chars = 0;
+  int counted = 0;
+  for (i = 0; i < list.len; i++) {
+    struct count_job *job = &list.jobs[i];
+    if (job->error) {
+      fprintf(stderr, "shell: count: %s: %s\n", job->path,
+              strerror(job->error));
+    } else {
+      count_print(flags, job->lines, job->words, job->chars,
+                  strcmp(job->path, "-") == 0 ? NULL : job->path);
+      lines += job->lines;
+      words += job->words;
+      chars += job->chars;
+      counted++;
+    }
+    free(job->path);
+  }
+  if (counted > 1) {
+    count_print(flags, lines, words, chars, "total");
+  }
+
+  free(list.jobs);
   return 1;
 }
 
 /**
  * @brief Copies a file from source to destination.
  *
- * Performs a binary copy using a buffer.
+ * Performs a binary copy using a buffer. Both files are opened relative
+ * to the cached working directory.
  *
  * @param args Null-terminated array of arguments (src, dst).
  * @return int 1 to continue execution.
@@ -209,24 +454,32 @@ int shell_cp(char **args) {
     return 1;
   }
 
-  FILE *src = fopen(args[1], "rb");
+  int src_fd = fs_open(args[1], O_RDONLY, 0);
+  FILE *src = src_fd < 0 ? NULL : fdopen(src_fd, "rb");
   if (src == NULL) {
     perror("shell");
+    if (src_fd >= 0)
+      close(src_fd);
     return 1;
   }
 
-  FILE *dst = fopen(args[2], "wb");
+  int dst_fd = fs_open(args[2], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  FILE *dst = dst_fd < 0 ? NULL : fdopen(dst_fd, "wb");
   if (dst == NULL) {
-    fclose(src);
     perror("shell");
+    fclose(src);
+    if (dst_fd >= 0)
+      close(dst_fd);
     return 1;
   }
 
   char buffer[1024];
-  size_t bytes;
+  size_t bytes, total = 0;
   while ((bytes = fread(buffer, 1, sizeof(buffer), src)) > 0) {
     fwrite(buffer, 1, bytes, dst);
+    total += bytes;
   }
+  stats_add(STAT_BUILTIN_BYTES, total);
 
   fclose(src);
   fclose(dst);
@@ -236,7 +489,8 @@ int shell_cp(char **args) {
 /**
  * @brief Moves or renames a file.
  *
- * Uses the `rename()` system call.
+ * Uses the `renameat()` system call relative to the cached working
+ * directory.
  *
  * @param args Null-terminated array of arguments (old name, new name).
  * @return int 1 to continue execution.
@@ -247,28 +501,291 @@ int shell_mv(char **args) {
     return 1;
   }
 
-  if (rename(args[1], args[2]) != 0) {
+  if (fs_rename(args[1], args[2], 0) != 0) {
     perror("shell");
   }
   return 1;
 }
 
 /**
- * @brief Deletes a file.
+ * @brief Deletes files and (with `-r`) directory trees.
  *
- * Uses the `remove()` system call.
+ * Usage: `rm [-r] [--async] path...`
  *
- * @param args Null-terminated array of arguments (filename).
+ * Plain `rm` uses the `unlinkat()` system call; `-r` deletes directories
+ * recursively. With `--async` each target is atomically renamed into a
+ * trash directory on its filesystem and a low-priority background thread
+ * deletes it, so the prompt returns immediately even for huge trees.
+ *
+ * @param args Null-terminated array of arguments.
  * @return int 1 to continue execution.
  */
 int shell_rm(char **args) {
-  if (args[1] == NULL) {
+  int recursive = 0;
+  int async = 0;
+  int i = 1;
+
+  for (; args[i] != NULL && args[i][0] == '-'; i++) {
+    if (strcmp(args[i], "-r") == 0 || strcmp(args[i], "-R") == 0) {
+      recursive = 1;
+    } else if (strcmp(args[i], "--async") == 0) {
+      async = 1;
+    } else if (strcmp(args[i], "--") == 0) {
+      i++;
+      break;
+    } else {
+      fprintf(stderr, "shell: rm: invalid option '%s'\n", args[i]);
+      fprintf(stderr, "usage: rm [-r] [--async] path...\n");
+      return 1;
+    }
+  }
+
+  if (args[i] == NULL) {
     fprintf(stderr, "shell: expected argument to \"rm\"\n");
     return 1;
   }
 
-  if (remove(args[1]) != 0) {
-    perror("shell");
+  for (; args[i] != NULL; i++) {
+    struct stat st;
+    int is_dir = fs_stat(args[i], &st, 0) == 0 && S_ISDIR(st.st_mode);
+    int rc;
+
+    if (is_dir && !recursive) {
+      fprintf(stderr, "shell: rm: %s: Is a directory\n", args[i]);
+      continue;
+    }
+    if (async) {
+      rc = trash_path(args[i]);
+    } else if (is_dir) {
+      rc = remove_tree(args[i]);
+    } else {
+      rc = fs_unlink(args[i], 0);
+    }
+    if (rc != 0) {
+      perror("shell");
+    }
+  }
+  return 1;
+}
+
+/**
+ * @brief Does nothing, successfully (`true` and `:`).
+ *
+ * @param args Null-terminated array of arguments (unused).
+ * @return int Always returns 1 to continue execution.
+ */
+int shell_true(char **args) {
+  (void)args; // unused
+  return 1;
+}
+
+/**
+ * @brief Does nothing, unsuccessfully.
+ *
+ * @param args Null-terminated array of arguments (unused).
+ * @return int Always returns 1 to continue execution.
+ */
+int shell_false(char **args) {
+  (void)args; // unused
+  last_status = 1;
+  return 1;
+}
+
+/**
+ * @brief Prints its arguments separated by spaces.
+ *
+ * Usage: `echo [-n] [word...]`; `-n` suppresses the trailing newline.
+ *
+ * @param args Null-terminated array of arguments.
+ * @return int Always returns 1 to continue execution.
+ */
+int shell_echo(char **args) {
+  int i = 1;
+  int newline = 1;
+
+  if (args[i] && strcmp(args[i], "-n") == 0) {
+    newline = 0;
+    i++;
+  }
+  for (int first = i; args[i] != NULL; i++) {
+    if (i > first)
+      putchar(' ');
+    fputs(args[i], stdout);
+  }
+  if (newline)
+    putchar('\n');
+  return 1;
+}
+
+/**
+ * @brief State of a `test` expression being evaluated.
+ */
+struct test_expr {
+  char **args; /**< The operands. */
+  int pos;     /**< Next operand. */
+  int end;     /**< One past the last operand. */
+  int error;   /**< Set on a malformed expression. */
+};
+
+static int test_or(struct test_expr *t);
+
+/**
+ * @brief Evaluates a unary file or string test (`-f path`, `-z str`...).
+ */
+static int test_unary(char op, const char *arg) {
+  struct stat st;
+
+  switch (op) {
+  case 'n':
+    return arg[0] != '\0';
+  case 'z':
+    return arg[0] == '\0';
+  case 'e':
+    return stat(arg, &st) == 0;
+  case 'f':
+    return stat(arg, &st) == 0 && S_ISREG(st.st_mode);
+  case 'd':
+    return stat(arg, &st) == 0 && S_ISDIR(st.st_mode);
+  case 's':
+    return stat(arg, &st) == 0 && st.st_size > 0;
+  case 'r':
+    return access(arg, R_OK) == 0;
+  case 'w':
+    return access(arg, W_OK) == 0;
+  case 'x':
+    return access(arg, X_OK) == 0;
+  }
+  return -1;
+}
+
+/**
+ * @brief Evaluates a binary test (`a = b`, `n -lt m`...).
+ * @return int 1 or 0, or -1 if `op` is not a binary operator.
+ */
+static int test_binary(const char *a, const char *op, const char *b) {
+  if (strcmp(op, "=") == 0 || strcmp(op, "==") == 0)
+    return strcmp(a, b) == 0;
+  if (strcmp(op, "!=") == 0)
+    return strcmp(a, b) != 0;
+  if (op[0] != '-' || strlen(op) != 3)
+    return -1;
+
+  long long x = atoll(a), y = atoll(b);
+  if (strcmp(op, "-eq") == 0)
+    return x == y;
+  if (strcmp(op, "-ne") == 0)
+    return x != y;
+  if (strcmp(op, "-lt") == 0)
+    return x < y;
+  if (strcmp(op, "-le") == 0)
+    return x <= y;
+  if (strcmp(op, "-gt") == 0)
+    return x > y;
+  if (strcmp(op, "-ge") == 0)
+    return x >= y;
+  return -1;
+}
+
+/**
+ * @brief primary := '!' primary | '(' or ')' | unary | binary | string
+ */
+static int test_primary(struct test_expr *t) {
+  char **a = t->args;
+  int left = t->end - t->pos;
+
+  if (left <= 0) {
+    t->error = 1;
+    return 0;
+  }
+  if (strcmp(a[t->pos], "!") == 0 && left > 1) {
+    t->pos++;
+    return !test_primary(t);
+  }
+  if (strcmp(a[t->pos], "(") == 0 && left > 2) {
+    t->pos++;
+    int r = test_or(t);
+    if (t->pos >= t->end || strcmp(a[t->pos], ")") != 0)
+      t->error = 1;
+    t->pos++;
+    return r;
+  }
+  if (left >= 3) {
+    int r = test_binary(a[t->pos], a[t->pos + 1], a[t->pos + 2]);
+    if (r >= 0) {
+      t->pos += 3;
+      return r;
+    }
+  }
+  if (left >= 2 && a[t->pos][0] == '-' && a[t->pos][1] &&
+      !a[t->pos][2]) {
+    int r = test_unary(a[t->pos][1], a[t->pos + 1]);
+    if (r >= 0) {
+      t->pos += 2;
+      return r;
+    }
+  }
+  // A lone string is true if it is not empty
+  return a[t->pos++][0] != '\0';
+}
+
+/**
+ * @brief and := primary ('-a' primary)*
+ */
+static int test_and(struct test_expr *t) {
+  int r = test_primary(t);
+  while (t->pos < t->end && strcmp(t->args[t->pos], "-a") == 0) {
+    t->pos++;
+    r = test_primary(t) && r;
+  }
+  return r;
+}
+
+/**
+ * @brief or := and ('-o' and)*
+ */
+static int test_or(struct test_expr *t) {
+  int r = test_and(t);
+  while (t->pos < t->end && strcmp(t->args[t->pos], "-o") == 0) {
+    t->pos++;
+    r = test_and(t) || r;
+  }
+  return r;
+}
+
+/**
+ * @brief Evaluates a condition (`test expr` or `[ expr ]`).
+ *
+ * Supports string tests (`-n`, `-z`, `=`, `!=`), integer comparisons
+ * (`-eq`, `-ne`, `-lt`, `-le`, `-gt`, `-ge`), file tests (`-e`, `-f`,
+ * `-d`, `-s`, `-r`, `-w`, `-x`), `!`, `-a`, `-o` and parentheses. The
+ * status is 0 if the condition holds, 1 if not and 2 on a syntax error.
+ *
+ * @param args Null-terminated array of arguments.
+ * @return int Always returns 1 to continue execution.
+ */
+int shell_test(char **args) {
+  struct test_expr t = {args, 1, 0, 0};
+
+  while (args[t.end] != NULL)
+    t.end++;
+  if (strcmp(args[0], "[") == 0) {
+    if (t.end < 2 || strcmp(args[t.end - 1], "]") != 0) {
+      fprintf(stderr, "shell: [: missing ']'\n");
+      last_status = 2;
+      return 1;
+    }
+    t.end--;
+  }
+  if (t.end <= 1) {
+    last_status = 1; // no expression: false
+    return 1;
+  }
+  int r = test_or(&t);
+  if (t.error || t.pos != t.end) {
+    fprintf(stderr, "shell: %s: syntax error\n", args[0]);
+    last_status = 2;
+    return 1;
   }
+  last_status = !r;
   return 1;
 }
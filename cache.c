@@ -0,0 +1,550 @@
+/**
+ * @file cache.c
+ * @brief On-disk cache of compiled scripts.
+ *
+ * `myshell script.sh` compiles the script (compile.c) before running it.
+ * For scripts that run over and over (cron jobs, CI steps), that work is
+ * the same every time, so the compiled program is saved in a cache
+ * directory and mapped straight into memory on later runs: the bytecode
+ * and string pool are used in place from the mapping, without parsing or
+ * copying anything.
+ *
+ * Entries are named after a hash of the script text. Each entry also
+ * stores the text itself, which is compared on load, so a hash collision
+ * or an edited script can never run stale code. The build identifier
+ * (version and build time) is part of the header: a rebuilt shell ignores
+ * entries written by another build.
+ *
+ * Entries are written to a temporary file and renamed into place, so
+ * concurrent invocations only ever see complete entries; the last writer
+ * wins, and both wrote the same content.
+ *
+ * The cache lives in `$MYSHELL_CACHE_DIR`, else `$XDG_CACHE_HOME/myshell`,
+ * else `~/.cache/myshell`. An edited script gets a new entry, so the cache
+ * is kept under `$MYSHELL_CACHE_SIZE` bytes (default 16M) the same way as
+ * the memo store: a load refreshes the modification time of its entry, and
+ * after each store the least recently used entries are removed.
+ *
+ * @author Abdelhamid
+ * @date 2025-12-14
+ */
+
+#include "shell.h"
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+/** @brief First bytes of a cache entry. */
+#define CACHE_MAGIC "MSHC"
+
+/** @brief Default size limit of the cache, in bytes. */
+#define CACHE_DEFAULT_SIZE (16LL << 20)
+
+/** @brief Identifies the build that wrote an entry. */
+#define CACHE_BUILD SHELL_VERSION " " __DATE__ " " __TIME__
+
+/**
+ * @brief Header of a cache entry.
+ *
+ * It is followed by the script text, the instructions and the string
+ * pool, each starting at a multiple of 8 bytes.
+ */
+struct cache_header {
+  char magic[4];      /**< CACHE_MAGIC. */
+  uint32_t insn_size; /**< sizeof(struct insn) of the writer. */
+  char build[48];     /**< CACHE_BUILD of the writer. */
+  uint64_t text_len;  /**< Length of the script text. */
+  uint64_t code_len;  /**< Number of instructions. */
+  uint64_t pool_len;  /**< Bytes in the string pool. */
+};
+
+/**
+ * @brief Rounds `n` up to a multiple of 8.
+ */
+static size_t align8(size_t n) { return (n + 7) & ~(size_t)7; }
+
+/**
+ * @brief Feeds bytes to a 64-bit FNV-1a hash.
+ *
+ * @param h The hash so far (HASH_SEED to start).
+ * @return uint64_t The updated hash.
+ */
+uint64_t hash_bytes(uint64_t h, const void *data, size_t len) {
+  const unsigned char *p = data;
+  for (size_t i = 0; i < len; i++) {
+    h ^= p[i];
+    h *= 1099511628211ull;
+  }
+  return h;
+}
+
+/**
+ * @brief Feeds the content of a file to a hash.
+ *
+ * @param path The file (relative to the working directory).
+ * @param h The hash, updated in place.
+ * @return int 0 on success, -1 if the file cannot be read.
+ */
+int hash_file(const char *path, uint64_t *h) {
+  char buf[65536];
+  ssize_t n;
+  int fd = fs_open(path, O_RDONLY, 0);
+
+  if (fd < 0)
+    return -1;
+  while ((n = read(fd, buf, sizeof(buf))) > 0)
+    *h = hash_bytes(*h, buf, (size_t)n);
+  close(fd);
+  return n < 0 ? -1 : 0;
+}
+
+/**
+ * @brief Finds the cache directory.
+ *
+ * Also the parent of the `memo` store (see memo.c).
+ *
+ * @param dir Receives the path.
+ * @param size Size of `dir`.
+ * @return int 0 on success, -1 if there is no usable location.
+ */
+int cache_dir(char *dir, size_t size) {
+  const char *env = getenv("MYSHELL_CACHE_DIR");
+  int n;
+
+  if (env && *env) {
+    n = snprintf(dir, size, "%s", env);
+  } else if ((env = getenv("XDG_CACHE_HOME")) && *env) {
+    n = snprintf(dir, size, "%s/myshell", env);
+  } else if ((env = getenv("HOME")) && *env) {
+    n = snprintf(dir, size, "%s/.cache/myshell", env);
+  } else {
+    return -1;
+  }
+  return n > 0 && (size_t)n < size ? 0 : -1;
+}
+
+/**
+ * @brief Creates a directory and any missing parents (`mkdir -p`).
+ */
+void make_dirs(char *dir) {
+  for (char *p = dir + 1; *p; p++) {
+    if (*p == '/' || *p == '\\') {
+      char c = *p;
+      *p = '\0';
+#ifdef _WIN32
+      _mkdir(dir);
+#else
+      mkdir(dir, 0700);
+#endif
+      *p = c;
+    }
+  }
+#ifdef _WIN32
+  _mkdir(dir);
+#else
+  mkdir(dir, 0700);
+#endif
+}
+
+#ifndef _WIN32
+/**
+ * @brief Writes a file atomically.
+ *
+ * The content goes to a temporary file in the same directory, which is
+ * renamed over `path` once it is complete, so readers only ever see the
+ * old file or the whole new one. On failure the temporary file is removed
+ * and `path` is left as it was.
+ *
+ * @param path The file (its directory must exist).
+ * @param fill Writes the content to a descriptor; returns 0 on success.
+ * @param arg Passed to `fill`.
+ * @return int 0 if the file was written, -1 otherwise.
+ */
+int atomic_write_file(const char *path, int (*fill)(int fd, void *arg),
+                      void *arg) {
+  char tmp[4200];
+  const char *slash = strrchr(path, '/');
+  int dir_len = slash ? (int)(slash - path) : 1;
+  int n = snprintf(tmp, sizeof(tmp), "%.*s/.tmp-XXXXXX", dir_len,
+                   slash ? path : ".");
+  if (n < 0 || (size_t)n >= sizeof(tmp))
+    return -1;
+
+  int fd = mkstemp(tmp);
+  if (fd < 0)
+    return -1;
+  int ok = fill(fd, arg) == 0;
+  if (close(fd) != 0)
+    ok = 0;
+  // Publish the complete file atomically
+  if (!ok || rename(tmp, path) != 0) {
+    unlink(tmp);
+    return -1;
+  }
+  return 0;
+}
+#endif
+
+#ifndef _WIN32
+/**
+ * @brief Reads a size limit from the environment.
+ *
+ * The value is a number of bytes with an optional suffix K, M or G.
+ *
+ * @param name The variable.
+ * @param def The limit if it is unset or invalid.
+ * @return long long The limit, in bytes.
+ */
+long long size_limit(const char *name, long long def) {
+  const char *env = getenv(name);
+  char *end;
+
+  if (!env || !*env)
+    return def;
+  long long n = strtoll(env, &end, 10);
+  if (*end == 'K' || *end == 'k')
+    n <<= 10;
+  else if (*end == 'M' || *end == 'm')
+    n <<= 20;
+  else if (*end == 'G' || *end == 'g')
+    n <<= 30;
+  return n > 0 ? n : def;
+}
+
+/**
+ * @brief A file seen while evicting.
+ */
+struct lru_file {
+  char name[64];   /**< File name in the directory. */
+  long long size;  /**< Its size. */
+  long long mtime; /**< Its last use. */
+};
+
+/**
+ * @brief Orders files from least to most recently used.
+ */
+static int by_mtime(const void *a, const void *b) {
+  const struct lru_file *x = a, *y = b;
+  return (x->mtime > y->mtime) - (x->mtime < y->mtime);
+}
+
+/**
+ * @brief Removes the least recently used files of a directory while their
+ *        total size is over a limit.
+ *
+ * Only the files whose name ends with `suffix` count; users of the files
+ * refresh their modification time to mark them as used.
+ *
+ * @param dir The directory.
+ * @param suffix The extension of the files (e.g. ".memo").
+ * @param limit The size limit, in bytes.
+ */
+void evict_lru(const char *dir, const char *suffix, long long limit) {
+  DIR *d = opendir(dir);
+  struct lru_file *files = NULL;
+  int n = 0, cap = 0;
+  long long total = 0;
+  size_t slen = strlen(suffix);
+  struct dirent *ent;
+  struct stat st;
+
+  if (!d)
+    return;
+  while ((ent = readdir(d)) != NULL) {
+    size_t len = strlen(ent->d_name);
+    if (len <= slen || len >= sizeof(files->name) ||
+        strcmp(ent->d_name + len - slen, suffix) != 0 ||
+        fstatat(dirfd(d), ent->d_name, &st, 0) != 0)
+      continue;
+    if (n == cap) {
+      cap = cap ? cap * 2 : 64;
+      files = realloc(files, cap * sizeof(struct lru_file));
+      if (!files) {
+        fprintf(stderr, "shell: allocation error\n");
+        exit(EXIT_FAILURE);
+      }
+    }
+    memcpy(files[n].name, ent->d_name, len + 1);
+    files[n].size = st.st_size;
+    files[n].mtime = fs_mtime_ns(&st);
+    total += st.st_size;
+    n++;
+  }
+  if (total > limit) {
+    qsort(files, n, sizeof(struct lru_file), by_mtime);
+    // Another shell may be evicting too: a missing file is fine
+    for (int i = 0; i < n && total > limit; i++) {
+      unlinkat(dirfd(d), files[i].name, 0);
+      total -= files[i].size;
+    }
+  }
+  closedir(d);
+  free(files);
+}
+#endif
+
+/**
+ * @brief Builds the path of the entry for a script text.
+ * @return int 0 on success, -1 if there is no cache directory.
+ */
+static int cache_path(const char *text, size_t len, char *path, size_t size) {
+  char dir[4096];
+
+  if (cache_dir(dir, sizeof(dir)) != 0)
+    return -1;
+  uint64_t h = hash_bytes(HASH_SEED, text, len);
+  int n = snprintf(path, size, "%s/%016llx-%llu.msc", dir,
+                   (unsigned long long)h, (unsigned long long)len);
+  return n > 0 && (size_t)n < size ? 0 : -1;
+}
+
+#ifndef _WIN32
+/**
+ * @brief Checks that `off` is -1 or the start of a string in the pool
+ *        (the pool ends with a NUL, see program_valid()).
+ */
+static int valid_string(const struct program *p, int off, int optional) {
+  return (optional && off == -1) || (off >= 0 && (size_t)off < p->pool_len);
+}
+
+/**
+ * @brief Checks that `pc` is an instruction index or the end of the code.
+ */
+static int valid_target(const struct program *p, int pc) {
+  return pc >= 0 && pc <= p->len;
+}
+
+/**
+ * @brief Checks the operands of a mapped program before it is run.
+ *
+ * The header checks only prove the entry is the right size: a corrupted
+ * instruction could still jump or index the pool out of the mapping. Each
+ * operand is checked against what its opcode uses it for (see
+ * `enum opcode`), so a damaged entry is treated as a miss.
+ *
+ * @return int Non-zero if every instruction is safe to run.
+ */
+static int program_valid(const struct program *p) {
+  if (p->pool_len > 0 && p->pool[p->pool_len - 1] != '\0')
+    return 0;
+  for (int pc = 0; pc < p->len; pc++) {
+    const struct insn *in = &p->code[pc];
+    int ok;
+
+    switch (in->op) {
+    case OP_CMD:
+    case OP_CASE:
+      ok = valid_string(p, in->a, 0);
+      break;
+    case OP_JMP:
+    case OP_JZ:
+    case OP_JNZ:
+    case OP_STAGE:
+    case OP_BG:
+    case OP_SUBSHELL:
+      ok = valid_target(p, in->a);
+      break;
+    case OP_LOOP:
+      ok = valid_target(p, in->a) && valid_target(p, in->b);
+      break;
+    case OP_FOR_INIT:
+      ok = valid_string(p, in->a, 1) && valid_string(p, in->b, 1);
+      break;
+    case OP_FOR_NEXT:
+    case OP_CASE_MATCH:
+      ok = valid_string(p, in->a, 0) && valid_target(p, in->b);
+      break;
+    case OP_REDIR:
+      // A failed redirection resumes after the OP_UNREDIR at `b`
+      ok = valid_string(p, in->a, 0) && in->b >= 0 && in->b < p->len;
+      break;
+    case OP_FUNC:
+      ok = valid_string(p, in->a, 0) && valid_target(p, in->b) &&
+           valid_string(p, in->c, 1);
+      // The locals run up to an empty name, which must be in the pool
+      for (size_t off = (size_t)in->c; ok && in->c >= 0 && p->pool[off];) {
+        off += strlen(p->pool + off) + 1;
+        ok = off < p->pool_len;
+      }
+      break;
+    case OP_PIPE:
+      // The stages are the `a` instructions that follow
+      ok = in->a > 0 && in->a < p->len - pc && valid_target(p, in->b);
+      for (int i = 1; ok && i <= in->a; i++)
+        ok = p->code[pc + i].op == OP_STAGE;
+      break;
+    case OP_NOT:
+    case OP_TRUE:
+    case OP_LOOP_END:
+    case OP_SAVE:
+    case OP_CASE_END:
+    case OP_UNREDIR:
+    case OP_RET:
+    case OP_HALT:
+      ok = 1;
+      break;
+    default:
+      ok = 0;
+      break;
+    }
+    if (!ok)
+      return 0;
+  }
+  return 1;
+}
+#endif
+
+/**
+ * @brief Loads the compiled form of a script from the cache.
+ *
+ * @param text The script text.
+ * @param len Length of `text`.
+ * @return struct program* A program backed by the mapped entry (release
+ *         with `program_free()`), or NULL if there is no valid entry.
+ */
+struct program *cache_load(const char *text, size_t len) {
+#ifdef _WIN32
+  (void)text;
+  (void)len;
+  return NULL;
+#else
+  char path[4200];
+  struct stat st;
+
+  if (cache_path(text, len, path, sizeof(path)) != 0)
+    return NULL;
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return NULL;
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(struct cache_header)) {
+    close(fd);
+    return NULL;
+  }
+  size_t size = (size_t)st.st_size;
+  char *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (map == MAP_FAILED) {
+    close(fd);
+    return NULL;
+  }
+  // Recently used: eviction goes by modification time (see cache_store())
+  futimens(fd, NULL);
+  close(fd);
+
+  // Check that the entry is ours, complete, and for exactly this text
+  struct cache_header *h = (struct cache_header *)map;
+  size_t text_off = align8(sizeof(*h));
+  size_t code_off = align8(text_off + h->text_len);
+  size_t pool_off = align8(code_off + h->code_len * sizeof(struct insn));
+  if (memcmp(h->magic, CACHE_MAGIC, 4) != 0 ||
+      h->insn_size != sizeof(struct insn) ||
+      strncmp(h->build, CACHE_BUILD, sizeof(h->build)) != 0 ||
+      h->text_len != len || h->code_len > size || pool_off > size ||
+      h->pool_len != size - pool_off ||
+      memcmp(map + text_off, text, len) != 0) {
+    munmap(map, size);
+    return NULL;
+  }
+
+  struct program *p = calloc(1, sizeof(struct program));
+  if (!p) {
+    munmap(map, size);
+    return NULL;
+  }
+  p->code = (struct insn *)(map + code_off);
+  p->len = (int)h->code_len;
+  p->pool = map + pool_off;
+  p->pool_len = h->pool_len;
+  p->refs = 1;
+  p->map = map;
+  p->map_len = size;
+  if (!program_valid(p)) {
+    program_free(p); // unmaps the entry
+    return NULL;
+  }
+  return p;
+#endif
+}
+
+#ifndef _WIN32
+/**
+ * @brief Writes a buffer followed by zero padding up to `padded` bytes.
+ * @return int 0 on success, -1 on failure.
+ */
+static int write_padded(int fd, const void *buf, size_t len, size_t padded) {
+  static const char zeros[8];
+  const char *p = buf;
+
+  while (len > 0) {
+    ssize_t n = write(fd, p, len);
+    if (n <= 0)
+      return -1;
+    p += n;
+    len -= (size_t)n;
+  }
+  len = padded - (size_t)(p - (const char *)buf);
+  return len == 0 || write(fd, zeros, len) == (ssize_t)len ? 0 : -1;
+}
+
+/**
+ * @brief What a cache entry is written from.
+ */
+struct cache_entry {
+  const char *text;  /**< The script text. */
+  size_t len;        /**< Length of `text`. */
+  struct program *p; /**< The program compiled from `text`. */
+};
+
+/**
+ * @brief Writes a cache entry (see atomic_write_file()).
+ */
+static int write_entry(int fd, void *arg) {
+  struct cache_entry *e = arg;
+  struct cache_header h;
+
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, CACHE_MAGIC, 4);
+  h.insn_size = sizeof(struct insn);
+  snprintf(h.build, sizeof(h.build), "%s", CACHE_BUILD);
+  h.text_len = e->len;
+  h.code_len = (uint64_t)e->p->len;
+  h.pool_len = e->p->pool_len;
+
+  size_t code_size = (size_t)e->p->len * sizeof(struct insn);
+  if (write_padded(fd, &h, sizeof(h), align8(sizeof(h))) != 0 ||
+      write_padded(fd, e->text, e->len, align8(e->len)) != 0 ||
+      write_padded(fd, e->p->code, code_size, align8(code_size)) != 0 ||
+      write_padded(fd, e->p->pool, e->p->pool_len, e->p->pool_len) != 0)
+    return -1;
+  return 0;
+}
+#endif
+
+/**
+ * @brief Saves the compiled form of a script in the cache.
+ *
+ * Failures are silent: the cache is only an optimization.
+ *
+ * @param text The script text.
+ * @param len Length of `text`.
+ * @param p The program compiled from `text`.
+ */
+void cache_store(const char *text, size_t len, struct program *p) {
+#ifdef _WIN32
+  (void)text;
+  (void)len;
+  (void)p;
+#else
+  char path[4200], dir[4096];
+  struct cache_entry entry = {text, len, p};
+
+  if (cache_path(text, len, path, sizeof(path)) != 0 ||
+      cache_dir(dir, sizeof(dir)) != 0)
+    return;
+
+  // Create the directory (and its parents, e.g. ~/.cache) if needed
+  make_dirs(dir);
+  if (atomic_write_file(path, write_entry, &entry) == 0)
+    evict_lru(dir, ".msc",
+              size_limit("MYSHELL_CACHE_SIZE", CACHE_DEFAULT_SIZE));
+#endif
+}
@@ -0,0 +1,1043 @@
+/**
+ * @file compile.c
+ * @brief Compiles shell scripts into bytecode for the VM (vm.c).
+ *
+ * The compiler reads the token spans produced by `lex_token()` and parses
+ * the shell grammar by recursive descent:
+ *
+ *     list      := and_or ((';' | '&' | newline) and_or)*
+ *     and_or    := pipeline (('&&' | '||') pipeline)*
+ *     pipeline  := ['!'] command ('|' command)*
+ *     command   := simple | compound [redirections] | function definition
+ *     compound  := if | while | until | for | case | '{' list '}'
+ *
+ * Simple commands are not parsed any further: their source text is copied
+ * into the program's string pool and becomes one `OP_CMD`, which the VM
+ * hands to `execute_simple()` at run time (so expansions happen each time
+ * the command runs). A pipeline made only of simple commands is also a
+ * single `OP_CMD`. Here-document bodies are appended to the text of the
+ * command they belong to, so the command text stays self-contained.
+ *
+ * Control flow becomes jumps. Code is emitted as the parser goes; when a
+ * construct turns out to need an instruction in front of code that was
+ * already emitted (a redirection after `done`, a `|` after a compound
+ * command, a trailing `&`), it is inserted and the jump targets behind it
+ * are relocated.
+ *
+ * @author Abdelhamid
+ * @date 2025-12-14
+ */
+
+#include "shell.h"
+#include <ctype.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+/** @brief Maximum number of stages in one pipeline. */
+#define MAX_STAGES 64
+
+/**
+ * @brief A here-document whose body is read from the lines that follow.
+ */
+struct heredoc {
+  char delim[256]; /**< The delimiter (quotes removed). */
+  int strip_tabs;  /**< Non-zero for `<<-`. */
+  int body_start;  /**< Start of the body in the source, or -1. */
+  int body_end;    /**< Just past the delimiter line. */
+};
+
+/**
+ * @brief An OP_CMD/OP_REDIR whose text needs here-document bodies.
+ */
+struct text_unit {
+  int insn;   /**< Index of the instruction to patch. */
+  int start;  /**< Start of the command text. */
+  int end;    /**< End of the command text. */
+  int doc_lo; /**< First here-document of the command. */
+  int doc_hi; /**< One past the last here-document. */
+  int done;   /**< Non-zero once patched. */
+};
+
+/**
+ * @brief Compiler state.
+ */
+struct compiler {
+  const char *src;       /**< Script text. */
+  int pos;               /**< Lexer position (just past `tok`). */
+  struct token tok;      /**< Current token. */
+  struct program *prog;  /**< Program being built. */
+  int error;             /**< Set on a syntax error. */
+  int incomplete;        /**< Set if the text ended too early. */
+  int line;              /**< Line number at `line_pos`. */
+  int line_pos;          /**< Position up to which lines were counted. */
+  int cmd_line;          /**< Line of the command being compiled. */
+  struct heredoc *docs;  /**< Here-documents seen so far. */
+  int num_docs;          /**< Entries in `docs`. */
+  int docs_cap;          /**< Allocated entries in `docs`. */
+  struct text_unit *units; /**< Command texts waiting for bodies. */
+  int num_units;         /**< Entries in `units`. */
+  int units_cap;         /**< Allocated entries in `units`. */
+  char *locals;          /**< Locals of the function (NUL-separated). */
+  int locals_len;        /**< Bytes used in `locals`. */
+  int in_function;       /**< Non-zero while compiling a function body. */
+};
+
+/**
+ * @brief Grows an array if it is full.
+ */
+static void *grow(void *array, int len, int *cap, size_t size) {
+  if (len < *cap)
+    return array;
+  *cap = *cap ? *cap * 2 : 16;
+  array = realloc(array, *cap * size);
+  if (!array) {
+    fprintf(stderr, "shell: allocation error\n");
+    exit(EXIT_FAILURE);
+  }
+  return array;
+}
+
+/* =========================================================================
+ *                          Program Construction
+ * ========================================================================= */
+
+/**
+ * @brief Allocates an empty program with one reference.
+ */
+static struct program *program_new() {
+  struct program *p = calloc(1, sizeof(struct program));
+  if (!p) {
+    fprintf(stderr, "shell: allocation error\n");
+    exit(EXIT_FAILURE);
+  }
+  p->refs = 1;
+  return p;
+}
+
+/**
+ * @brief Drops a reference to a program, freeing it with the last one.
+ * @param p The program (may be NULL).
+ */
+void program_free(struct program *p) {
+  if (!p || --p->refs > 0)
+    return;
+#ifndef _WIN32
+  if (p->map) {
+    // Loaded from the script cache: code and pool live in the mapping
+    munmap(p->map, p->map_len);
+    free(p->source);
+    free(p);
+    return;
+  }
+#endif
+  free(p->code);
+  free(p->pool);
+  free(p->source);
+  free(p);
+}
+
+/**
+ * @brief Adds `n` bytes plus a terminating NUL to the string pool.
+ * @return int Offset of the string in the pool.
+ */
+static int pool_add(struct program *p, const char *s, size_t n) {
+  if (p->pool_len + n + 1 > p->pool_cap) {
+    while (p->pool_len + n + 1 > p->pool_cap)
+      p->pool_cap = p->pool_cap ? p->pool_cap * 2 : 256;
+    p->pool = realloc(p->pool, p->pool_cap);
+    if (!p->pool) {
+      fprintf(stderr, "shell: allocation error\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  int off = (int)p->pool_len;
+  memcpy(p->pool + off, s, n);
+  p->pool[off + n] = '\0';
+  p->pool_len += n + 1;
+  return off;
+}
+
+/**
+ * @brief Appends an instruction.
+ * @return int Its index.
+ */
+static int emit(struct compiler *c, int op, int a, int b) {
+  struct program *p = c->prog;
+  p->code = grow(p->code, p->len, &p->cap, sizeof(struct insn));
+  p->code[p->len].op = op;
+  p->code[p->len].a = a;
+  p->code[p->len].b = b;
+  p->code[p->len].c = -1;
+  p->code[p->len].line = c->cmd_line;
+  return p->len++;
+}
+
+/**
+ * @brief Checks whether operand `a` (which = 0) or `b` (which = 1) of an
+ *        instruction is a code address.
+ */
+static int is_target(int op, int which) {
+  switch (op) {
+  case OP_JMP:
+  case OP_JZ:
+  case OP_JNZ:
+  case OP_STAGE:
+  case OP_BG:
+  case OP_SUBSHELL:
+    return which == 0;
+  case OP_FOR_NEXT:
+  case OP_CASE_MATCH:
+  case OP_FUNC:
+  case OP_PIPE:
+  case OP_REDIR:
+    return which == 1;
+  case OP_LOOP:
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * @brief Inserts an instruction at index `at`, relocating code addresses.
+ *
+ * Addresses greater than `at` move up by one. An address equal to `at`
+ * keeps pointing at `at`, i.e. at the new instruction: jumps to the start
+ * of a command now also run what was put in front of it.
+ *
+ * @return int `at`.
+ */
+static int insert(struct compiler *c, int at, int op, int a, int b) {
+  struct program *p = c->prog;
+  int line = at < p->len ? p->code[at].line : c->cmd_line;
+
+  emit(c, OP_HALT, -1, -1);
+  memmove(&p->code[at + 1], &p->code[at],
+          (p->len - 1 - at) * sizeof(struct insn));
+  for (int i = 0; i < p->len; i++) {
+    if (i == at)
+      continue;
+    if (is_target(p->code[i].op, 0) && p->code[i].a > at)
+      p->code[i].a++;
+    if (is_target(p->code[i].op, 1) && p->code[i].b > at)
+      p->code[i].b++;
+  }
+  for (int i = 0; i < c->num_units; i++) {
+    if (c->units[i].insn >= at)
+      c->units[i].insn++;
+  }
+  p->code[at].op = op;
+  p->code[at].a = a;
+  p->code[at].b = b;
+  p->code[at].c = -1;
+  p->code[at].line = line;
+  return at;
+}
+
+/* =========================================================================
+ *                          Here-Documents
+ * ========================================================================= */
+
+/**
+ * @brief Stores the final text of a command once its bodies are known.
+ *
+ * The text is the command followed by a newline and the raw bodies, which
+ * is exactly what `parse_input()` expects.
+ */
+static void finish_unit(struct compiler *c, struct text_unit *u) {
+  if (u->done || u->insn < 0)
+    return;
+  for (int k = u->doc_lo; k < u->doc_hi; k++) {
+    if (c->docs[k].body_start < 0)
+      return;
+  }
+  size_t len = u->end - u->start + 1;
+  for (int k = u->doc_lo; k < u->doc_hi; k++)
+    len += c->docs[k].body_end - c->docs[k].body_start + 1;
+
+  char *text = malloc(len + 1);
+  size_t n = u->end - u->start;
+  memcpy(text, c->src + u->start, n);
+  text[n++] = '\n';
+  for (int k = u->doc_lo; k < u->doc_hi; k++) {
+    size_t blen = c->docs[k].body_end - c->docs[k].body_start;
+    memcpy(text + n, c->src + c->docs[k].body_start, blen);
+    n += blen;
+    if (blen == 0 || text[n - 1] != '\n')
+      text[n++] = '\n';
+  }
+  c->prog->code[u->insn].a = pool_add(c->prog, text, n);
+  free(text);
+  u->done = 1;
+}
+
+/**
+ * @brief Locates the bodies of pending here-documents after a newline.
+ *
+ * Each body runs up to its delimiter line; the lexer continues after the
+ * last one. A body without a delimiter extends to the end of the text.
+ */
+static void read_bodies(struct compiler *c) {
+  int pending = 0;
+
+  for (int k = 0; k < c->num_docs; k++) {
+    struct heredoc *d = &c->docs[k];
+    if (d->body_start >= 0)
+      continue;
+    pending = 1;
+    d->body_start = c->pos;
+    size_t dlen = strlen(d->delim);
+    int pos = c->pos;
+    while (c->src[pos]) {
+      int start = pos;
+      while (d->strip_tabs && c->src[start] == '\t')
+        start++;
+      int end = start;
+      while (c->src[end] && c->src[end] != '\n')
+        end++;
+      pos = c->src[end] ? end + 1 : end;
+      if ((size_t)(end - start) == dlen &&
+          strncmp(c->src + start, d->delim, dlen) == 0)
+        break;
+    }
+    d->body_end = pos;
+    c->pos = pos;
+  }
+  if (!pending)
+    return;
+  for (int i = 0; i < c->num_units; i++)
+    finish_unit(c, &c->units[i]);
+}
+
+/**
+ * @brief Emits an instruction whose operand `a` is a piece of source text.
+ *
+ * @param start Start of the text.
+ * @param end End of the text.
+ * @param doc_lo First here-document used by the text.
+ * @param doc_hi One past the last here-document.
+ * @return int Index of the instruction.
+ */
+static int emit_text(struct compiler *c, int op, int start, int end,
+                     int doc_lo, int doc_hi) {
+  if (doc_lo == doc_hi)
+    return emit(c, op, pool_add(c->prog, c->src + start, end - start), -1);
+
+  int insn = emit(c, op, -1, -1);
+  c->units = grow(c->units, c->num_units, &c->units_cap,
+                  sizeof(struct text_unit));
+  struct text_unit *u = &c->units[c->num_units++];
+  u->insn = insn;
+  u->start = start;
+  u->end = end;
+  u->doc_lo = doc_lo;
+  u->doc_hi = doc_hi;
+  u->done = 0;
+  finish_unit(c, u);
+  return insn;
+}
+
+/* =========================================================================
+ *                          Tokens
+ * ========================================================================= */
+
+/**
+ * @brief Returns the line number of source position `pos`.
+ *
+ * Positions must be asked for in increasing order.
+ */
+static int line_at(struct compiler *c, int pos) {
+  while (c->line_pos < pos && c->src[c->line_pos]) {
+    if (c->src[c->line_pos] == '\n')
+      c->line++;
+    c->line_pos++;
+  }
+  return c->line;
+}
+
+/**
+ * @brief Reports a syntax error at the current token.
+ *
+ * At the end of the text, the input is only incomplete: nothing is printed
+ * and `incomplete` is set, so the caller can read more lines.
+ */
+static void syntax_error(struct compiler *c) {
+  if (c->error)
+    return;
+  c->error = 1;
+  if (c->tok.type == TOK_END || c->tok.incomplete) {
+    c->incomplete = 1;
+    return;
+  }
+  int line = line_at(c, c->tok.start);
+  if (c->tok.type == TOK_OP && strcmp(c->tok.op, "\n") == 0)
+    fprintf(stderr, "shell: line %d: syntax error near unexpected newline\n",
+            line);
+  else
+    fprintf(stderr, "shell: line %d: syntax error near unexpected token `%.*s'\n",
+            line, c->tok.len, c->src + c->tok.start);
+}
+
+/**
+ * @brief Advances to the next token.
+ */
+static void next(struct compiler *c) {
+  lex_token(c->src, &c->pos, &c->tok);
+  if (c->tok.incomplete) {
+    syntax_error(c);
+    return;
+  }
+  if (c->tok.type == TOK_OP && strcmp(c->tok.op, "\n") == 0)
+    read_bodies(c);
+}
+
+/**
+ * @brief Checks whether the current token is the unquoted word `w`.
+ */
+static int is_word(struct compiler *c, const char *w) {
+  return c->tok.type == TOK_WORD && (size_t)c->tok.len == strlen(w) &&
+         strncmp(c->src + c->tok.start, w, c->tok.len) == 0;
+}
+
+/**
+ * @brief Checks whether the current token is the operator `op`.
+ */
+static int is_op(struct compiler *c, const char *op) {
+  return c->tok.type == TOK_OP && strcmp(c->tok.op, op) == 0;
+}
+
+/**
+ * @brief Checks whether the current token is a redirection operator.
+ */
+static int is_redirection(struct compiler *c) {
+  return is_op(c, "<") || is_op(c, ">") || is_op(c, ">>") ||
+         is_op(c, "<<") || is_op(c, "<<-") || is_op(c, "<<<");
+}
+
+/**
+ * @brief Skips newline tokens.
+ */
+static void skip_newlines(struct compiler *c) {
+  while (!c->error && is_op(c, "\n"))
+    next(c);
+}
+
+/**
+ * @brief Consumes the word `w` or reports a syntax error.
+ */
+static void expect(struct compiler *c, const char *w) {
+  if (c->error)
+    return;
+  if (is_word(c, w) || is_op(c, w))
+    next(c);
+  else
+    syntax_error(c);
+}
+
+/**
+ * @brief Checks whether the current token is one of `stops` (in command
+ *        position, reserved words end a list).
+ */
+static int is_stop(struct compiler *c, const char *const *stops) {
+  for (; stops && *stops; stops++) {
+    if (is_word(c, *stops))
+      return 1;
+  }
+  return 0;
+}
+
+/**
+ * @brief Records `name` as a local variable of the function being compiled.
+ *
+ * Names are stored back to back, each followed by a NUL.
+ */
+static void add_local(struct compiler *c, const char *name, int len) {
+  for (int i = 0; i < c->locals_len; i += (int)strlen(c->locals + i) + 1) {
+    if ((int)strlen(c->locals + i) == len &&
+        strncmp(c->locals + i, name, len) == 0)
+      return;
+  }
+  c->locals = realloc(c->locals, c->locals_len + len + 1);
+  if (!c->locals) {
+    fprintf(stderr, "shell: allocation error\n");
+    exit(EXIT_FAILURE);
+  }
+  memcpy(c->locals + c->locals_len, name, len);
+  c->locals[c->locals_len + len] = '\0';
+  c->locals_len += len + 1;
+}
+
+/* =========================================================================
+ *                          Grammar
+ * ========================================================================= */
+
+static void parse_list(struct compiler *c, const char *const *stops);
+static int parse_command(struct compiler *c, int *start, int *end);
+
+/**
+ * @brief Reads redirections (with their targets) into a text span.
+ *
+ * @param start Receives the start of the span.
+ * @param end Receives the end of the span.
+ */
+static void scan_redirections(struct compiler *c, int *start, int *end) {
+  *start = *end = c->tok.start;
+  while (!c->error && is_redirection(c)) {
+    const char *op = c->tok.op;
+    next(c);
+    if (c->tok.type != TOK_WORD) {
+      syntax_error(c);
+      return;
+    }
+    if (strcmp(op, "<<") == 0 || strcmp(op, "<<-") == 0) {
+      c->docs = grow(c->docs, c->num_docs, &c->docs_cap,
+                     sizeof(struct heredoc));
+      struct heredoc *d = &c->docs[c->num_docs++];
+      heredoc_delimiter(c->src + c->tok.start, c->tok.len, d->delim,
+                        sizeof(d->delim));
+      d->strip_tabs = op[2] == '-';
+      d->body_start = d->body_end = -1;
+    }
+    *end = c->tok.start + c->tok.len;
+    next(c);
+  }
+}
+
+/**
+ * @brief Scans the words and redirections of a simple command.
+ *
+ * @param start Receives the start of the command text.
+ * @param end Receives the end of the command text.
+ */
+static void scan_simple(struct compiler *c, int *start, int *end) {
+  int first = 1;
+  int is_local = 0;
+
+  *start = *end = c->tok.start;
+  while (!c->error && c->tok.type != TOK_END) {
+    if (is_redirection(c)) {
+      int s, e;
+      scan_redirections(c, &s, &e);
+      *end = e;
+      continue;
+    }
+    if (c->tok.type == TOK_OP)
+      break;
+    // `local` names become frame slots of the function
+    const char *w = c->src + c->tok.start;
+    if (first)
+      is_local = c->in_function && is_word(c, "local");
+    else if (is_local) {
+      int n = 0;
+      while (n < c->tok.len && (isalnum((unsigned char)w[n]) || w[n] == '_'))
+        n++;
+      if (n > 0 && (n == c->tok.len || w[n] == '='))
+        add_local(c, w, n);
+    }
+    first = 0;
+    *end = c->tok.start + c->tok.len;
+    next(c);
+  }
+}
+
+/**
+ * @brief Compiles `if list; then list; [elif list; then list;]...
+ *        [else list;] fi`.
+ */
+static void parse_if(struct compiler *c) {
+  static const char *const then_stop[] = {"then", NULL};
+  static const char *const body_stop[] = {"elif", "else", "fi", NULL};
+  static const char *const fi_stop[] = {"fi", NULL};
+  int ends[MAX_STAGES];
+  int num_ends = 0;
+
+  next(c);
+  parse_list(c, then_stop);
+  expect(c, "then");
+  int skip = emit(c, OP_JNZ, -1, -1);
+  parse_list(c, body_stop);
+
+  while (!c->error && is_word(c, "elif") && num_ends < MAX_STAGES - 1) {
+    ends[num_ends++] = emit(c, OP_JMP, -1, -1);
+    c->prog->code[skip].a = c->prog->len;
+    next(c);
+    parse_list(c, then_stop);
+    expect(c, "then");
+    skip = emit(c, OP_JNZ, -1, -1);
+    parse_list(c, body_stop);
+  }
+  ends[num_ends++] = emit(c, OP_JMP, -1, -1);
+  c->prog->code[skip].a = c->prog->len;
+  if (!c->error && is_word(c, "else")) {
+    next(c);
+    parse_list(c, fi_stop);
+  } else {
+    // No branch taken: the status is 0
+    emit(c, OP_TRUE, -1, -1);
+  }
+  expect(c, "fi");
+  for (int i = 0; i < num_ends; i++)
+    c->prog->code[ends[i]].a = c->prog->len;
+}
+
+/**
+ * @brief Compiles `while list; do list; done` and `until ...`.
+ */
+static void parse_while(struct compiler *c) {
+  static const char *const do_stop[] = {"do", NULL};
+  static const char *const done_stop[] = {"done", NULL};
+  int until = is_word(c, "until");
+
+  next(c);
+  int loop = emit(c, OP_LOOP, -1, -1);
+  int cond = c->prog->len;
+  parse_list(c, do_stop);
+  expect(c, "do");
+  int exit_jump = emit(c, until ? OP_JZ : OP_JNZ, -1, -1);
+  parse_list(c, done_stop);
+  expect(c, "done");
+  emit(c, OP_SAVE, -1, -1);
+  emit(c, OP_JMP, cond, -1);
+  int end = emit(c, OP_LOOP_END, -1, -1);
+  c->prog->code[exit_jump].a = end;
+  c->prog->code[loop].a = end;
+  c->prog->code[loop].b = cond;
+}
+
+/**
+ * @brief Compiles `for [-j N] name [in word...]; do list; done`.
+ *
+ * With `-j N` (`-jN`), the iterations run in up to N parallel workers;
+ * N is expanded at run time, so `-j $(nproc)` works.
+ */
+static void parse_for(struct compiler *c) {
+  static const char *const done_stop[] = {"done", NULL};
+  int jobs = -1; // serial
+  next(c);
+  if (c->tok.type == TOK_WORD && c->tok.len >= 2 &&
+      strncmp(c->src + c->tok.start, "-j", 2) == 0) {
+    if (c->tok.len > 2) {
+      jobs = pool_add(c->prog, c->src + c->tok.start + 2, c->tok.len - 2);
+    } else {
+      next(c);
+      if (c->tok.type != TOK_WORD) {
+        syntax_error(c);
+        return;
+      }
+      jobs = pool_add(c->prog, c->src + c->tok.start, c->tok.len);
+    }
+    next(c);
+  }
+  const char *name = c->src + c->tok.start;
+  int n = c->tok.len;
+  if (c->tok.type != TOK_WORD || n == 0 || isdigit((unsigned char)name[0])) {
+    syntax_error(c);
+    return;
+  }
+  for (int i = 0; i < n; i++) {
+    if (!isalnum((unsigned char)name[i]) && name[i] != '_') {
+      syntax_error(c);
+      return;
+    }
+  }
+  int var = pool_add(c->prog, name, n);
+  next(c);
+  skip_newlines(c);
+
+  int words = -1; // no `in`: iterate over "$@"
+  if (is_word(c, "in")) {
+    next(c);
+    int start = c->tok.start, end = c->tok.start;
+    while (!c->error && c->tok.type == TOK_WORD) {
+      end = c->tok.start + c->tok.len;
+      next(c);
+    }
+    words = pool_add(c->prog, c->src + start, end - start);
+  }
+  if (is_op(c, ";"))
+    next(c);
+  skip_newlines(c);
+  expect(c, "do");
+
+  int loop = emit(c, OP_LOOP, -1, -1);
+  emit(c, OP_FOR_INIT, words, jobs);
+  int step = emit(c, OP_FOR_NEXT, var, -1);
+  parse_list(c, done_stop);
+  expect(c, "done");
+  emit(c, OP_SAVE, -1, -1);
+  emit(c, OP_JMP, step, -1);
+  int end = emit(c, OP_LOOP_END, -1, -1);
+  c->prog->code[step].b = end;
+  c->prog->code[loop].a = end;
+  c->prog->code[loop].b = step;
+}
+
+/**
+ * @brief Compiles `case word in [(]pattern[|pattern]...) list;; ... esac`.
+ */
+static void parse_case(struct compiler *c) {
+  static const char *const esac_stop[] = {"esac", NULL};
+  int ends[256];
+  int num_ends = 0;
+
+  next(c);
+  if (c->tok.type != TOK_WORD) {
+    syntax_error(c);
+    return;
+  }
+  emit(c, OP_CASE,
+       pool_add(c->prog, c->src + c->tok.start, c->tok.len), -1);
+  next(c);
+  skip_newlines(c);
+  expect(c, "in");
+  skip_newlines(c);
+
+  while (!c->error && !is_word(c, "esac")) {
+    int matches[64];
+    int num_matches = 0;
+
+    if (is_op(c, "("))
+      next(c);
+    while (!c->error) {
+      if (c->tok.type != TOK_WORD || num_matches == 64) {
+        syntax_error(c);
+        return;
+      }
+      matches[num_matches++] = emit(
+          c, OP_CASE_MATCH,
+          pool_add(c->prog, c->src + c->tok.start, c->tok.len), -1);
+      next(c);
+      if (!is_op(c, "|"))
+        break;
+      next(c);
+    }
+    expect(c, ")");
+    int skip = emit(c, OP_JMP, -1, -1);
+    for (int i = 0; i < num_matches; i++)
+      c->prog->code[matches[i]].b = c->prog->len;
+    emit(c, OP_TRUE, -1, -1);
+    parse_list(c, esac_stop);
+    if (num_ends < 256)
+      ends[num_ends++] = emit(c, OP_JMP, -1, -1);
+    c->prog->code[skip].a = c->prog->len;
+    if (is_op(c, ";;")) {
+      next(c);
+      skip_newlines(c);
+    } else if (!is_word(c, "esac")) {
+      syntax_error(c);
+    }
+  }
+  expect(c, "esac");
+  // No pattern matched: the status is 0
+  emit(c, OP_TRUE, -1, -1);
+  for (int i = 0; i < num_ends; i++)
+    c->prog->code[ends[i]].a = c->prog->len;
+  emit(c, OP_CASE_END, -1, -1);
+}
+
+/**
+ * @brief Compiles `name() compound` or `function name [()] compound`.
+ *
+ * The body is compiled in place after an OP_FUNC, which defines the
+ * function at run time and jumps over the body.
+ *
+ * @param name Start of the function name.
+ * @param len Length of the name.
+ */
+static void parse_function(struct compiler *c, const char *name, int len) {
+  char *outer_locals = c->locals;
+  int outer_len = c->locals_len;
+  int start, end;
+
+  int def = emit(c, OP_FUNC, pool_add(c->prog, name, len), -1);
+  c->locals = NULL;
+  c->locals_len = 0;
+  c->in_function++;
+  skip_newlines(c);
+  if (parse_command(c, &start, &end) != 0 && !c->error)
+    syntax_error(c); // the body must be a compound command
+  c->in_function--;
+  emit(c, OP_RET, -1, -1);
+  c->prog->code[def].b = c->prog->len;
+  // The pool adds one more NUL: an empty name ends the list
+  if (c->locals)
+    c->prog->code[def].c = pool_add(c->prog, c->locals, c->locals_len);
+  free(c->locals);
+  c->locals = outer_locals;
+  c->locals_len = outer_len;
+}
+
+/**
+ * @brief Checks for `name ()` at the current word.
+ */
+static int at_function_definition(struct compiler *c) {
+  int i = c->pos;
+  while (c->src[i] == ' ' || c->src[i] == '\t')
+    i++;
+  if (c->src[i] != '(')
+    return 0;
+  i++;
+  while (c->src[i] == ' ' || c->src[i] == '\t')
+    i++;
+  return c->src[i] == ')';
+}
+
+/**
+ * @brief Compiles one command.
+ *
+ * Compound commands (and function definitions) are compiled immediately,
+ * including any redirections that follow them. A simple command is only
+ * scanned; its span is returned so the caller can merge pipelines.
+ *
+ * @param start Receives the start of a simple command's text.
+ * @param end Receives its end.
+ * @return int 1 for a simple command, 0 for a compound command.
+ */
+static int parse_command(struct compiler *c, int *start, int *end) {
+  static const char *const brace_stop[] = {"}", NULL};
+  static const char *const reserved[] = {"then", "elif", "else", "fi", "do",
+                                         "done", "esac", "}", "in", NULL};
+  int pc = c->prog->len;
+
+  c->cmd_line = line_at(c, c->tok.start);
+  if (c->tok.type == TOK_OP && !is_redirection(c) && !is_op(c, "(")) {
+    syntax_error(c);
+    return 0;
+  }
+  if (is_stop(c, reserved)) {
+    syntax_error(c);
+    return 0;
+  }
+
+  if (is_word(c, "if")) {
+    parse_if(c);
+  } else if (is_word(c, "while") || is_word(c, "until")) {
+    parse_while(c);
+  } else if (is_word(c, "for")) {
+    parse_for(c);
+  } else if (is_word(c, "case")) {
+    parse_case(c);
+  } else if (is_word(c, "{")) {
+    next(c);
+    parse_list(c, brace_stop);
+    expect(c, "}");
+  } else if (is_op(c, "(")) {
+    // The body is a block run by OP_SUBSHELL (in-process or forked)
+    int sub = emit(c, OP_SUBSHELL, -1, -1);
+    next(c);
+    parse_list(c, NULL);
+    expect(c, ")");
+    emit(c, OP_HALT, -1, -1);
+    c->prog->code[sub].a = c->prog->len;
+  } else if (is_word(c, "function")) {
+    next(c);
+    if (c->tok.type != TOK_WORD) {
+      syntax_error(c);
+      return 0;
+    }
+    const char *name = c->src + c->tok.start;
+    int len = c->tok.len;
+    int paren = at_function_definition(c);
+    next(c);
+    if (paren) {
+      next(c);
+      next(c);
+    }
+    parse_function(c, name, len);
+    return 0;
+  } else if (c->tok.type == TOK_WORD && at_function_definition(c)) {
+    const char *name = c->src + c->tok.start;
+    int len = c->tok.len;
+    next(c); // name
+    next(c); // (
+    next(c); // )
+    parse_function(c, name, len);
+    return 0;
+  } else {
+    scan_simple(c, start, end);
+    return 1;
+  }
+
+  // Redirections of a compound command apply to all of it
+  if (!c->error && is_redirection(c)) {
+    int s, e, doc_lo = c->num_docs;
+    scan_redirections(c, &s, &e);
+    if (c->error)
+      return 0;
+    // The text is stored by emitting it at the end, then moving it in front
+    int text = emit_text(c, OP_REDIR, s, e, doc_lo, c->num_docs);
+    struct insn redir = c->prog->code[text];
+    c->prog->len--;
+    for (int i = 0; i < c->num_units; i++) {
+      if (c->units[i].insn == text)
+        c->units[i].insn = -2; // re-pointed below
+    }
+    insert(c, pc, OP_REDIR, redir.a, -1);
+    for (int i = 0; i < c->num_units; i++) {
+      if (c->units[i].insn == -2)
+        c->units[i].insn = pc;
+    }
+    c->prog->code[pc].b = emit(c, OP_UNREDIR, -1, -1);
+  }
+  return 0;
+}
+
+/**
+ * @brief Compiles a pipeline.
+ *
+ * If every stage is a simple command, the whole pipeline is one OP_CMD
+ * (the executor runs it). Otherwise each stage becomes a block ending in
+ * OP_HALT, run in its own child by an OP_PIPE.
+ */
+static void parse_pipeline(struct compiler *c) {
+  int start[MAX_STAGES], end[MAX_STAGES], lo[MAX_STAGES], hi[MAX_STAGES];
+  int simple[MAX_STAGES], block[MAX_STAGES], err[MAX_STAGES];
+  int n = 0;
+  int pipe_mode = 0;
+  int skip = -1;
+  int pc = c->prog->len;
+  int bang = 0;
+
+  if (is_word(c, "!")) {
+    bang = 1;
+    next(c);
+  }
+
+  while (!c->error) {
+    if (n == MAX_STAGES) {
+      fprintf(stderr, "shell: too many pipeline stages\n");
+      c->error = 1;
+      return;
+    }
+    int stage_pc = c->prog->len;
+    lo[n] = c->num_docs;
+    simple[n] = parse_command(c, &start[n], &end[n]);
+    hi[n] = c->num_docs;
+    err[n] = is_op(c, "|&");
+    if (c->error)
+      return;
+    int more = is_op(c, "|") || is_op(c, "|&");
+
+    if (!simple[n] && !pipe_mode && (n > 0 || more)) {
+      // Switch to blocks: jump over them to the OP_PIPE
+      pipe_mode = 1;
+      skip = insert(c, pc, OP_JMP, -1, -1);
+      stage_pc++;
+      emit(c, OP_HALT, -1, -1);
+      block[n] = stage_pc;
+      for (int i = 0; i < n; i++) {
+        block[i] = emit_text(c, OP_CMD, start[i], end[i], lo[i], hi[i]);
+        emit(c, OP_HALT, -1, -1);
+      }
+    } else if (pipe_mode) {
+      if (simple[n]) {
+        block[n] = emit_text(c, OP_CMD, start[n], end[n], lo[n], hi[n]);
+      } else {
+        block[n] = stage_pc;
+      }
+      emit(c, OP_HALT, -1, -1);
+    }
+    n++;
+    if (!more)
+      break;
+    next(c);
+    skip_newlines(c);
+  }
+  if (c->error || n == 0)
+    return;
+
+  if (pipe_mode) {
+    c->prog->code[skip].a = c->prog->len;
+    int pipe = emit(c, OP_PIPE, n, -1);
+    for (int i = 0; i < n; i++)
+      emit(c, OP_STAGE, block[i], err[i]);
+    c->prog->code[pipe].b = c->prog->len;
+  } else if (simple[0]) {
+    emit_text(c, OP_CMD, start[0], end[n - 1], lo[0], hi[n - 1]);
+  }
+  if (bang)
+    emit(c, OP_NOT, -1, -1);
+}
+
+/**
+ * @brief Compiles pipelines joined by `&&` and `||`.
+ */
+static void parse_and_or(struct compiler *c) {
+  parse_pipeline(c);
+  while (!c->error && (is_op(c, "&&") || is_op(c, "||"))) {
+    int jump = emit(c, is_op(c, "&&") ? OP_JNZ : OP_JZ, -1, -1);
+    next(c);
+    skip_newlines(c);
+    parse_pipeline(c);
+    c->prog->code[jump].a = c->prog->len;
+  }
+}
+
+/**
+ * @brief Compiles a list of commands up to one of the `stops` words.
+ *
+ * @param stops Reserved words that end the list (not consumed), or NULL.
+ */
+static void parse_list(struct compiler *c, const char *const *stops) {
+  while (!c->error) {
+    while (!c->error && (is_op(c, "\n") || is_op(c, ";")))
+      next(c);
+    if (c->error || c->tok.type == TOK_END || is_op(c, ")") ||
+        is_op(c, ";;") || is_stop(c, stops))
+      return;
+
+    int pc = c->prog->len;
+    parse_and_or(c);
+    if (c->error)
+      return;
+    if (is_op(c, "&")) {
+      // Run the whole and-or list in a background child
+      insert(c, pc, OP_BG, -1, -1);
+      emit(c, OP_HALT, -1, -1);
+      c->prog->code[pc].a = c->prog->len;
+      next(c);
+    } else if (is_op(c, ";") || is_op(c, "\n")) {
+      next(c);
+    } else if (c->tok.type != TOK_END && !is_op(c, ")") && !is_op(c, ";;")) {
+      syntax_error(c);
+    }
+  }
+}
+
+/**
+ * @brief Compiles script text into bytecode.
+ *
+ * @param text The script.
+ * @param incomplete Set to 1 if the text ends in the middle of a command
+ *        (an open `if`, `while`, quote...), 0 otherwise.
+ * @return struct program* The program, or NULL on a syntax error.
+ */
+struct program *compile_script(const char *text, int *incomplete) {
+  struct compiler c;
+  uint64_t start = stats_now();
+
+  memset(&c, 0, sizeof(c));
+  c.src = text ? text : "";
+  c.prog = program_new();
+  c.line = 1;
+  c.cmd_line = 1;
+
+  next(&c);
+  parse_list(&c, NULL);
+  if (!c.error && c.tok.type != TOK_END)
+    syntax_error(&c); // stray `)` or `;;`
+  if (!c.error)
+    read_bodies(&c); // bodies missing their delimiter run to the end
+  emit(&c, OP_HALT, -1, -1);
+
+  free(c.docs);
+  free(c.units);
+  free(c.locals);
+  *incomplete = c.incomplete;
+  stats_time(STAT_PARSE, stats_now() - start);
+  if (c.error) {
+    program_free(c.prog);
+    return NULL;
+  }
+  return c.prog;
+}
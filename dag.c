@@ -0,0 +1,639 @@
+/**
+ * @file dag.c
+ * @brief The `dag` built-in: runs a graph of dependent tasks in parallel.
+ *
+ * A task file lists named tasks, what they depend on, and optionally the
+ * files they read and write:
+ *
+ *     # comment
+ *     fetch:
+ *       out: raw.csv
+ *       run: curl -so raw.csv https://example.com/data.csv
+ *     clean: fetch
+ *       in: raw.csv
+ *       out: clean.csv
+ *       run: sort -u raw.csv > clean.csv
+ *
+ * A line starting in column 0 names a task (`name: deps...`); indented
+ * `in:`, `out:` and `run:` lines describe it (`run:` may repeat, one
+ * command line each). The commands run in forked children, like a
+ * subshell, with as many tasks at once as the dependencies allow (up to
+ * one per CPU). A task is skipped when it is up to date: all its outputs
+ * exist, none of its dependencies ran, and no input is newer than the
+ * oldest output. With `-c`, inputs are compared by content instead: a
+ * hash of the command and the input files is saved after each success in
+ * `file.state`, and the task is skipped while it matches.
+ *
+ * The first failure stops new tasks from starting (`-k` only skips the
+ * tasks that depend on it) and becomes the status of `dag`.
+ *
+ * @author Abdelhamid
+ * @date 2025-12-14
+ */
+
+#include "shell.h"
+
+#ifndef _WIN32
+
+/**
+ * @brief States of a task during a run.
+ */
+enum task_state {
+  TASK_PENDING, /**< Waiting for its dependencies. */
+  TASK_RUNNING, /**< Its child is running. */
+  TASK_DONE,    /**< Ran and succeeded. */
+  TASK_FRESH,   /**< Up to date: skipped. */
+  TASK_FAILED,  /**< Ran and failed. */
+  TASK_BLOCKED  /**< Not run because a dependency failed. */
+};
+
+/**
+ * @brief A growable list of words.
+ */
+struct word_list {
+  char **items; /**< The words. */
+  int len;      /**< Number of words. */
+  int cap;      /**< Allocated entries. */
+};
+
+/**
+ * @brief One task of the graph.
+ */
+struct task {
+  char *name;              /**< Task name. */
+  struct word_list deps;   /**< Names of the tasks it depends on. */
+  struct word_list inputs; /**< Files it reads. */
+  struct word_list outputs; /**< Files it writes. */
+  char *run;               /**< Commands (lines separated by newlines). */
+  int *dep_ids;            /**< `deps` resolved to task indices. */
+  int *users;              /**< Tasks that depend on this one. */
+  int num_users;           /**< Number of `users`. */
+  int waiting;             /**< Dependencies not finished yet. */
+  int wanted;              /**< Part of this run. */
+  int state;               /**< An `enum task_state`. */
+  int pid;                 /**< Child running it. */
+  uint64_t hash;           /**< `-c`: hash of command and inputs. */
+  uint64_t saved_hash;     /**< `-c`: hash recorded by the last success. */
+};
+
+/**
+ * @brief A parsed task file.
+ */
+struct graph {
+  struct task *tasks; /**< The tasks, in file order. */
+  int len;            /**< Number of tasks. */
+  int cap;            /**< Allocated tasks. */
+};
+
+/**
+ * @brief Appends a copy of `word` (of length `n`) to a list.
+ */
+static void list_add(struct word_list *l, const char *word, size_t n) {
+  if (l->len == l->cap) {
+    l->cap = l->cap ? l->cap * 2 : 4;
+    l->items = realloc(l->items, l->cap * sizeof(char *));
+    if (!l->items) {
+      fprintf(stderr, "shell: allocation error\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  l->items[l->len++] = strndup(word, n);
+}
+
+/**
+ * @brief Appends the whitespace-separated words of `text` to a list.
+ */
+static void list_split(struct word_list *l, const char *text) {
+  while (*text) {
+    size_t n = strcspn(text, " \t");
+    if (n > 0)
+      list_add(l, text, n);
+    text += n;
+    text += strspn(text, " \t");
+  }
+}
+
+/**
+ * @brief Frees the words of a list.
+ */
+static void list_free(struct word_list *l) {
+  for (int i = 0; i < l->len; i++)
+    free(l->items[i]);
+  free(l->items);
+}
+
+/**
+ * @brief Releases a graph.
+ */
+static void graph_free(struct graph *g) {
+  for (int i = 0; i < g->len; i++) {
+    struct task *t = &g->tasks[i];
+    free(t->name);
+    list_free(&t->deps);
+    list_free(&t->inputs);
+    list_free(&t->outputs);
+    free(t->run);
+    free(t->dep_ids);
+    free(t->users);
+  }
+  free(g->tasks);
+}
+
+/**
+ * @brief Returns the index of the task called `name`, or -1.
+ */
+static int find_task(struct graph *g, const char *name) {
+  for (int i = 0; i < g->len; i++) {
+    if (strcmp(g->tasks[i].name, name) == 0)
+      return i;
+  }
+  return -1;
+}
+
+/**
+ * @brief Parses a task file.
+ * @return int 0 on success, -1 after printing an error.
+ */
+static int graph_load(struct graph *g, const char *path) {
+  FILE *f = fopen(path, "r");
+  char *line = NULL;
+  size_t size = 0;
+  ssize_t n;
+  int lineno = 0, result = 0;
+  struct task *t = NULL;
+
+  if (!f) {
+    fprintf(stderr, "shell: dag: %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+  while (result == 0 && (n = getline(&line, &size, f)) >= 0) {
+    lineno++;
+    while (n > 0 && (line[n - 1] == '\n' || line[n - 1] == '\r'))
+      line[--n] = '\0';
+    const char *p = line + strspn(line, " \t");
+    if (*p == '\0' || *p == '#')
+      continue;
+    const char *colon = strchr(p, ':');
+    if (!colon) {
+      fprintf(stderr, "shell: dag: %s:%d: missing ':'\n", path, lineno);
+      result = -1;
+      break;
+    }
+    const char *value = colon + 1 + strspn(colon + 1, " \t");
+    size_t key_len = colon - p;
+
+    if (p == line) {
+      // `name: deps...` starts a task
+      char *name = strndup(p, key_len);
+      if (key_len == 0 || find_task(g, name) >= 0) {
+        fprintf(stderr, "shell: dag: %s:%d: %s task name\n", path, lineno,
+                key_len ? "duplicate" : "empty");
+        free(name);
+        result = -1;
+        break;
+      }
+      if (g->len == g->cap) {
+        g->cap = g->cap ? g->cap * 2 : 16;
+        g->tasks = realloc(g->tasks, g->cap * sizeof(struct task));
+        if (!g->tasks) {
+          fprintf(stderr, "shell: allocation error\n");
+          exit(EXIT_FAILURE);
+        }
+      }
+      t = &g->tasks[g->len++];
+      memset(t, 0, sizeof(*t));
+      t->name = name;
+      list_split(&t->deps, value);
+    } else if (!t) {
+      fprintf(stderr, "shell: dag: %s:%d: no task to describe\n", path,
+              lineno);
+      result = -1;
+    } else if (key_len == 2 && strncmp(p, "in", 2) == 0) {
+      list_split(&t->inputs, value);
+    } else if (key_len == 3 && strncmp(p, "out", 3) == 0) {
+      list_split(&t->outputs, value);
+    } else if (key_len == 3 && strncmp(p, "run", 3) == 0) {
+      size_t old = t->run ? strlen(t->run) : 0;
+      t->run = realloc(t->run, old + strlen(value) + 2);
+      if (!t->run) {
+        fprintf(stderr, "shell: allocation error\n");
+        exit(EXIT_FAILURE);
+      }
+      sprintf(t->run + old, "%s\n", value);
+    } else {
+      fprintf(stderr, "shell: dag: %s:%d: unknown key '%.*s'\n", path,
+              lineno, (int)key_len, p);
+      result = -1;
+    }
+  }
+  free(line);
+  fclose(f);
+  return result;
+}
+
+/**
+ * @brief Resolves dependency names and builds the reverse edges.
+ * @return int 0 on success, -1 after printing an error.
+ */
+static int graph_link(struct graph *g) {
+  for (int i = 0; i < g->len; i++) {
+    struct task *t = &g->tasks[i];
+    t->dep_ids = malloc((t->deps.len + 1) * sizeof(int));
+    if (!t->dep_ids) {
+      fprintf(stderr, "shell: allocation error\n");
+      exit(EXIT_FAILURE);
+    }
+    for (int d = 0; d < t->deps.len; d++) {
+      int j = find_task(g, t->deps.items[d]);
+      if (j < 0) {
+        fprintf(stderr, "shell: dag: %s: unknown dependency '%s'\n", t->name,
+                t->deps.items[d]);
+        return -1;
+      }
+      t->dep_ids[d] = j;
+      g->tasks[j].num_users++;
+    }
+  }
+  for (int i = 0; i < g->len; i++) {
+    g->tasks[i].users = malloc((g->tasks[i].num_users + 1) * sizeof(int));
+    if (!g->tasks[i].users) {
+      fprintf(stderr, "shell: allocation error\n");
+      exit(EXIT_FAILURE);
+    }
+    g->tasks[i].num_users = 0;
+  }
+  for (int i = 0; i < g->len; i++) {
+    struct task *t = &g->tasks[i];
+    for (int d = 0; d < t->deps.len; d++) {
+      struct task *dep = &g->tasks[t->dep_ids[d]];
+      dep->users[dep->num_users++] = i;
+    }
+  }
+  return 0;
+}
+
+/**
+ * @brief Marks a task and everything it depends on as part of the run.
+ */
+static void want(struct graph *g, int i) {
+  struct task *t = &g->tasks[i];
+  if (t->wanted)
+    return;
+  t->wanted = 1;
+  for (int d = 0; d < t->deps.len; d++)
+    want(g, t->dep_ids[d]);
+}
+
+/**
+ * @brief Counts the unfinished dependencies of the wanted tasks and checks
+ *        that they form no cycle.
+ * @return int 0 on success, -1 after printing the tasks of a cycle.
+ */
+static int graph_order(struct graph *g, int *queue) {
+  int head = 0, tail = 0;
+
+  for (int i = 0; i < g->len; i++) {
+    struct task *t = &g->tasks[i];
+    t->waiting = t->wanted ? t->deps.len : 0;
+    if (t->wanted && t->waiting == 0)
+      queue[tail++] = i;
+  }
+  // Kahn's algorithm on a copy of the counters
+  int *left = malloc((g->len + 1) * sizeof(int));
+  if (!left) {
+    fprintf(stderr, "shell: allocation error\n");
+    exit(EXIT_FAILURE);
+  }
+  for (int i = 0; i < g->len; i++)
+    left[i] = g->tasks[i].waiting;
+  while (head < tail) {
+    struct task *t = &g->tasks[queue[head++]];
+    for (int u = 0; u < t->num_users; u++) {
+      int j = t->users[u];
+      if (g->tasks[j].wanted && --left[j] == 0)
+        queue[tail++] = j;
+    }
+  }
+  int result = 0;
+  for (int i = 0; i < g->len; i++) {
+    if (g->tasks[i].wanted && left[i] > 0) {
+      if (result == 0)
+        fprintf(stderr, "shell: dag: dependency cycle among:");
+      fprintf(stderr, " %s", g->tasks[i].name);
+      result = -1;
+    }
+  }
+  if (result)
+    fprintf(stderr, "\n");
+  free(left);
+  return result;
+}
+
+/**
+ * @brief Returns the modification time of a file in nanoseconds, or -1 if
+ *        it does not exist.
+ */
+static long long mtime_ns(const char *path) {
+  struct stat st;
+  return fs_stat(path, &st, 0) == 0 ? fs_mtime_ns(&st) : -1;
+}
+
+/**
+ * @brief Hashes a task's commands and the names and contents of its inputs.
+ */
+static uint64_t task_hash(struct task *t) {
+  uint64_t h = HASH_SEED;
+
+  if (t->run)
+    h = hash_bytes(h, t->run, strlen(t->run) + 1);
+  for (int i = 0; i < t->inputs.len; i++) {
+    h = hash_bytes(h, t->inputs.items[i], strlen(t->inputs.items[i]) + 1);
+    if (hash_file(t->inputs.items[i], &h) != 0)
+      h = hash_bytes(h, "\0missing", 8);
+  }
+  return h;
+}
+
+/**
+ * @brief Checks whether a task can be skipped.
+ *
+ * @param content Non-zero to compare input hashes (`-c`), else mtimes.
+ */
+static int up_to_date(struct graph *g, struct task *t, int content) {
+  long long oldest = -1;
+
+  if (t->outputs.len == 0)
+    return 0; // nothing to check: always runs
+  for (int i = 0; i < t->outputs.len; i++) {
+    long long m = mtime_ns(t->outputs.items[i]);
+    if (m < 0)
+      return 0;
+    if (oldest < 0 || m < oldest)
+      oldest = m;
+  }
+  if (content) {
+    t->hash = task_hash(t);
+    return t->saved_hash != 0 && t->hash == t->saved_hash;
+  }
+  for (int d = 0; d < t->deps.len; d++) {
+    if (g->tasks[t->dep_ids[d]].state == TASK_DONE)
+      return 0;
+  }
+  for (int i = 0; i < t->inputs.len; i++) {
+    if (mtime_ns(t->inputs.items[i]) > oldest)
+      return 0;
+  }
+  return 1;
+}
+
+/**
+ * @brief Loads the hashes saved by earlier `-c` runs.
+ */
+static void state_load(struct graph *g, const char *path) {
+  FILE *f = fopen(path, "r");
+  unsigned long long hash;
+  char name[1024];
+
+  if (!f)
+    return;
+  while (fscanf(f, "%llx %1023s", &hash, name) == 2) {
+    int i = find_task(g, name);
+    if (i >= 0)
+      g->tasks[i].saved_hash = hash;
+  }
+  fclose(f);
+}
+
+/**
+ * @brief Saves the task hashes (written aside, then renamed into place).
+ */
+static void state_save(struct graph *g, const char *path) {
+  char tmp[4300];
+  snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+  FILE *f = fopen(tmp, "w");
+
+  if (!f)
+    return;
+  for (int i = 0; i < g->len; i++) {
+    if (g->tasks[i].saved_hash)
+      fprintf(f, "%016llx %s\n", (unsigned long long)g->tasks[i].saved_hash,
+              g->tasks[i].name);
+  }
+  if (fclose(f) != 0 || rename(tmp, path) != 0)
+    remove(tmp);
+}
+
+/**
+ * @brief Queues the users of a finished task whose dependencies are all
+ *        finished.
+ */
+static void release(struct graph *g, int i, int *queue, int *tail) {
+  struct task *t = &g->tasks[i];
+  for (int u = 0; u < t->num_users; u++) {
+    struct task *user = &g->tasks[t->users[u]];
+    if (user->wanted && --user->waiting == 0)
+      queue[(*tail)++] = t->users[u];
+  }
+}
+
+/**
+ * @brief Runs the wanted tasks of a graph.
+ *
+ * Ready tasks wait in a FIFO; up to `jobs` children run at once and are
+ * collected by `jobs_wait_for()`, which leaves the shell's background jobs
+ * to the job table. A finished task releases the tasks that depend on it.
+ *
+ * @return int The status of the first failed task, or 0.
+ */
+static int graph_run(struct graph *g, int *queue, int jobs, int keep_going,
+                     int content) {
+  int head = 0, tail = 0, running = 0, status = 0;
+  int *pids = malloc((g->len + 1) * sizeof(int));
+
+  if (!pids) {
+    fprintf(stderr, "shell: allocation error\n");
+    exit(EXIT_FAILURE);
+  }
+  for (int i = 0; i < g->len; i++) {
+    if (g->tasks[i].wanted && g->tasks[i].waiting == 0)
+      queue[tail++] = i;
+  }
+  for (;;) {
+    if (head < tail && running < jobs && (status == 0 || keep_going)) {
+      int i = queue[head++];
+      struct task *t = &g->tasks[i];
+      t->state = TASK_PENDING;
+      for (int d = 0; d < t->deps.len; d++) {
+        int s = g->tasks[t->dep_ids[d]].state;
+        if (s == TASK_FAILED || s == TASK_BLOCKED)
+          t->state = TASK_BLOCKED;
+      }
+      if (t->state == TASK_PENDING && up_to_date(g, t, content))
+        t->state = TASK_FRESH;
+      if (t->state == TASK_PENDING) {
+        read_sync();
+        jobs_flush();
+        pid_t pid = jobs_fork(t->name);
+        if (pid == 0)
+          run_child_text(t->run ? t->run : ":");
+        if (pid > 0) {
+          t->state = TASK_RUNNING;
+          t->pid = pid;
+          running++;
+          continue;
+        }
+        perror("fork");
+        t->state = TASK_FAILED;
+        if (status == 0)
+          status = 1;
+      }
+      release(g, i, queue, &tail);
+      continue;
+    }
+    if (running == 0)
+      break;
+
+    int code, i, n = 0;
+    for (i = 0; i < g->len; i++) {
+      if (g->tasks[i].state == TASK_RUNNING)
+        pids[n++] = g->tasks[i].pid;
+    }
+    int pid = jobs_wait_for(pids, n, &code);
+    if (pid < 0)
+      break;
+    for (i = 0; i < g->len; i++) {
+      if (g->tasks[i].state == TASK_RUNNING && g->tasks[i].pid == pid)
+        break;
+    }
+    running--;
+    struct task *t = &g->tasks[i];
+    if (code != 0) {
+      fprintf(stderr, "shell: dag: %s: failed with status %d\n", t->name,
+              code);
+      t->state = TASK_FAILED;
+      if (status == 0)
+        status = code;
+    } else {
+      t->state = TASK_DONE;
+      if (content)
+        t->saved_hash = t->hash ? t->hash : task_hash(t);
+    }
+    release(g, i, queue, &tail);
+  }
+  free(pids);
+  return status;
+}
+
+#endif
+
+/* =========================================================================
+ *                          Built-in Command Implementation
+ * ========================================================================= */
+
+/**
+ * @brief Runs a task graph.
+ *
+ * Usage: `dag [-j jobs] [-k] [-c] file [task...]`
+ *
+ * - `-j jobs`: run at most `jobs` tasks at once (default: one per CPU).
+ * - `-k`: keep going after a failure, skipping only what depends on it.
+ * - `-c`: decide whether a task is up to date from the content of its
+ *   inputs (hashes kept in `file.state`) instead of modification times.
+ *
+ * With task names, only those tasks and their dependencies run. The status
+ * is that of the first failed task, 1 for a dependency cycle, or 2 for an
+ * invalid file.
+ *
+ * @param args Null-terminated array of arguments.
+ * @return int Always returns 1 to continue execution.
+ */
+int shell_dag(char **args) {
+#ifdef _WIN32
+  (void)args;
+  fprintf(stderr, "dag not supported on Windows mode.\n");
+  last_status = 1;
+  return 1;
+#else
+  int jobs = 0, keep_going = 0, content = 0;
+  int i;
+
+  for (i = 1; args[i] != NULL && args[i][0] == '-' && args[i][1]; i++) {
+    const char *opt = args[i] + 1;
+    if (strcmp(args[i], "--") == 0) {
+      i++;
+      break;
+    }
+    for (; *opt; opt++) {
+      if (*opt == 'k') {
+        keep_going = 1;
+        continue;
+      }
+      if (*opt == 'c') {
+        content = 1;
+        continue;
+      }
+      if (*opt != 'j') {
+        fprintf(stderr, "shell: dag: -%c: invalid option\n", *opt);
+        last_status = 2;
+        return 1;
+      }
+      const char *value = opt[1] ? opt + 1 : args[++i];
+      if (!value) {
+        fprintf(stderr, "shell: dag: -j: option requires an argument\n");
+        last_status = 2;
+        return 1;
+      }
+      jobs = atoi(value);
+      break;
+    }
+  }
+  if (!args[i]) {
+    fprintf(stderr, "Usage: dag [-j jobs] [-k] [-c] file [task...]\n");
+    last_status = 2;
+    return 1;
+  }
+  if (jobs <= 0)
+    jobs = pool_cpu_count();
+
+  const char *path = args[i++];
+  struct graph g = {NULL, 0, 0};
+  last_status = 2;
+  if (graph_load(&g, path) != 0 || graph_link(&g) != 0) {
+    graph_free(&g);
+    return 1;
+  }
+  if (!args[i]) {
+    for (int t = 0; t < g.len; t++)
+      g.tasks[t].wanted = 1;
+  }
+  for (; args[i]; i++) {
+    int t = find_task(&g, args[i]);
+    if (t < 0) {
+      fprintf(stderr, "shell: dag: %s: no such task\n", args[i]);
+      graph_free(&g);
+      return 1;
+    }
+    want(&g, t);
+  }
+
+  int *queue = malloc((g.len + 1) * sizeof(int));
+  if (!queue) {
+    fprintf(stderr, "shell: allocation error\n");
+    exit(EXIT_FAILURE);
+  }
+  char state[4200];
+  snprintf(state, sizeof(state), "%s.state", path);
+  if (graph_order(&g, queue) != 0) {
+    last_status = 1;
+  } else {
+    if (content)
+      state_load(&g, state);
+    last_status = graph_run(&g, queue, jobs, keep_going, content);
+    if (content)
+      state_save(&g, state);
+  }
+  free(queue);
+  graph_free(&g);
+  return 1;
+#endif
+}
@@ -0,0 +1,632 @@
+/**
+ * @file dirs.c
+ * @brief Directory navigation: cd helpers, directory stack and `z` jumps.
+ *
+ * Every successful directory change goes through `change_directory()`,
+ * which keeps `PWD`/`OLDPWD` up to date and records the visit in a frecency
+ * database (frequency + recency, as popularized by `z`). The database lives
+ * in memory as an array indexed by a hash table, so recording a visit or
+ * resolving `z <terms>` never touches the directory tree. On disk it is the
+ * append-only `~/.shell_dirs` file: each visit appends one record, and the
+ * file is compacted when it grows to twice the number of live entries.
+ *
+ * @author Abdelhamid
+ * @date 2025-12-14
+ */
+
+#include "shell.h"
+#include <ctype.h>
+#include <time.h>
+
+/** @brief Name of the directory database file. */
+#define DIRS_FILE ".shell_dirs"
+
+/** @brief Maximum depth of the pushd/popd stack. */
+#define DIR_STACK_SIZE 64
+
+/** @brief When the sum of all ranks exceeds this, ranks are aged. */
+#define DIRS_MAX_RANK 9000.0
+
+/**
+ * @brief One remembered directory.
+ */
+struct dir_entry {
+  char *path;  /**< Absolute directory path. */
+  double rank; /**< Visit count, decayed over time. */
+  long time;   /**< Time of the last visit (seconds since epoch). */
+  int mapped;  /**< Non-zero if `path` points into the session image. */
+};
+
+/** @brief All remembered directories. */
+static struct dir_entry *dir_db = NULL;
+
+/** @brief Number of entries in `dir_db`. */
+static int dir_db_len = 0;
+
+/** @brief Allocated capacity of `dir_db`. */
+static int dir_db_cap = 0;
+
+/** @brief Open-addressing hash index: path -> position in `dir_db` + 1. */
+static int *dir_index = NULL;
+
+/** @brief Number of slots in `dir_index` (a power of two). */
+static int dir_index_size = 0;
+
+/** @brief Records currently stored in the on-disk file. */
+static int dir_file_records = 0;
+
+/**
+ * @brief Identity, size and modification time of the on-disk file when
+ *        this shell last read or wrote it.
+ */
+static long long dir_file_stamp[4];
+
+/** @brief Non-zero once another shell has written to the file since. */
+static int dir_file_stale = 0;
+
+/** @brief The pushd/popd stack (most recent last). */
+static char *dir_stack[DIR_STACK_SIZE];
+
+/** @brief Number of entries on the directory stack. */
+static int dir_stack_len = 0;
+
+/**
+ * @brief FNV-1a hash of a path.
+ */
+static unsigned long dir_hash(const char *s) {
+  unsigned long h = 2166136261UL;
+  while (*s) {
+    h ^= (unsigned char)*s++;
+    h *= 16777619UL;
+  }
+  return h;
+}
+
+/**
+ * @brief Rebuilds the hash index with room for at least `need` entries.
+ */
+static void dir_reindex(int need) {
+  int size = 64;
+  while (size < need * 2)
+    size *= 2;
+
+  free(dir_index);
+  dir_index = calloc(size, sizeof(int));
+  if (!dir_index) {
+    fprintf(stderr, "shell: allocation error\n");
+    exit(EXIT_FAILURE);
+  }
+  dir_index_size = size;
+
+  for (int i = 0; i < dir_db_len; i++) {
+    unsigned long slot = dir_hash(dir_db[i].path) & (size - 1);
+    while (dir_index[slot])
+      slot = (slot + 1) & (size - 1);
+    dir_index[slot] = i + 1;
+  }
+}
+
+/**
+ * @brief Finds the entry for `path`, optionally creating it.
+ *
+ * @param path Absolute directory path.
+ * @param create Non-zero to add a new (zero-rank) entry if missing.
+ * @return struct dir_entry* The entry, or NULL if absent and not created.
+ */
+static struct dir_entry *dir_lookup(const char *path, int create) {
+  if (dir_index_size == 0 || (create && (dir_db_len + 1) * 2 > dir_index_size))
+    dir_reindex(dir_db_len + 1);
+
+  unsigned long slot = dir_hash(path) & (dir_index_size - 1);
+  while (dir_index[slot]) {
+    struct dir_entry *e = &dir_db[dir_index[slot] - 1];
+    if (strcmp(e->path, path) == 0)
+      return e;
+    slot = (slot + 1) & (dir_index_size - 1);
+  }
+  if (!create)
+    return NULL;
+
+  if (dir_db_len == dir_db_cap) {
+    dir_db_cap = dir_db_cap ? dir_db_cap * 2 : 64;
+    dir_db = realloc(dir_db, dir_db_cap * sizeof(struct dir_entry));
+    if (!dir_db) {
+      fprintf(stderr, "shell: allocation error\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  struct dir_entry *e = &dir_db[dir_db_len++];
+  e->path = strdup(path);
+  e->rank = 0;
+  e->time = 0;
+  e->mapped = 0;
+  dir_index[slot] = dir_db_len;
+  return e;
+}
+
+/**
+ * @brief Builds the path of the database file.
+ * @return int 0 on success, -1 if the home directory is unknown.
+ */
+static int dirs_file_path(char *buf, size_t size) {
+  char *home = getenv("HOME");
+  if (!home)
+    home = getenv("USERPROFILE"); // Windows fallback
+  if (!home)
+    return -1;
+  snprintf(buf, size, "%s/%s", home, DIRS_FILE);
+  return 0;
+}
+
+/**
+ * @brief Reads the identity, size and modification time of the database
+ *        file (all -1 if it does not exist).
+ */
+static void dirs_file_stamp(long long stamp[4]) {
+  char path[1024];
+  struct stat st;
+
+  stamp[0] = stamp[1] = stamp[2] = stamp[3] = -1;
+  if (dirs_file_path(path, sizeof(path)) != 0 || stat(path, &st) != 0)
+    return;
+  stamp[0] = (long long)st.st_dev;
+  stamp[1] = (long long)st.st_ino;
+  stamp[2] = (long long)st.st_size;
+  stamp[3] = fs_mtime_ns(&st);
+}
+
+/**
+ * @brief Rewrites the database file with one record per live entry.
+ */
+static void dirs_compact() {
+  char path[1024];
+  char tmp[1100];
+  if (dirs_file_path(path, sizeof(path)) != 0)
+    return;
+  snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid());
+
+  FILE *fp = fopen(tmp, "w");
+  if (!fp)
+    return;
+  for (int i = 0; i < dir_db_len; i++) {
+    fprintf(fp, "%.2f|%ld|%s\n", dir_db[i].rank, dir_db[i].time,
+            dir_db[i].path);
+  }
+  fclose(fp);
+  if (rename(tmp, path) == 0) {
+    // The file holds exactly what is in memory again
+    dir_file_records = dir_db_len;
+    dir_file_stale = 0;
+    dirs_file_stamp(dir_file_stamp);
+  } else {
+    remove(tmp);
+  }
+}
+
+/**
+ * @brief Loads the directory database from `~/.shell_dirs`.
+ *
+ * Later records for the same path override earlier ones, so the append-only
+ * file always reflects the latest state.
+ */
+void load_dirs() {
+  char path[1024];
+  char line[4096];
+  if (dirs_file_path(path, sizeof(path)) != 0)
+    return;
+
+  // Stamped before reading: a record appended meanwhile marks it changed
+  dirs_file_stamp(dir_file_stamp);
+  dir_file_stale = 0;
+  FILE *fp = fopen(path, "r");
+  if (!fp)
+    return;
+  while (fgets(line, sizeof(line), fp)) {
+    char *rank = strtok(line, "|");
+    char *when = strtok(NULL, "|");
+    char *dir = strtok(NULL, "\n");
+    if (rank && when && dir && dir[0] == '/') {
+      struct dir_entry *e = dir_lookup(dir, 1);
+      e->rank = atof(rank);
+      e->time = atol(when);
+      dir_file_records++;
+    }
+  }
+  fclose(fp);
+}
+
+/**
+ * @brief Checks whether another shell wrote to the database file since
+ *        this one loaded it, so the entries in memory miss its records.
+ */
+int dirs_changed() {
+  long long now[4];
+
+  if (dir_file_stale)
+    return 1;
+  dirs_file_stamp(now);
+  return memcmp(now, dir_file_stamp, sizeof(now)) != 0;
+}
+
+/**
+ * @brief Forgets the entries in memory and loads the database file again.
+ */
+void dirs_reload() {
+  for (int i = 0; i < dir_db_len; i++) {
+    if (!dir_db[i].mapped)
+      free(dir_db[i].path);
+  }
+  dir_db_len = 0;
+  dir_index_size = 0;
+  dir_file_records = 0;
+  load_dirs();
+}
+
+/**
+ * @brief Returns one entry of the database (for session snapshots).
+ *
+ * @param i Position of the entry.
+ * @param rank Receives its rank.
+ * @param when Receives the time of its last visit.
+ * @return const char* Its path, or NULL past the last entry.
+ */
+const char *dirs_entry(int i, double *rank, long *when) {
+  if (i < 0 || i >= dir_db_len)
+    return NULL;
+  *rank = dir_db[i].rank;
+  *when = dir_db[i].time;
+  return dir_db[i].path;
+}
+
+/**
+ * @brief Adds an entry to the database without recording a visit (to
+ *        restore a session image).
+ *
+ * The path is not copied: it points into the mapped image, which stays
+ * mapped for the life of the shell. Paths must be distinct. The hash index
+ * is rebuilt on the first lookup, not here, to keep startup short.
+ */
+void dirs_restore(const char *path, double rank, long when) {
+  if (dir_db_len == dir_db_cap) {
+    dir_db_cap = dir_db_cap ? dir_db_cap * 2 : 64;
+    dir_db = realloc(dir_db, dir_db_cap * sizeof(struct dir_entry));
+    if (!dir_db) {
+      fprintf(stderr, "shell: allocation error\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  struct dir_entry *e = &dir_db[dir_db_len++];
+  e->path = (char *)path;
+  e->rank = rank;
+  e->time = when;
+  e->mapped = 1;
+  dir_index_size = 0;
+}
+
+/**
+ * @brief Returns the number of records in the database file.
+ */
+int dirs_records() { return dir_file_records; }
+
+/**
+ * @brief Sets the number of records in the database file (when restored
+ *        from a snapshot instead of read), and takes the file as loaded.
+ */
+void dirs_set_records(int records) {
+  dir_file_records = records;
+  dir_file_stale = 0;
+  dirs_file_stamp(dir_file_stamp);
+}
+
+/**
+ * @brief Records a visit to `dir` in memory and on disk.
+ *
+ * Ranks are aged (multiplied by 0.99) once their sum exceeds
+ * DIRS_MAX_RANK, which lets stale directories fade out; entries that drop
+ * below 1 are forgotten.
+ *
+ * @param dir Absolute path of the directory just entered.
+ */
+static void dirs_record(const char *dir) {
+  struct dir_entry *e = dir_lookup(dir, 1);
+  double total = 0;
+
+  e->rank += 1;
+  e->time = (long)time(NULL);
+
+  for (int i = 0; i < dir_db_len; i++)
+    total += dir_db[i].rank;
+
+  if (total > DIRS_MAX_RANK) {
+    int keep = 0;
+    for (int i = 0; i < dir_db_len; i++) {
+      dir_db[i].rank *= 0.99;
+      if (dir_db[i].rank >= 1)
+        dir_db[keep++] = dir_db[i];
+      else if (!dir_db[i].mapped)
+        free(dir_db[i].path);
+    }
+    dir_db_len = keep;
+    dir_reindex(dir_db_len);
+    dirs_compact();
+    return;
+  }
+
+  char path[1024];
+  if (dirs_file_path(path, sizeof(path)) != 0)
+    return;
+  if (dir_file_records >= 2 * dir_db_len + 64) {
+    dirs_compact();
+    return;
+  }
+  // A file that is not as this shell left it has another shell's records
+  long long before[4];
+  dirs_file_stamp(before);
+  if (memcmp(before, dir_file_stamp, sizeof(before)) != 0)
+    dir_file_stale = 1;
+  FILE *fp = fopen(path, "a");
+  if (fp) {
+    fprintf(fp, "%.2f|%ld|%s\n", e->rank, e->time, e->path);
+    fclose(fp);
+    dir_file_records++;
+    dirs_file_stamp(dir_file_stamp);
+  }
+}
+
+/**
+ * @brief Changes the working directory and updates shell state.
+ *
+ * On success sets `OLDPWD` and `PWD`, refreshes the cached working-directory
+ * descriptor and records the new directory in the frecency database. All
+ * built-ins that change directory use this.
+ *
+ * @param path The target directory.
+ * @return int 0 on success, -1 on failure (errno is set).
+ */
+int change_directory(const char *path) {
+  char old[4096];
+  char cwd[4096];
+  int have_old = getcwd(old, sizeof(old)) != NULL;
+
+  if (fs_chdir(path) != 0)
+    return -1;
+
+  if (have_old)
+    setenv("OLDPWD", old, 1);
+  if (getcwd(cwd, sizeof(cwd)) != NULL) {
+    setenv("PWD", cwd, 1);
+    dirs_record(cwd);
+  }
+  return 0;
+}
+
+/**
+ * @brief Frecency score of an entry: rank weighted by last-visit age.
+ */
+static double dir_score(const struct dir_entry *e, long now) {
+  long age = now - e->time;
+  if (age < 3600)
+    return e->rank * 4;
+  if (age < 86400)
+    return e->rank * 2;
+  if (age < 604800)
+    return e->rank / 2;
+  return e->rank / 4;
+}
+
+/**
+ * @brief Checks whether all terms occur in `path`, in order.
+ *
+ * @param path Candidate directory.
+ * @param terms Null-terminated search terms.
+ * @param nocase Non-zero for a case-insensitive match.
+ * @return int 1 on match, 0 otherwise.
+ */
+static int dir_matches(const char *path, char **terms, int nocase) {
+  const char *p = path;
+  for (int i = 0; terms[i] != NULL; i++) {
+    size_t n = strlen(terms[i]);
+    const char *hit = NULL;
+    for (const char *s = p; *s && !hit; s++) {
+      size_t k = 0;
+      while (k < n && s[k] &&
+             (nocase ? tolower((unsigned char)s[k]) ==
+                           tolower((unsigned char)terms[i][k])
+                     : s[k] == terms[i][k]))
+        k++;
+      if (k == n)
+        hit = s;
+    }
+    if (!hit)
+      return 0;
+    p = hit + n;
+  }
+  return 1;
+}
+
+/**
+ * @brief Finds the highest-scoring remembered directory matching `terms`.
+ *
+ * Tries a case-sensitive match first and falls back to ignoring case.
+ *
+ * @param terms Null-terminated search terms.
+ * @return const char* The best directory, or NULL if nothing matches.
+ */
+static const char *dirs_best(char **terms) {
+  long now = (long)time(NULL);
+  for (int nocase = 0; nocase < 2; nocase++) {
+    const struct dir_entry *best = NULL;
+    double best_score = 0;
+    for (int i = 0; i < dir_db_len; i++) {
+      double score = dir_score(&dir_db[i], now);
+      if ((!best || score > best_score) &&
+          dir_matches(dir_db[i].path, terms, nocase)) {
+        best = &dir_db[i];
+        best_score = score;
+      }
+    }
+    if (best)
+      return best->path;
+  }
+  return NULL;
+}
+
+/* =========================================================================
+ *                          Built-in Command Implementations
+ * ========================================================================= */
+
+/**
+ * @brief Changes the current working directory.
+ *
+ * - `cd` with no argument goes to `$HOME`.
+ * - `cd -` goes back to `$OLDPWD` and prints the new directory.
+ * - `cd dir` changes to `dir`.
+ *
+ * @param args Null-terminated array of arguments (args[1] is the path).
+ * @return int Always returns 1 to continue execution.
+ */
+int shell_cd(char **args) {
+  const char *target = args[1];
+
+  if (target == NULL) {
+    target = getenv("HOME");
+    if (!target)
+      target = getenv("USERPROFILE"); // Windows fallback
+    if (!target) {
+      fprintf(stderr, "shell: cd: HOME not set\n");
+      return 1;
+    }
+  } else if (strcmp(target, "-") == 0) {
+    target = getenv("OLDPWD");
+    if (!target) {
+      fprintf(stderr, "shell: cd: OLDPWD not set\n");
+      return 1;
+    }
+  }
+
+  if (change_directory(target) != 0) {
+    perror("shell");
+  } else if (args[1] && strcmp(args[1], "-") == 0) {
+    printf("%s\n", getenv("PWD"));
+  }
+  return 1;
+}
+
+/**
+ * @brief Prints the directory stack, current directory first.
+ *
+ * @param args Null-terminated array of arguments (unused).
+ * @return int Always returns 1 to continue execution.
+ */
+int shell_dirs(char **args) {
+  (void)args; // unused
+  char cwd[4096];
+  if (getcwd(cwd, sizeof(cwd)) == NULL)
+    strcpy(cwd, "unknown");
+
+  printf("%s", cwd);
+  for (int i = dir_stack_len - 1; i >= 0; i--)
+    printf(" %s", dir_stack[i]);
+  printf("\n");
+  return 1;
+}
+
+/**
+ * @brief Pushes the current directory on the stack and changes directory.
+ *
+ * With no argument, swaps the current directory with the top of the stack.
+ *
+ * @param args Null-terminated array of arguments (args[1] is the path).
+ * @return int Always returns 1 to continue execution.
+ */
+int shell_pushd(char **args) {
+  char cwd[4096];
+  const char *target = args[1];
+
+  if (getcwd(cwd, sizeof(cwd)) == NULL) {
+    perror("shell");
+    return 1;
+  }
+  if (target == NULL) {
+    if (dir_stack_len == 0) {
+      fprintf(stderr, "shell: pushd: no other directory\n");
+      return 1;
+    }
+    target = dir_stack[--dir_stack_len];
+  } else if (dir_stack_len == DIR_STACK_SIZE) {
+    fprintf(stderr, "shell: pushd: directory stack full\n");
+    return 1;
+  }
+
+  char *saved = args[1] ? NULL : (char *)target;
+  if (change_directory(target) != 0) {
+    perror("shell");
+    if (saved)
+      dir_stack_len++; // put the swapped entry back
+    return 1;
+  }
+  free(saved);
+  dir_stack[dir_stack_len++] = strdup(cwd);
+  return shell_dirs(args);
+}
+
+/**
+ * @brief Pops the top of the directory stack and changes to it.
+ *
+ * @param args Null-terminated array of arguments (unused).
+ * @return int Always returns 1 to continue execution.
+ */
+int shell_popd(char **args) {
+  if (dir_stack_len == 0) {
+    fprintf(stderr, "shell: popd: directory stack empty\n");
+    return 1;
+  }
+  char *target = dir_stack[dir_stack_len - 1];
+  if (change_directory(target) != 0) {
+    perror("shell");
+    return 1;
+  }
+  dir_stack_len--;
+  free(target);
+  return shell_dirs(args);
+}
+
+/**
+ * @brief Jumps to the most frecent remembered directory matching the terms.
+ *
+ * Usage: `z [-l] term...`. Terms must appear in the path in order; the
+ * best match by frecency wins. `-l` lists the matches with their scores
+ * instead of jumping. Resolution uses only the in-memory database.
+ *
+ * @param args Null-terminated array of arguments.
+ * @return int Always returns 1 to continue execution.
+ */
+int shell_z(char **args) {
+  int list = args[1] && strcmp(args[1], "-l") == 0;
+  char **terms = &args[list ? 2 : 1];
+
+  if (list) {
+    long now = (long)time(NULL);
+    for (int i = 0; i < dir_db_len; i++) {
+      if (dir_matches(dir_db[i].path, terms, 1))
+        printf("%10.1f  %s\n", dir_score(&dir_db[i], now), dir_db[i].path);
+    }
+    return 1;
+  }
+  if (terms[0] == NULL) {
+    fprintf(stderr, "shell: expected argument to \"z\"\n");
+    return 1;
+  }
+
+  const char *dir = dirs_best(terms);
+  if (!dir) {
+    fprintf(stderr, "shell: z: no match\n");
+    return 1;
+  }
+  // Copy first: recording the visit may reorganize the database
+  char *target = strdup(dir);
+  if (change_directory(target) != 0)
+    perror("shell");
+  free(target);
+  return 1;
+}
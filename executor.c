@@ -12,22 +12,94 @@
  * @date 2025-12-14
  */
 
+#define _GNU_SOURCE /* tee(), splice(), pipe2(), F_GETPIPE_SZ */
 #include "shell.h"
+#include <limits.h>
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
 
 /* External references to built-in command tables defined in builtins.c */
 extern char *builtin_str[];
 extern int (*builtin_func[])(char **);
 
+/**
+ * @brief Looks up a built-in command by name.
+ *
+ * @param name The command name (args[0]).
+ * @return int Index into `builtin_func`, or -1 if `name` is not a built-in.
+ */
+static int find_builtin(const char *name) {
+  int n = shell_num_builtins();
+  for (int i = 0; i < n; i++) {
+    if (name[0] == builtin_str[i][0] && strcmp(name, builtin_str[i]) == 0)
+      return i;
+  }
+  return -1;
+}
+
+/**
+ * @brief Checks whether `name` is a built-in command.
+ * @return int 1 if it is, 0 otherwise.
+ */
+int is_builtin(const char *name) { return find_builtin(name) >= 0; }
+
+#ifndef _WIN32
+/**
+ * @brief Converts a `waitpid()` status into a shell exit status.
+ *
+ * @param status The raw wait status.
+ * @return int The exit code, or 128 + signal number if the child was killed.
+ */
+static int wait_status(int status) {
+  if (WIFEXITED(status))
+    return WEXITSTATUS(status);
+  if (WIFSIGNALED(status))
+    return 128 + WTERMSIG(status);
+  return 1;
+}
+#endif
+
+/** @brief Set while the last command of a script runs (see
+ *  `execute_tail()`): an external command may then replace the shell. */
+static int tail_call = 0;
+
+/**
+ * @brief Replaces the shell with a program (`exec`, tail calls).
+ *
+ * Input buffered by `read` is handed back and stdio is flushed first, so
+ * the program sees exactly what the shell left. The shell ends here, so
+ * its metrics are exported first too. Only returns on failure.
+ *
+ * @param args Null-terminated array of arguments (args[0] is the command).
+ * @return int The status to report: 126 (not executable) or 127.
+ */
+static int exec_replace(char **args) {
+  read_sync();
+  stats_export(1);
+  jobs_flush();
+  execvp(args[0], args);
+  SHELL_PROBE2(exec__fail, args[0], errno);
+  int status = errno == EACCES || errno == ENOEXEC ? 126 : 127;
+  perror("shell");
+  return status;
+}
+
 /**
  * @brief Launches an external process using system calls.
  *
  * On Linux/macOS:
  * Uses `fork()` to create a child process and `execvp()` to replace the
  * child's image with the new program. Parent waits for child to finish.
+ * If the command is the last one of a script (a tail call), there is
+ * nothing left for the shell to do afterwards, so it `exec`s the program
+ * itself: no fork, and the script's exit status is the program's.
  *
  * On Windows:
  * Uses `_spawnvp()` to synchronously execute the new process.
  *
+ * The exit status is stored in `last_status` (`$?`).
+ *
  * @param args Null-terminated array of arguments (args[0] is the command).
  * @return int Always returns 1 to indicate the shell should continue running.
  */
@@ -37,28 +109,66 @@ int launch_process(char **args) {
   int status = _spawnvp(_P_WAIT, args[0], (const char *const *)args);
   if (status == -1) {
     perror("shell");
+    status = 127;
   }
+  last_status = status;
   return 1;
 #else
   // POSIX implementation using fork/exec
   pid_t pid, wpid;
   int status;
 
-  pid = fork();
+  stats_add(STAT_SPAWNS, 1);
+  if (tail_call)
+    jobs_exit(exec_replace(args));
+
+  // A pipe that a successful exec closes (close-on-exec) and a failed
+  // one writes to: the time until it closes is the launch latency
+  int exec_pipe[2];
+  int timed = pipe(exec_pipe) == 0;
+  if (timed) {
+    fcntl(exec_pipe[0], F_SETFD, FD_CLOEXEC);
+    fcntl(exec_pipe[1], F_SETFD, FD_CLOEXEC);
+  }
+
+  uint64_t launch = stats_now();
+  pid = jobs_fork(args[0]);
   if (pid == 0) {
     // Child process
+    if (timed)
+      close(exec_pipe[0]);
     if (execvp(args[0], args) == -1) {
+      SHELL_PROBE2(exec__fail, args[0], errno);
+      if (timed && write(exec_pipe[1], "", 1) < 0) {
+        // the parent then sees the exit instead
+      }
       perror("shell");
     }
-    exit(EXIT_FAILURE);
-  } else if (pid < 0) {
+    jobs_exit(127);
+  }
+  if (timed) {
+    char c;
+    ssize_t n = -1;
+    close(exec_pipe[1]);
+    while (pid > 0 && (n = read(exec_pipe[0], &c, 1)) < 0 && errno == EINTR)
+      ;
+    if (n == 0)
+      stats_latency(STAT_LAUNCH, stats_now() - launch);
+    close(exec_pipe[0]);
+  }
+  if (pid < 0) {
     // Error forking
     perror("shell");
+    last_status = 1;
   } else {
     // Parent process waits for child
+    uint64_t start = stats_now();
     do {
       wpid = waitpid(pid, &status, WUNTRACED);
     } while (!WIFEXITED(status) && !WIFSIGNALED(status));
+    stats_time(STAT_WAIT, stats_now() - start);
+    last_status = wait_status(status);
+    SHELL_PROBE2(reap, pid, last_status);
   }
 
   return 1;
@@ -66,106 +176,699 @@ int launch_process(char **args) {
 }
 
 /**
- * @brief Handles input (`<`) and output (`>`) redirection tokens.
+ * @def MAX_OUTPUTS
+ * @brief Maximum number of output redirections on one command.
+ */
+#define MAX_OUTPUTS 16
+
+/**
+ * @brief Files opened for the redirections of one command.
+ */
+struct redirection {
+  int in_fd;                /**< Input file descriptor, or -1. */
+  int out_fds[MAX_OUTPUTS]; /**< Output targets, in command-line order. */
+  int num_out;              /**< Number of entries in `out_fds`. */
+};
+
+/**
+ * @brief Closes every descriptor held by a redirection.
+ * @param r The redirection.
+ */
+static void close_redirection(struct redirection *r) {
+  if (r->in_fd >= 0)
+    close(r->in_fd);
+  for (int i = 0; i < r->num_out; i++)
+    close(r->out_fds[i]);
+  r->in_fd = -1;
+  r->num_out = 0;
+}
+
+/**
+ * @brief Handles input (`<`) and output (`>`, `>>`) redirection tokens.
+ *
+ * Scans the argument list for redirection symbols and opens the specified
+ * files relative to the cached working directory. The redirection symbols
+ * and filenames are removed from `args` (the remaining arguments are moved
+ * up) so they are not passed to the command.
  *
- * Scans the argument list for redirection symbols. If found, opens the
- * specified files and updates the `in_fd` and `out_fd` parameters.
- * The redirection symbols and filenames are removed (set to NULL) in args
- * to prevent them from being passed to the command.
+ * Several output redirections may be given (`cmd > a > b`, as in zsh's
+ * MULTIOS); every target then receives a full copy of the output.
  *
  * @param args The null-terminated array of arguments.
- * @param in_fd Pointer on an integer to store the input file descriptor.
- * @param out_fd Pointer on an integer to store the output file descriptor.
+ * @param r Receives the opened descriptors.
+ * @return int 0 on success, -1 if a redirection failed (nothing is left
+ *         open in that case).
  */
-void handle_redirection(char **args, int *in_fd, int *out_fd) {
+static int handle_redirection(char **args, struct redirection *r) {
+  int k = 0;
+
+  r->in_fd = -1;
+  r->num_out = 0;
   for (int i = 0; args[i] != NULL; i++) {
-    if (strcmp(args[i], ">") == 0) {
-      args[i] = NULL; // Truncate args here
-      // Open file for writing, create if not exists, truncate if exists
-      *out_fd = open(args[i + 1], O_WRONLY | O_CREAT | O_TRUNC, 0644);
-      if (*out_fd < 0)
-        perror("shell");
-    } else if (strcmp(args[i], "<") == 0) {
-      args[i] = NULL;
+    int is_out = is_operator(args[i], ">");
+    int is_append = is_operator(args[i], ">>");
+    int is_in = is_operator(args[i], "<");
+
+    if (!is_out && !is_append && !is_in) {
+      args[k++] = args[i];
+      continue;
+    }
+    if (args[i + 1] == NULL) {
+      fprintf(stderr, "shell: syntax error: expected file after '%s'\n",
+              args[i]);
+      close_redirection(r);
+      return -1;
+    }
+
+    int fd;
+    if (is_in) {
       // Open file for reading
-      *in_fd = open(args[i + 1], O_RDONLY);
-      if (*in_fd < 0)
-        perror("shell");
+      fd = fs_open(args[i + 1], O_RDONLY, 0);
+    } else {
+      // Open file for writing, create if not exists, truncate or append
+      fd = fs_open(args[i + 1],
+                   O_WRONLY | O_CREAT | (is_append ? O_APPEND : O_TRUNC),
+                   0644);
+    }
+    if (fd < 0) {
+      perror("shell");
+      close_redirection(r);
+      return -1;
+    }
+
+    if (is_in) {
+      if (r->in_fd >= 0)
+        close(r->in_fd);
+      r->in_fd = fd;
+    } else if (r->num_out == MAX_OUTPUTS) {
+      fprintf(stderr, "shell: too many output redirections\n");
+      close(fd);
+      close_redirection(r);
+      return -1;
+    } else {
+      r->out_fds[r->num_out++] = fd;
     }
+    i++; // skip the filename
   }
+  args[k] = NULL;
+  return 0;
 }
 
-// Pipeline execution logic (POSIX only)
+// Output fan-out and pipeline execution logic (POSIX only)
 #ifndef _WIN32
+#include <pthread.h>
+
+/**
+ * @brief State of a running output fan-out (one source, many targets).
+ */
+struct fanout {
+  int src;          /**< Read end of the pipe the command writes into. */
+  int *fds;         /**< Destination descriptors. */
+  int n;            /**< Number of destinations. */
+  pthread_t thread; /**< Pump thread. */
+};
+
+/**
+ * @brief Writes a whole buffer, retrying short writes.
+ * @return int 0 on success, -1 on error.
+ */
+static int write_all(int fd, const char *buf, size_t len) {
+  while (len > 0) {
+    ssize_t n = write(fd, buf, len);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    buf += n;
+    len -= n;
+  }
+  return 0;
+}
+
+/**
+ * @brief Fan-out pump using plain read()/write() through a user buffer.
+ *
+ * Used where splice() is unavailable or refused (e.g. O_APPEND targets).
+ */
+static void fanout_copy(struct fanout *f) {
+  char buffer[65536];
+  ssize_t n;
+  while ((n = read(f->src, buffer, sizeof(buffer))) != 0) {
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    for (int i = 0; i < f->n; i++)
+      write_all(f->fds[i], buffer, n);
+  }
+}
+
+#ifdef __linux__
+/**
+ * @brief Moves exactly `len` bytes from pipe `from` to `to` with splice().
+ *
+ * Falls back to read()/write() if the kernel refuses to splice into `to`.
+ *
+ * @return int 0 on success, -1 on error.
+ */
+static int splice_all(int from, int to, size_t len) {
+  char buffer[65536];
+  while (len > 0) {
+    ssize_t n = splice(from, NULL, to, NULL, len, SPLICE_F_MOVE);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0 && errno == EINVAL) {
+      // Destination does not support splice: copy through user space
+      n = read(from, buffer, len < sizeof(buffer) ? len : sizeof(buffer));
+      if (n <= 0 || write_all(to, buffer, n) != 0)
+        return -1;
+    } else if (n <= 0) {
+      return -1;
+    }
+    len -= n;
+  }
+  return 0;
+}
+
+/**
+ * @brief Zero-copy fan-out pump built on tee(2) and splice(2).
+ *
+ * Each round, tee() duplicates the data waiting in the source pipe into one
+ * private pipe per destination except the last (tee only adds references to
+ * the same pipe buffers; nothing is copied into user space). splice() then
+ * drains each private pipe into its destination, and finally moves the
+ * source data itself into the last destination, consuming it.
+ *
+ * @return int 0 if the stream was fully pumped, -1 if the caller should
+ *         finish with `fanout_copy()` (setup failed before any data moved).
+ */
+static int fanout_splice(struct fanout *f) {
+  int side[2 * MAX_OUTPUTS];
+  int made = 0;
+  int rc = 0;
+  size_t cap = (size_t)fcntl(f->src, F_GETPIPE_SZ);
+
+  for (; made < f->n - 1; made++) {
+    if (pipe2(&side[2 * made], O_CLOEXEC) != 0)
+      break;
+    // Side pipes as large as the source, so tee() never comes up short
+    fcntl(side[2 * made + 1], F_SETPIPE_SZ, (int)cap);
+  }
+  if (made < f->n - 1) {
+    rc = -1;
+    goto out;
+  }
+
+  for (;;) {
+    ssize_t avail = 0;
+    size_t got[MAX_OUTPUTS];
+
+    // Wait for data: the first tee blocks until the source has some
+    for (int i = 0; i < f->n - 1; i++) {
+      ssize_t n;
+      do {
+        n = tee(f->src, side[2 * i + 1], i == 0 ? cap : (size_t)avail, 0);
+      } while (n < 0 && errno == EINTR);
+      if (n < 0) {
+        n = 0;
+      }
+      if (i == 0) {
+        if (n == 0)
+          goto out; // EOF: every writer is gone
+        avail = n;
+      }
+      got[i] = n;
+    }
+
+    int short_tee = 0;
+    for (int i = 1; i < f->n - 1; i++)
+      short_tee |= got[i] < (size_t)avail;
+
+    if (f->n == 1) {
+      // Single destination: just splice whatever arrives
+      ssize_t n;
+      do {
+        n = splice(f->src, NULL, f->fds[0], NULL, cap, SPLICE_F_MOVE);
+      } while (n < 0 && errno == EINTR);
+      if (n == 0)
+        goto out;
+      if (n < 0) {
+        fanout_copy(f);
+        goto out;
+      }
+      continue;
+    }
+
+    for (int i = 0; i < f->n - 1; i++)
+      splice_all(side[2 * i], f->fds[i], got[i]);
+
+    if (!short_tee) {
+      splice_all(f->src, f->fds[f->n - 1], avail);
+    } else {
+      // Rare: a tee came up short. Consume this round through a buffer
+      // and complete the destinations that missed bytes.
+      char *buffer = malloc(avail);
+      ssize_t n = buffer ? read(f->src, buffer, avail) : -1;
+      if (n == avail) {
+        write_all(f->fds[f->n - 1], buffer, avail);
+        for (int i = 1; i < f->n - 1; i++)
+          write_all(f->fds[i], buffer + got[i], avail - got[i]);
+      }
+      free(buffer);
+    }
+  }
+
+out:
+  for (int i = 0; i < 2 * made; i++)
+    close(side[i]);
+  return rc;
+}
+#endif
+
+/**
+ * @brief Pump thread body: copies the source pipe to every destination.
+ * @param arg The `fanout`.
+ * @return void* Always NULL.
+ */
+static void *fanout_pump(void *arg) {
+  struct fanout *f = arg;
+#ifdef __linux__
+  if (fanout_splice(f) == 0)
+    return NULL;
+#endif
+  fanout_copy(f);
+  return NULL;
+}
+
+/**
+ * @brief Starts fanning out a new pipe to several destinations.
+ *
+ * The shell itself relays the data (on a helper thread), so no `tee`
+ * process is needed. The caller hands the returned write end to the
+ * command as its stdout, closes its own copy, and calls `fanout_finish()`
+ * once the command has exited.
+ *
+ * @param f Fan-out state to initialize.
+ * @param fds Destination descriptors (owned by the caller).
+ * @param n Number of destinations.
+ * @return int Write end of the pipe, or -1 on failure.
+ */
+static int fanout_start(struct fanout *f, int *fds, int n) {
+  int p[2];
+  if (pipe(p) != 0) {
+    perror("shell");
+    return -1;
+  }
+  fcntl(p[0], F_SETFD, FD_CLOEXEC);
+  fcntl(p[1], F_SETFD, FD_CLOEXEC);
+
+  f->src = p[0];
+  f->fds = fds;
+  f->n = n;
+  if (pthread_create(&f->thread, NULL, fanout_pump, f) != 0) {
+    perror("shell");
+    close(p[0]);
+    close(p[1]);
+    return -1;
+  }
+  return p[1];
+}
+
+/**
+ * @brief Waits for a fan-out to drain (all writers closed) and cleans up.
+ * @param f The fan-out started by `fanout_start()`.
+ */
+static void fanout_finish(struct fanout *f) {
+  pthread_join(f->thread, NULL);
+  close(f->src);
+}
+
 /**
  * @brief Executes a pipeline of commands connected by pipe `|`.
  *
  * This function creates necessary pipes and forks processes for each command
  * in the pipeline. It sets up `dup2` to redirect stdout of a command to stdin
- * of the next command.
+ * of the next command. Built-in commands run inside their forked child, so
+ * they can be used as pipeline stages (e.g. `cat log.txt | count -l`).
+ *
+ * Each stage may carry its own redirections; they are opened here in the
+ * parent, so a stage with several output targets can be fanned out by the
+ * shell. A stage followed by `|&` also sends its stderr into the pipe.
  *
  * @param cmd_args Array of string arrays (command arguments).
  * @param num_cmds Total number of commands in the pipeline.
- * @return int Always returns 1.
+ * @param err_to_pipe Per stage: non-zero if stderr joins the pipe (`|&`).
+ * @return int Always returns 1. The status of the last stage is stored in
+ *         `last_status`.
  */
-int execute_pipeline(char ***cmd_args, int num_cmds) {
+int execute_pipeline(char ***cmd_args, int num_cmds, int *err_to_pipe) {
   int i;
   int pipefd[2 * (num_cmds - 1)];
   int status;
+  struct redirection redir[num_cmds];
+  struct fanout fan[num_cmds];
+  int stage_out[num_cmds];
+
+  // Open every stage's redirections up front
+  for (i = 0; i < num_cmds; i++) {
+    stage_out[i] = -1;
+    if (handle_redirection(cmd_args[i], &redir[i]) != 0) {
+      while (--i >= 0)
+        close_redirection(&redir[i]);
+      last_status = 1;
+      return 1;
+    }
+  }
 
   // Create all necessary pipes
   for (i = 0; i < num_cmds - 1; i++) {
     if (pipe(pipefd + i * 2) < 0) {
       perror("pipe");
+      // Release the pipes and redirections opened so far
+      while (--i >= 0) {
+        close(pipefd[i * 2]);
+        close(pipefd[i * 2 + 1]);
+      }
+      for (i = 0; i < num_cmds; i++)
+        close_redirection(&redir[i]);
+      last_status = 1;
       return 1;
     }
   }
 
+  // Stages with several output targets write into a fan-out pipe
+  for (i = 0; i < num_cmds; i++) {
+    if (redir[i].num_out > 1) {
+      stage_out[i] = fanout_start(&fan[i], redir[i].out_fds, redir[i].num_out);
+    } else if (redir[i].num_out == 1) {
+      stage_out[i] = redir[i].out_fds[0];
+    }
+  }
+
+  // Flush pending output so children do not inherit (and repeat) it
+  jobs_flush();
+
+  // Count the stages here: the children's counters die with them
+  stats_add(STAT_STAGES, num_cmds);
+  for (i = 0; i < num_cmds; i++) {
+    if (cmd_args[i][0] && is_function(cmd_args[i][0]))
+      stats_add(STAT_FUNCTIONS, 1);
+    else if (cmd_args[i][0] && find_builtin(cmd_args[i][0]) >= 0)
+      stats_add(STAT_BUILTINS, 1);
+    else {
+      stats_add(STAT_EXTERNALS, 1);
+      stats_add(STAT_SPAWNS, 1);
+    }
+  }
+
+  pid_t pids[num_cmds];
   int pid;
   for (i = 0; i < num_cmds; i++) {
-    pid = fork();
+    pid = pids[i] = jobs_fork(cmd_args[i][0]);
     if (pid == 0) {
       // Child Process Logic
 
-      // Connect input from previous pipe (if not first command)
-      if (i != 0) {
+      // Connect input from a file or the previous pipe (if not first)
+      if (redir[i].in_fd >= 0) {
+        dup2(redir[i].in_fd, 0);
+      } else if (i != 0) {
         if (dup2(pipefd[(i - 1) * 2], 0) < 0)
           perror("dup2");
       }
-      // Connect output to next pipe (if not last command)
-      if (i != num_cmds - 1) {
+      // Connect output to a file or the next pipe (if not last command)
+      if (stage_out[i] >= 0) {
+        dup2(stage_out[i], 1);
+      } else if (i != num_cmds - 1) {
         if (dup2(pipefd[i * 2 + 1], 1) < 0)
           perror("dup2");
       }
+      // `|&`: stderr goes wherever stdout goes
+      if (err_to_pipe[i]) {
+        dup2(1, 2);
+      }
 
       // Close all pipe file descriptors in child
       for (int j = 0; j < 2 * (num_cmds - 1); j++) {
         close(pipefd[j]);
       }
 
-      if (execvp(cmd_args[i][0], cmd_args[i]) < 0) {
+      // Functions and built-ins run in the child and exit with it
+      if (cmd_args[i][0] && is_function(cmd_args[i][0])) {
+        call_function(cmd_args[i]);
+        jobs_exit(last_status);
+      }
+      int b = cmd_args[i][0] ? find_builtin(cmd_args[i][0]) : -1;
+      if (b >= 0) {
+        SHELL_PROBE1(builtin, cmd_args[i][0]);
+        previous_status = last_status;
+        last_status = 0;
+        (*builtin_func[b])(cmd_args[i]);
+        jobs_exit(last_status);
+      }
+
+      if (cmd_args[i][0] == NULL || execvp(cmd_args[i][0], cmd_args[i]) < 0) {
+        SHELL_PROBE2(exec__fail, cmd_args[i][0], errno);
         perror("execvp");
-        exit(EXIT_FAILURE);
+        jobs_exit(127);
       }
     } else if (pid < 0) {
       perror("fork");
-      return 1;
+      break;
     }
   }
+  int started = i;
 
-  // Parent closes all pipe fds
+  // Parent closes all pipe fds and its copies of the redirections
   for (i = 0; i < 2 * (num_cmds - 1); i++) {
     close(pipefd[i]);
   }
+  for (i = 0; i < num_cmds; i++) {
+    if (redir[i].num_out > 1 && stage_out[i] >= 0)
+      close(stage_out[i]);
+  }
 
-  // Wait for all children to complete
+  // Wait for all stages to complete (not other background children)
+  last_status = started < num_cmds ? 1 : 0;
+  uint64_t start = stats_now();
+  for (i = 0; i < started; i++) {
+    waitpid(pids[i], &status, 0);
+    SHELL_PROBE2(reap, pids[i], wait_status(status));
+    if (i == num_cmds - 1)
+      last_status = wait_status(status);
+  }
+  stats_time(STAT_WAIT, stats_now() - start);
+
+  // Let fan-outs drain, then release the files
   for (i = 0; i < num_cmds; i++) {
-    wait(&status);
+    if (redir[i].num_out > 1 && stage_out[i] >= 0)
+      fanout_finish(&fan[i]);
+    close_redirection(&redir[i]);
   }
   return 1;
 }
 #endif
 
+/**
+ * @def MAX_REDIR_DEPTH
+ * @brief Maximum nesting of active redirections (commands inside
+ *        redirected loops, groups and functions).
+ */
+#define MAX_REDIR_DEPTH 64
+
+/**
+ * @brief An applied redirection and what it replaced.
+ */
+struct redir_frame {
+  struct redirection redir; /**< The opened files. */
+  int saved_stdin;          /**< Previous stdin, or -1 if not redirected. */
+  int saved_stdout;         /**< Previous stdout, or -1 if not redirected. */
+  int fanning;              /**< Non-zero if `fan` relays the output. */
+#ifndef _WIN32
+  struct fanout *fan; /**< Relay for several output targets (heap). */
+#endif
+};
+
+/** @brief Stack of applied redirections. */
+static struct redir_frame redir_stack[MAX_REDIR_DEPTH];
+
+/** @brief Number of entries in `redir_stack`. */
+static int redir_depth = 0;
+
+#ifndef _WIN32
+/** @brief Fan-outs made permanent by `exec` (see redirect_keep()). */
+static struct fanout *kept_fans[MAX_REDIR_DEPTH];
+
+/** @brief Number of entries in `kept_fans`. */
+static int num_kept_fans = 0;
+
+/** @brief Process that started the kept fan-outs (children have none). */
+static pid_t kept_fans_owner = 0;
+
+/**
+ * @brief Lets kept fan-outs copy out what the shell wrote before it exits.
+ *
+ * Registered with `atexit()`: closing standard output drops the last
+ * write end of the current relay, so each pump reaches end of file.
+ */
+static void drain_kept_fans() {
+  if (getpid() != kept_fans_owner)
+    return;
+  fflush(stdout);
+  close(STDOUT_FILENO);
+  for (int i = 0; i < num_kept_fans; i++) {
+    fanout_finish(kept_fans[i]);
+    for (int j = 0; j < kept_fans[i]->n; j++)
+      close(kept_fans[i]->fds[j]);
+    free(kept_fans[i]);
+  }
+  num_kept_fans = 0;
+}
+#endif
+
+/**
+ * @brief Duplicates a descriptor to a close-on-exec copy.
+ */
+static int save_fd(int fd) {
+#ifdef F_DUPFD_CLOEXEC
+  // Close-on-exec, so the saved copies do not leak into the command
+  return fcntl(fd, F_DUPFD_CLOEXEC, 0);
+#else
+  return dup(fd);
+#endif
+}
+
+/**
+ * @brief Opens the redirections in `args` and applies them to the shell.
+ *
+ * The redirection tokens are removed from `args`. Only the descriptors
+ * that are actually redirected are saved, so commands without any
+ * redirection cost no extra system calls. Every successful call must be
+ * paired with `redirect_pop()`.
+ *
+ * @param args The null-terminated array of arguments.
+ * @return int 0 on success, -1 if a redirection failed.
+ */
+int redirect_push(char **args) {
+  if (redir_depth == MAX_REDIR_DEPTH) {
+    fprintf(stderr, "shell: redirections nested too deeply\n");
+    return -1;
+  }
+  struct redir_frame *f = &redir_stack[redir_depth];
+  if (handle_redirection(args, &f->redir) != 0)
+    return -1;
+  f->saved_stdin = -1;
+  f->saved_stdout = -1;
+  f->fanning = 0;
+
+  if (f->redir.in_fd != -1) {
+    f->saved_stdin = save_fd(STDIN_FILENO);
+    read_forget(STDIN_FILENO);
+    dup2(f->redir.in_fd, STDIN_FILENO);
+  }
+  if (f->redir.num_out > 0) {
+    // Flush what is already buffered, so it does not end up in the target
+    fflush(stdout);
+    f->saved_stdout = save_fd(STDOUT_FILENO);
+#ifndef _WIN32
+    if (f->redir.num_out > 1) {
+      // Several targets: the shell relays one pipe to all of them. The
+      // relay and its targets live on the heap, not in this frame, so
+      // `exec` can keep them after the frame is reused
+      int n = f->redir.num_out;
+      f->fan = malloc(sizeof(struct fanout) + n * sizeof(int));
+      int w = -1;
+      if (f->fan) {
+        int *fds = (int *)(f->fan + 1);
+        memcpy(fds, f->redir.out_fds, n * sizeof(int));
+        w = fanout_start(f->fan, fds, n);
+      }
+      if (w >= 0) {
+        dup2(w, STDOUT_FILENO);
+        close(w);
+        f->fanning = 1;
+        tail_call = 0; // the relay thread must outlive the command
+      } else {
+        free(f->fan);
+        f->fan = NULL;
+      }
+    }
+#else
+    if (f->redir.num_out > 1) {
+      fprintf(stderr, "shell: only the last output redirection is used\n");
+    }
+#endif
+    if (!f->fanning)
+      dup2(f->redir.out_fds[f->redir.num_out - 1], STDOUT_FILENO);
+  }
+  redir_depth++;
+  return 0;
+}
+
+/**
+ * @brief Makes the most recent `redirect_push()` permanent (`exec > log`).
+ *
+ * The saved descriptors are dropped, so the matching `redirect_pop()` no
+ * longer restores anything. A fan-out relay keeps running.
+ */
+void redirect_keep() {
+  if (redir_depth == 0)
+    return;
+  struct redir_frame *f = &redir_stack[redir_depth - 1];
+
+  if (f->saved_stdin >= 0)
+    close(f->saved_stdin);
+  if (f->saved_stdout >= 0)
+    close(f->saved_stdout);
+  f->saved_stdin = f->saved_stdout = -1;
+#ifndef _WIN32
+  if (f->fanning && num_kept_fans < MAX_REDIR_DEPTH) {
+    // The fan-out and its targets now live until the shell exits
+    if (kept_fans_owner != getpid()) {
+      kept_fans_owner = getpid();
+      num_kept_fans = 0;
+      atexit(drain_kept_fans);
+    }
+    kept_fans[num_kept_fans++] = f->fan;
+    f->fan = NULL;
+    f->fanning = 0;
+    f->redir.num_out = 0;
+  }
+#endif
+}
+
+/**
+ * @brief Undoes the most recent `redirect_push()`.
+ */
+void redirect_pop() {
+  if (redir_depth == 0)
+    return;
+  struct redir_frame *f = &redir_stack[--redir_depth];
+
+  // Restore original stdin/stdout (flushing what built-ins wrote first)
+  if (f->saved_stdin >= 0) {
+    read_forget(STDIN_FILENO);
+    dup2(f->saved_stdin, STDIN_FILENO);
+    close(f->saved_stdin);
+  }
+  if (f->saved_stdout >= 0) {
+    fflush(stdout);
+    dup2(f->saved_stdout, STDOUT_FILENO);
+    close(f->saved_stdout);
+  }
+#ifndef _WIN32
+  // The last write end is gone now; wait for the relay to drain
+  if (f->fanning) {
+    fanout_finish(f->fan);
+    free(f->fan);
+    f->fan = NULL;
+    f->fanning = 0;
+  }
+#endif
+  close_redirection(&f->redir);
+}
+
 /**
  * @brief Main execution dispatch logic.
  *
@@ -175,74 +878,416 @@ int execute_pipeline(char ***cmd_args, int num_cmds) {
  * @param args Null-terminated array of arguments (tokens).
  * @return int 1 to continue execution, 0 to exit (if command is 'exit').
  */
-int execute_command(char **args) {
+static int run_command(char **args) {
   int i;
-  int in_fd = -1, out_fd = -1;
-
-  // Save original stdin/stdout to restore later
-  int saved_stdin = dup(STDIN_FILENO);
-  int saved_stdout = dup(STDOUT_FILENO);
-
-  if (args[0] == NULL) {
-    // Empty command
-    return 1;
-  }
 
-  // 1. Check for Pipes ("|")
+  // 1. Check for Pipes ("|" or "|&")
   int num_pipes = 0;
   for (i = 0; args[i] != NULL; i++) {
-    if (strcmp(args[i], "|") == 0)
+    if (is_operator(args[i], "|") || is_operator(args[i], "|&"))
       num_pipes++;
   }
 
+  // Give back input buffered by `read` before anything else reads it
+  if (num_pipes > 0 || strcmp(args[0], "read") != 0)
+    read_sync();
+
   if (num_pipes > 0) {
+    tail_call = 0;
 #ifdef _WIN32
     fprintf(stderr, "Piping not supported on Windows mode.\n");
     return 1;
 #else
     // Split args into multiple commands for pipeline
     char ***cmd_args = malloc((num_pipes + 1) * sizeof(char **));
+    int *err_to_pipe = calloc(num_pipes + 1, sizeof(int));
     int cmd_idx = 0;
     cmd_args[cmd_idx++] = args;
     for (i = 0; args[i] != NULL; i++) {
-      if (strcmp(args[i], "|") == 0) {
+      if (is_operator(args[i], "|") || is_operator(args[i], "|&")) {
+        err_to_pipe[cmd_idx - 1] = args[i][1] == '&';
         args[i] = NULL;                     // Terminate current command args
         cmd_args[cmd_idx++] = &args[i + 1]; // Start next command
       }
     }
-    int status = execute_pipeline(cmd_args, num_pipes + 1);
+    int status = execute_pipeline(cmd_args, num_pipes + 1, err_to_pipe);
     free(cmd_args);
+    free(err_to_pipe);
     return status;
 #endif
   }
 
-  // 2. Check for Built-in Commands
-  for (i = 0; i < shell_num_builtins(); i++) {
-    if (strcmp(args[0], builtin_str[i]) == 0) {
-      return (*builtin_func[i])(args);
+  // 2. Handle Redirection (if any); applies to built-ins as well
+  if (redirect_push(args) != 0) {
+    last_status = 1;
+    return 1;
+  }
+  if (args[0] == NULL) {
+    // Only redirections: files were created/truncated, nothing to run
+    redirect_pop();
+    last_status = 0;
+    return 1;
+  }
+
+  // 3. Run a Function or Built-in Command, or launch an External Process
+  int status;
+  i = find_builtin(args[0]);
+  if (is_function(args[0])) {
+    tail_call = 0; // the body may run several commands
+    stats_add(STAT_FUNCTIONS, 1);
+    status = call_function(args);
+    fflush(stdout);
+  } else if (i >= 0) {
+    tail_call = 0;
+    stats_add(STAT_BUILTINS, 1);
+    SHELL_PROBE1(builtin, args[0]);
+    // Built-ins report failure by setting last_status themselves
+    previous_status = last_status;
+    last_status = 0;
+    status = (*builtin_func[i])(args);
+    // Keep built-in output ordered with the output of later commands
+    fflush(stdout);
+  } else {
+    stats_add(STAT_EXTERNALS, 1);
+    status = launch_process(args);
+  }
+
+  redirect_pop();
+  return status;
+}
+
+/**
+ * @brief Runs a command and records its duration under its name (for
+ *        `stats -l`). A pipeline counts under its first command.
+ */
+static int run_timed(char **args) {
+  const char *name = args[0]; // redirections may be removed from args
+  uint64_t start = stats_now();
+  int status = run_command(args);
+  stats_command(name, stats_now() - start);
+  return status;
+}
+
+/**
+ * @brief Executes a command, handling leading `NAME=value` assignments.
+ *
+ * A command made only of assignments sets shell variables. Assignments in
+ * front of a command (`LANG=C sort file`) are placed in the environment
+ * for that command only and undone afterwards.
+ *
+ * @param args Null-terminated array of arguments (tokens).
+ * @return int 1 to continue execution, 0 to exit (if command is 'exit').
+ */
+int execute_command(char **args) {
+  int n = 0;
+
+  if (args[0] == NULL) {
+    // Empty command
+    return 1;
+  }
+
+  while (args[n] != NULL && is_assignment(args[n]))
+    n++;
+  if (args[n] == NULL) {
+    for (int k = 0; k < n; k++)
+      var_assign(args[k]);
+    last_status = 0;
+    return 1;
+  }
+  if (n == 0)
+    return run_timed(args);
+
+  // Temporary environment for this command; remember what to restore
+  char *saved[n];
+  for (int k = 0; k < n; k++) {
+    int len = is_assignment(args[k]);
+    args[k][len] = '\0';
+    const char *old = getenv(args[k]);
+    saved[k] = old ? strdup(old) : NULL;
+    setenv(args[k], args[k] + len + 1, 1);
+  }
+
+  int status = run_timed(args + n);
+
+  for (int k = n - 1; k >= 0; k--) {
+    if (saved[k]) {
+      setenv(args[k], saved[k], 1);
+      free(saved[k]);
+    } else {
+      unsetenv(args[k]);
     }
   }
+  return status;
+}
 
-  // 3. Handle Redirection (if any)
-  handle_redirection(args, &in_fd, &out_fd);
+/* =========================================================================
+ *                   Process Substitution and Here-Documents
+ * ========================================================================= */
 
-  if (in_fd != -1) {
-    dup2(in_fd, STDIN_FILENO);
-    close(in_fd);
+/**
+ * @def MAX_TEMP_FDS
+ * @brief Maximum number of per-command descriptors (substitution pipes).
+ */
+#define MAX_TEMP_FDS 32
+
+/** @brief Descriptors that live until the current command line finishes
+ *  (process substitution pipes, here-document bodies). */
+static int temp_fds[MAX_TEMP_FDS];
+
+/** @brief Number of entries in `temp_fds`. */
+static int num_temp_fds = 0;
+
+/**
+ * @brief Closes every per-command descriptor.
+ */
+static void close_temp_fds() {
+  for (int i = 0; i < num_temp_fds; i++)
+    close(temp_fds[i]);
+  num_temp_fds = 0;
+}
+
+/**
+ * @brief Starts `cmd` connected to a pipe for `<(cmd)` / `>(cmd)`.
+ *
+ * The command runs concurrently in a forked copy of the shell. For
+ * `<(cmd)` its stdout feeds the pipe and the shell keeps the read end; for
+ * `>(cmd)` its stdin drains the pipe and the shell keeps the write end. The
+ * kept end is inherited by the command being built, which reaches it as
+ * `/dev/fd/N`, and is closed when the command line finishes. The child
+ * exits with the status of the command and is handed to the job reaper.
+ *
+ * @param cmd The command line to run.
+ * @param input Non-zero for `<(cmd)`, zero for `>(cmd)`.
+ * @return int The shell's end of the pipe, or -1 on failure.
+ */
+int process_substitution(const char *cmd, int input) {
+#ifdef _WIN32
+  (void)cmd;
+  (void)input;
+  fprintf(stderr, "shell: process substitution not supported on Windows\n");
+  return -1;
+#else
+  int p[2];
+  if (num_temp_fds == MAX_TEMP_FDS) {
+    fprintf(stderr, "shell: too many process substitutions\n");
+    return -1;
+  }
+  if (pipe(p) != 0) {
+    perror("shell");
+    return -1;
   }
-  if (out_fd != -1) {
-    dup2(out_fd, STDOUT_FILENO);
-    close(out_fd);
+
+  int keep = input ? p[0] : p[1];
+  int give = input ? p[1] : p[0];
+
+  jobs_flush();
+  pid_t pid = jobs_fork(cmd);
+  if (pid == 0) {
+    // Child: run the command with its end of the pipe as stdin/stdout
+    char *line = strdup(cmd);
+    tail_call = 0;
+    dup2(give, input ? STDOUT_FILENO : STDIN_FILENO);
+    close(p[0]);
+    close(p[1]);
+    close_temp_fds(); // do not hold other substitutions' pipes open
+    execute_line(line);
+    jobs_flush();
+    _exit(last_status);
+  } else if (pid < 0) {
+    perror("fork");
+    close(p[0]);
+    close(p[1]);
+    return -1;
+  }
+
+  close(give);
+  temp_fds[num_temp_fds++] = keep;
+  jobs_track(pid);
+  return keep;
+#endif
+}
+
+/**
+ * @brief Stores a here-document body and returns a descriptor to read it.
+ *
+ * Small bodies (up to PIPE_BUF bytes, which always fit in a pipe without
+ * blocking) go into a pipe. Larger ones go into an anonymous in-memory
+ * file from `memfd_create()` that is sealed against any further change;
+ * where memfd is unavailable an unlinked temporary file is used instead.
+ * Nothing is ever written to a named file on disk. The descriptor is
+ * closed when the current command line finishes.
+ *
+ * @param body The document text.
+ * @param len Length of `body`.
+ * @return int A readable descriptor positioned at the start, or -1.
+ */
+int here_document(const char *body, size_t len) {
+#ifdef _WIN32
+  (void)body;
+  (void)len;
+  fprintf(stderr, "shell: here-documents not supported on Windows\n");
+  return -1;
+#else
+  int fd = -1;
+
+  if (num_temp_fds == MAX_TEMP_FDS) {
+    fprintf(stderr, "shell: too many here-documents\n");
+    return -1;
   }
 
-  // 4. Launch External Process
-  int status = launch_process(args);
+  if (len <= PIPE_BUF) {
+    int p[2];
+    if (pipe(p) == 0) {
+      write_all(p[1], body, len);
+      close(p[1]);
+      fd = p[0];
+    }
+  } else {
+#ifdef MFD_ALLOW_SEALING
+    fd = memfd_create("heredoc", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+#endif
+    if (fd < 0) {
+      FILE *tmp = tmpfile();
+      fd = tmp ? dup(fileno(tmp)) : -1;
+      if (tmp)
+        fclose(tmp);
+    }
+    if (fd >= 0) {
+      write_all(fd, body, len);
+#ifdef F_SEAL_WRITE
+      fcntl(fd, F_ADD_SEALS,
+            F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL);
+#endif
+      lseek(fd, 0, SEEK_SET);
+    }
+  }
 
-  // Restore original stdin/stdout
-  dup2(saved_stdin, STDIN_FILENO);
-  dup2(saved_stdout, STDOUT_FILENO);
-  close(saved_stdin);
-  close(saved_stdout);
+  if (fd < 0) {
+    perror("shell");
+    return -1;
+  }
+  fcntl(fd, F_SETFD, FD_CLOEXEC);
+  temp_fds[num_temp_fds++] = fd;
+  return fd;
+#endif
+}
 
+/**
+ * @brief Parses and executes the text of one simple command or pipeline.
+ *
+ * This is what the VM runs for each OP_CMD. Aliases are expanded first (see
+ * alias.c). Releases the arguments and the per-command descriptors
+ * afterwards.
+ *
+ * @param text The command text (may be followed by here-document bodies).
+ * @return int 1 to continue execution, 0 to terminate the shell.
+ */
+int execute_simple(const char *text) {
+  int compound;
+  char *expanded = alias_expand(text, &compound);
+  if (expanded && compound) {
+    // An alias brought in `;`, `&&`, `if`...: compile the result
+    int status = execute_line(expanded);
+    free(expanded);
+    return status;
+  }
+  char **args = parse_input(expanded ? expanded : (char *)text);
+  int status = execute_command(args);
+
+  free_args(args);
+  free(expanded);
+  close_temp_fds();
+  return status;
+}
+
+/**
+ * @brief Runs the last command of a script (a tail call).
+ *
+ * Like `execute_simple()`, but if the command turns out to be a simple
+ * external command, the shell `exec`s it instead of forking (unless
+ * `exec` made a fan-out permanent, whose relay thread would die with it).
+ *
+ * @param text The command text.
+ * @return int 1 to continue execution, 0 to terminate the shell.
+ */
+int execute_tail(const char *text) {
+#ifndef _WIN32
+  // A kept fan-out relays from a thread of this process: it must not end
+  tail_call = num_kept_fans == 0;
+#else
+  tail_call = 1;
+#endif
+  int status = execute_simple(text);
+  tail_call = 0;
   return status;
 }
+
+/**
+ * @brief Applies the redirections of a compound command.
+ *
+ * @param text The redirections (e.g. `> out`, `> out >> log`, or `< file`).
+ * @return int 0 on success, -1 on failure. Pair with `redirect_pop()`.
+ */
+int redirect_text(const char *text) {
+  char **args = parse_input((char *)text);
+
+  read_sync();
+  int result = redirect_push(args);
+  free_args(args);
+  // The redirection holds its own descriptors by now
+  close_temp_fds();
+  return result;
+}
+
+/**
+ * @brief Compiles and executes one command line (or a whole script).
+ *
+ * @param line The command line.
+ * @return int 1 to continue execution, 0 to terminate the shell.
+ */
+int execute_line(char *line) {
+  int incomplete;
+  struct program *prog = compile_script(line, &incomplete);
+
+  if (!prog) {
+    if (incomplete)
+      fprintf(stderr, "shell: syntax error: unexpected end of input\n");
+    last_status = 2;
+    return 1;
+  }
+  int status = vm_run(prog);
+  program_free(prog);
+  return status;
+}
+
+/* =========================================================================
+ *                          Built-in Command Implementations
+ * ========================================================================= */
+
+/**
+ * @brief Replaces the shell with a program, or makes redirections
+ *        permanent.
+ *
+ * Usage: `exec [command [args...]]`. With a command, the shell process
+ * becomes that program (its redirections apply). Without one, the
+ * redirections on the `exec` line stay in effect for the rest of the
+ * session: `exec > log`, or `exec > log > copy` to write to both.
+ *
+ * @param args Null-terminated array of arguments.
+ * @return int 1 to continue execution, 0 to exit (a script whose `exec`
+ *         failed ends, like in other shells).
+ */
+int shell_exec(char **args) {
+  if (args[1] == NULL) {
+    redirect_keep();
+    return 1;
+  }
+#ifdef _WIN32
+  fprintf(stderr, "shell: exec: not supported on Windows\n");
+  last_status = 1;
+  return 1;
+#else
+  last_status = exec_replace(args + 1);
+  return interactive;
+#endif
+}
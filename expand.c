@@ -0,0 +1,682 @@
+/**
+ * @file expand.c
+ * @brief Parameter and arithmetic expansion (`$name`, `${...}`, `$((...))`).
+ *
+ * Everything here runs inside the shell process, so common string and
+ * number manipulations do not need `expr`, `sed` or `awk`:
+ *
+ * - `$name`, `${name}`, `$1`..`$9`, `${10}`, `$#`, `$?`, `$$`, `$0`,
+ *   `$@`, `$*`
+ * - `${#name}` (length), `${name[i]}`, `${name[@]}`, `${#name[@]}` (arrays)
+ * - `${name:-word}`, `${name:=word}`, `${name:+word}`, `${name:?word}` and
+ *   the forms without `:` (which only test for unset)
+ * - `${name#pat}`, `${name##pat}`, `${name%pat}`, `${name%%pat}`
+ * - `${name/pat/rep}`, `${name//pat/rep}`, `${name/#pat/rep}`,
+ *   `${name/%pat/rep}`
+ * - `${name:offset}`, `${name:offset:length}` (arithmetic operands; a
+ *   negative offset counts from the end)
+ * - `$((expression))` (see arith.c)
+ *
+ * Patterns use the glob syntax `*`, `?`, `[...]` and `\`, matched by
+ * `pattern_match()`. Field splitting of the results is done by the caller
+ * (`cook_word()` in parser.c).
+ *
+ * @author Abdelhamid
+ * @date 2025-12-14
+ */
+
+#include "shell.h"
+#include <ctype.h>
+
+/** @brief Name of the shell or script, for `$0`. */
+const char *shell_name = "myshell";
+
+/* =========================================================================
+ *                          Pattern Matching
+ * ========================================================================= */
+
+/**
+ * @brief Matches a bracket expression `[...]` against one character.
+ *
+ * @param p Points just past the `[`.
+ * @param c The character.
+ * @param matched Receives 1 if `c` is in the set.
+ * @return const char* Just past the closing `]`, or NULL if unterminated.
+ */
+static const char *match_bracket(const char *p, char c, int *matched) {
+  int negate = 0;
+  *matched = 0;
+
+  if (*p == '!' || *p == '^') {
+    negate = 1;
+    p++;
+  }
+  // A leading ']' is a literal member
+  const char *start = p;
+  while (*p && (*p != ']' || p == start)) {
+    char lo = *p, hi;
+    if (lo == '\\' && p[1])
+      lo = *++p;
+    if (p[1] == '-' && p[2] && p[2] != ']') {
+      hi = p[2];
+      p += 3;
+    } else {
+      hi = lo;
+      p++;
+    }
+    if ((unsigned char)c >= (unsigned char)lo &&
+        (unsigned char)c <= (unsigned char)hi)
+      *matched = 1;
+  }
+  if (*p != ']')
+    return NULL;
+  if (negate)
+    *matched = !*matched;
+  return p + 1;
+}
+
+/**
+ * @brief Matches `pat` against the `n` bytes at `s`.
+ *
+ * @param pat NUL-terminated glob pattern.
+ * @param s Subject text (need not be terminated).
+ * @param n Length of the subject.
+ * @return int 1 on a match, 0 otherwise.
+ */
+static int match_n(const char *pat, const char *s, size_t n) {
+  const char *end = s + n;
+  // Backtracking point for the last '*'
+  const char *star_p = NULL, *star_s = NULL;
+
+  while (1) {
+    if (*pat == '*') {
+      while (*pat == '*')
+        pat++;
+      star_p = pat;
+      star_s = s;
+      continue;
+    }
+    if (s == end) {
+      if (*pat == '\0')
+        return 1;
+      return 0;
+    }
+    if (*pat != '\0') {
+      const char *next = NULL;
+      int ok = 0;
+      if (*pat == '?') {
+        ok = 1;
+        next = pat + 1;
+      } else if (*pat == '[') {
+        next = match_bracket(pat + 1, *s, &ok);
+        if (!next) { // unterminated: literal '['
+          ok = *s == '[';
+          next = pat + 1;
+        }
+      } else if (*pat == '\\' && pat[1]) {
+        ok = pat[1] == *s;
+        next = pat + 2;
+      } else {
+        ok = *pat == *s;
+        next = pat + 1;
+      }
+      if (ok) {
+        pat = next;
+        s++;
+        continue;
+      }
+    }
+    // Mismatch: let the last '*' swallow one more character
+    if (!star_p || star_s == end)
+      return 0;
+    pat = star_p;
+    s = ++star_s;
+  }
+}
+
+/**
+ * @brief Matches a whole string against a glob pattern.
+ *
+ * @param pat Pattern (`*`, `?`, `[...]`, `\`).
+ * @param str Subject string.
+ * @return int 1 on a match, 0 otherwise.
+ */
+int pattern_match(const char *pat, const char *str) {
+  return match_n(pat, str, strlen(str));
+}
+
+/* =========================================================================
+ *                          Parameter Lookup
+ * ========================================================================= */
+
+/**
+ * @brief Joins the positional parameters with single spaces.
+ * @return char* Newly allocated string.
+ */
+static char *join_params(void) {
+  size_t total = 1;
+  for (int i = 0; i < shell_num_params; i++)
+    total += strlen(shell_params[i]) + 1;
+  char *out = malloc(total);
+  char *o = out;
+  for (int i = 0; i < shell_num_params; i++) {
+    size_t n = strlen(shell_params[i]);
+    if (i > 0)
+      *o++ = ' ';
+    memcpy(o, shell_params[i], n);
+    o += n;
+  }
+  *o = '\0';
+  return out;
+}
+
+/**
+ * @brief Looks up a parameter by name (variable, positional or special).
+ *
+ * @param name Parameter name, e.g. "HOME", "1", "?" or "@".
+ * @return char* Newly allocated value, or NULL if unset.
+ */
+static char *param_value(const char *name) {
+  char num[32];
+
+  if (isdigit((unsigned char)name[0])) {
+    int k = atoi(name);
+    if (k == 0)
+      return strdup(shell_name);
+    if (k > shell_num_params)
+      return NULL;
+    return strdup(shell_params[k - 1]);
+  }
+  if (name[1] == '\0') {
+    switch (name[0]) {
+    case '?':
+      snprintf(num, sizeof(num), "%d", last_status);
+      return strdup(num);
+    case '$':
+      snprintf(num, sizeof(num), "%d", (int)getpid());
+      return strdup(num);
+    case '#':
+      snprintf(num, sizeof(num), "%d", shell_num_params);
+      return strdup(num);
+    case '@':
+    case '*':
+      return join_params();
+    }
+  }
+  const char *v = var_get(name);
+  return v ? strdup(v) : NULL;
+}
+
+/**
+ * @brief Reads a parameter name starting at `s`.
+ *
+ * @param s Text after `$` or `${`.
+ * @param braced Non-zero inside `${...}` (multi-digit positionals allowed).
+ * @return int Length of the name (0 if none).
+ */
+static int name_length(const char *s, int braced) {
+  int n = 0;
+  if (isdigit((unsigned char)s[0])) {
+    if (!braced)
+      return 1;
+    while (isdigit((unsigned char)s[n]))
+      n++;
+    return n;
+  }
+  if (strchr("?$#@*", s[0]) && s[0])
+    return 1;
+  while (isalnum((unsigned char)s[n]) || s[n] == '_')
+    n++;
+  if (n > 0 && !isalpha((unsigned char)s[0]) && s[0] != '_')
+    return 0;
+  return n;
+}
+
+/**
+ * @brief Appends `n` bytes to a growing heap string.
+ */
+static void append(char **buf, size_t *len, size_t *cap, const char *s,
+                   size_t n) {
+  if (*len + n + 1 > *cap) {
+    while (*len + n + 1 > *cap)
+      *cap = *cap ? *cap * 2 : 64;
+    *buf = realloc(*buf, *cap);
+    if (!*buf) {
+      fprintf(stderr, "shell: allocation error\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  memcpy(*buf + *len, s, n);
+  *len += n;
+  (*buf)[*len] = '\0';
+}
+
+/**
+ * @brief Length of a parameter reference: a name plus an optional
+ *        `[subscript]`.
+ *
+ * @param s Text of the reference.
+ * @param len Length available.
+ * @return int Length of the reference (0 if `s` does not start with one).
+ */
+static int ref_length(const char *s, int len) {
+  int n = name_length(s, 1);
+  if (n == 0 || n >= len || s[n] != '[')
+    return n;
+  const char *close = memchr(s + n, ']', len - n);
+  return close ? (int)(close - s) + 1 : n;
+}
+
+/**
+ * @brief Looks up `${name[sub]}`.
+ *
+ * `@` and `*` join every element with spaces; any other subscript is an
+ * arithmetic expression (negative indexes count from the end).
+ *
+ * @param name Variable name.
+ * @param sub Expanded subscript text.
+ * @param count Set to the number of elements for `@` / `*`.
+ * @return char* Newly allocated value, or NULL if unset.
+ */
+static char *element_value(const char *name, const char *sub, int *count) {
+  int n = var_array_len(name);
+  char *out = NULL;
+  size_t olen = 0, cap = 0;
+
+  if (strcmp(sub, "@") == 0 || strcmp(sub, "*") == 0) {
+    *count = n;
+    append(&out, &olen, &cap, "", 0);
+    for (int k = 0; k < n; k++) {
+      const char *item = var_get_index(name, k);
+      if (k > 0)
+        append(&out, &olen, &cap, " ", 1);
+      append(&out, &olen, &cap, item, strlen(item));
+    }
+    return out;
+  }
+  long long idx;
+  arith_eval(sub, &idx);
+  if (idx < 0)
+    idx += n;
+  const char *item = var_get_index(name, (int)idx);
+  return item ? strdup(item) : NULL;
+}
+
+/* =========================================================================
+ *                          Expansion
+ * ========================================================================= */
+
+/**
+ * @brief Finds the end of a `${...}` or `$(...)` group.
+ *
+ * @param s Text starting at the opening `{` or `(`.
+ * @param len Length available.
+ * @return int Index of the matching close character, or -1.
+ */
+static int match_close(const char *s, int len) {
+  char open = s[0], close = open == '{' ? '}' : ')';
+  int depth = 0;
+  char quote = 0;
+
+  for (int i = 0; i < len; i++) {
+    char c = s[i];
+    if (quote) {
+      if (c == quote)
+        quote = 0;
+      else if (c == '\\' && quote == '"' && i + 1 < len)
+        i++;
+    } else if (c == '\\' && i + 1 < len) {
+      i++;
+    } else if (c == '\'' || c == '"') {
+      quote = c;
+    } else if (c == open) {
+      depth++;
+    } else if (c == close && --depth == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+/**
+ * @brief Expands a word inside `${...}` or `$((...))`.
+ *
+ * Removes quotes and performs `$` expansions, without field splitting.
+ *
+ * @param s Word text.
+ * @param len Length of the word.
+ * @return char* Newly allocated result.
+ */
+char *expand_text(const char *s, int len) {
+  char *out = NULL;
+  size_t olen = 0, cap = 0;
+  char quote = 0;
+
+  append(&out, &olen, &cap, "", 0);
+  for (int i = 0; i < len; i++) {
+    char c = s[i];
+    if (quote == '\'') {
+      if (c == '\'')
+        quote = 0;
+      else
+        append(&out, &olen, &cap, &c, 1);
+    } else if (c == '\'' && !quote) {
+      quote = c;
+    } else if (c == '"') {
+      quote = quote ? 0 : '"';
+    } else if (c == '\\' && i + 1 < len &&
+               (!quote || strchr("\"\\$`", s[i + 1]))) {
+      append(&out, &olen, &cap, &s[++i], 1);
+    } else if (c == '$') {
+      char *value = expand_dollar(s, len, &i);
+      if (value) {
+        append(&out, &olen, &cap, value, strlen(value));
+        free(value);
+      } else {
+        append(&out, &olen, &cap, &c, 1);
+      }
+    } else {
+      append(&out, &olen, &cap, &c, 1);
+    }
+  }
+  return out;
+}
+
+/**
+ * @brief Removes the shortest or longest prefix/suffix matching `pat`.
+ *
+ * @param value Subject (modified in place).
+ * @param pat Pattern.
+ * @param suffix Non-zero for `%`/`%%`, zero for `#`/`##`.
+ * @param longest Non-zero for `##`/`%%`.
+ */
+static void remove_affix(char *value, const char *pat, int suffix,
+                         int longest) {
+  size_t n = strlen(value);
+
+  for (size_t k = 0; k <= n; k++) {
+    size_t cut = longest ? n - k : k;
+    if (!suffix && match_n(pat, value, cut)) {
+      memmove(value, value + cut, n - cut + 1);
+      return;
+    }
+    if (suffix && match_n(pat, value + n - cut, cut)) {
+      value[n - cut] = '\0';
+      return;
+    }
+  }
+}
+
+/**
+ * @brief Length of the longest match of `pat` at the start of `s`.
+ *
+ * @param found Receives 1 if there is any match (possibly empty).
+ */
+static size_t longest_match(const char *pat, const char *s, size_t n,
+                            int *found) {
+  for (size_t k = n + 1; k-- > 0;) {
+    if (match_n(pat, s, k)) {
+      *found = 1;
+      return k;
+    }
+  }
+  *found = 0;
+  return 0;
+}
+
+/**
+ * @brief Implements `${name/pat/rep}` and its variants.
+ *
+ * @param value Subject.
+ * @param pat Pattern.
+ * @param rep Replacement.
+ * @param mode '/' (first), 'a' (all), '#' (anchored at start), '%' (at end).
+ * @return char* Newly allocated result.
+ */
+static char *replace(const char *value, const char *pat, const char *rep,
+                     char mode) {
+  char *out = NULL;
+  size_t olen = 0, cap = 0;
+  size_t n = strlen(value), rlen = strlen(rep);
+  size_t i = 0, k;
+  int found;
+
+  append(&out, &olen, &cap, "", 0);
+  if (mode == '#') {
+    k = longest_match(pat, value, n, &found);
+    if (found) {
+      append(&out, &olen, &cap, rep, rlen);
+      i = k;
+    }
+  } else if (mode == '%') {
+    // The earliest start that matches through the end is the longest match
+    for (; i <= n && !match_n(pat, value + i, n - i); i++)
+      ;
+    append(&out, &olen, &cap, value, i <= n ? i : n);
+    if (i <= n)
+      append(&out, &olen, &cap, rep, rlen);
+    i = n;
+  } else {
+    while (i < n) {
+      k = longest_match(pat, value + i, n - i, &found);
+      if (!found || k == 0) {
+        append(&out, &olen, &cap, &value[i++], 1);
+        continue;
+      }
+      append(&out, &olen, &cap, rep, rlen);
+      i += k;
+      if (mode != 'a')
+        break;
+    }
+  }
+  append(&out, &olen, &cap, value + i, n - i);
+  return out;
+}
+
+/**
+ * @brief Applies the operator part of `${name<op>word}`.
+ *
+ * @param name Parameter name.
+ * @param value Current value (owned; may be NULL when unset).
+ * @param op Operator text, just after the name.
+ * @param oplen Length of the operator text through the closing brace.
+ * @return char* Newly allocated result, or NULL if unset.
+ */
+static char *apply_operator(const char *name, char *value, const char *op,
+                            int oplen) {
+  int colon = op[0] == ':';
+  char c = op[colon];
+
+  // ${name:-word} ${name-word} ${name:=word} ${name:+word} ${name:?word}
+  if (c == '-' || c == '=' || c == '+' || c == '?') {
+    int use_word = value == NULL || (colon && value[0] == '\0');
+    if (c == '+')
+      use_word = !use_word;
+    if (!use_word)
+      return c == '+' ? (free(value), strdup("")) : value;
+    free(value);
+    char *word = expand_text(op + colon + 1, oplen - colon - 1);
+    if (c == '=') {
+      if (valid_var_name(name))
+        var_set(name, word);
+    } else if (c == '?') {
+      fprintf(stderr, "shell: %s: %s\n", name,
+              *word ? word : "parameter null or not set");
+      last_status = 1;
+    }
+    return word;
+  }
+
+  if (!value)
+    value = strdup("");
+
+  // ${name:offset} ${name:offset:length}
+  if (colon) {
+    const char *rest = op + 1;
+    int restlen = oplen - 1;
+    const char *sep = memchr(rest, ':', restlen);
+    int offlen = sep ? (int)(sep - rest) : restlen;
+    long long off = 0, cnt = -1;
+    long long n = (long long)strlen(value);
+
+    char *expr = expand_text(rest, offlen);
+    arith_eval(expr, &off);
+    free(expr);
+    if (sep) {
+      expr = expand_text(sep + 1, restlen - offlen - 1);
+      arith_eval(expr, &cnt);
+      free(expr);
+    }
+    if (off < 0)
+      off = off + n < 0 ? 0 : off + n;
+    if (off > n)
+      off = n;
+    if (cnt < 0)
+      cnt = sep && cnt < 0 ? (n - off + cnt < 0 ? 0 : n - off + cnt)
+                           : n - off;
+    if (off + cnt > n)
+      cnt = n - off;
+    memmove(value, value + off, cnt);
+    value[cnt] = '\0';
+    return value;
+  }
+
+  // ${name#pat} ${name##pat} ${name%pat} ${name%%pat}
+  if (c == '#' || c == '%') {
+    int longest = op[1] == c;
+    char *pat = expand_text(op + 1 + longest, oplen - 1 - longest);
+    remove_affix(value, pat, c == '%', longest);
+    free(pat);
+    return value;
+  }
+
+  // ${name/pat/rep} ${name//pat/rep} ${name/#pat/rep} ${name/%pat/rep}
+  if (c == '/') {
+    char mode = '/';
+    const char *p = op + 1;
+    int plen = oplen - 1;
+    if (*p == '/' || *p == '#' || *p == '%') {
+      mode = *p == '/' ? 'a' : *p;
+      p++;
+      plen--;
+    }
+    // The pattern ends at the first unescaped '/'
+    int k = 0;
+    while (k < plen && p[k] != '/') {
+      if (p[k] == '\\' && k + 1 < plen)
+        k++;
+      k++;
+    }
+    char *pat = expand_text(p, k);
+    char *rep = k < plen ? expand_text(p + k + 1, plen - k - 1) : strdup("");
+    char *result = replace(value, pat, rep, mode);
+    free(pat);
+    free(rep);
+    free(value);
+    return result;
+  }
+
+  fprintf(stderr, "shell: ${%s%.*s}: bad substitution\n", name, oplen, op);
+  last_status = 1;
+  free(value);
+  return strdup("");
+}
+
+/**
+ * @brief Expands the `$` reference at `src[*i]`.
+ *
+ * Handles `$((expr))`, `${...}`, `$name` and the special parameters.
+ * `$(command)` is not supported and is left as literal text.
+ *
+ * @param src Text containing the reference.
+ * @param len Length of `src`.
+ * @param i In: index of the `$`. Out: index of the last character used.
+ * @return char* Newly allocated value ("" if unset), or NULL if the `$` is
+ *               not followed by anything expandable (a literal `$`).
+ */
+char *expand_dollar(const char *src, int len, int *i) {
+  int start = *i + 1;
+  const char *s = src + start;
+  int avail = len - start;
+  char name[256];
+
+  if (avail <= 0)
+    return NULL;
+
+  // $((expression))
+  if (avail >= 2 && s[0] == '(' && s[1] == '(') {
+    int end = match_close(s, avail);
+    if (end < 3 || s[end - 1] != ')')
+      return NULL;
+    char *expr = expand_text(s + 2, end - 3);
+    long long value;
+    char num[32];
+    if (arith_eval(expr, &value) < 0)
+      last_status = 1;
+    free(expr);
+    snprintf(num, sizeof(num), "%lld", value);
+    *i = start + end;
+    return strdup(num);
+  }
+
+  // ${...}
+  if (s[0] == '{') {
+    int end = match_close(s, avail);
+    if (end < 0)
+      return NULL;
+    const char *body = s + 1;
+    int blen = end - 1;
+    int length_of = 0;
+    *i = start + end;
+
+    // ${#name}, but not ${#} or ${#-word} style operators on '#'
+    if (blen > 1 && body[0] == '#' && ref_length(body + 1, blen - 1) == blen - 1) {
+      length_of = 1;
+      body++;
+      blen--;
+    }
+    int n = name_length(body, 1);
+    if (n == 0 || n >= (int)sizeof(name)) {
+      fprintf(stderr, "shell: ${%.*s}: bad substitution\n", blen, body);
+      last_status = 1;
+      return strdup("");
+    }
+    memcpy(name, body, n);
+    name[n] = '\0';
+
+    char *value;
+    int count = -1;
+    if (n < blen && body[n] == '[') {
+      // ${name[index]}, ${name[@]}
+      int k = ref_length(body, blen);
+      char *sub = expand_text(body + n + 1, k - n - 2);
+      value = element_value(name, sub, &count);
+      free(sub);
+      n = k;
+    } else {
+      value = param_value(name);
+    }
+    if (length_of) {
+      char num[32];
+      if (count >= 0)
+        snprintf(num, sizeof(num), "%d", count);
+      else
+        snprintf(num, sizeof(num), "%zu", value ? strlen(value) : (size_t)0);
+      free(value);
+      return strdup(num);
+    }
+    if (n < blen)
+      return apply_operator(name, value, body + n, blen - n);
+    return value ? value : strdup("");
+  }
+
+  // $name, $1, $?, ...
+  int n = name_length(s, 0);
+  if (n == 0 || n > avail || n >= (int)sizeof(name))
+    return NULL;
+  memcpy(name, s, n);
+  name[n] = '\0';
+  *i = start + n - 1;
+  char *value = param_value(name);
+  return value ? value : strdup("");
+}
@@ -0,0 +1,190 @@
+/**
+ * @file fsops.c
+ * @brief Filesystem helpers relative to a cached working-directory fd.
+ *
+ * The shell keeps an `O_PATH` file descriptor for its current directory
+ * (refreshed by `change_directory()`), and built-ins and redirections open,
+ * stat, rename and unlink relative paths through the `*at()` system calls
+ * against that descriptor. Path lookups start from an already resolved
+ * directory, and a directory that is renamed while the shell sits in it
+ * keeps working.
+ *
+ * On Windows the helpers fall back to the plain path-based calls.
+ *
+ * @author Abdelhamid
+ * @date 2025-12-14
+ */
+
+#define _GNU_SOURCE /* O_PATH, renameat2() */
+#include "shell.h"
+
+#ifndef _WIN32
+
+#ifndef O_PATH
+#define O_PATH O_RDONLY
+#endif
+
+/** @brief Descriptor of the current working directory (-1: not open yet). */
+static int cwd_fd = -1;
+
+/**
+ * @brief Returns the cached working-directory descriptor.
+ *
+ * Opens "." on first use. Falls back to AT_FDCWD if that fails, which makes
+ * the helpers behave exactly like their path-based counterparts.
+ *
+ * @return int A directory descriptor usable with the *at() calls.
+ */
+int fs_cwd() {
+  if (cwd_fd < 0) {
+    cwd_fd = open(".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (cwd_fd < 0)
+      return AT_FDCWD;
+  }
+  return cwd_fd;
+}
+
+/**
+ * @brief Changes the process working directory and the cached descriptor.
+ *
+ * The target is resolved relative to the cached descriptor, then entered
+ * with `fchdir()`, so the descriptor and the process cwd never disagree.
+ *
+ * @param path The target directory.
+ * @return int 0 on success, -1 on failure (errno is set).
+ */
+int fs_chdir(const char *path) {
+  int fd = openat(fs_cwd(), path, O_PATH | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0)
+    return -1;
+  if (fchdir(fd) != 0) {
+    int err = errno;
+    close(fd);
+    errno = err;
+    return -1;
+  }
+  if (cwd_fd >= 0)
+    close(cwd_fd);
+  cwd_fd = fd;
+  return 0;
+}
+
+/**
+ * @brief Returns a new descriptor of the working directory, for
+ *        `fs_restore_cwd()`.
+ * @return int The descriptor, or -1 on failure.
+ */
+int fs_save_cwd() {
+  int fd = fs_cwd();
+  if (fd == AT_FDCWD)
+    return open(".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+  return fcntl(fd, F_DUPFD_CLOEXEC, 0);
+}
+
+/**
+ * @brief Returns to a directory saved by `fs_save_cwd()`.
+ *
+ * The descriptor becomes the cached one (it is consumed either way).
+ *
+ * @return int 0 on success, -1 on failure.
+ */
+int fs_restore_cwd(int fd) {
+  if (fd < 0)
+    return -1;
+  if (fchdir(fd) != 0) {
+    close(fd);
+    return -1;
+  }
+  if (cwd_fd >= 0)
+    close(cwd_fd);
+  cwd_fd = fd;
+  return 0;
+}
+
+/**
+ * @brief `open()` relative to the cached working directory.
+ * @return int The new descriptor, or -1 on failure.
+ */
+int fs_open(const char *path, int flags, int mode) {
+  return openat(fs_cwd(), path, flags | O_CLOEXEC, mode);
+}
+
+/**
+ * @brief `stat()` (or `lstat()` with AT_SYMLINK_NOFOLLOW) via `fstatat()`.
+ * @return int 0 on success, -1 on failure.
+ */
+int fs_stat(const char *path, struct stat *st, int flags) {
+  return fstatat(fs_cwd(), path, st, flags);
+}
+
+/**
+ * @brief Removes a file (or, with AT_REMOVEDIR, an empty directory).
+ * @return int 0 on success, -1 on failure.
+ */
+int fs_unlink(const char *path, int flags) {
+  return unlinkat(fs_cwd(), path, flags);
+}
+
+/**
+ * @brief Renames `from` to `to`, both relative to the cached directory.
+ *
+ * Uses `renameat2()` where available so callers can pass
+ * RENAME_NOREPLACE; with flags == 0 it behaves like `rename()`.
+ *
+ * @return int 0 on success, -1 on failure.
+ */
+int fs_rename(const char *from, const char *to, unsigned flags) {
+#ifdef RENAME_NOREPLACE
+  if (flags)
+    return renameat2(fs_cwd(), from, fs_cwd(), to, flags);
+#else
+  (void)flags;
+#endif
+  return renameat(fs_cwd(), from, fs_cwd(), to);
+}
+
+#else
+
+int fs_cwd() { return -1; }
+
+int fs_chdir(const char *path) { return chdir(path); }
+
+int fs_save_cwd() { return -1; }
+
+int fs_restore_cwd(int fd) {
+  (void)fd;
+  return -1;
+}
+
+int fs_open(const char *path, int flags, int mode) {
+  return open(path, flags | _O_BINARY, mode);
+}
+
+int fs_stat(const char *path, struct stat *st, int flags) {
+  (void)flags;
+  return stat(path, st);
+}
+
+int fs_unlink(const char *path, int flags) {
+  return (flags & AT_REMOVEDIR) ? _rmdir(path) : remove(path);
+}
+
+int fs_rename(const char *from, const char *to, unsigned flags) {
+  (void)flags;
+  return rename(from, to);
+}
+
+#endif
+
+/**
+ * @brief Returns the modification time of a stat result in nanoseconds.
+ */
+long long fs_mtime_ns(const struct stat *st) {
+#if defined(__APPLE__)
+  return st->st_mtimespec.tv_sec * 1000000000LL + st->st_mtimespec.tv_nsec;
+#elif defined(_WIN32)
+  return st->st_mtime * 1000000000LL;
+#else
+  return st->st_mtim.tv_sec * 1000000000LL + st->st_mtim.tv_nsec;
+#endif
+}
@@ -34,6 +34,7 @@ int history_count = 0;
  * @param line The command line string to add.
  */
 void add_history(char *line) {
+  SHELL_PROBE1(history__add, line);
   if (history_count < HISTORY_SIZE) {
     history[history_count++] = strdup(line);
   } else {
@@ -60,6 +61,14 @@ void print_history() {
   }
 }
 
+/**
+ * @brief Returns one entry of the history (oldest first).
+ * @return const char* Entry `i`, or NULL past the last one.
+ */
+const char *history_entry(int i) {
+  return i >= 0 && i < history_count ? history[i] : NULL;
+}
+
 /**
  * @brief Loads command history from the persistence file.
  *
@@ -124,6 +133,7 @@ void save_history() {
 
   snprintf(path, sizeof(path), "%s/%s", home, HISTORY_FILE);
 
+  SHELL_PROBE1(history__save, history_count);
   FILE *fp = fopen(path, "w");
   if (fp) {
     for (int i = 0; i < history_count; i++) {
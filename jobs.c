@@ -0,0 +1,217 @@
+/**
+ * @file jobs.c
+ * @brief Tracking and reaping of background child processes.
+ *
+ * Some children run alongside the command that started them instead of
+ * being waited for directly (for example the producers and consumers of
+ * `<(...)` / `>(...)` process substitutions). They are registered here and
+ * reaped without blocking between commands, so they never linger as
+ * zombies. `jobs_wait_any()` and `jobs_wait_for()` are the blocking
+ * counterparts used by the built-ins that run several children at once.
+ *
+ * Children of the shell end through `jobs_exit()`, which knows whether the
+ * shell is embedded in another program (libmyshell): there, the caller's
+ * atexit handlers and stdio buffers belong to the caller and must not run
+ * or be written from the child.
+ *
+ * @author Abdelhamid
+ * @date 2025-12-14
+ */
+
+#include "shell.h"
+
+/** @brief Non-zero in the child of a libmyshell call (see libmyshell.c). */
+int jobs_embedded = 0;
+
+/**
+ * @brief Flushes the shell's output before a fork, an exec or an exit.
+ *
+ * Flushes every stream, except when embedded: the caller's other streams
+ * are flushed by the caller, and writing their buffers from a child would
+ * repeat them.
+ */
+void jobs_flush() {
+  if (jobs_embedded) {
+    fflush(stdout);
+    fflush(stderr);
+  } else {
+    fflush(NULL);
+  }
+}
+
+/**
+ * @brief Ends a child of the shell (or the shell) with a status.
+ *
+ * When embedded, `_exit()` skips the caller's atexit handlers, which are
+ * not the child's to run.
+ *
+ * @param status The exit status.
+ */
+void jobs_exit(int status) {
+  jobs_flush();
+  if (jobs_embedded)
+    _exit(status);
+  exit(status);
+}
+
+#ifndef _WIN32
+
+/** @brief Maximum number of background children tracked at once. */
+#define MAX_JOBS 256
+
+/** @brief PIDs of tracked children (0 = free slot). */
+static pid_t jobs[MAX_JOBS];
+
+/**
+ * @brief Registers a background child so it will be reaped later.
+ *
+ * @param pid The child's process ID.
+ */
+void jobs_track(int pid) {
+  for (int i = 0; i < MAX_JOBS; i++) {
+    if (jobs[i] == 0) {
+      jobs[i] = pid;
+      return;
+    }
+  }
+  // Table full: wait for it now rather than leak a zombie
+  waitpid(pid, NULL, 0);
+}
+
+/**
+ * @brief Reaps tracked children that have exited.
+ *
+ * @param block Non-zero to wait until every tracked child has exited.
+ */
+void jobs_reap(int block) {
+  for (int i = 0; i < MAX_JOBS; i++) {
+    if (jobs[i] != 0) {
+      int raw;
+      pid_t r = waitpid(jobs[i], &raw, block ? 0 : WNOHANG);
+      if (r == jobs[i])
+        SHELL_PROBE2(reap, r,
+                     WIFSIGNALED(raw) ? 128 + WTERMSIG(raw) : WEXITSTATUS(raw));
+      if (r == jobs[i] || (r < 0 && errno == ECHILD))
+        jobs[i] = 0;
+    }
+  }
+}
+
+/**
+ * @brief Waits for any child to exit.
+ *
+ * The reaper of `for -j`, which keeps several children running at once
+ * and matches the pid against its own. A
+ * tracked child collected here by accident is dropped by the next
+ * `jobs_reap()`, which sees ECHILD for it.
+ *
+ * @param status Receives the exit status (128 + signal number if killed).
+ * @return int The pid of the child, or -1 if there are no children.
+ */
+int jobs_wait_any(int *status) {
+  int raw;
+  pid_t pid;
+
+  do {
+    pid = waitpid(-1, &raw, 0);
+  } while (pid < 0 && errno == EINTR);
+  if (pid > 0) {
+    *status = WIFSIGNALED(raw) ? 128 + WTERMSIG(raw) : WEXITSTATUS(raw);
+    SHELL_PROBE2(reap, pid, *status);
+  }
+  return (int)pid;
+}
+
+/**
+ * @brief Waits for one of a set of children to exit.
+ *
+ * Unlike `jobs_wait_any()`, this leaves the shell's other children alone:
+ * it peeks at the next exited child with `WNOWAIT` and only collects it if
+ * it is in the set. Any other exited child is handed to the job table,
+ * which reaps it and frees its slot as `jobs_reap()` would.
+ *
+ * @param pids The children to wait for.
+ * @param n Number of entries in `pids`.
+ * @param status Receives the exit status (128 + signal number if killed).
+ * @return int The pid of the child, or -1 if there are no children.
+ */
+int jobs_wait_for(const int *pids, int n, int *status) {
+  for (;;) {
+    siginfo_t info;
+    int raw, mine = 0;
+
+    info.si_pid = 0;
+    if (waitid(P_ALL, 0, &info, WEXITED | WNOWAIT) < 0) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    for (int i = 0; i < n; i++) {
+      if (pids[i] == info.si_pid)
+        mine = 1;
+    }
+    if (info.si_pid <= 0 || waitpid(info.si_pid, &raw, 0) != info.si_pid)
+      continue;
+    int code = WIFSIGNALED(raw) ? 128 + WTERMSIG(raw) : WEXITSTATUS(raw);
+    SHELL_PROBE2(reap, info.si_pid, code);
+    if (mine) {
+      *status = code;
+      return (int)info.si_pid;
+    }
+    for (int i = 0; i < MAX_JOBS; i++) {
+      if (jobs[i] == info.si_pid)
+        jobs[i] = 0;
+    }
+  }
+}
+
+/**
+ * @brief Forks a child, counting it and timing the `fork()` call.
+ *
+ * Every fork of the shell goes through here, so the metrics see the
+ * copy-on-write setup cost that grows with the shell's memory, and the
+ * `spawn` probe fires for every child.
+ *
+ * @param what What the child runs (a program name, or a description such
+ *        as "(subshell)"), for the probe.
+ * @return int As `fork()`.
+ */
+int jobs_fork(const char *what) {
+  uint64_t start = stats_now();
+  pid_t pid = fork();
+  if (pid > 0)
+    SHELL_PROBE2(spawn, pid, what ? what : "");
+  if (pid != 0) {
+    stats_time(STAT_SPAWN, stats_now() - start);
+    stats_add(STAT_FORKS, 1);
+  } else {
+    profile_child();
+    stats_child();
+  }
+  return (int)pid;
+}
+
+#else
+
+void jobs_track(int pid) { (void)pid; }
+
+void jobs_reap(int block) { (void)block; }
+
+int jobs_wait_any(int *status) {
+  (void)status;
+  return -1;
+}
+
+int jobs_wait_for(const int *pids, int n, int *status) {
+  (void)pids;
+  (void)n;
+  (void)status;
+  return -1;
+}
+
+int jobs_fork(const char *what) {
+  (void)what;
+  return -1;
+}
+
+#endif
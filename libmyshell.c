@@ -0,0 +1,291 @@
+/**
+ * @file libmyshell.c
+ * @brief The libmyshell API (see myshell.h): runs command lines for C
+ *        programs with the shell's compiler and VM instead of `/bin/sh`.
+ *
+ * `msh_run()` forks once. The child applies the context's environment and
+ * directory, compiles the command and runs it with run_program(), so the
+ * last command is exec'd in place of the child: `msh_run(ctx, "gzip -d f")`
+ * costs one fork and one exec, where `system()` costs two execs (the shell,
+ * then gzip). Output is read back through pipes.
+ *
+ * Everything the shell changes (variables, directory, its global state)
+ * changes in the child, so the caller's process and other threads are left
+ * alone. What persists lives in the context, which is only touched by the
+ * thread using it.
+ *
+ * @author Abdelhamid
+ * @date 2025-12-14
+ */
+
+#define _GNU_SOURCE /* pipe2() */
+#include "shell.h"
+#include "myshell.h"
+
+/**
+ * @brief A command context.
+ */
+struct msh_ctx {
+  char **env;  /**< "NAME=value" to set, or "NAME" to unset, in order. */
+  int env_len; /**< Entries in `env`. */
+  char *cwd;   /**< Absolute start directory, or NULL for the caller's. */
+};
+
+struct msh_ctx *msh_new(void) { return calloc(1, sizeof(struct msh_ctx)); }
+
+void msh_free(struct msh_ctx *ctx) {
+  if (!ctx)
+    return;
+  for (int i = 0; i < ctx->env_len; i++)
+    free(ctx->env[i]);
+  free(ctx->env);
+  free(ctx->cwd);
+  free(ctx);
+}
+
+int msh_setenv(struct msh_ctx *ctx, const char *name, const char *value) {
+  size_t len = strlen(name);
+  if (len == 0 || strchr(name, '=')) {
+    errno = EINVAL;
+    return -1;
+  }
+  char *entry = malloc(len + (value ? strlen(value) + 2 : 1));
+  char **env = realloc(ctx->env, (ctx->env_len + 1) * sizeof(char *));
+  if (!entry || !env) {
+    free(entry);
+    if (env)
+      ctx->env = env;
+    errno = ENOMEM;
+    return -1;
+  }
+  if (value)
+    sprintf(entry, "%s=%s", name, value);
+  else
+    strcpy(entry, name);
+  // A later setting of the same name replaces the earlier one
+  int k = 0;
+  for (int i = 0; i < ctx->env_len; i++) {
+    if (strncmp(env[i], name, len) == 0 &&
+        (env[i][len] == '=' || env[i][len] == '\0'))
+      free(env[i]);
+    else
+      env[k++] = env[i];
+  }
+  env[k++] = entry;
+  ctx->env = env;
+  ctx->env_len = k;
+  return 0;
+}
+
+int msh_chdir(struct msh_ctx *ctx, const char *dir) {
+  char path[4096];
+  struct stat st;
+
+  if (dir[0] == '/' || !ctx->cwd)
+    snprintf(path, sizeof(path), "%s", dir);
+  else
+    snprintf(path, sizeof(path), "%s/%s", ctx->cwd, dir);
+  char *abs = realpath(path, NULL);
+  if (!abs)
+    return -1;
+  if (stat(abs, &st) != 0 || !S_ISDIR(st.st_mode)) {
+    free(abs);
+    errno = ENOTDIR;
+    return -1;
+  }
+  free(ctx->cwd);
+  ctx->cwd = abs;
+  return 0;
+}
+
+void msh_result_free(struct msh_result *result) {
+  free(result->out);
+  free(result->err);
+  result->out = result->err = NULL;
+  result->out_len = result->err_len = 0;
+}
+
+#ifndef _WIN32
+#include <poll.h>
+
+/**
+ * @brief A growing capture buffer.
+ */
+struct capture {
+  char *data; /**< Bytes read (NUL-terminated). */
+  size_t len; /**< Bytes in `data`. */
+  size_t cap; /**< Allocated size of `data`. */
+};
+
+/**
+ * @brief Reads what is available on a pipe into a capture buffer.
+ * @return int 1 if more may come, 0 at end of file, -1 on error.
+ */
+static int capture_read(int fd, struct capture *c) {
+  if (c->cap - c->len < 4096) {
+    size_t cap = c->cap ? c->cap * 2 : 8192;
+    char *data = realloc(c->data, cap);
+    if (!data)
+      return -1;
+    c->data = data;
+    c->cap = cap;
+  }
+  ssize_t n = read(fd, c->data + c->len, c->cap - c->len - 1);
+  if (n < 0)
+    return errno == EINTR || errno == EAGAIN ? 1 : -1;
+  c->len += (size_t)n;
+  c->data[c->len] = '\0';
+  return n > 0;
+}
+
+/**
+ * @brief Runs the command as the whole of the forked child.
+ */
+static void child(struct msh_ctx *ctx, const char *cmd) {
+  for (int i = 0; i < ctx->env_len; i++) {
+    char *eq = strchr(ctx->env[i], '=');
+    if (eq) {
+      *eq = '\0';
+      setenv(ctx->env[i], eq + 1, 1);
+      *eq = '=';
+    } else {
+      unsetenv(ctx->env[i]);
+    }
+  }
+  if (ctx->cwd) {
+    if (fs_chdir(ctx->cwd) != 0) {
+      fprintf(stderr, "myshell: %s: %s\n", ctx->cwd, strerror(errno));
+      fflush(stderr);
+      _exit(1);
+    }
+    setenv("PWD", ctx->cwd, 1);
+  }
+  interactive = 0;
+  jobs_embedded = 1;
+  stats_child();
+  int incomplete, status = 2;
+  struct program *p = compile_script(cmd, &incomplete);
+  if (p)
+    status = run_program(p);
+  else if (incomplete)
+    fprintf(stderr, "myshell: syntax error: unexpected end of file\n");
+  // Embedded: _exit(), the caller's atexit handlers are not ours to run
+  jobs_exit(status);
+}
+
+/**
+ * @brief `pipe()` with both ends close-on-exec.
+ *
+ * The caller may fork and exec from other threads while a capture is in
+ * progress; a write end inherited by such a child would hold the pipe
+ * open and keep `msh_run()` from ever seeing end of file. The child's
+ * copies on fds 1 and 2 are made by `dup2()`, which clears the flag.
+ */
+static int cloexec_pipe(int fds[2]) {
+#if defined(__APPLE__)
+  if (pipe(fds) != 0)
+    return -1;
+  fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+  fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+  return 0;
+#else
+  return pipe2(fds, O_CLOEXEC);
+#endif
+}
+
+int msh_run(struct msh_ctx *ctx, const char *cmd, struct msh_result *result) {
+  int out[2] = {-1, -1}, err[2] = {-1, -1};
+
+  if (result && (cloexec_pipe(out) != 0 || cloexec_pipe(err) != 0)) {
+    int e = errno;
+    if (out[0] >= 0) {
+      close(out[0]);
+      close(out[1]);
+    }
+    errno = e;
+    return -1;
+  }
+  // What the caller has buffered must not be written twice
+  fflush(stdout);
+  fflush(stderr);
+  pid_t pid = fork();
+  if (pid == 0) {
+    if (result) {
+      dup2(out[1], STDOUT_FILENO);
+      dup2(err[1], STDERR_FILENO);
+      close(out[0]);
+      close(out[1]);
+      close(err[0]);
+      close(err[1]);
+    }
+    child(ctx, cmd);
+  }
+  int e = errno;
+  if (result) {
+    close(out[1]);
+    close(err[1]);
+  }
+  if (pid < 0) {
+    if (result) {
+      close(out[0]);
+      close(err[0]);
+    }
+    errno = e;
+    return -1;
+  }
+
+  if (result) {
+    struct capture c[2] = {{NULL, 0, 0}, {NULL, 0, 0}};
+    struct pollfd fds[2] = {{out[0], POLLIN, 0}, {err[0], POLLIN, 0}};
+    int open_fds = 2;
+    while (open_fds > 0) {
+      if (poll(fds, 2, -1) < 0) {
+        if (errno == EINTR)
+          continue;
+        break;
+      }
+      for (int i = 0; i < 2; i++) {
+        if (fds[i].fd < 0 || !fds[i].revents)
+          continue;
+        if (capture_read(fds[i].fd, &c[i]) <= 0) {
+          close(fds[i].fd);
+          fds[i].fd = -1;
+          open_fds--;
+        }
+      }
+    }
+    for (int i = 0; i < 2; i++) {
+      if (fds[i].fd >= 0)
+        close(fds[i].fd);
+      if (!c[i].data)
+        c[i].data = calloc(1, 1);
+    }
+    result->out = c[0].data;
+    result->out_len = c[0].len;
+    result->err = c[1].data;
+    result->err_len = c[1].len;
+  }
+
+  int raw;
+  while (waitpid(pid, &raw, 0) < 0) {
+    if (errno != EINTR)
+      return -1;
+  }
+  int status = WIFSIGNALED(raw) ? 128 + WTERMSIG(raw) : WEXITSTATUS(raw);
+  if (result)
+    result->status = status;
+  return status;
+}
+
+#else
+
+int msh_run(struct msh_ctx *ctx, const char *cmd, struct msh_result *result) {
+  (void)ctx;
+  (void)cmd;
+  (void)result;
+  fprintf(stderr, "libmyshell not supported on Windows mode.\n");
+  errno = ENOSYS;
+  return -1;
+}
+
+#endif
@@ -0,0 +1,35 @@
+/**
+ * @file libtest.c
+ * @brief Smoke test of libmyshell: links a program against the static
+ *        library (so a symbol the library misses fails the build) and runs
+ *        a command line through msh_run().
+ *
+ * Built and run by `make libtest`.
+ *
+ * @author Abdelhamid
+ * @date 2025-12-14
+ */
+
+#include "myshell.h"
+#include <stdio.h>
+#include <string.h>
+
+int main(void) {
+  struct msh_ctx *ctx = msh_new();
+  struct msh_result r;
+
+  if (!ctx || msh_setenv(ctx, "WHO", "libmyshell") != 0)
+    return 1;
+  // `.` goes through source_file(), which reads the file into memory
+  int status = msh_run(ctx, ". /dev/null; echo hello $WHO | cat", &r);
+  int ok = status == 0 && strcmp(r.out, "hello libmyshell\n") == 0 &&
+           r.err_len == 0;
+  if (!ok)
+    fprintf(stderr, "libtest: status %d, out \"%s\", err \"%s\"\n", status,
+            r.out ? r.out : "", r.err ? r.err : "");
+  else
+    printf("libtest: ok\n");
+  msh_result_free(&r);
+  msh_free(ctx);
+  return ok ? 0 : 1;
+}
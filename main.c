@@ -12,33 +12,136 @@
 
 #include "shell.h"
 
+/** @brief Name of the startup file run by interactive shells. */
+#define RC_FILE ".myshellrc"
+
+/**
+ * @brief Runs a script non-interactively.
+ *
+ * Handles `myshell script [args...]` and `myshell -c text [name [args...]]`:
+ * `$0` is the script (or `name`) and the remaining arguments become the
+ * positional parameters.
+ *
+ * @return int The exit status of the script.
+ */
+int run_script(int argc, char **argv) {
+  char *text;
+  int first; // index of the first positional parameter
+  int use_cache = 0;
+
+  if (strcmp(argv[1], "-c") == 0) {
+    if (argc < 3) {
+      fprintf(stderr, "myshell: -c: option requires an argument\n");
+      return 2;
+    }
+    text = strdup(argv[2]);
+    if (argc > 3)
+      shell_name = argv[3];
+    first = 4;
+  } else {
+    text = read_script(argv[1]);
+    if (!text)
+      return 127;
+    shell_name = argv[1];
+    first = 2;
+    use_cache = 1;
+  }
+  shell_params = argv + (first < argc ? first : argc);
+  shell_num_params = first < argc ? argc - first : 0;
+
+  load_dirs();
+  int status = run_script_text(text, use_cache);
+  free(text);
+  fflush(NULL);
+  profile_stop();
+  stats_export(1);
+  return status;
+}
+
+/**
+ * @brief Runs `~/.myshellrc` in the shell, if it exists.
+ *
+ * Its compiled form is cached by content (see source_file()), so only the
+ * first start after an edit parses it.
+ *
+ * @return int 1 to continue, 0 if the file exits the shell.
+ */
+static int load_rc() {
+  char path[1024];
+  struct stat st;
+  char *home = getenv("HOME");
+  if (!home)
+    home = getenv("USERPROFILE"); // Windows fallback
+  if (!home)
+    return 1;
+
+  snprintf(path, sizeof(path), "%s/%s", home, RC_FILE);
+  if (stat(path, &st) != 0)
+    return 1;
+  return source_file(path, NULL);
+}
+
 /**
  * @brief Main entry point of the shell program.
  *
- * The main function performs the following steps:
- * 1. Initializes the shell (loading configuration/history).
+ * With arguments, runs a script file or `-c` text and exits with its
+ * status, or runs as (or through) a server (see server.c). Otherwise:
+ * 1. Initializes the shell (loading history from the session image or
+ *    its file, running `~/.myshellrc` unless `--norc` is given, resuming
+ *    pending `rm --async` deletions).
  * 2. Enter the main shell loop (`shell_loop`).
  * 3. On exit, saves the history and performs necessary cleanup.
  *
- * @param argc Argument count (unused).
- * @param argv Argument vector (unused).
- * @return int Exit status (EXIT_SUCCESS).
+ * @param argc Argument count.
+ * @param argv Argument vector (`[script | -c text] [args...]`,
+ *             `--server socket` or `--client socket ...`), optionally
+ *             after `--norc` and `--profile=file`.
+ * @return int Exit status (of the last command, or the `exit` argument).
  */
 int main(int argc, char **argv) {
-  // Suppress unused variable warnings
-  (void)argc;
-  (void)argv;
+  int norc = argc > 1 && strcmp(argv[1], "--norc") == 0;
+  if (norc) {
+    argc--;
+    argv++;
+  }
+  if (argc > 1 && strncmp(argv[1], "--profile=", 10) == 0) {
+    profile_start(argv[1] + 10);
+    argc--;
+    argv++;
+  }
+  if (argc > 2 && strcmp(argv[1], "--server") == 0)
+    return server_main(argv[2]);
+  if (argc > 2 && strcmp(argv[1], "--client") == 0)
+    return client_main(argv[2], argc - 2, argv + 2);
+  if (argc > 1)
+    return run_script(argc, argv);
+  interactive = 1;
 
-  // Load history from file
-  load_history();
+  // Restore history and the directory database used by `z` from the
+  // session image, or load them from their files
+  if (!session_load()) {
+    load_history();
+    load_dirs();
+  }
+
+  // Run the user's startup file
+  int running = norc || load_rc();
+
+  // Finish deleting anything `rm --async` left in the trash
+  trash_resume();
 
   // Start the main shell loop
-  shell_loop();
+  if (running)
+    shell_loop();
 
-  // Save history before exiting
+  // Save history before exiting, then the image for the next start, then
+  // the last metrics
   save_history();
+  session_save();
+  profile_stop();
+  stats_export(1);
 
-  return EXIT_SUCCESS;
+  return last_status;
 }
 
 /**
@@ -47,9 +150,10 @@ int main(int argc, char **argv) {
  * This function handles the core REPL (Read-Eval-Print Loop) logic:
  * 1. **Read**: Display prompt and read a line of input.
  * 2. **Record**: Add the command line to history.
- * 3. **Parse**: Tokenize the input string into arguments.
- * 4. **Execute**: Run the parsed command (built-in or external).
- * 5. **Cleanup**: Free allocated memory for the line and arguments.
+ * 3. **Compile & Execute**: the input is compiled to bytecode and run by
+ *    the VM. While it is incomplete (an `if` without `fi`, an open quote),
+ *    more lines are read with a `> ` prompt.
+ * 4. **Cleanup**: Reap finished background children and free the line.
  *
  * The loop runs indefinitely until `execute_command` returns 0 (e.g., on
  * 'exit').
@@ -57,29 +161,55 @@ int main(int argc, char **argv) {
 void shell_loop() {
   char *line = NULL;
   size_t len = 0;
-  char **args;
   int status = 1;
+  int lines_read = 0;
 
   do {
+    int incomplete;
+    struct program *prog;
+
     type_prompt();
     read_line(&line, &len);
+    while (!(prog = compile_script(line, &incomplete)) && incomplete &&
+           read_continuation(&line, &len))
+      ;
+    // Timed from here: waiting for continuation lines is the user's time
+    uint64_t start = stats_now();
+
+    // Number the session's lines like those of a script, so the profile
+    // tells them apart
+    if (prog && profile_active()) {
+      for (int i = 0; i < prog->len; i++)
+        prog->code[i].line += lines_read;
+    }
+    for (const char *c = line; c && *c; c++)
+      lines_read += *c == '\n';
 
     // Add non-empty lines to history
     if (line && *line != '\0') {
       add_history(line);
     }
 
-    args = parse_input(line);
-    status = execute_command(args);
+    if (prog) {
+      status = vm_run(prog);
+      program_free(prog);
+    } else {
+      if (incomplete)
+        fprintf(stderr, "shell: syntax error: unexpected end of file\n");
+      last_status = 2;
+    }
+
+    // Reap finished background children (e.g. process substitutions)
+    jobs_reap(0);
+
+    // Export metrics when the interval has passed
+    stats_export(0);
+    stats_latency(STAT_PROMPT, stats_now() - start);
 
     // cleanup
     if (line) {
       free(line);
       line = NULL;
     }
-    if (args) {
-      free(args);
-      args = NULL;
-    }
   } while (status);
 }
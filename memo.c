@@ -0,0 +1,364 @@
+/**
+ * @file memo.c
+ * @brief The `memo` built-in: replays the results of deterministic
+ *        commands instead of running them again.
+ *
+ * `memo cmd args...` looks the command up in a local store. The key is
+ * made of the arguments, the working directory, the variables named with
+ * `-e`, and the size and modification time (with `-c`: the content hash)
+ * of the input files named with `-i`. On a hit, the stored standard
+ * output, standard error and exit status are replayed without running
+ * anything; on a miss, the command runs with its output captured, which
+ * is then copied out and stored.
+ *
+ * Entries live in the `memo` directory of the cache directory (see
+ * cache.c), named after a hash of the key. Each entry also holds the key
+ * itself, compared on load, so a hash collision can never replay the
+ * wrong output. Entries are written to a temporary file and renamed into
+ * place, and read through a mapping, so concurrent shells can share the
+ * store (and evict from it) safely.
+ *
+ * The store is kept under `$MYSHELL_MEMO_SIZE` bytes (suffixes K, M, G;
+ * default 64M): a hit refreshes the modification time of its entry, and
+ * after each store the least recently used entries are removed. Results
+ * larger than a quarter of the limit are not stored.
+ *
+ * @author Abdelhamid
+ * @date 2025-12-14
+ */
+
+#include "shell.h"
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+/** @brief First bytes of a memo entry. */
+#define MEMO_MAGIC "MSHM"
+
+/** @brief Default size limit of the store, in bytes. */
+#define MEMO_DEFAULT_SIZE (64LL << 20)
+
+/**
+ * @brief Header of a memo entry, followed by the key, the standard output
+ *        and the standard error.
+ */
+struct memo_header {
+  char magic[4];    /**< MEMO_MAGIC. */
+  int32_t status;   /**< Exit status of the command. */
+  uint64_t key_len; /**< Bytes of key. */
+  uint64_t out_len; /**< Bytes of standard output. */
+  uint64_t err_len; /**< Bytes of standard error. */
+};
+
+#ifndef _WIN32
+/**
+ * @brief A growable byte buffer (the key being built).
+ */
+struct memo_key {
+  char *data; /**< The bytes. */
+  size_t len; /**< Bytes used. */
+  size_t cap; /**< Bytes allocated. */
+};
+
+/**
+ * @brief Appends a NUL-terminated field to the key.
+ */
+static void key_add(struct memo_key *k, const char *field) {
+  size_t n = strlen(field) + 1;
+  if (k->len + n > k->cap) {
+    k->cap = (k->len + n) * 2;
+    k->data = realloc(k->data, k->cap);
+    if (!k->data) {
+      fprintf(stderr, "shell: allocation error\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  memcpy(k->data + k->len, field, n);
+  k->len += n;
+}
+
+/**
+ * @brief Adds the stamp of an input file: size and mtime, or with
+ *        `content` a hash of its bytes.
+ */
+static void key_add_input(struct memo_key *k, const char *path, int content) {
+  struct stat st;
+  char stamp[64];
+  uint64_t h = HASH_SEED;
+
+  key_add(k, "in");
+  key_add(k, path);
+  if (fs_stat(path, &st, 0) != 0 ||
+      (content && hash_file(path, &h) != 0)) {
+    key_add(k, "missing");
+    return;
+  }
+  if (content)
+    snprintf(stamp, sizeof(stamp), "hash %016llx", (unsigned long long)h);
+  else
+    snprintf(stamp, sizeof(stamp), "%lld %lld", (long long)st.st_size,
+             fs_mtime_ns(&st));
+  key_add(k, stamp);
+}
+
+/**
+ * @brief Writes a whole buffer.
+ * @return int 0 on success, -1 on failure.
+ */
+static int write_all(int fd, const void *buf, size_t len) {
+  const char *p = buf;
+  while (len > 0) {
+    ssize_t n = write(fd, p, len);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return -1;
+    p += n;
+    len -= (size_t)n;
+  }
+  return 0;
+}
+
+/**
+ * @brief Copies a file from its start to a descriptor.
+ * @return int 0 on success, -1 on failure.
+ */
+static int copy_file(FILE *from, int to) {
+  char buf[65536];
+  size_t n;
+
+  rewind(from);
+  while ((n = fread(buf, 1, sizeof(buf), from)) > 0) {
+    if (write_all(to, buf, n) != 0)
+      return -1;
+  }
+  return 0;
+}
+
+/**
+ * @brief Replays an entry if it exists and matches the key.
+ * @return int 1 on a hit (status in `last_status`), 0 on a miss.
+ */
+static int memo_replay(const char *path, struct memo_key *k) {
+  struct stat st;
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+  if (fd < 0)
+    return 0;
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(struct memo_header)) {
+    close(fd);
+    return 0;
+  }
+  size_t size = (size_t)st.st_size;
+  char *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (map == MAP_FAILED) {
+    close(fd);
+    return 0;
+  }
+  struct memo_header *h = (struct memo_header *)map;
+  int hit = memcmp(h->magic, MEMO_MAGIC, 4) == 0 && h->key_len == k->len &&
+            h->out_len <= size && h->err_len <= size &&
+            sizeof(*h) + h->key_len + h->out_len + h->err_len == size &&
+            memcmp(map + sizeof(*h), k->data, k->len) == 0;
+  if (hit) {
+    // Recently used: eviction goes by modification time
+    futimens(fd, NULL);
+    const char *out = map + sizeof(*h) + h->key_len;
+    fflush(stdout);
+    write_all(STDOUT_FILENO, out, h->out_len);
+    write_all(STDERR_FILENO, out + h->out_len, h->err_len);
+    last_status = h->status;
+  }
+  munmap(map, size);
+  close(fd);
+  return hit;
+}
+
+/**
+ * @brief What a memo entry is written from.
+ */
+struct memo_entry {
+  struct memo_header h; /**< The header. */
+  struct memo_key *k;   /**< The key. */
+  FILE *out;            /**< Captured standard output. */
+  FILE *err;            /**< Captured standard error. */
+};
+
+/**
+ * @brief Writes a memo entry (see atomic_write_file()).
+ */
+static int write_entry(int fd, void *arg) {
+  struct memo_entry *e = arg;
+
+  if (write_all(fd, &e->h, sizeof(e->h)) != 0 ||
+      write_all(fd, e->k->data, e->k->len) != 0 ||
+      copy_file(e->out, fd) != 0 || copy_file(e->err, fd) != 0)
+    return -1;
+  return 0;
+}
+
+/**
+ * @brief Saves the captured results of a command in the store.
+ *
+ * Results larger than a quarter of the size limit are not stored: they
+ * would evict most of the store (or themselves) for a single entry.
+ */
+static void memo_store(const char *dir, const char *path, struct memo_key *k,
+                       FILE *out, FILE *err, int status) {
+  struct memo_entry e = {.k = k, .out = out, .err = err};
+  long long limit = size_limit("MYSHELL_MEMO_SIZE", MEMO_DEFAULT_SIZE);
+
+  fflush(out);
+  fflush(err);
+  memcpy(e.h.magic, MEMO_MAGIC, 4);
+  e.h.status = status;
+  e.h.key_len = k->len;
+  e.h.out_len = (uint64_t)ftell(out);
+  e.h.err_len = (uint64_t)ftell(err);
+  if (sizeof(e.h) + e.h.key_len + e.h.out_len + e.h.err_len >
+      (uint64_t)limit / 4)
+    return;
+  if (atomic_write_file(path, write_entry, &e) == 0)
+    evict_lru(dir, ".memo", limit);
+}
+
+/**
+ * @brief Runs a command with its standard output and error captured.
+ *
+ * The command runs in the shell like any other (built-ins and functions
+ * included); only descriptors 1 and 2 are redirected meanwhile.
+ *
+ * @return int The result of `execute_command()`.
+ */
+static int memo_run(char **cmd, FILE *out, FILE *err) {
+  jobs_flush();
+  int saved_out = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 0);
+  int saved_err = fcntl(STDERR_FILENO, F_DUPFD_CLOEXEC, 0);
+  dup2(fileno(out), STDOUT_FILENO);
+  dup2(fileno(err), STDERR_FILENO);
+
+  int result = execute_command(cmd);
+
+  jobs_flush();
+  dup2(saved_out, STDOUT_FILENO);
+  dup2(saved_err, STDERR_FILENO);
+  close(saved_out);
+  close(saved_err);
+  return result;
+}
+#endif
+
+/* =========================================================================
+ *                          Built-in Command Implementation
+ * ========================================================================= */
+
+/**
+ * @brief Runs a command, or replays its stored results.
+ *
+ * Usage: `memo [-c] [-i file]... [-e name]... command [args...]`
+ *
+ * - `-i file`: an input of the command; its size and modification time
+ *   are part of the key.
+ * - `-c`: use a hash of the content of the inputs instead.
+ * - `-e name`: the value of variable `name` is part of the key.
+ *
+ * On a miss the output appears when the command has finished. On Windows
+ * the command simply runs.
+ *
+ * @param args Null-terminated array of arguments.
+ * @return int 1 to continue execution, 0 if the command exits the shell.
+ */
+int shell_memo(char **args) {
+  int i = 1;
+
+#ifndef _WIN32
+  struct memo_key k = {NULL, 0, 0};
+  char cwd[4096];
+  int content = 0;
+
+  // Inputs are stamped after every option is known (-c may come last)
+  for (; args[i] && args[i][0] == '-' && args[i][1]; i++) {
+    if (strcmp(args[i], "--") == 0) {
+      i++;
+      break;
+    }
+    if (strcmp(args[i], "-c") == 0) {
+      content = 1;
+    } else if ((strcmp(args[i], "-i") == 0 || strcmp(args[i], "-e") == 0) &&
+               args[i + 1]) {
+      i++;
+    } else {
+      fprintf(stderr, "shell: memo: %s: invalid option\n", args[i]);
+      free(k.data);
+      last_status = 2;
+      return 1;
+    }
+  }
+  if (!args[i]) {
+    fprintf(stderr,
+            "Usage: memo [-c] [-i file]... [-e name]... command [args...]\n");
+    last_status = 2;
+    return 1;
+  }
+
+  key_add(&k, "cwd");
+  key_add(&k, getcwd(cwd, sizeof(cwd)) ? cwd : "?");
+  for (int j = 1; j < i; j++) {
+    if (strcmp(args[j], "-i") == 0) {
+      key_add_input(&k, args[++j], content);
+    } else if (strcmp(args[j], "-e") == 0) {
+      const char *value = var_get(args[++j]);
+      key_add(&k, "env");
+      key_add(&k, args[j]);
+      key_add(&k, value ? value : "\001unset");
+    }
+  }
+  key_add(&k, "argv");
+  for (int j = i; args[j]; j++)
+    key_add(&k, args[j]);
+
+  char dir[4096], path[4200];
+  int have_store = cache_dir(dir, sizeof(dir) - 8) == 0;
+  if (have_store) {
+    strcat(dir, "/memo");
+    snprintf(path, sizeof(path), "%s/%016llx.memo", dir,
+             (unsigned long long)hash_bytes(HASH_SEED, k.data, k.len));
+    if (memo_replay(path, &k)) {
+      stats_add(STAT_MEMO_HITS, 1);
+      free(k.data);
+      return 1;
+    }
+  }
+  stats_add(STAT_MEMO_MISSES, 1);
+
+  FILE *out = tmpfile();
+  FILE *err = tmpfile();
+  int result;
+  if (!out || !err) {
+    // Cannot capture: just run it
+    result = execute_command(args + i);
+  } else {
+    result = memo_run(args + i, out, err);
+    fflush(stdout);
+    copy_file(out, STDOUT_FILENO);
+    copy_file(err, STDERR_FILENO);
+    if (result && have_store) {
+      make_dirs(dir);
+      memo_store(dir, path, &k, out, err, last_status);
+    }
+  }
+  if (out)
+    fclose(out);
+  if (err)
+    fclose(err);
+  free(k.data);
+  return result;
+#else
+  for (; args[i] && args[i][0] == '-' && args[i][1]; i++) {
+    if ((strcmp(args[i], "-i") == 0 || strcmp(args[i], "-e") == 0) &&
+        args[i + 1])
+      i++;
+  }
+  return args[i] ? execute_command(args + i) : 1;
+#endif
+}
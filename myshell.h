@@ -0,0 +1,117 @@
+/**
+ * @file myshell.h
+ * @brief Public API of libmyshell: running shell command lines from C
+ *        programs without `/bin/sh`.
+ *
+ * Replaces `system()` and `popen()` for services that only need a command
+ * line run: the text is parsed by the shell's own compiler and run by its
+ * VM in a child process (the last command is exec'd directly), with its
+ * standard output and error optionally captured into memory.
+ *
+ * ```c
+ * struct msh_ctx *ctx = msh_new();
+ * struct msh_result r;
+ * msh_setenv(ctx, "LC_ALL", "C");
+ * if (msh_run(ctx, "ls /etc | count -l", &r) == 0)
+ *   printf("%.*s", (int)r.out_len, r.out);
+ * msh_result_free(&r);
+ * msh_free(ctx);
+ * ```
+ *
+ * A context holds the environment overrides and working directory its
+ * commands start from. Commands never change the calling process (a `cd`
+ * or assignment in one command does not carry over to the next). A
+ * context must not be used by two threads at once; separate contexts can
+ * be used from different threads.
+ *
+ * Link with `libmyshell.a` (or `-lmyshell`) and `-pthread`.
+ *
+ * @author Abdelhamid
+ * @date 2025-12-14
+ */
+
+#ifndef MYSHELL_H
+#define MYSHELL_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Marks the API as exported: the library is built with hidden
+ *        visibility, so nothing else of the shell is.
+ */
+#if defined(__GNUC__) && !defined(_WIN32)
+#define MSH_API __attribute__((visibility("default")))
+#else
+#define MSH_API
+#endif
+
+/** @brief A command context (opaque). */
+struct msh_ctx;
+
+/**
+ * @brief What a command produced.
+ */
+struct msh_result {
+  int status;     /**< Exit status (128+n if killed by signal n). */
+  char *out;      /**< Standard output (NUL-terminated). */
+  size_t out_len; /**< Bytes in `out`, without the NUL. */
+  char *err;      /**< Standard error (NUL-terminated). */
+  size_t err_len; /**< Bytes in `err`, without the NUL. */
+};
+
+/**
+ * @brief Creates a context that starts commands in the current directory
+ *        with the current environment.
+ * @return The context, or NULL if out of memory.
+ */
+MSH_API struct msh_ctx *msh_new(void);
+
+/**
+ * @brief Frees a context.
+ */
+MSH_API void msh_free(struct msh_ctx *ctx);
+
+/**
+ * @brief Sets a variable in the environment of the context's commands.
+ * @param value The value, or NULL to unset the variable.
+ * @return 0 on success, -1 on error (errno is set).
+ */
+MSH_API int msh_setenv(struct msh_ctx *ctx, const char *name,
+                       const char *value);
+
+/**
+ * @brief Sets the directory the context's commands start in.
+ * @param dir The directory (relative paths are resolved against the
+ *        context's current one).
+ * @return 0 on success, -1 on error (errno is set).
+ */
+MSH_API int msh_chdir(struct msh_ctx *ctx, const char *dir);
+
+/**
+ * @brief Runs a command line and waits for it.
+ *
+ * Standard input is inherited. Output is captured into `result` (release
+ * it with msh_result_free()); with a NULL `result`, it goes to the
+ * caller's standard output and error, as with `system()`. Syntax errors
+ * are reported on the command's standard error with status 2.
+ *
+ * @return The exit status, or -1 if the command could not be started
+ *         (errno is set).
+ */
+MSH_API int msh_run(struct msh_ctx *ctx, const char *cmd,
+                    struct msh_result *result);
+
+/**
+ * @brief Frees the buffers of a result.
+ */
+MSH_API void msh_result_free(struct msh_result *result);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MYSHELL_H */
@@ -3,59 +3,650 @@
  * @brief Input parsing module for the shell.
  *
  * This file implements the functionality to tokenize user input strings
- * into executable commands and arguments. It handles memory allocation
- * and resizing for the argument list.
+ * into executable commands and arguments. It is split in two stages:
+ *
+ * 1. **Lexing** (`lex_token`): finds the span of the next word or operator
+ *    in the source text. Quotes, backslashes and `<(...)`/`>(...)` groups
+ *    are kept inside words; operators such as `|`, `>` or `;` end them.
+ * 2. **Cooking** (`parse_input`): turns each word span into its final
+ *    string (quote removal, process substitution), attaches here-document
+ *    bodies, and builds the argument array. Operators are returned as
+ *    pointers into a static table, so the executor can tell a real `>` from
+ *    a quoted `'>'` with `is_operator()`.
  *
  * @author Abdelhamid
  * @date 2025-12-14
  */
 
 #include "shell.h"
+#include <ctype.h>
+#include <stddef.h>
+
+/**
+ * @brief Storage of the operator strings, back to back, so that
+ *        `is_operator()` can recognize a table entry by its address alone.
+ */
+static const char operator_text[] = "<<<\0<<-\0&&\0||\0;;\0|&\0>>\0<<\0"
+                                    "|\0&\0;\0<\0>\0(\0)\0\n";
+
+/**
+ * @brief Operator tokens recognized by the lexer (longest first).
+ */
+static const char *operators[] = {
+    operator_text + 0,  operator_text + 4,  operator_text + 8,
+    operator_text + 11, operator_text + 14, operator_text + 17,
+    operator_text + 20, operator_text + 23, operator_text + 26,
+    operator_text + 28, operator_text + 30, operator_text + 32,
+    operator_text + 34, operator_text + 36, operator_text + 38,
+    operator_text + 40};
+
+/** @brief Number of entries in `operators`. */
+#define NUM_OPERATORS ((int)(sizeof(operators) / sizeof(operators[0])))
+
+/**
+ * @brief Returns the operator table entry equal to `op`.
+ */
+static const char *operator_entry(const char *op) {
+  for (int i = 0; i < NUM_OPERATORS; i++) {
+    if (strcmp(operators[i], op) == 0)
+      return operators[i];
+  }
+  return NULL;
+}
+
+/**
+ * @brief Checks whether `tok` is the operator `op` (and not a quoted word).
+ *
+ * @param tok A token returned by `parse_input()`.
+ * @param op The operator text, e.g. ">".
+ * @return int 1 if `tok` is that operator, 0 otherwise.
+ */
+int is_operator(const char *tok, const char *op) {
+  if (tok < operator_text || tok >= operator_text + sizeof(operator_text))
+    return 0;
+  return strcmp(tok, op) == 0;
+}
+
+/**
+ * @brief Skips a balanced `(...)` or `{...}` group starting at `line[pos]`.
+ *
+ * Quotes inside the group are honoured, so `<(echo ")")` works.
+ *
+ * @param line Source text.
+ * @param pos Index of the opening parenthesis or brace.
+ * @return int Index just past the matching close, or -1 if unterminated.
+ */
+static int skip_group(const char *line, int pos) {
+  char open = line[pos], close = open == '{' ? '}' : ')';
+  int depth = 0;
+  char quote = 0;
+
+  for (; line[pos]; pos++) {
+    char c = line[pos];
+    if (quote) {
+      if (c == quote)
+        quote = 0;
+      else if (c == '\\' && quote == '"' && line[pos + 1])
+        pos++;
+    } else if (c == '\\' && line[pos + 1]) {
+      pos++;
+    } else if (c == '\'' || c == '"') {
+      quote = c;
+    } else if (c == open) {
+      depth++;
+    } else if (c == close && --depth == 0) {
+      return pos + 1;
+    }
+  }
+  return -1;
+}
+
+/**
+ * @brief Scans the next token in `line`, starting at `*pos`.
+ *
+ * Skips blanks and `#` comments, then returns either an operator or a word
+ * span. A word ends at unquoted whitespace or at an operator character;
+ * `<(` and `>(` inside or at the start of a word begin a process
+ * substitution, which extends to the matching `)`. Likewise `${...}` and
+ * `$((...))` extend to their matching close, so they may contain blanks
+ * and operator characters.
+ *
+ * @param line Source text.
+ * @param pos In: where to start scanning. Out: just past the token.
+ * @param tok Receives the token type and span.
+ * @return int The token type (TOK_END at the end of the text).
+ */
+int lex_token(const char *line, int *pos, struct token *tok) {
+  int i = *pos;
+
+  // Skip blanks (newlines are tokens) and comments
+  while (line[i] == ' ' || line[i] == '\t' || line[i] == '\r' ||
+         line[i] == '\a')
+    i++;
+  if (line[i] == '#') {
+    while (line[i] && line[i] != '\n')
+      i++;
+  }
+
+  tok->start = i;
+  tok->op = NULL;
+  tok->incomplete = 0;
+
+  if (line[i] == '\0') {
+    tok->type = TOK_END;
+    tok->len = 0;
+    *pos = i;
+    return TOK_END;
+  }
+
+  // Operators (but `<(` / `>(` start a word)
+  if (!((line[i] == '<' || line[i] == '>') && line[i + 1] == '(')) {
+    for (int k = 0; k < NUM_OPERATORS; k++) {
+      size_t n = strlen(operators[k]);
+      if (strncmp(line + i, operators[k], n) == 0) {
+        tok->type = TOK_OP;
+        tok->op = operators[k];
+        tok->len = (int)n;
+        *pos = i + (int)n;
+        return TOK_OP;
+      }
+    }
+  }
+
+  // Word
+  char quote = 0;
+  for (; line[i]; i++) {
+    char c = line[i];
+    if (quote) {
+      if (c == quote)
+        quote = 0;
+      else if (c == '\\' && quote == '"' && line[i + 1])
+        i++;
+      continue;
+    }
+    if (c == '\\') {
+      if (line[i + 1])
+        i++;
+      continue;
+    }
+    if (c == '\'' || c == '"') {
+      quote = c;
+      continue;
+    }
+    if ((c == '<' || c == '>' || c == '$') &&
+        (line[i + 1] == '(' || (c == '$' && line[i + 1] == '{'))) {
+      int end = skip_group(line, i + 1);
+      if (end < 0) {
+        tok->incomplete = 1;
+        i = (int)strlen(line);
+        break;
+      }
+      i = end - 1;
+      continue;
+    }
+    if (strchr(" \t\r\n\a|&;<>()", c))
+      break;
+  }
+  if (quote)
+    tok->incomplete = 1;
+
+  tok->type = TOK_WORD;
+  tok->len = i - tok->start;
+  *pos = i;
+  return TOK_WORD;
+}
+
+/**
+ * @brief Growable character buffer used while cooking words.
+ */
+struct strbuf {
+  char *data;
+  size_t len;
+  size_t cap;
+};
+
+/**
+ * @brief Appends `n` bytes to a string buffer.
+ */
+static void sb_append(struct strbuf *sb, const char *s, size_t n) {
+  if (sb->len + n + 1 > sb->cap) {
+    while (sb->len + n + 1 > sb->cap)
+      sb->cap = sb->cap ? sb->cap * 2 : 256;
+    sb->data = realloc(sb->data, sb->cap);
+    if (!sb->data) {
+      fprintf(stderr, "shell: allocation error\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  memcpy(sb->data + sb->len, s, n);
+  sb->len += n;
+  sb->data[sb->len] = '\0';
+}
+
+/**
+ * @brief Ends the word being cooked in `sb` (appends its terminator).
+ */
+static void sb_end_word(struct strbuf *sb) {
+  sb_append(sb, "", 0);
+  sb->len++;
+}
+
+/**
+ * @brief Appends an unquoted expansion result, splitting it on `IFS`.
+ *
+ * Runs of IFS whitespace separate words; every other IFS character ends
+ * the current word, even an empty one.
+ *
+ * @param value The expansion result.
+ * @param sb Output buffer.
+ * @param started In/out: whether the current word has begun.
+ * @return int Number of words completed.
+ */
+static int split_fields(const char *value, struct strbuf *sb, int *started) {
+  const char *ifs = var_get("IFS");
+  int words = 0;
+
+  if (!ifs)
+    ifs = " \t\n";
+  for (const char *v = value; *v; v++) {
+    if (!strchr(ifs, *v)) {
+      sb_append(sb, v, 1);
+      *started = 1;
+    } else if (*started || !isspace((unsigned char)*v)) {
+      sb_end_word(sb);
+      words++;
+      *started = 0;
+    }
+  }
+  return words;
+}
+
+/**
+ * @brief Cooks one word span: removes quotes and runs substitutions.
+ *
+ * - `'...'` is taken literally.
+ * - `"..."` is taken literally except that `\` escapes `"`, `\` and `$`,
+ *   and `$` expansions are performed.
+ * - An unquoted `\` escapes the next character.
+ * - `$name`, `${...}` and `$((...))` are expanded (see expand.c). Unless
+ *   `split` is zero or the word is an assignment (`NAME=value`), unquoted
+ *   results are split into several words on `IFS`, and a word that ends
+ *   up empty is dropped. `"$@"` yields one word per positional parameter.
+ * - `<(cmd)` / `>(cmd)` are replaced by a `/dev/fd/N` path connected to
+ *   `cmd` (see `process_substitution()`).
+ *
+ * The resulting words are appended to `sb`, each NUL-terminated.
+ *
+ * @param src Start of the word in the source text.
+ * @param len Length of the word span.
+ * @param sb Output buffer.
+ * @param split Non-zero to perform field splitting.
+ * @return int Number of words produced.
+ */
+static int cook_word(const char *src, int len, struct strbuf *sb, int split) {
+  char quote = 0;
+  int words = 0;
+  // The current word has begun (quotes count, so "" is a word)
+  int started = 0;
+  // "$@" with no parameters: the quotes alone do not make a word
+  int empty_at = 0;
+  size_t word_start = sb->len;
+
+  if (split) {
+    int n = 0;
+    while (n < len && (isalnum((unsigned char)src[n]) || src[n] == '_'))
+      n++;
+    if (n > 0 && n < len && src[n] == '=' && !isdigit((unsigned char)src[0]))
+      split = 0;
+  }
+
+  for (int i = 0; i < len; i++) {
+    char c = src[i];
+    if (quote == '\'') {
+      if (c == '\'')
+        quote = 0;
+      else
+        sb_append(sb, &c, 1);
+    } else if (quote == '"' && c == '"') {
+      quote = 0;
+    } else if (quote == '"' && c == '\\') {
+      if (i + 1 < len && strchr("\"\\$`", src[i + 1]))
+        c = src[++i];
+      sb_append(sb, &c, 1);
+    } else if (c == '$' && i + 1 < len && src[i + 1] == '@' && quote) {
+      // "$@": each parameter becomes its own word
+      for (int k = 0; k < shell_num_params; k++) {
+        if (k > 0) {
+          sb_end_word(sb);
+          words++;
+          word_start = sb->len;
+        }
+        sb_append(sb, shell_params[k], strlen(shell_params[k]));
+      }
+      if (shell_num_params == 0)
+        empty_at = 1;
+      i++;
+    } else if (c == '$') {
+      char *value = expand_dollar(src, len, &i);
+      if (!value) {
+        sb_append(sb, &c, 1);
+        started = 1;
+      } else if (quote || !split) {
+        sb_append(sb, value, strlen(value));
+        started = 1;
+      } else {
+        int done = split_fields(value, sb, &started);
+        words += done;
+        if (done > 0)
+          word_start = sb->len;
+      }
+      free(value);
+    } else if (quote) {
+      sb_append(sb, &c, 1);
+    } else if (c == '\'' || c == '"') {
+      quote = c;
+      started = 1;
+    } else if (c == '\\') {
+      if (i + 1 < len)
+        sb_append(sb, &src[++i], 1);
+      started = 1;
+    } else if ((c == '<' || c == '>') && i + 1 < len && src[i + 1] == '(') {
+      int end = skip_group(src, i + 1);
+      if (end < 0 || end > len)
+        end = len;
+      // Inner command text, without the parentheses
+      char *cmd = strndup(src + i + 2, end - i - 3 > 0 ? end - i - 3 : 0);
+      char path[32];
+      int fd = process_substitution(cmd, c == '<');
+      free(cmd);
+      if (fd >= 0) {
+        snprintf(path, sizeof(path), "/dev/fd/%d", fd);
+        sb_append(sb, path, strlen(path));
+      }
+      started = 1;
+      i = end - 1;
+    } else {
+      sb_append(sb, &c, 1);
+      started = 1;
+    }
+  }
+
+  if (empty_at && sb->len == word_start)
+    started = 0;
+  if (started || sb->len > word_start || !split) {
+    // Make sure every word is terminated, even an empty one ("")
+    sb_end_word(sb);
+    words++;
+  }
+  return words;
+}
+
+/**
+ * @brief Extracts a here-document delimiter from its word span.
+ *
+ * Quotes and backslashes are removed. If any part of the word was quoted
+ * (`<<'EOF'`, `<<"EOF"`, `<<\EOF`), the body is taken literally.
+ *
+ * @param src Start of the delimiter word.
+ * @param len Length of the word span.
+ * @param out Receives the delimiter text.
+ * @param size Size of `out`.
+ * @return int 1 if the delimiter was quoted, 0 otherwise.
+ */
+int heredoc_delimiter(const char *src, int len, char *out, size_t size) {
+  int quoted = 0;
+  size_t k = 0;
+  char quote = 0;
+
+  for (int i = 0; i < len && k + 1 < size; i++) {
+    char c = src[i];
+    if (quote) {
+      if (c == quote)
+        quote = 0;
+      else
+        out[k++] = c;
+    } else if (c == '\'' || c == '"') {
+      quote = c;
+      quoted = 1;
+    } else if (c == '\\' && i + 1 < len) {
+      out[k++] = src[++i];
+      quoted = 1;
+    } else {
+      out[k++] = c;
+    }
+  }
+  out[k] = '\0';
+  return quoted;
+}
+
+/**
+ * @brief Copies a here-document body out of the command text.
+ *
+ * Reads lines starting at `*body_pos` until a line equal to `delim`
+ * (after removing leading tabs when `strip_tabs` is set, for `<<-`).
+ * Unless the delimiter was quoted, `$` expansions are performed and `\`
+ * followed by `$`, `` ` ``, `\` or a newline is processed as an escape; a
+ * quoted delimiter leaves the body completely untouched.
+ *
+ * @param line The full command text (bodies follow the command line).
+ * @param body_pos In: start of the body. Out: just past the delimiter line.
+ * @param delim The delimiter.
+ * @param strip_tabs Non-zero for `<<-`.
+ * @param quoted Non-zero if the delimiter was quoted.
+ * @param out Receives the body.
+ */
+static void heredoc_body(const char *line, int *body_pos, const char *delim,
+                         int strip_tabs, int quoted, struct strbuf *out) {
+  int pos = *body_pos;
+  size_t dlen = strlen(delim);
+
+  while (line[pos]) {
+    int start = pos;
+    while (strip_tabs && line[start] == '\t')
+      start++;
+    int end = start;
+    while (line[end] && line[end] != '\n')
+      end++;
+    pos = line[end] ? end + 1 : end;
+
+    if ((size_t)(end - start) == dlen && strncmp(line + start, delim, dlen) == 0)
+      break;
+
+    // Copy the line (including its newline)
+    for (int i = start; i < pos; i++) {
+      if (!quoted && line[i] == '\\' && i + 1 < pos &&
+          strchr("$`\\\n", line[i + 1])) {
+        i++;
+        if (line[i] == '\n')
+          continue; // line continuation
+      } else if (!quoted && line[i] == '$') {
+        char *value = expand_dollar(line, end, &i);
+        if (value) {
+          sb_append(out, value, strlen(value));
+          free(value);
+          continue;
+        }
+      }
+      sb_append(out, &line[i], 1);
+    }
+  }
+  *body_pos = pos;
+}
+
+/**
+ * @brief Turns a here-document/here-string into a `/dev/fd/N` word.
+ *
+ * @param body The document text.
+ * @param sb Output buffer receiving the path word.
+ */
+static void heredoc_word(struct strbuf *body, struct strbuf *sb) {
+  char path[32];
+  int fd = here_document(body->data ? body->data : "", body->len);
+  if (fd >= 0) {
+    snprintf(path, sizeof(path), "/dev/fd/%d", fd);
+    sb_append(sb, path, strlen(path));
+  }
+  sb_append(sb, "", 0);
+  sb->len++;
+}
+
+/**
+ * @brief Storage behind an argument array returned by `parse_input()`.
+ *
+ * The cooked strings live in one `arena`; `argv` points into it (or into
+ * the static operator table). `free_args()` recovers the header from the
+ * `argv` pointer, so callers may freely overwrite entries of the array.
+ */
+struct arglist {
+  char *arena;   /**< All cooked word strings, back to back. */
+  char *argv[];  /**< The null-terminated argument array. */
+};
 
 /**
  * @brief Parses a raw input line into an array of tokens (arguments).
  *
- * This function uses `strtok` to split the input string based on standard
- * delimiters (space, tab, newline). It dynamically allocates memory for
- * the array of pointers and resizes it if the number of arguments exceeds
- * the initial buffer size.
+ * Words are cooked (quotes removed, substitutions performed) and operators
+ * are returned as entries of the static operator table. Newline tokens are
+ * dropped. Memory is allocated dynamically and grows with the input.
  *
  * @param line The input string read from the user.
  * @return char** A null-terminated array of strings, where the first element
  *                is the command and subsequent elements are arguments.
- *                Returns NULL if allocation fails.
+ *                Release it with `free_args()`.
  */
 char **parse_input(char *line) {
+  struct strbuf sb = {NULL, 0, 0};
   int bufsize = MAX_ARGS;
   int position = 0;
-  char **tokens = malloc(bufsize * sizeof(char *));
-  char *token;
+  // While building, words are stored as arena offsets (the arena may move)
+  ptrdiff_t *offsets = malloc(bufsize * sizeof(ptrdiff_t));
+  const char **ops = malloc(bufsize * sizeof(char *));
+  struct token tok;
+  int pos = 0;
 
-  if (!tokens) {
+  SHELL_PROBE1(parse__start, line);
+  if (!offsets || !ops) {
     fprintf(stderr, "shell: allocation error\n");
     exit(EXIT_FAILURE);
   }
 
-  // Initialize strtok with the line and delimiters
-  token = strtok(line, DELIMITERS);
-  while (token != NULL) {
-    tokens[position] = token;
+  // Here-document bodies start on the line after the command
+  int body_pos = -1;
+
+  while (line && lex_token(line, &pos, &tok) != TOK_END) {
+    if (tok.type == TOK_OP && strcmp(tok.op, "\n") == 0) {
+      // Skip over the here-document bodies read for this line
+      if (body_pos > pos)
+        pos = body_pos;
+      body_pos = -1;
+      continue;
+    }
+
+    if (tok.type == TOK_OP &&
+        (strcmp(tok.op, "<<") == 0 || strcmp(tok.op, "<<-") == 0 ||
+         strcmp(tok.op, "<<<") == 0)) {
+      const char *op = tok.op;
+      if (lex_token(line, &pos, &tok) != TOK_WORD) {
+        fprintf(stderr, "shell: syntax error: expected word after '%s'\n", op);
+        break;
+      }
+
+      // The document becomes an input redirection from /dev/fd/N
+      struct strbuf body = {NULL, 0, 0};
+      if (strcmp(op, "<<<") == 0) {
+        cook_word(line + tok.start, tok.len, &body, 0);
+        body.len--; // drop the terminator counted by cook_word
+        sb_append(&body, "\n", 1);
+      } else {
+        char delim[256];
+        int quoted = heredoc_delimiter(line + tok.start, tok.len, delim,
+                                       sizeof(delim));
+        if (body_pos < 0) {
+          const char *nl = strchr(line + pos, '\n');
+          body_pos = nl ? (int)(nl - line) + 1 : (int)strlen(line);
+        }
+        heredoc_body(line, &body_pos, delim, op[2] == '-', quoted, &body);
+      }
+      ops[position] = operator_entry("<");
+      offsets[position++] = -1;
+      if (position >= bufsize - 1) {
+        bufsize += MAX_ARGS;
+        offsets = realloc(offsets, bufsize * sizeof(ptrdiff_t));
+        ops = realloc(ops, bufsize * sizeof(char *));
+        if (!offsets || !ops) {
+          fprintf(stderr, "shell: allocation error\n");
+          exit(EXIT_FAILURE);
+        }
+      }
+      ops[position] = NULL;
+      offsets[position] = (ptrdiff_t)sb.len;
+      heredoc_word(&body, &sb);
+      free(body.data);
+    } else if (tok.type == TOK_OP) {
+      ops[position] = tok.op;
+      offsets[position] = -1;
+    } else {
+      ptrdiff_t start = (ptrdiff_t)sb.len;
+      int words = cook_word(line + tok.start, tok.len, &sb, 1);
+      // Field splitting may have produced several words (or none)
+      for (int w = 0; w < words; w++) {
+        ops[position] = NULL;
+        offsets[position++] = start;
+        start += (ptrdiff_t)strlen(sb.data + start) + 1;
+        if (position >= bufsize - 1) {
+          bufsize += MAX_ARGS;
+          offsets = realloc(offsets, bufsize * sizeof(ptrdiff_t));
+          ops = realloc(ops, bufsize * sizeof(char *));
+          if (!offsets || !ops) {
+            fprintf(stderr, "shell: allocation error\n");
+            exit(EXIT_FAILURE);
+          }
+        }
+      }
+      continue;
+    }
     position++;
 
-    // Resize buffer if we exceeded the limit
+    // Resize buffers if we exceeded the limit
     if (position >= bufsize) {
       bufsize += MAX_ARGS;
-      tokens = realloc(tokens, bufsize * sizeof(char *));
-      if (!tokens) {
+      offsets = realloc(offsets, bufsize * sizeof(ptrdiff_t));
+      ops = realloc(ops, bufsize * sizeof(char *));
+      if (!offsets || !ops) {
         fprintf(stderr, "shell: allocation error\n");
         exit(EXIT_FAILURE);
       }
     }
+  }
 
-    token = strtok(NULL, DELIMITERS);
+  struct arglist *list =
+      malloc(sizeof(struct arglist) + (position + 1) * sizeof(char *));
+  if (!list) {
+    fprintf(stderr, "shell: allocation error\n");
+    exit(EXIT_FAILURE);
+  }
+  list->arena = sb.data;
+  for (int i = 0; i < position; i++) {
+    list->argv[i] = ops[i] ? (char *)ops[i] : sb.data + offsets[i];
   }
 
   // Null-terminate the list of arguments
-  tokens[position] = NULL;
-  return tokens;
+  list->argv[position] = NULL;
+  free(offsets);
+  free(ops);
+  SHELL_PROBE1(parse__done, position);
+  return list->argv;
+}
+
+/**
+ * @brief Releases an argument array returned by `parse_input()`.
+ * @param args The array (may be NULL).
+ */
+void free_args(char **args) {
+  if (!args)
+    return;
+  struct arglist *list =
+      (struct arglist *)((char *)args - offsetof(struct arglist, argv));
+  free(list->arena);
+  free(list);
 }
@@ -0,0 +1,109 @@
+/**
+ * @file pool.c
+ * @brief Worker pool used by built-ins that process many independent items.
+ *
+ * The pool spreads a fixed number of jobs (identified by their index) over
+ * a set of worker threads. Workers claim the next job with an atomic counter,
+ * so there is no queue to lock and each job is processed exactly once.
+ * Callers store results by job index, which keeps their output order
+ * deterministic regardless of which thread finished first.
+ *
+ * @author Abdelhamid
+ * @date 2025-12-14
+ */
+
+#include "shell.h"
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+/**
+ * @brief Shared state handed to every worker thread.
+ */
+struct pool_state {
+  int njobs;                    /**< Total number of jobs. */
+  int next;                     /**< Index of the next unclaimed job. */
+  void (*fn)(int idx, void *ctx); /**< Job function. */
+  void *ctx;                    /**< Caller context passed to `fn`. */
+};
+
+/**
+ * @brief Returns the number of online CPUs (at least 1).
+ * @return int Number of processors available to the shell.
+ */
+int pool_cpu_count() {
+#ifdef _WIN32
+  char *n = getenv("NUMBER_OF_PROCESSORS");
+  int cpus = n ? atoi(n) : 1;
+#else
+  int cpus = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+  return cpus > 0 ? cpus : 1;
+}
+
+#ifndef _WIN32
+/**
+ * @brief Worker thread body: claims and runs jobs until none are left.
+ * @param arg Pointer to the shared `pool_state`.
+ * @return void* Always NULL.
+ */
+static void *pool_worker(void *arg) {
+  struct pool_state *st = arg;
+  int idx;
+
+  while ((idx = __atomic_fetch_add(&st->next, 1, __ATOMIC_RELAXED)) <
+         st->njobs) {
+    st->fn(idx, st->ctx);
+  }
+  return NULL;
+}
+#endif
+
+/**
+ * @brief Runs `fn(idx, ctx)` for every idx in [0, njobs) on a thread pool.
+ *
+ * Blocks until every job has completed. The calling thread takes part in
+ * the work, so `nthreads` threads are busy in total. If threads cannot be
+ * created (or on Windows) the remaining jobs simply run on the caller.
+ *
+ * @param njobs Number of jobs to run.
+ * @param fn Function executed once per job index.
+ * @param ctx Opaque pointer forwarded to `fn`.
+ * @param nthreads Maximum concurrency; values < 1 mean "one per CPU".
+ */
+void pool_run(int njobs, void (*fn)(int idx, void *ctx), void *ctx,
+              int nthreads) {
+#ifdef _WIN32
+  (void)nthreads;
+  for (int i = 0; i < njobs; i++)
+    fn(i, ctx);
+#else
+  struct pool_state st = {njobs, 0, fn, ctx};
+
+  if (nthreads < 1)
+    nthreads = pool_cpu_count();
+  if (nthreads > njobs)
+    nthreads = njobs;
+  if (nthreads <= 1) {
+    pool_worker(&st);
+    return;
+  }
+
+  pthread_t *threads = malloc((nthreads - 1) * sizeof(pthread_t));
+  int started = 0;
+  if (threads) {
+    for (; started < nthreads - 1; started++) {
+      if (pthread_create(&threads[started], NULL, pool_worker, &st) != 0)
+        break;
+    }
+  }
+
+  // The calling thread works too, then waits for the helpers
+  pool_worker(&st);
+  for (int i = 0; i < started; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  free(threads);
+#endif
+}
@@ -0,0 +1,576 @@
+/**
+ * @file profile.c
+ * @brief Line-level profiler of scripts: `myshell --profile=out.json
+ *        script` and `set -o profile`.
+ *
+ * The VM brackets every command it runs (simple commands, pipelines,
+ * subshells) with profile_enter()/profile_leave(), and every function call
+ * with profile_call()/profile_return(). While profiling is on, each
+ * bracket reads the monotonic clock, the CPU time of the shell and of its
+ * reaped children, and the fork counter of stats.c. The difference is
+ * charged to the script line (file and line number) and to the function.
+ * When profiling is off, each bracket is a single test.
+ *
+ * A line's time includes the functions it calls. Its self time is what is
+ * left once those calls are subtracted. That self time is also charged to
+ * the whole stack of lines and functions that led to it. The stacks are
+ * written in the "folded" format of flamegraph.pl and speedscope:
+ *
+ *     deploy.sh:40;build;lib.sh:12 1850000
+ *
+ * (one stack per line, frames separated by `;`, self time in µs).
+ *
+ * When profiling stops (at exit, or with `set +o profile`), three things
+ * are produced: the JSON profile, the folded stacks next to it
+ * (`out.folded`), and a report of the most expensive lines and functions
+ * on standard error.
+ *
+ * Children forked by the shell stop profiling (see jobs_fork()): their
+ * time is charged to the line that started them, as seen by the parent.
+ * Profiling also turns off the exec of the last command of a script in
+ * place of the shell, so the profile is still written.
+ *
+ * @author Abdelhamid
+ * @date 2025-12-14
+ */
+
+#include "shell.h"
+#include <time.h>
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+/** @brief Number of hash buckets of each table (power of two). */
+#define PROFILE_BUCKETS 1024
+
+/** @brief Deepest stack of nested lines and calls followed. */
+#define PROFILE_DEPTH 256
+
+/** @brief Lines and functions shown in the report. */
+#define PROFILE_REPORT 15
+
+/**
+ * @brief What was measured for one script line.
+ */
+struct line_stat {
+  char *file;             /**< Script the line is in. */
+  int line;               /**< Line number. */
+  char *text;             /**< First command seen on the line. */
+  uint64_t count;         /**< Commands run on the line. */
+  uint64_t wall_ns;       /**< Wall time, including called functions. */
+  uint64_t self_ns;       /**< Wall time, excluding called functions. */
+  uint64_t cpu_ns;        /**< CPU time of the shell and its children. */
+  uint64_t forks;         /**< Processes forked. */
+  struct line_stat *next; /**< Next entry in the bucket. */
+};
+
+/**
+ * @brief What was measured for one function.
+ */
+struct func_stat {
+  char *name;             /**< Function name. */
+  uint64_t calls;         /**< Calls. */
+  uint64_t wall_ns;       /**< Wall time of the calls. */
+  uint64_t cpu_ns;        /**< CPU time of the calls. */
+  uint64_t forks;         /**< Processes forked by the calls. */
+  struct func_stat *next; /**< Next entry in the bucket. */
+};
+
+/**
+ * @brief Self time of one stack of lines and functions.
+ */
+struct stack_stat {
+  char *stack;             /**< Frames separated by `;`. */
+  uint64_t self_ns;        /**< Self time of the innermost line. */
+  struct stack_stat *next; /**< Next entry in the bucket. */
+};
+
+/**
+ * @brief A line or call being measured.
+ */
+struct pframe {
+  struct line_stat *line; /**< The line, or NULL for a call. */
+  struct func_stat *func; /**< The function, or NULL for a line. */
+  uint64_t start;         /**< Clock at entry. */
+  uint64_t cpu;           /**< CPU time at entry. */
+  uint64_t forks;         /**< Fork count at entry. */
+  uint64_t inner;         /**< Wall time of nested frames. */
+};
+
+/** @brief Non-zero while profiling. */
+static int profiling = 0;
+
+/** @brief Where the JSON profile goes. */
+static char *profile_path = NULL;
+
+/** @brief Clock when profiling started. */
+static uint64_t profile_start_ns;
+
+/** @brief CPU time when profiling started. */
+static uint64_t profile_start_cpu;
+
+/** @brief Per-line, per-function and per-stack tables. */
+static struct line_stat *lines[PROFILE_BUCKETS];
+static struct func_stat *funcs[PROFILE_BUCKETS];
+static struct stack_stat *stacks[PROFILE_BUCKETS];
+
+/** @brief Frames being measured. */
+static struct pframe frames[PROFILE_DEPTH];
+
+/** @brief Frames in use (may exceed PROFILE_DEPTH; deeper ones are not
+ *  measured). */
+static int depth = 0;
+
+/**
+ * @brief Returns the CPU time used by the shell and its reaped children.
+ */
+static uint64_t cpu_now() {
+#ifdef _WIN32
+  return 0;
+#else
+  struct rusage self, children;
+  getrusage(RUSAGE_SELF, &self);
+  getrusage(RUSAGE_CHILDREN, &children);
+  struct timeval t[4] = {self.ru_utime, self.ru_stime, children.ru_utime,
+                         children.ru_stime};
+  uint64_t ns = 0;
+  for (int i = 0; i < 4; i++)
+    ns += (uint64_t)t[i].tv_sec * 1000000000ull +
+          (uint64_t)t[i].tv_usec * 1000;
+  return ns;
+#endif
+}
+
+/**
+ * @brief Hashes a string with a line number (FNV-1a).
+ */
+static unsigned profile_hash(const char *s, int line) {
+  unsigned h = 2166136261u ^ (unsigned)line;
+  while (*s) {
+    h ^= (unsigned char)*s++;
+    h *= 16777619u;
+  }
+  return h & (PROFILE_BUCKETS - 1);
+}
+
+/**
+ * @brief Finds or adds the entry of a script line.
+ */
+static struct line_stat *line_entry(const char *file, int line,
+                                    const char *text) {
+  unsigned h = profile_hash(file, line);
+  for (struct line_stat *l = lines[h]; l; l = l->next) {
+    if (l->line == line && strcmp(l->file, file) == 0) {
+      if (!l->text && text)
+        l->text = strdup(text);
+      return l;
+    }
+  }
+  struct line_stat *l = calloc(1, sizeof(struct line_stat));
+  if (!l)
+    return NULL;
+  l->file = strdup(file);
+  l->line = line;
+  l->text = text ? strdup(text) : NULL;
+  l->next = lines[h];
+  lines[h] = l;
+  return l;
+}
+
+/**
+ * @brief Finds or adds the entry of a function.
+ */
+static struct func_stat *func_entry(const char *name) {
+  unsigned h = profile_hash(name, 0);
+  for (struct func_stat *f = funcs[h]; f; f = f->next) {
+    if (strcmp(f->name, name) == 0)
+      return f;
+  }
+  struct func_stat *f = calloc(1, sizeof(struct func_stat));
+  if (!f)
+    return NULL;
+  f->name = strdup(name);
+  f->next = funcs[h];
+  funcs[h] = f;
+  return f;
+}
+
+/**
+ * @brief Adds self time to the stack of the frames in use.
+ */
+static void charge_stack(uint64_t self_ns) {
+  char stack[8192];
+  size_t len = 0;
+
+  for (int i = 0; i < depth && i < PROFILE_DEPTH; i++) {
+    int n;
+    if (frames[i].line)
+      n = snprintf(stack + len, sizeof(stack) - len, "%s%s:%d", i ? ";" : "",
+                   frames[i].line->file, frames[i].line->line);
+    else
+      n = snprintf(stack + len, sizeof(stack) - len, "%s%s", i ? ";" : "",
+                   frames[i].func->name);
+    if (n < 0 || (size_t)n >= sizeof(stack) - len)
+      return; // too deep to name: leave it out
+    len += (size_t)n;
+  }
+
+  unsigned h = profile_hash(stack, 0);
+  struct stack_stat *s;
+  for (s = stacks[h]; s; s = s->next) {
+    if (strcmp(s->stack, stack) == 0)
+      break;
+  }
+  if (!s) {
+    s = calloc(1, sizeof(struct stack_stat));
+    if (!s)
+      return;
+    s->stack = strdup(stack);
+    s->next = stacks[h];
+    stacks[h] = s;
+  }
+  s->self_ns += self_ns;
+}
+
+/**
+ * @brief Starts measuring a frame.
+ */
+static void push_frame(struct line_stat *line, struct func_stat *func) {
+  if (depth < PROFILE_DEPTH) {
+    struct pframe *fr = &frames[depth];
+    fr->line = line;
+    fr->func = func;
+    fr->inner = 0;
+    fr->forks = stats_get(STAT_FORKS);
+    fr->cpu = cpu_now();
+    fr->start = stats_now(); // last, so the reads above are not charged
+  }
+  depth++;
+}
+
+/**
+ * @brief Stops measuring the innermost frame and charges it.
+ *
+ * @param is_line Non-zero if a line is expected (else a call): profiling
+ *        may have started inside a line or call, whose end is ignored.
+ */
+static void pop_frame(int is_line) {
+  uint64_t now = stats_now();
+
+  if (depth == 0)
+    return;
+  if (depth > PROFILE_DEPTH) {
+    depth--;
+    return;
+  }
+  struct pframe *fr = &frames[depth - 1];
+  if ((fr->line != NULL) != is_line)
+    return;
+  uint64_t wall = now - fr->start;
+  uint64_t cpu = cpu_now() - fr->cpu;
+  uint64_t forks = stats_get(STAT_FORKS) - fr->forks;
+
+  if (fr->line) {
+    uint64_t self = wall > fr->inner ? wall - fr->inner : 0;
+    fr->line->count++;
+    fr->line->wall_ns += wall;
+    fr->line->self_ns += self;
+    fr->line->cpu_ns += cpu;
+    fr->line->forks += forks;
+    charge_stack(self);
+  } else {
+    fr->func->calls++;
+    fr->func->wall_ns += wall;
+    fr->func->cpu_ns += cpu;
+    fr->func->forks += forks;
+  }
+  depth--;
+  if (depth > 0)
+    frames[depth - 1].inner += wall;
+}
+
+int profile_active() { return profiling; }
+
+void profile_enter(struct program *p, int line, const char *text) {
+  if (!profiling)
+    return;
+  const char *file = p->source ? p->source : shell_name;
+  struct line_stat *l = line_entry(file, line, text);
+  if (l)
+    push_frame(l, NULL);
+  else
+    depth++; // keep enter/leave balanced
+}
+
+void profile_leave() {
+  if (profiling)
+    pop_frame(1);
+}
+
+void profile_call(const char *name) {
+  if (!profiling)
+    return;
+  struct func_stat *f = func_entry(name);
+  if (f)
+    push_frame(NULL, f);
+  else
+    depth++;
+}
+
+void profile_return() {
+  if (profiling)
+    pop_frame(0);
+}
+
+void profile_child() { profiling = 0; }
+
+/**
+ * @brief Writes a JSON string literal.
+ */
+static void json_string(FILE *fp, const char *s) {
+  fputc('"', fp);
+  for (; s && *s; s++) {
+    unsigned char c = (unsigned char)*s;
+    if (c == '"' || c == '\\')
+      fprintf(fp, "\\%c", c);
+    else if (c == '\n')
+      fputs("\\n", fp);
+    else if (c == '\t')
+      fputs("\\t", fp);
+    else if (c < 0x20)
+      fprintf(fp, "\\u%04x", c);
+    else
+      fputc(c, fp);
+  }
+  fputc('"', fp);
+}
+
+/**
+ * @brief Orders lines by decreasing self time.
+ */
+static int by_self(const void *a, const void *b) {
+  const struct line_stat *x = *(const struct line_stat *const *)a;
+  const struct line_stat *y = *(const struct line_stat *const *)b;
+  return x->self_ns < y->self_ns ? 1 : x->self_ns > y->self_ns ? -1 : 0;
+}
+
+/**
+ * @brief Orders functions by decreasing wall time.
+ */
+static int by_wall(const void *a, const void *b) {
+  const struct func_stat *x = *(const struct func_stat *const *)a;
+  const struct func_stat *y = *(const struct func_stat *const *)b;
+  return x->wall_ns < y->wall_ns ? 1 : x->wall_ns > y->wall_ns ? -1 : 0;
+}
+
+/**
+ * @brief Builds the path of the folded stacks: the JSON path with its
+ *        `.json` suffix (if any) replaced by `.folded`.
+ */
+static void folded_path(char *path, size_t size) {
+  size_t len = strlen(profile_path);
+  if (len > 5 && strcmp(profile_path + len - 5, ".json") == 0)
+    len -= 5;
+  snprintf(path, size, "%.*s.folded", (int)len, profile_path);
+}
+
+/**
+ * @brief Writes the profile, the folded stacks and the report.
+ */
+static void profile_write(struct line_stat **ls, int nl, struct func_stat **fs,
+                          int nf) {
+  uint64_t wall = stats_now() - profile_start_ns;
+  uint64_t cpu = cpu_now() - profile_start_cpu;
+  char path[4200];
+
+  FILE *fp = fopen(profile_path, "w");
+  if (!fp) {
+    fprintf(stderr, "shell: profile: %s: %s\n", profile_path, strerror(errno));
+  } else {
+    fprintf(fp, "{\n  \"script\": ");
+    json_string(fp, shell_name);
+    fprintf(fp, ",\n  \"wall_ms\": %.3f,\n  \"cpu_ms\": %.3f,\n", wall / 1e6,
+            cpu / 1e6);
+    fprintf(fp, "  \"forks\": %llu,\n  \"lines\": [",
+            (unsigned long long)stats_get(STAT_FORKS));
+    for (int i = 0; i < nl; i++) {
+      fprintf(fp, "%s\n    {\"file\": ", i ? "," : "");
+      json_string(fp, ls[i]->file);
+      fprintf(fp, ", \"line\": %d, \"command\": ", ls[i]->line);
+      json_string(fp, ls[i]->text ? ls[i]->text : "");
+      fprintf(fp,
+              ", \"count\": %llu, \"wall_ms\": %.3f, \"self_ms\": %.3f, "
+              "\"cpu_ms\": %.3f, \"forks\": %llu}",
+              (unsigned long long)ls[i]->count, ls[i]->wall_ns / 1e6,
+              ls[i]->self_ns / 1e6, ls[i]->cpu_ns / 1e6,
+              (unsigned long long)ls[i]->forks);
+    }
+    fprintf(fp, "\n  ],\n  \"functions\": [");
+    for (int i = 0; i < nf; i++) {
+      fprintf(fp, "%s\n    {\"name\": ", i ? "," : "");
+      json_string(fp, fs[i]->name);
+      fprintf(fp,
+              ", \"calls\": %llu, \"wall_ms\": %.3f, \"cpu_ms\": %.3f, "
+              "\"forks\": %llu}",
+              (unsigned long long)fs[i]->calls, fs[i]->wall_ns / 1e6,
+              fs[i]->cpu_ns / 1e6, (unsigned long long)fs[i]->forks);
+    }
+    fprintf(fp, "\n  ]\n}\n");
+    fclose(fp);
+  }
+
+  folded_path(path, sizeof(path));
+  fp = fopen(path, "w");
+  if (!fp) {
+    fprintf(stderr, "shell: profile: %s: %s\n", path, strerror(errno));
+  } else {
+    for (int b = 0; b < PROFILE_BUCKETS; b++) {
+      for (struct stack_stat *s = stacks[b]; s; s = s->next) {
+        if (s->self_ns >= 1000)
+          fprintf(fp, "%s %llu\n", s->stack,
+                  (unsigned long long)(s->self_ns / 1000));
+      }
+    }
+    fclose(fp);
+  }
+
+  // The report: where the time went, most expensive first
+  fprintf(stderr, "profile: %.3f s wall, %.3f s cpu, written to %s\n",
+          wall / 1e9, cpu / 1e9, profile_path);
+  fprintf(stderr, "%10s %10s %10s %8s %6s  %s\n", "self ms", "total ms",
+          "cpu ms", "count", "forks", "line");
+  for (int i = 0; i < nl && i < PROFILE_REPORT; i++) {
+    fprintf(stderr, "%10.3f %10.3f %10.3f %8llu %6llu  %s:%d  %.40s\n",
+            ls[i]->self_ns / 1e6, ls[i]->wall_ns / 1e6, ls[i]->cpu_ns / 1e6,
+            (unsigned long long)ls[i]->count,
+            (unsigned long long)ls[i]->forks, ls[i]->file, ls[i]->line,
+            ls[i]->text ? ls[i]->text : "");
+  }
+  if (nf > 0) {
+    fprintf(stderr, "%10s %10s %10s %8s %6s  %s\n", "", "total ms", "cpu ms",
+            "calls", "forks", "function");
+    for (int i = 0; i < nf && i < PROFILE_REPORT; i++) {
+      fprintf(stderr, "%10s %10.3f %10.3f %8llu %6llu  %s\n", "",
+              fs[i]->wall_ns / 1e6, fs[i]->cpu_ns / 1e6,
+              (unsigned long long)fs[i]->calls,
+              (unsigned long long)fs[i]->forks, fs[i]->name);
+    }
+  }
+}
+
+int profile_start(const char *path) {
+  if (profiling)
+    return 0; // already on: keep what was measured
+  static int registered = 0;
+  char cwd[4096];
+  // Resolved now, so a `cd` in the script does not move the output
+  if (path[0] != '/' && getcwd(cwd, sizeof(cwd))) {
+    profile_path = malloc(strlen(cwd) + strlen(path) + 2);
+    if (profile_path)
+      sprintf(profile_path, "%s/%s", cwd, path);
+  } else {
+    profile_path = strdup(path);
+  }
+  if (!profile_path)
+    return -1;
+  // Also write it when the shell exits directly (end of input);
+  // forked children stopped profiling, so they write nothing
+  if (!registered)
+    registered = atexit(profile_stop) == 0;
+  depth = 0;
+  profile_start_cpu = cpu_now();
+  profile_start_ns = stats_now();
+  profiling = 1;
+  return 0;
+}
+
+void profile_stop() {
+  struct line_stat **ls = NULL;
+  struct func_stat **fs = NULL;
+  int nl = 0, nf = 0;
+
+  if (!profiling)
+    return;
+  profiling = 0;
+
+  for (int b = 0; b < PROFILE_BUCKETS; b++) {
+    for (struct line_stat *l = lines[b]; l; l = l->next)
+      nl++;
+    for (struct func_stat *f = funcs[b]; f; f = f->next)
+      nf++;
+  }
+  ls = malloc((nl + 1) * sizeof(*ls));
+  fs = malloc((nf + 1) * sizeof(*fs));
+  if (ls && fs) {
+    nl = nf = 0;
+    for (int b = 0; b < PROFILE_BUCKETS; b++) {
+      for (struct line_stat *l = lines[b]; l; l = l->next) {
+        if (l->count > 0) // not the `set +o profile` still running
+          ls[nl++] = l;
+      }
+      for (struct func_stat *f = funcs[b]; f; f = f->next)
+        fs[nf++] = f;
+    }
+    qsort(ls, nl, sizeof(*ls), by_self);
+    qsort(fs, nf, sizeof(*fs), by_wall);
+    profile_write(ls, nl, fs, nf);
+  }
+  free(ls);
+  free(fs);
+
+  // Start afresh next time
+  for (int b = 0; b < PROFILE_BUCKETS; b++) {
+    while (lines[b]) {
+      struct line_stat *l = lines[b];
+      lines[b] = l->next;
+      free(l->file);
+      free(l->text);
+      free(l);
+    }
+    while (funcs[b]) {
+      struct func_stat *f = funcs[b];
+      funcs[b] = f->next;
+      free(f->name);
+      free(f);
+    }
+    while (stacks[b]) {
+      struct stack_stat *s = stacks[b];
+      stacks[b] = s->next;
+      free(s->stack);
+      free(s);
+    }
+  }
+  free(profile_path);
+  profile_path = NULL;
+  depth = 0;
+}
+
+/* =========================================================================
+ *                          Built-in Command Implementation
+ * ========================================================================= */
+
+/**
+ * @brief Sets shell options. Only `profile` is supported.
+ *
+ * Usage: `set -o profile` starts profiling into `$MYSHELL_PROFILE` (or
+ * `profile.json`); `set +o profile` stops and writes the profile.
+ *
+ * @param args Null-terminated array of arguments.
+ * @return int Always returns 1 to continue execution.
+ */
+int shell_set(char **args) {
+  if (!args[1] || !args[2] || strcmp(args[2], "profile") != 0 || args[3] ||
+      (strcmp(args[1], "-o") != 0 && strcmp(args[1], "+o") != 0)) {
+    fprintf(stderr, "set: usage: set -o profile | set +o profile\n");
+    last_status = 2;
+    return 1;
+  }
+  if (args[1][0] == '+') {
+    profile_stop();
+    return 1;
+  }
+  const char *path = getenv("MYSHELL_PROFILE");
+  if (profile_start(path && *path ? path : "profile.json") != 0)
+    last_status = 1;
+  return 1;
+}
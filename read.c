@@ -0,0 +1,365 @@
+/**
+ * @file read.c
+ * @brief The `read` built-in and its per-descriptor line buffers.
+ *
+ * A `read` must not consume more input than the line it returns: the rest
+ * belongs to whatever reads the descriptor next (the next `read`, or a
+ * command in the loop body). bash therefore reads one byte per system
+ * call, which makes `while read -r line; do ...; done < file` cost one
+ * syscall per byte.
+ *
+ * This implementation reads seekable descriptors in large chunks and
+ * keeps the unused part in a per-descriptor buffer. Consecutive `read`s
+ * are served from the buffer. Before any other command runs, the executor
+ * calls `read_sync()`, which seeks the descriptor back to the end of the
+ * data actually consumed, so the other command sees exactly the input bash
+ * would leave it. Descriptors that cannot seek (pipes, terminals) fall
+ * back to byte-at-a-time reads.
+ *
+ * @author Abdelhamid
+ * @date 2025-12-14
+ */
+
+#include "shell.h"
+#include <ctype.h>
+
+/** @brief Size of a read chunk. */
+#define READ_CHUNK 65536
+
+/** @brief Descriptors 0..READ_MAX_FDS-1 can be buffered. */
+#define READ_MAX_FDS 10
+
+/** @brief Maximum number of fields for `read -a`. */
+#define READ_MAX_FIELDS 1024
+
+/**
+ * @brief Buffered input of one descriptor.
+ */
+struct read_buffer {
+  char *data;   /**< Chunk of file data (READ_CHUNK bytes). */
+  size_t len;   /**< Valid bytes in `data`. */
+  size_t pos;   /**< Bytes of `data` already consumed. */
+  off_t start;  /**< File offset of `data[0]`. */
+  off_t kernel; /**< Where we left the descriptor's file offset. */
+  int active;   /**< Non-zero if the buffer is in use. */
+  int synced;   /**< Non-zero if other commands may have run since. */
+};
+
+/** @brief One buffer per low descriptor. */
+static struct read_buffer buffers[READ_MAX_FDS];
+
+/**
+ * @brief Puts a descriptor's file offset back where the data consumed by
+ *        `read` ends.
+ *
+ * The buffered data is kept; the next `read` checks that nobody moved
+ * the offset in the meantime before using it again.
+ */
+static void sync_one(int fd) {
+  struct read_buffer *b = &buffers[fd];
+  off_t logical = b->start + (off_t)b->pos;
+
+  if (!b->active)
+    return;
+  if (b->kernel != logical) {
+    if (lseek(fd, logical, SEEK_SET) < 0) {
+      b->active = 0;
+      return;
+    }
+    b->kernel = logical;
+  }
+  b->synced = 1;
+}
+
+/**
+ * @brief Makes every buffered descriptor consistent before another command
+ *        runs.
+ */
+void read_sync() {
+  for (int fd = 0; fd < READ_MAX_FDS; fd++)
+    sync_one(fd);
+}
+
+/**
+ * @brief Drops the buffer of `fd` (after syncing it).
+ *
+ * Called when `fd` is about to refer to a different file (redirection).
+ *
+ * @param fd The descriptor.
+ */
+void read_forget(int fd) {
+  if (fd < 0 || fd >= READ_MAX_FDS)
+    return;
+  sync_one(fd);
+  buffers[fd].active = 0;
+}
+
+/**
+ * @brief Returns the buffer for `fd` if it can be used, else NULL.
+ *
+ * A descriptor is buffered only if it is seekable. A buffer that was
+ * synced is kept only if the file offset is still where it was left.
+ */
+static struct read_buffer *buffer_for(int fd) {
+  if (fd < 0 || fd >= READ_MAX_FDS)
+    return NULL;
+  struct read_buffer *b = &buffers[fd];
+
+  if (b->active && !b->synced)
+    return b;
+  off_t cur = lseek(fd, 0, SEEK_CUR);
+  if (cur < 0)
+    return NULL; // pipe or terminal: cannot give data back
+  if (!b->data) {
+    b->data = malloc(READ_CHUNK);
+    if (!b->data)
+      return NULL;
+    // Hand the unread input back when the shell exits, too
+    static int registered = 0;
+    if (!registered)
+      atexit(read_sync);
+    registered = 1;
+  }
+  if (!b->active || cur != b->kernel) {
+    b->len = b->pos = 0;
+    b->start = cur;
+  }
+  b->kernel = cur;
+  b->active = 1;
+  b->synced = 0;
+  return b;
+}
+
+/**
+ * @brief Reads one character from `fd`.
+ *
+ * @return int The character (0..255), or -1 at end of input or on error.
+ */
+static int read_char(int fd, struct read_buffer *b) {
+  if (b) {
+    if (b->pos == b->len) {
+      off_t end = b->start + (off_t)b->len;
+      // After a sync the offset sits before the data already buffered
+      if (b->kernel != end && lseek(fd, end, SEEK_SET) < 0)
+        return -1;
+      long n = read(fd, b->data, READ_CHUNK);
+      b->kernel = end + (n > 0 ? n : 0);
+      if (n <= 0)
+        return -1;
+      b->start = end;
+      b->len = (size_t)n;
+      b->pos = 0;
+    }
+    return (unsigned char)b->data[b->pos++];
+  }
+  unsigned char c;
+  if (read(fd, &c, 1) != 1)
+    return -1;
+  return c;
+}
+
+/**
+ * @brief Growable line buffer with a per-byte "escaped" mask.
+ */
+struct read_line {
+  char *text;    /**< The characters read (NUL-terminated). */
+  char *escaped; /**< 1 where the character was backslash-escaped. */
+  size_t len;
+  size_t cap;
+};
+
+/**
+ * @brief Appends one character to a line buffer.
+ */
+static void line_add(struct read_line *l, char c, char escaped) {
+  if (l->len + 2 > l->cap) {
+    l->cap = l->cap ? l->cap * 2 : 256;
+    l->text = realloc(l->text, l->cap);
+    l->escaped = realloc(l->escaped, l->cap);
+    if (!l->text || !l->escaped) {
+      fprintf(stderr, "shell: allocation error\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  l->escaped[l->len] = escaped;
+  l->text[l->len++] = c;
+  l->text[l->len] = '\0';
+}
+
+/**
+ * @brief Checks whether position `i` of the line is an IFS character.
+ */
+static int is_ifs(struct read_line *l, size_t i, const char *ifs) {
+  return !l->escaped[i] && l->text[i] != '\0' && strchr(ifs, l->text[i]);
+}
+
+/**
+ * @brief Checks whether position `i` of the line is IFS whitespace.
+ */
+static int is_ifs_space(struct read_line *l, size_t i, const char *ifs) {
+  return is_ifs(l, i, ifs) && isspace((unsigned char)l->text[i]);
+}
+
+/**
+ * @brief Splits a line into fields on IFS.
+ *
+ * Leading and trailing IFS whitespace is ignored. When `max` fields have
+ * been found, the rest of the line (minus trailing IFS whitespace) is the
+ * last field.
+ *
+ * @param l The line.
+ * @param ifs Field separators.
+ * @param fields Receives newly allocated fields.
+ * @param max Maximum number of fields.
+ * @return int Number of fields.
+ */
+static int split_line(struct read_line *l, const char *ifs, char **fields,
+                      int max) {
+  size_t i = 0, end = l->len;
+  int n = 0;
+
+  while (end > 0 && is_ifs_space(l, end - 1, ifs))
+    end--;
+  while (i < end && is_ifs_space(l, i, ifs))
+    i++;
+  while (i < end && n < max) {
+    size_t start = i;
+    if (n == max - 1) {
+      i = end;
+    } else {
+      while (i < end && !is_ifs(l, i, ifs))
+        i++;
+    }
+    fields[n++] = strndup(l->text + start, i - start);
+    // Skip the separator: whitespace, at most one other IFS character,
+    // then whitespace again
+    while (i < end && is_ifs_space(l, i, ifs))
+      i++;
+    if (i < end && is_ifs(l, i, ifs) && !is_ifs_space(l, i, ifs)) {
+      i++;
+      while (i < end && is_ifs_space(l, i, ifs))
+        i++;
+    }
+  }
+  return n;
+}
+
+/* =========================================================================
+ *                          Built-in Command Implementations
+ * ========================================================================= */
+
+/**
+ * @brief Reads a line and assigns it to variables.
+ *
+ * Usage: `read [-r] [-d delim] [-n count] [-u fd] [-a array] [name...]`
+ *
+ * The line is split on `IFS`; each name receives one field and the last
+ * name receives the rest of the line. Without names, the whole line is
+ * stored in `REPLY`. Unless `-r` is given, a backslash escapes the next
+ * character and a backslash-newline continues the line.
+ *
+ * - `-d delim`: end the line at the first character of `delim` (NUL if
+ *   empty) instead of a newline.
+ * - `-n count`: return after at most `count` characters.
+ * - `-u fd`: read from descriptor `fd` instead of stdin.
+ * - `-a array`: store the fields in the array variable `array`.
+ *
+ * The status is 1 at end of input (the partial line is still assigned).
+ *
+ * @param args Null-terminated array of arguments.
+ * @return int Always returns 1 to continue execution.
+ */
+int shell_read(char **args) {
+  int raw = 0;
+  int delim = '\n';
+  long limit = -1;
+  int fd = STDIN_FILENO;
+  const char *array = NULL;
+  int i;
+
+  for (i = 1; args[i] != NULL && args[i][0] == '-' && args[i][1]; i++) {
+    const char *opt = args[i] + 1;
+    if (strcmp(args[i], "--") == 0) {
+      i++;
+      break;
+    }
+    for (; *opt; opt++) {
+      if (*opt == 'r') {
+        raw = 1;
+        continue;
+      }
+      if (!strchr("dnua", *opt)) {
+        fprintf(stderr, "shell: read: -%c: invalid option\n", *opt);
+        last_status = 2;
+        return 1;
+      }
+      // Options with a value: the rest of this word, or the next one
+      const char *value = opt[1] ? opt + 1 : args[++i];
+      if (!value) {
+        fprintf(stderr, "shell: read: -%c: option requires an argument\n",
+                *opt);
+        last_status = 2;
+        return 1;
+      }
+      if (*opt == 'd')
+        delim = (unsigned char)value[0];
+      else if (*opt == 'n')
+        limit = atol(value);
+      else if (*opt == 'u')
+        fd = atoi(value);
+      else
+        array = value;
+      break;
+    }
+  }
+
+  struct read_buffer *b = buffer_for(fd);
+  struct read_line line = {NULL, NULL, 0, 0};
+  int c = -1;
+
+  line_add(&line, '\0', 0);
+  line.len = 0;
+  while (limit < 0 || (long)line.len < limit) {
+    c = read_char(fd, b);
+    if (c < 0 || c == delim)
+      break;
+    if (c == '\\' && !raw) {
+      c = read_char(fd, b);
+      if (c < 0)
+        break;
+      if (c != '\n')
+        line_add(&line, (char)c, 1);
+      continue;
+    }
+    line_add(&line, (char)c, 0);
+  }
+  last_status = c < 0 ? 1 : 0;
+
+  const char *ifs = var_get("IFS");
+  if (!ifs)
+    ifs = " \t\n";
+
+  if (array) {
+    char *fields[READ_MAX_FIELDS];
+    int n = split_line(&line, ifs, fields, READ_MAX_FIELDS);
+    var_set_array(array, fields, n);
+    for (int k = 0; k < n; k++)
+      free(fields[k]);
+  } else if (args[i] == NULL) {
+    var_set("REPLY", line.text);
+  } else {
+    int names = 0;
+    while (args[i + names] != NULL)
+      names++;
+    char **fields = calloc(names, sizeof(char *));
+    int n = split_line(&line, ifs, fields, names);
+    for (int k = 0; k < names; k++) {
+      var_set(args[i + k], k < n ? fields[k] : "");
+      free(fields[k]);
+    }
+    free(fields);
+  }
+  free(line.text);
+  free(line.escaped);
+  return 1;
+}
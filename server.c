@@ -0,0 +1,539 @@
+/**
+ * @file server.c
+ * @brief Server mode: a long-lived shell that runs scripts for thin
+ *        clients over a Unix domain socket.
+ *
+ * `myshell --server path` listens on `path`. A client (`myshell --client
+ * path -c 'text'`, or any program speaking the protocol below) sends its
+ * arguments, environment and working directory, and passes its standard
+ * input, output and error with `SCM_RIGHTS`. The server compiles the
+ * script, forks, and the child runs it directly on the client's
+ * descriptors, so output never goes through the socket. When the child
+ * exits, the server sends its status back and the client exits with it.
+ *
+ * What stays warm between requests: compiled programs (kept by text, so a
+ * script that runs thousands of times is compiled once and reaches every
+ * child through fork), and the directory database. Each request still gets
+ * a fresh copy of the shell state in its own child.
+ *
+ * Protocol: one `struct server_request` header, carrying the three
+ * descriptors, followed by `len` bytes of NUL-terminated strings: the
+ * working directory, the argument count, the arguments (as after
+ * `myshell`: `script args...` or `-c text [name args...]`), then the
+ * environment until the end. The reply is the exit status as an int32_t.
+ *
+ * The socket is created with mode 0600: only its owner can connect.
+ *
+ * @author Abdelhamid
+ * @date 2025-12-14
+ */
+
+#define _GNU_SOURCE /* accept4(), MSG_CMSG_CLOEXEC, clearenv() */
+#include "shell.h"
+
+#ifndef _WIN32
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/** @brief First bytes of a request. */
+#define SERVER_MAGIC 0x5348534du /* "MSHS" */
+
+/** @brief Largest request payload accepted. */
+#define SERVER_MAX_REQUEST (16u << 20)
+
+/** @brief Number of compiled programs kept by the server. */
+#define SERVER_PROGRAMS 64
+
+extern char **environ;
+
+/**
+ * @brief Header of a request (sent with the descriptors).
+ */
+struct server_request {
+  uint32_t magic; /**< SERVER_MAGIC. */
+  uint32_t len;   /**< Bytes of payload that follow. */
+};
+
+/**
+ * @brief A compiled program kept for later requests.
+ */
+struct warm_program {
+  uint64_t hash;     /**< hash_bytes() of the text. */
+  char *text;        /**< The script text. */
+  struct program *p; /**< Its compiled form (one reference held). */
+};
+
+/**
+ * @brief A request whose child is running.
+ */
+struct pending {
+  int pid;  /**< The child. */
+  int conn; /**< Connection to answer. */
+};
+
+/** @brief Compiled programs, replaced round-robin. */
+static struct warm_program warm[SERVER_PROGRAMS];
+
+/** @brief Next slot of `warm` to replace. */
+static int warm_next = 0;
+
+/** @brief Self-pipe written by the SIGCHLD handler. */
+static int child_pipe[2] = {-1, -1};
+
+/**
+ * @brief Wakes up the server loop when a child exits.
+ */
+static void on_child(int sig) {
+  int saved = errno;
+  (void)sig;
+  if (write(child_pipe[1], "", 1) < 0) {
+    // Already pending: the loop reaps every exited child at once
+  }
+  errno = saved;
+}
+
+/**
+ * @brief Reads exactly `len` bytes.
+ * @return int 0 on success, -1 on error or end of file.
+ */
+static int read_full(int fd, void *buf, size_t len) {
+  char *p = buf;
+  while (len > 0) {
+    ssize_t n = read(fd, p, len);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return -1;
+    p += n;
+    len -= (size_t)n;
+  }
+  return 0;
+}
+
+/**
+ * @brief Sends an exit status to a client and closes the connection.
+ */
+static void answer(int conn, int status) {
+  int32_t s = status;
+  if (write(conn, &s, sizeof(s)) != (ssize_t)sizeof(s)) {
+    // The client is gone: nothing to tell
+  }
+  close(conn);
+}
+
+/**
+ * @brief Returns the compiled program for a script text, compiling it on
+ *        first use.
+ * @return struct program* The program (owned by the table), or NULL after
+ *         a syntax error.
+ */
+static struct program *warm_program(const char *text) {
+  size_t len = strlen(text);
+  uint64_t h = hash_bytes(HASH_SEED, text, len);
+
+  for (int i = 0; i < SERVER_PROGRAMS; i++) {
+    if (warm[i].p && warm[i].hash == h && strcmp(warm[i].text, text) == 0)
+      return warm[i].p;
+  }
+  int incomplete;
+  struct program *p = compile_script(text, &incomplete);
+  if (!p) {
+    if (incomplete)
+      fprintf(stderr, "myshell: syntax error: unexpected end of file\n");
+    return NULL;
+  }
+  struct warm_program *w = &warm[warm_next];
+  warm_next = (warm_next + 1) % SERVER_PROGRAMS;
+  if (w->p) {
+    program_free(w->p);
+    free(w->text);
+  }
+  w->hash = h;
+  w->text = strdup(text);
+  w->p = p;
+  return p;
+}
+
+/**
+ * @brief Receives a request: its descriptors and payload.
+ * @return char* The payload (NUL-terminated; free it), or NULL.
+ */
+static char *receive(int conn, int fds[3], size_t *len) {
+  struct server_request h;
+  struct iovec iov = {&h, sizeof(h)};
+  union {
+    struct cmsghdr align;
+    char buf[CMSG_SPACE(3 * sizeof(int))];
+  } ctrl;
+  struct msghdr msg;
+
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = ctrl.buf;
+  msg.msg_controllen = sizeof(ctrl.buf);
+  ssize_t n = recvmsg(conn, &msg, MSG_CMSG_CLOEXEC);
+  struct cmsghdr *c = n > 0 ? CMSG_FIRSTHDR(&msg) : NULL;
+  if (!c || c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS ||
+      c->cmsg_len != CMSG_LEN(3 * sizeof(int)))
+    return NULL;
+  memcpy(fds, CMSG_DATA(c), 3 * sizeof(int));
+  if (read_full(conn, (char *)&h + n, sizeof(h) - (size_t)n) != 0 ||
+      h.magic != SERVER_MAGIC || h.len > SERVER_MAX_REQUEST) {
+    for (int i = 0; i < 3; i++)
+      close(fds[i]);
+    return NULL;
+  }
+  char *payload = malloc(h.len + 1);
+  if (!payload || read_full(conn, payload, h.len) != 0) {
+    free(payload);
+    for (int i = 0; i < 3; i++)
+      close(fds[i]);
+    return NULL;
+  }
+  payload[h.len] = '\0';
+  *len = h.len;
+  return payload;
+}
+
+/**
+ * @brief Splits a payload into NUL-terminated strings.
+ * @return char** The strings (NULL-terminated; free the array only).
+ */
+static char **split_payload(char *payload, size_t len, int *count) {
+  int n = 0;
+  for (size_t i = 0; i < len; i++)
+    n += payload[i] == '\0';
+  char **strs = malloc((n + 1) * sizeof(char *));
+  if (!strs) {
+    fprintf(stderr, "shell: allocation error\n");
+    exit(EXIT_FAILURE);
+  }
+  int k = 0;
+  for (size_t i = 0; i < len; i += strlen(payload + i) + 1)
+    strs[k++] = payload + i;
+  strs[k] = NULL;
+  *count = k;
+  return strs;
+}
+
+/**
+ * @brief Handles one connection: prepares the script, then forks the
+ *        child that runs it.
+ *
+ * @return int The child's pid, or -1 if the request was answered already.
+ */
+static int serve(int conn, int listen_fd) {
+  int fds[3];
+  size_t len;
+  char *payload = receive(conn, fds, &len);
+  if (!payload) {
+    close(conn);
+    return -1;
+  }
+  int count;
+  char **strs = split_payload(payload, len, &count);
+  int argc = count >= 2 ? atoi(strs[1]) : -1;
+  if (argc < 1 || argc > count - 2) {
+    free(strs);
+    free(payload);
+    for (int i = 0; i < 3; i++)
+      close(fds[i]);
+    answer(conn, 2);
+    return -1;
+  }
+  const char *cwd = strs[0];
+  char **args = strs + 2;
+  char **env = strs + 2 + argc;
+
+  // Errors of this request (no script, syntax) go to the client
+  int saved_err = fcntl(STDERR_FILENO, F_DUPFD_CLOEXEC, 0);
+  dup2(fds[2], STDERR_FILENO);
+  char *text = NULL, *name = NULL;
+  int first, status = 0;
+  if (strcmp(args[0], "-c") == 0) {
+    if (argc < 2) {
+      fprintf(stderr, "myshell: -c: option requires an argument\n");
+      status = 2;
+    } else {
+      text = strdup(args[1]);
+      name = argc > 2 ? args[2] : NULL;
+    }
+    first = 3;
+  } else {
+    char path[8192];
+    snprintf(path, sizeof(path), "%s%s%s", args[0][0] == '/' ? "" : cwd,
+             args[0][0] == '/' ? "" : "/", args[0]);
+    text = read_script(path);
+    status = text ? 0 : 127;
+    name = args[0];
+    first = 1;
+  }
+  struct program *p = text ? warm_program(text) : NULL;
+  if (text && !p)
+    status = 2;
+  dup2(saved_err, STDERR_FILENO);
+  close(saved_err);
+  free(text);
+
+  pid_t pid = -1;
+  if (p) {
+    fflush(NULL);
+    pid = fork();
+  }
+  if (pid == 0) {
+    signal(SIGCHLD, SIG_DFL);
+    signal(SIGPIPE, SIG_DFL);
+    close(listen_fd);
+    close(conn);
+    close(child_pipe[0]);
+    close(child_pipe[1]);
+    for (int i = 0; i < 3; i++)
+      dup2(fds[i], i);
+    for (int i = 0; i < 3; i++) {
+      if (fds[i] > 2)
+        close(fds[i]);
+    }
+    clearenv();
+    for (int i = 0; env[i]; i++)
+      putenv(env[i]);
+    if (fs_chdir(cwd) != 0) {
+      fprintf(stderr, "myshell: %s: %s\n", cwd, strerror(errno));
+      exit(1);
+    }
+    if (name)
+      shell_name = name;
+    shell_params = args + (first < argc ? first : argc);
+    shell_num_params = first < argc ? argc - first : 0;
+    int result = run_program(p);
+    fflush(NULL);
+    exit(result);
+  }
+
+  if (pid < 0 && p) {
+    perror("fork");
+    status = 1;
+  }
+  for (int i = 0; i < 3; i++)
+    close(fds[i]);
+  free(strs);
+  free(payload);
+  if (pid < 0) {
+    answer(conn, status);
+    return -1;
+  }
+  return pid;
+}
+
+/**
+ * @brief Opens the listening socket.
+ * @return int The socket, or -1 after printing an error.
+ */
+static int listen_on(const char *path) {
+  struct sockaddr_un addr;
+  struct stat st;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "myshell: %s: socket path too long\n", path);
+    return -1;
+  }
+  strcpy(addr.sun_path, path);
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    perror("socket");
+    return -1;
+  }
+  // A socket left by a server that is gone
+  if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode) &&
+      connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+    unlink(path);
+  mode_t mask = umask(077);
+  int ok = bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0 &&
+           listen(fd, 128) == 0;
+  umask(mask);
+  if (!ok) {
+    fprintf(stderr, "myshell: %s: %s\n", path, strerror(errno));
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+/**
+ * @brief Runs the server until it is killed.
+ *
+ * @param path The socket to create.
+ * @return int 1 if the server could not start.
+ */
+int server_main(const char *path) {
+  struct pending *pending = NULL;
+  int num_pending = 0, cap = 0;
+
+  int listen_fd = listen_on(path);
+  if (listen_fd < 0)
+    return 1;
+  if (pipe(child_pipe) != 0) {
+    perror("pipe");
+    return 1;
+  }
+  for (int i = 0; i < 2; i++) {
+    fcntl(child_pipe[i], F_SETFD, FD_CLOEXEC);
+    fcntl(child_pipe[i], F_SETFL, O_NONBLOCK);
+  }
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = on_child;
+  sa.sa_flags = SA_RESTART;
+  sigaction(SIGCHLD, &sa, NULL);
+  signal(SIGPIPE, SIG_IGN);
+  load_dirs();
+
+  for (;;) {
+    struct pollfd fds[2] = {{listen_fd, POLLIN, 0}, {child_pipe[0], POLLIN, 0}};
+    if (poll(fds, 2, -1) < 0) {
+      if (errno == EINTR)
+        continue;
+      perror("poll");
+      return 1;
+    }
+    if (fds[1].revents) {
+      char buf[64];
+      while (read(child_pipe[0], buf, sizeof(buf)) > 0)
+        ;
+      int raw;
+      pid_t pid;
+      while ((pid = waitpid(-1, &raw, WNOHANG)) > 0) {
+        for (int i = 0; i < num_pending; i++) {
+          if (pending[i].pid == pid) {
+            answer(pending[i].conn, WIFSIGNALED(raw) ? 128 + WTERMSIG(raw)
+                                                     : WEXITSTATUS(raw));
+            pending[i] = pending[--num_pending];
+            break;
+          }
+        }
+      }
+    }
+    if (fds[0].revents) {
+      int conn = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+      if (conn < 0)
+        continue;
+      int pid = serve(conn, listen_fd);
+      if (pid < 0)
+        continue;
+      if (num_pending == cap) {
+        cap = cap ? cap * 2 : 16;
+        pending = realloc(pending, cap * sizeof(struct pending));
+        if (!pending) {
+          fprintf(stderr, "shell: allocation error\n");
+          exit(EXIT_FAILURE);
+        }
+      }
+      pending[num_pending].pid = pid;
+      pending[num_pending].conn = conn;
+      num_pending++;
+    }
+  }
+}
+
+/**
+ * @brief Sends a request to a server and waits for the exit status.
+ *
+ * Falls back to running the script in this process when there is no
+ * server (so tooling keeps working while it restarts).
+ *
+ * @param path The server socket.
+ * @param argc Argument count.
+ * @param argv Arguments, as for `run_script()` (`argv[0]` is ignored).
+ * @return int The exit status of the script.
+ */
+int client_main(const char *path, int argc, char **argv) {
+  struct sockaddr_un addr;
+  char cwd[4096];
+
+  if (argc < 2) {
+    fprintf(stderr, "Usage: myshell --client socket [script | -c text] "
+                    "[args...]\n");
+    return 2;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0 || !getcwd(cwd, sizeof(cwd)) ||
+      connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+    if (fd >= 0)
+      close(fd);
+    return run_script(argc, argv);
+  }
+
+  // Payload: cwd, argc, arguments, environment
+  size_t len = strlen(cwd) + 1 + 16;
+  for (int i = 1; i < argc; i++)
+    len += strlen(argv[i]) + 1;
+  for (char **e = environ; *e; e++)
+    len += strlen(*e) + 1;
+  char *payload = malloc(len);
+  if (!payload) {
+    fprintf(stderr, "shell: allocation error\n");
+    exit(EXIT_FAILURE);
+  }
+  size_t used = 0;
+  used += sprintf(payload + used, "%s", cwd) + 1;
+  used += sprintf(payload + used, "%d", argc - 1) + 1;
+  for (int i = 1; i < argc; i++)
+    used += sprintf(payload + used, "%s", argv[i]) + 1;
+  for (char **e = environ; *e; e++)
+    used += sprintf(payload + used, "%s", *e) + 1;
+
+  struct server_request h = {SERVER_MAGIC, (uint32_t)used};
+  struct iovec iov = {&h, sizeof(h)};
+  union {
+    struct cmsghdr align;
+    char buf[CMSG_SPACE(3 * sizeof(int))];
+  } ctrl;
+  struct msghdr msg;
+  int fds[3] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+
+  memset(&msg, 0, sizeof(msg));
+  memset(&ctrl, 0, sizeof(ctrl));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = ctrl.buf;
+  msg.msg_controllen = sizeof(ctrl.buf);
+  struct cmsghdr *c = CMSG_FIRSTHDR(&msg);
+  c->cmsg_level = SOL_SOCKET;
+  c->cmsg_type = SCM_RIGHTS;
+  c->cmsg_len = CMSG_LEN(sizeof(fds));
+  memcpy(CMSG_DATA(c), fds, sizeof(fds));
+
+  int32_t status;
+  int ok = sendmsg(fd, &msg, 0) == (ssize_t)sizeof(h) &&
+           write(fd, payload, used) == (ssize_t)used &&
+           read_full(fd, &status, sizeof(status)) == 0;
+  free(payload);
+  close(fd);
+  if (!ok) {
+    fprintf(stderr, "myshell: %s: lost the server\n", path);
+    return 1;
+  }
+  return status;
+}
+
+#else
+
+int server_main(const char *path) {
+  (void)path;
+  fprintf(stderr, "Server mode not supported on Windows mode.\n");
+  return 1;
+}
+
+int client_main(const char *path, int argc, char **argv) {
+  (void)path;
+  return run_script(argc, argv);
+}
+
+#endif
@@ -0,0 +1,260 @@
+/**
+ * @file session.c
+ * @brief Session image: the state an interactive shell rebuilds at every
+ *        start, saved in one file and mapped at the next start.
+ *
+ * Today that state is the history (`~/.shell_history`) and the directory
+ * database (`~/.shell_dirs`, an append-only log that may hold several
+ * records per directory). Reading them means parsing text and replaying
+ * the log. The image holds the result, so a start maps one file. History
+ * entries are copied out; directory paths are used in place, and the hash
+ * index over them is only built when the database is first searched.
+ *
+ * The image is `session.img` in the cache directory (see `cache.c`). It is
+ * only used while its fingerprint matches: a hash of the home directory
+ * and of the identity, size and modification time of each source file.
+ * When a file changed (another shell appended to the log, the history was
+ * edited), the files are read as before, and the image is rewritten when
+ * the shell exits. The image is stamped with the fingerprint of the files
+ * at exit, so it must describe them as they are then: the history was just
+ * saved from memory, and a directory log another shell appended to since
+ * this one loaded it is read again first.
+ *
+ * Layout (all positions are offsets from the start, so the image can be
+ * mapped anywhere):
+ *
+ *     struct session_header
+ *     uint32_t history[history_len]        offsets of the entries
+ *     struct session_dir dirs[dirs_len]
+ *     NUL-terminated strings
+ *
+ * @author Abdelhamid
+ * @date 2025-12-14
+ */
+
+#include "shell.h"
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+/** @brief First bytes of a session image. */
+#define SESSION_MAGIC "MSHI"
+
+/** @brief Format version; bump when the layout changes. */
+#define SESSION_VERSION 1
+
+/**
+ * @brief Header of a session image.
+ */
+struct session_header {
+  char magic[4];         /**< SESSION_MAGIC. */
+  uint32_t version;      /**< SESSION_VERSION. */
+  uint64_t fingerprint;  /**< session_fingerprint() when written. */
+  uint64_t size;         /**< Size of the whole image. */
+  uint32_t history_len;  /**< Number of history entries. */
+  uint32_t dirs_len;     /**< Number of directory entries. */
+  uint32_t dirs_records; /**< Records in the directory database file. */
+  uint32_t reserved;     /**< Zero. */
+};
+
+/**
+ * @brief A directory database entry in the image.
+ */
+struct session_dir {
+  double rank;   /**< Visit count, decayed over time. */
+  int64_t time;  /**< Time of the last visit. */
+  uint32_t path; /**< Offset of the path. */
+  uint32_t pad;  /**< Zero. */
+};
+
+/** @brief The files the image is derived from (see history.c, dirs.c). */
+static const char *const session_sources[] = {".shell_history",
+                                              ".shell_dirs"};
+
+/**
+ * @brief Builds the path of the image.
+ * @return int 0 on success, -1 if there is no cache directory.
+ */
+static int session_path(char *path, size_t size) {
+  char dir[4096];
+  if (cache_dir(dir, sizeof(dir)) != 0)
+    return -1;
+  int n = snprintf(path, size, "%s/session.img", dir);
+  return n > 0 && (size_t)n < size ? 0 : -1;
+}
+
+/**
+ * @brief Hashes the home directory and the stat data of the source files.
+ * @return int 0 on success, -1 if the home directory is unknown.
+ */
+static int session_fingerprint(uint64_t *h) {
+  char path[4096];
+  struct stat st;
+  const char *home = getenv("HOME");
+  if (!home)
+    home = getenv("USERPROFILE"); // Windows fallback
+  if (!home)
+    return -1;
+
+  *h = hash_bytes(HASH_SEED, home, strlen(home) + 1);
+  for (size_t i = 0; i < sizeof(session_sources) / sizeof(char *); i++) {
+    long long stamp[4] = {0, 0, -1, 0};
+    snprintf(path, sizeof(path), "%s/%s", home, session_sources[i]);
+    if (stat(path, &st) == 0) {
+      stamp[0] = (long long)st.st_dev;
+      stamp[1] = (long long)st.st_ino;
+      stamp[2] = (long long)st.st_size;
+      stamp[3] = fs_mtime_ns(&st);
+    }
+    *h = hash_bytes(*h, stamp, sizeof(stamp));
+  }
+  return 0;
+}
+
+#ifndef _WIN32
+/**
+ * @brief Checks that an offset names a NUL-terminated string inside the
+ *        image.
+ */
+static int session_string(const char *map, size_t size, uint32_t off,
+                          size_t strings) {
+  return off >= strings && off < size && memchr(map + off, '\0', size - off);
+}
+#endif
+
+int session_load() {
+#ifdef _WIN32
+  return 0;
+#else
+  char path[4200];
+  struct stat st;
+  uint64_t fingerprint;
+
+  if (session_path(path, sizeof(path)) != 0 ||
+      session_fingerprint(&fingerprint) != 0)
+    return 0;
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return 0;
+  if (fstat(fd, &st) != 0 ||
+      (size_t)st.st_size < sizeof(struct session_header)) {
+    close(fd);
+    return 0;
+  }
+  size_t size = (size_t)st.st_size;
+  char *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return 0;
+
+  // Check that the image is ours, complete, and still describes the files
+  const struct session_header *h = (const struct session_header *)map;
+  const uint32_t *history = (const uint32_t *)(map + sizeof(*h));
+  size_t dirs_off = sizeof(*h) + (((size_t)h->history_len * 4 + 7) & ~7u);
+  const struct session_dir *dirs = (const struct session_dir *)(map + dirs_off);
+  size_t strings = dirs_off + (size_t)h->dirs_len * sizeof(struct session_dir);
+  int ok = memcmp(h->magic, SESSION_MAGIC, 4) == 0 &&
+           h->version == SESSION_VERSION && h->size == size &&
+           h->fingerprint == fingerprint && h->history_len <= size &&
+           h->dirs_len <= size && strings <= size;
+  for (uint32_t i = 0; ok && i < h->history_len; i++)
+    ok = session_string(map, size, history[i], strings);
+  for (uint32_t i = 0; ok && i < h->dirs_len; i++)
+    ok = session_string(map, size, dirs[i].path, strings);
+  if (!ok) {
+    munmap(map, size);
+    return 0;
+  }
+
+  for (uint32_t i = 0; i < h->history_len; i++)
+    add_history(map + history[i]);
+  // The directory paths are used in place: the image stays mapped
+  for (uint32_t i = 0; i < h->dirs_len; i++)
+    dirs_restore(map + dirs[i].path, dirs[i].rank, (long)dirs[i].time);
+  dirs_set_records((int)h->dirs_records);
+  return 1;
+#endif
+}
+
+#ifndef _WIN32
+/**
+ * @brief A laid-out session image.
+ */
+struct session_image {
+  const char *data; /**< The bytes. */
+  size_t size;      /**< Their number. */
+};
+
+/**
+ * @brief Writes a session image (see atomic_write_file()).
+ */
+static int write_image(int fd, void *arg) {
+  struct session_image *img = arg;
+  return write(fd, img->data, img->size) == (ssize_t)img->size ? 0 : -1;
+}
+#endif
+
+void session_save() {
+#ifndef _WIN32
+  char path[4200], dir[4096];
+  struct session_header h;
+  const char *s;
+  double rank;
+  long when;
+
+  if (session_path(path, sizeof(path)) != 0 ||
+      cache_dir(dir, sizeof(dir)) != 0)
+    return;
+  // Entries in memory must match the log the fingerprint is taken from
+  if (dirs_changed())
+    dirs_reload();
+  memset(&h, 0, sizeof(h));
+  if (session_fingerprint(&h.fingerprint) != 0)
+    return;
+  memcpy(h.magic, SESSION_MAGIC, 4);
+  h.version = SESSION_VERSION;
+  h.dirs_records = (uint32_t)dirs_records();
+
+  // Lay out the image in memory, then write it in one go
+  size_t text = 0;
+  while ((s = history_entry(h.history_len)) != NULL) {
+    text += strlen(s) + 1;
+    h.history_len++;
+  }
+  while ((s = dirs_entry(h.dirs_len, &rank, &when)) != NULL) {
+    text += strlen(s) + 1;
+    h.dirs_len++;
+  }
+  size_t dirs_off = sizeof(h) + (((size_t)h.history_len * 4 + 7) & ~7u);
+  size_t strings = dirs_off + (size_t)h.dirs_len * sizeof(struct session_dir);
+  h.size = strings + text;
+  if (h.size > UINT32_MAX)
+    return;
+  char *image = calloc(1, h.size);
+  if (!image)
+    return;
+  uint32_t *history = (uint32_t *)(image + sizeof(h));
+  struct session_dir *dirs = (struct session_dir *)(image + dirs_off);
+  size_t off = strings;
+  for (uint32_t i = 0; i < h.history_len; i++) {
+    s = history_entry(i);
+    history[i] = (uint32_t)off;
+    memcpy(image + off, s, strlen(s) + 1);
+    off += strlen(s) + 1;
+  }
+  for (uint32_t i = 0; i < h.dirs_len; i++) {
+    s = dirs_entry(i, &rank, &when);
+    dirs[i].rank = rank;
+    dirs[i].time = when;
+    dirs[i].path = (uint32_t)off;
+    memcpy(image + off, s, strlen(s) + 1);
+    off += strlen(s) + 1;
+  }
+  memcpy(image, &h, sizeof(h));
+
+  make_dirs(dir);
+  struct session_image img = {image, h.size};
+  atomic_write_file(path, write_image, &img);
+  free(image);
+#endif
+}
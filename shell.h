@@ -13,9 +13,12 @@
 #ifndef SHELL_H
 #define SHELL_H
 
+#include <errno.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 
 /* Cross-platform system headers */
 #ifdef _WIN32
@@ -34,9 +37,14 @@
 #define O_CREAT _O_CREAT
 #define O_TRUNC _O_TRUNC
 #define O_RDONLY _O_RDONLY
+#define setenv(name, value, overwrite) _putenv_s(name, value)
+#define unsetenv(name) _putenv_s(name, "")
+#define AT_SYMLINK_NOFOLLOW 0x100
+#define AT_REMOVEDIR 0x200
 #define STDIN_FILENO 0
 #define STDOUT_FILENO 1
 #else
+#include <dirent.h>
 #include <fcntl.h>
 #include <sys/types.h>
 #include <sys/wait.h>
@@ -44,6 +52,38 @@
 
 #endif
 
+/*
+ * Static probes (USDT) for bpftrace and SystemTap, in the `myshell`
+ * provider. With <sys/sdt.h> (systemtap-sdt-dev), each probe compiles to a
+ * single `nop` plus an ELF note describing its arguments: nothing runs
+ * until a tracer attaches, and attaching needs no rebuild or restart.
+ * Without the header, probes compile to nothing.
+ *
+ *     bpftrace -e 'usdt:./myshell:myshell:spawn { @start[arg0] = nsecs; }
+ *                  usdt:./myshell:myshell:reap /@start[arg0]/ {
+ *                    @lat = hist(nsecs - @start[arg0]); }'
+ */
+#if !defined(_WIN32) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define SHELL_HAVE_SDT 1
+#endif
+#endif
+
+#ifdef SHELL_HAVE_SDT
+#define SHELL_PROBE1(name, a) DTRACE_PROBE1(myshell, name, a)
+#define SHELL_PROBE2(name, a, b) DTRACE_PROBE2(myshell, name, a, b)
+#else
+#define SHELL_PROBE1(name, a) ((void)0)
+#define SHELL_PROBE2(name, a, b) ((void)0)
+#endif
+
+/**
+ * @def SHELL_VERSION
+ * @brief Version of the shell (shown by `about`, part of cache keys).
+ */
+#define SHELL_VERSION "1.0"
+
 /**
  * @def MAX_INPUT_SIZE
  * @brief Maximum number of characters allowed in a single command line input.
@@ -64,6 +104,87 @@
  */
 #define DELIMITERS " \t\r\n\a"
 
+/**
+ * @brief Token types returned by the lexer.
+ */
+enum token_type {
+  TOK_END,  /**< End of the input text. */
+  TOK_WORD, /**< A word (command name, argument, filename...). */
+  TOK_OP    /**< An operator such as `|`, `>` or `;`. */
+};
+
+/**
+ * @brief A token found by `lex_token()`: a span of the source text.
+ */
+struct token {
+  int type;       /**< One of `enum token_type`. */
+  int start;      /**< Offset of the first character in the source. */
+  int len;        /**< Length of the span. */
+  const char *op; /**< For TOK_OP: the operator string, else NULL. */
+  int incomplete; /**< Non-zero if a quote or `(` was left unterminated. */
+};
+
+/**
+ * @brief Bytecode operations of compiled scripts (see compile.c, vm.c).
+ *
+ * `a`, `b` and `c` are the operands of `struct insn`. Strings are offsets
+ * into the program's string pool; code targets are instruction indexes.
+ */
+enum opcode {
+  OP_CMD,        /**< Run the simple command or pipeline text `a`. */
+  OP_JMP,        /**< Jump to `a`. */
+  OP_JZ,         /**< Jump to `a` if the last status is 0. */
+  OP_JNZ,        /**< Jump to `a` if the last status is not 0. */
+  OP_NOT,        /**< Negate the last status (`!`). */
+  OP_TRUE,       /**< Set the last status to 0. */
+  OP_LOOP,       /**< Enter a loop: `break` goes to `a`, `continue` to `b`. */
+  OP_LOOP_END,   /**< Leave the innermost loop (status of its last body). */
+  OP_SAVE,       /**< Remember the last status as the loop's status. */
+  OP_FOR_INIT,   /**< Expand the word list `a` (-1: "$@"); `b`: `-j` text. */
+  OP_FOR_NEXT,   /**< Assign the next word to variable `a`, else jump `b`. */
+  OP_CASE,       /**< Expand the case subject `a`. */
+  OP_CASE_MATCH, /**< Jump to `b` if the subject matches pattern `a`. */
+  OP_CASE_END,   /**< Drop the case subject. */
+  OP_REDIR,      /**< Apply the redirections in text `a`. */
+  OP_UNREDIR,    /**< Undo the innermost OP_REDIR. */
+  OP_FUNC,       /**< Define function `a` (locals `c`); body up to `b`. */
+  OP_RET,        /**< Return from a function body. */
+  OP_PIPE,       /**< Pipeline of `a` OP_STAGE entries; continue at `b`. */
+  OP_STAGE,      /**< Pipeline stage starting at `a` (`b`: `|&`). */
+  OP_BG,         /**< Run the code up to `a` in the background. */
+  OP_SUBSHELL,   /**< Run the code up to `a` as a subshell `( ... )`. */
+  OP_HALT        /**< End of a background, pipeline or subshell block. */
+};
+
+/**
+ * @brief One bytecode instruction.
+ */
+struct insn {
+  int op;   /**< An `enum opcode`. */
+  int a;    /**< First operand. */
+  int b;    /**< Second operand. */
+  int c;    /**< Third operand. */
+  int line; /**< Source line, for error messages and profiling. */
+};
+
+/**
+ * @brief A compiled script: bytecode plus a pool of NUL-terminated strings.
+ */
+struct program {
+  struct insn *code; /**< Instructions. */
+  int len;           /**< Number of instructions. */
+  int cap;           /**< Allocated instructions. */
+  char *pool;        /**< String pool (command texts, names, patterns). */
+  size_t pool_len;   /**< Bytes used in `pool`. */
+  size_t pool_cap;   /**< Bytes allocated for `pool`. */
+  int refs;          /**< References (the caller plus defined functions). */
+  char *map;         /**< Mapped cache entry holding `code` and `pool`, or
+                          NULL if they were allocated (see cache.c). */
+  size_t map_len;    /**< Size of `map`. */
+  char *source;      /**< File it was compiled from (for profiles), or NULL
+                          for the script or command line. */
+};
+
 /* =========================================================================
  *                               Function Declarations
  * ========================================================================= */
@@ -82,14 +203,121 @@
  */
 void shell_loop();
 
+/**
+ * @brief Runs `argv[1..]` = `script [args...]` or `-c text [name [args...]]`.
+ * @return The exit status of the script.
+ */
+int run_script(int argc, char **argv);
+
 /**
  * @brief Parses a line of input into an array of strings (tokens).
  *
  * @param line The input string to parse.
- * @return A null-terminated array of strings (char**), or NULL on failure.
+ * @return A null-terminated array of strings (char**); free with
+ *         `free_args()`.
  */
 char **parse_input(char *line);
 
+/**
+ * @brief Releases an argument array returned by `parse_input()`.
+ * @param args The array (may be NULL).
+ */
+void free_args(char **args);
+
+/**
+ * @brief Scans the next token (word or operator span) of `line`.
+ *
+ * @param line Source text.
+ * @param pos In: where to start. Out: just past the token.
+ * @param tok Receives the token.
+ * @return The token type (TOK_END at the end of the text).
+ */
+int lex_token(const char *line, int *pos, struct token *tok);
+
+/**
+ * @brief Checks whether a parsed token is the (unquoted) operator `op`.
+ * @return 1 if it is, 0 otherwise.
+ */
+int is_operator(const char *tok, const char *op);
+
+/**
+ * @brief Parses and executes one command line.
+ *
+ * Also releases per-command resources (e.g. process substitution pipes).
+ *
+ * @param line The command line (modified).
+ * @return 1 to continue execution, 0 to terminate the shell.
+ */
+int execute_line(char *line);
+
+/**
+ * @brief Starts `cmd` connected to a pipe for `<(cmd)` / `>(cmd)`.
+ *
+ * @param cmd The command line to run in the background.
+ * @param input Non-zero for `<(cmd)` (the shell reads cmd's output).
+ * @return The shell's end of the pipe (valid until the current command
+ *         line finishes), or -1 on failure.
+ */
+int process_substitution(const char *cmd, int input);
+
+/**
+ * @brief Stores a here-document body in a sealed memfd (or a pipe).
+ *
+ * @param body The document text.
+ * @param len Length of `body`.
+ * @return A readable descriptor valid until the command line finishes,
+ *         or -1 on failure.
+ */
+int here_document(const char *body, size_t len);
+
+/**
+ * @brief Extracts a here-document delimiter (quote removal).
+ * @return 1 if the delimiter was quoted (body taken literally), else 0.
+ */
+int heredoc_delimiter(const char *src, int len, char *out, size_t size);
+
+/**
+ * @brief Checks whether `name` is a built-in command.
+ * @return 1 if it is, 0 otherwise.
+ */
+int is_builtin(const char *name);
+
+/**
+ * @brief Parses and executes the text of one simple command or pipeline.
+ * @param text The command text (may be followed by here-document bodies).
+ * @return 1 to continue execution, 0 to terminate the shell.
+ */
+int execute_simple(const char *text);
+
+/**
+ * @brief Applies the redirections in `args` to the shell (removing them).
+ * @return 0 on success, -1 on failure. Pair with `redirect_pop()`.
+ */
+int redirect_push(char **args);
+
+/**
+ * @brief Undoes the most recent `redirect_push()`.
+ */
+void redirect_pop();
+
+/**
+ * @brief Runs the last command of a script: a simple external command
+ *        replaces the shell instead of being forked.
+ * @return 1 to continue execution, 0 to terminate the shell.
+ */
+int execute_tail(const char *text);
+
+/**
+ * @brief Makes the most recent `redirect_push()` permanent (`exec > f`).
+ */
+void redirect_keep();
+
+/**
+ * @brief Applies the redirections in `text` (of a compound command).
+ * @return 0 on success, -1 on failure. Pair with `redirect_pop()`.
+ */
+int redirect_text(const char *text);
+
 /**
  * @brief Decides whether to execute a built-in command or launch an external
  * process.
@@ -116,11 +344,42 @@ int launch_process(char **args);
 
 /**
  * @brief Changes the current working directory.
+ *
+ * No argument goes to `$HOME`; `-` goes back to `$OLDPWD`.
+ *
  * @param args Command arguments (args[1] is the target directory).
  * @return 1 to continue execution.
  */
 int shell_cd(char **args);
 
+/**
+ * @brief Pushes the current directory on the stack and changes directory.
+ * @param args Command arguments (args[1] is the target directory).
+ * @return 1 to continue execution.
+ */
+int shell_pushd(char **args);
+
+/**
+ * @brief Pops the directory stack and changes to the popped directory.
+ * @param args Command arguments (unused).
+ * @return 1 to continue execution.
+ */
+int shell_popd(char **args);
+
+/**
+ * @brief Prints the directory stack.
+ * @param args Command arguments (unused).
+ * @return 1 to continue execution.
+ */
+int shell_dirs(char **args);
+
+/**
+ * @brief Jumps to the most frecent remembered directory matching the terms.
+ * @param args Command arguments (`-l` to list, then the search terms).
+ * @return 1 to continue execution.
+ */
+int shell_z(char **args);
+
 /**
  * @brief Exits the shell.
  * @param args Command arguments (unused).
@@ -157,8 +416,8 @@ int shell_about(char **args);
 int shell_history(char **args);
 
 /**
- * @brief Counts lines, words, and characters in a file.
- * @param args Command arguments (args[1] is the filename).
+ * @brief Counts lines, words, and characters in files, directories or stdin.
+ * @param args Command arguments (options, then filenames; "-" is stdin).
  * @return 1 to continue execution.
  */
 int shell_count(char **args);
@@ -178,12 +437,114 @@ int shell_cp(char **args);
 int shell_mv(char **args);
 
 /**
- * @brief Removes (deletes) a file.
- * @param args Command arguments (args[1] is the filename).
+ * @brief Removes (deletes) files, or trees with `-r`; `--async` defers it.
+ * @param args Command arguments (options, then the paths).
  * @return 1 to continue execution.
  */
 int shell_rm(char **args);
 
+/**
+ * @brief Reads a line into variables (`read [-r] [-d c] [-n n] [-a arr]`).
+ * @param args Command arguments (options, then variable names).
+ * @return 1 to continue execution.
+ */
+int shell_read(char **args);
+
+/**
+ * @brief Sets and exports variables (`export NAME[=value]...`).
+ * @param args Command arguments (names or assignments).
+ * @return 1 to continue execution.
+ */
+int shell_export(char **args);
+
+/**
+ * @brief Removes variables (`unset NAME...`).
+ * @param args Command arguments (variable names).
+ * @return 1 to continue execution.
+ */
+int shell_unset(char **args);
+
+/**
+ * @brief Prints its arguments (`echo [-n] word...`).
+ * @param args Command arguments.
+ * @return 1 to continue execution.
+ */
+int shell_echo(char **args);
+
+/**
+ * @brief Replaces the shell with a program (`exec cmd`), or makes the
+ *        redirections permanent (`exec > log`).
+ * @param args Command arguments.
+ * @return 1 to continue execution, 0 to exit.
+ */
+int shell_exec(char **args);
+
+/**
+ * @brief Runs a task graph file (`dag [-j n] [-k] [-c] file [task...]`).
+ * @param args Command arguments.
+ * @return 1 to continue execution.
+ */
+int shell_dag(char **args);
+
+/**
+ * @brief Runs a command or replays its stored results
+ *        (`memo [-c] [-i file]... [-e name]... cmd [args...]`).
+ * @param args Command arguments.
+ * @return 1 to continue execution, 0 to exit.
+ */
+int shell_memo(char **args);
+
+/**
+ * @brief Defines or prints aliases (`alias [name[=value]...]`).
+ * @param args Command arguments.
+ * @return 1 to continue execution.
+ */
+int shell_alias(char **args);
+
+/**
+ * @brief Removes aliases (`unalias [-a] name...`).
+ * @param args Command arguments.
+ * @return 1 to continue execution.
+ */
+int shell_unalias(char **args);
+
+/**
+ * @brief Prints the shell's metrics (`stats [-p]`).
+ */
+int shell_stats(char **args);
+
+/**
+ * @brief Sets shell options (`set -o profile`, `set +o profile`).
+ */
+int shell_set(char **args);
+
+/**
+ * @brief Runs a file in the current shell (`source file [args...]`,
+ *        `. file [args...]`).
+ * @param args Command arguments.
+ * @return 1 to continue execution, 0 to exit.
+ */
+int shell_source(char **args);
+
+/**
+ * @brief Evaluates a condition (`test expr`, `[ expr ]`).
+ * @param args Command arguments.
+ * @return 1 to continue execution.
+ */
+int shell_test(char **args);
+
+/**
+ * @brief Control built-ins of scripts (`break`, `continue`, `return`,
+ *        `local`, `shift`); see vm.c.
+ * @param args Command arguments.
+ * @return 1 to continue execution.
+ */
+int shell_break(char **args);
+int shell_continue(char **args);
+int shell_return(char **args);
+int shell_local(char **args);
+int shell_shift(char **args);
+
 /**
  * @brief Returns the number of built-in commands.
  * @return The count of built-in commands available.
@@ -205,6 +566,11 @@ void add_history(char *line);
  */
 void print_history();
 
+/**
+ * @brief Returns history entry `i` (oldest first), or NULL past the last.
+ */
+const char *history_entry(int i);
+
 /**
  * @brief Loads history from a file (e.g., .shell_history) into memory.
  */
@@ -215,6 +581,643 @@ void load_history();
  */
 void save_history();
 
+/* -------------------------------------------------------------------------
+ *                               Variables and Expansion
+ * ------------------------------------------------------------------------- */
+
+/** @brief Exit status of the last command (`$?`). */
+extern int last_status;
+
+/** @brief `$?` before the running built-in started (for `exit`, `return`). */
+extern int previous_status;
+
+/** @brief Non-zero for the interactive REPL, zero when running a script. */
+extern int interactive;
+
+/** @brief Positional parameters `$1`..`$N`. */
+extern char **shell_params;
+
+/** @brief Number of positional parameters (`$#`). */
+extern int shell_num_params;
+
+/** @brief Name of the shell or script (`$0`). */
+extern const char *shell_name;
+
+/**
+ * @brief Returns the value of a shell or environment variable.
+ * @return The value, or NULL if unset.
+ */
+const char *var_get(const char *name);
+
+/**
+ * @brief Sets a shell variable (and the environment copy, if exported).
+ */
+void var_set(const char *name, const char *value);
+
+/**
+ * @brief Replaces a variable with an array of `n` elements (copied).
+ */
+void var_set_array(const char *name, char **items, int n);
+
+/**
+ * @brief Returns element `idx` of an array variable (NULL if unset).
+ */
+const char *var_get_index(const char *name, int idx);
+
+/**
+ * @brief Returns the number of elements of a variable (0 if unset).
+ */
+int var_array_len(const char *name);
+
+/**
+ * @brief Marks a variable as exported to launched programs.
+ */
+void var_export(const char *name);
+
+/**
+ * @brief Removes a variable.
+ */
+void var_unset(const char *name);
+
+/**
+ * @brief Starts recording variable changes (nested snapshots allowed).
+ */
+void var_snapshot();
+
+/**
+ * @brief Undoes the variable changes since the last var_snapshot().
+ */
+void var_restore();
+
+/**
+ * @brief Checks whether `name` is a valid variable name.
+ * @return 1 if valid, 0 otherwise.
+ */
+int valid_var_name(const char *name);
+
+/**
+ * @brief Checks whether a word has the form `NAME=value`.
+ * @return Length of NAME, or 0 if the word is not an assignment.
+ */
+int is_assignment(const char *word);
+
+/**
+ * @brief Applies an assignment word (`NAME=value`).
+ */
+void var_assign(const char *word);
+
+/**
+ * @brief Seeks descriptors buffered by `read` back to the data consumed.
+ *
+ * Must be called before any other command may read those descriptors.
+ */
+void read_sync();
+
+/**
+ * @brief Syncs and drops the `read` buffer of `fd` (before redirecting it).
+ */
+void read_forget(int fd);
+
+/**
+ * @brief Expands the `$` reference at `src[*i]`.
+ *
+ * @param src Text containing the reference.
+ * @param len Length of `src`.
+ * @param i In: index of the `$`. Out: index of its last character.
+ * @return A newly allocated value, or NULL for a literal `$`.
+ */
+char *expand_dollar(const char *src, int len, int *i);
+
+/**
+ * @brief Removes quotes and performs `$` expansions (no field splitting).
+ * @return A newly allocated string.
+ */
+char *expand_text(const char *s, int len);
+
+/**
+ * @brief Matches a string against a glob pattern (`*`, `?`, `[...]`).
+ * @return 1 on a match, 0 otherwise.
+ */
+int pattern_match(const char *pat, const char *str);
+
+/**
+ * @brief Evaluates a 64-bit integer arithmetic expression.
+ * @param text Expression source.
+ * @param result Receives the value (0 on error).
+ * @return 0 on success, -1 on error.
+ */
+int arith_eval(const char *text, long long *result);
+
+/* -------------------------------------------------------------------------
+ *                               Scripts (Compiler and VM)
+ * ------------------------------------------------------------------------- */
+
+/**
+ * @brief Compiles script text into bytecode.
+ * @param text The script.
+ * @param incomplete Set to 1 if the text ends in the middle of a command
+ *        (open `if`, quote...), so more input should be read.
+ * @return The program (release with `program_free()`), or NULL on error.
+ */
+struct program *compile_script(const char *text, int *incomplete);
+
+/**
+ * @brief Drops a reference to a program, freeing it with the last one.
+ */
+void program_free(struct program *p);
+
+/**
+ * @brief Runs a compiled program from its first instruction.
+ * @return 1 to continue, 0 if the shell should exit.
+ */
+int vm_run(struct program *p);
+
+/**
+ * @brief Returns non-zero if `name` is a defined shell function.
+ */
+int is_function(const char *name);
+
+/**
+ * @brief Calls the shell function `args[0]` with arguments `args[1..]`.
+ * @return 1 to continue, 0 if the shell should exit.
+ */
+int call_function(char **args);
+
+/**
+ * @brief Returns the slot of a `local` variable of the running functions.
+ * @return Pointer to the value (NULL if `name` is not local).
+ */
+char **local_slot(const char *name);
+
+/**
+ * @brief Runs a whole script file (or `-c` text) non-interactively.
+ * @param text The script.
+ * @param use_cache Non-zero to use the compiled script cache.
+ * @return The exit status of the script.
+ */
+int run_script_text(const char *text, int use_cache);
+
+/**
+ * @brief Runs a compiled script as the whole of this process (its last
+ *        command may replace the process).
+ * @return The exit status of the script.
+ */
+int run_program(struct program *p);
+
+/**
+ * @brief Runs a file in the current shell (`source`), with `params` as the
+ *        positional parameters if not NULL.
+ * @return 1 to continue, 0 if the shell should exit.
+ */
+int source_file(const char *path, char **params);
+
+/**
+ * @brief Runs script text as the rest of a forked child, then exits with
+ *        its status (the last command replaces the child).
+ */
+void run_child_text(const char *text);
+
+/**
+ * @brief Loads the compiled form of a script from the on-disk cache.
+ * @return The program (mapped; release with `program_free()`), or NULL.
+ */
+struct program *cache_load(const char *text, size_t len);
+
+/**
+ * @brief Saves the compiled form of a script in the on-disk cache.
+ */
+void cache_store(const char *text, size_t len, struct program *p);
+
+/**
+ * @brief Finds the cache directory ($MYSHELL_CACHE_DIR, else
+ *        $XDG_CACHE_HOME/myshell, else ~/.cache/myshell).
+ * @return 0 on success, -1 if there is no usable location.
+ */
+int cache_dir(char *dir, size_t size);
+
+/**
+ * @brief Creates a directory and any missing parents (`mkdir -p`).
+ */
+void make_dirs(char *dir);
+
+/**
+ * @brief Replaces `path` with the content `fill` writes to a descriptor
+ *        (0 on success), through a temporary file renamed into place.
+ * @return 0 if the file was written, -1 otherwise (`path` is unchanged).
+ */
+int atomic_write_file(const char *path, int (*fill)(int fd, void *arg),
+                      void *arg);
+
+/**
+ * @brief Reads a size limit in bytes (suffixes K, M, G) from the
+ *        environment variable `name`, or returns `def`.
+ */
+long long size_limit(const char *name, long long def);
+
+/**
+ * @brief Removes the least recently used `*suffix` files of `dir` while
+ *        they total more than `limit` bytes.
+ */
+void evict_lru(const char *dir, const char *suffix, long long limit);
+
+/** @brief Initial value of a `hash_bytes()` hash. */
+#define HASH_SEED 14695981039346656037ull
+
+/**
+ * @brief Feeds bytes to a 64-bit FNV-1a hash.
+ * @return The updated hash.
+ */
+uint64_t hash_bytes(uint64_t h, const void *data, size_t len);
+
+/**
+ * @brief Feeds the content of a file to a hash.
+ * @return 0 on success, -1 if the file cannot be read.
+ */
+int hash_file(const char *path, uint64_t *h);
+
+/* -------------------------------------------------------------------------
+ *                               Server Mode
+ * ------------------------------------------------------------------------- */
+
+/**
+ * @brief Serves script requests on a Unix domain socket (`--server path`).
+ * @return The exit status when the server cannot start (it never returns
+ *         otherwise).
+ */
+int server_main(const char *path);
+
+/**
+ * @brief Runs `argv[1..]` (as for run_script()) through the server at
+ *        `path`, or locally if no server answers (`--client path ...`).
+ * @return The exit status of the script.
+ */
+int client_main(const char *path, int argc, char **argv);
+
+/* -------------------------------------------------------------------------
+ *                               Directory Navigation
+ * ------------------------------------------------------------------------- */
+
+/**
+ * @brief Changes directory, updating PWD/OLDPWD and the frecency database.
+ * @param path The target directory.
+ * @return 0 on success, -1 on failure (errno is set).
+ */
+int change_directory(const char *path);
+
+/**
+ * @brief Loads the directory frecency database (e.g., .shell_dirs).
+ */
+void load_dirs();
+
+/**
+ * @brief Returns non-zero if another shell wrote to the database file
+ *        since this one loaded it.
+ */
+int dirs_changed();
+
+/**
+ * @brief Discards the entries in memory and loads the database file again.
+ */
+void dirs_reload();
+
+/**
+ * @brief Returns database entry `i` (its path, rank and last visit), or
+ *        NULL past the last one.
+ */
+const char *dirs_entry(int i, double *rank, long *when);
+
+/**
+ * @brief Adds a database entry without recording a visit. `path` is not
+ *        copied and must stay valid (it points into the session image).
+ */
+void dirs_restore(const char *path, double rank, long when);
+
+/**
+ * @brief Returns the number of records in the database file.
+ */
+int dirs_records();
+
+/**
+ * @brief Sets the number of records in the database file, which is taken
+ *        as loaded (restored from the session image).
+ */
+void dirs_set_records(int records);
+
+/* -------------------------------------------------------------------------
+ *                               Aliases
+ * ------------------------------------------------------------------------- */
+
+/**
+ * @brief Expands aliases in the command words of a simple command or
+ *        pipeline (interactive shells only).
+ * @param compound Set to non-zero if the result has lists or compound
+ *        commands, so it must be compiled rather than parsed.
+ * @return The expanded text (free it), or NULL if no alias applies.
+ */
+char *alias_expand(const char *text, int *compound);
+
+/**
+ * @brief Returns non-zero if `name` is an alias.
+ */
+int is_alias(const char *name);
+
+/* -------------------------------------------------------------------------
+ *                               Session Snapshots
+ * ------------------------------------------------------------------------- */
+
+/**
+ * @brief Restores history and the directory database from the session
+ *        image, if it matches their files.
+ * @return 1 if restored, 0 if they must be loaded from their files.
+ */
+int session_load();
+
+/**
+ * @brief Writes the session image for the next start.
+ */
+void session_save();
+
+/* -------------------------------------------------------------------------
+ *                               Filesystem Helpers
+ * ------------------------------------------------------------------------- */
+
+/**
+ * @brief Returns the cached descriptor of the current working directory.
+ */
+int fs_cwd();
+
+/**
+ * @brief Changes directory and refreshes the cached directory descriptor.
+ * @param path The target directory.
+ * @return 0 on success, -1 on failure (errno is set).
+ */
+int fs_chdir(const char *path);
+
+/**
+ * @brief Returns a new descriptor of the working directory (or -1).
+ */
+int fs_save_cwd();
+
+/**
+ * @brief Returns to (and consumes) a descriptor from fs_save_cwd().
+ * @return 0 on success, -1 on failure.
+ */
+int fs_restore_cwd(int fd);
+
+/**
+ * @brief Opens a file relative to the cached working directory (openat).
+ * @return The new descriptor, or -1 on failure.
+ */
+int fs_open(const char *path, int flags, int mode);
+
+/**
+ * @brief Stats a path relative to the cached working directory (fstatat).
+ * @param flags 0, or AT_SYMLINK_NOFOLLOW to not follow a final symlink.
+ * @return 0 on success, -1 on failure.
+ */
+int fs_stat(const char *path, struct stat *st, int flags);
+
+/**
+ * @brief Unlinks a path relative to the cached working directory (unlinkat).
+ * @param flags 0, or AT_REMOVEDIR for an empty directory.
+ * @return 0 on success, -1 on failure.
+ */
+int fs_unlink(const char *path, int flags);
+
+/**
+ * @brief Renames relative to the cached working directory (renameat2).
+ * @param flags 0, or renameat2() flags such as RENAME_NOREPLACE.
+ * @return 0 on success, -1 on failure.
+ */
+int fs_rename(const char *from, const char *to, unsigned flags);
+
+/**
+ * @brief Returns the modification time of a stat result in nanoseconds.
+ */
+long long fs_mtime_ns(const struct stat *st);
+
+/* -------------------------------------------------------------------------
+ *                               Deletion (Trash)
+ * ------------------------------------------------------------------------- */
+
+/**
+ * @brief Deletes a file or a whole directory tree.
+ * @param path File or directory to delete.
+ * @return 0 on success, -1 on failure (errno is set).
+ */
+int remove_tree(const char *path);
+
+/**
+ * @brief Renames a file or tree into the trash for background deletion.
+ * @param path File or directory to delete.
+ * @return 0 on success, -1 on failure (errno is set).
+ */
+int trash_path(const char *path);
+
+/**
+ * @brief Restarts background deletion of trash left by earlier sessions.
+ */
+void trash_resume();
+
+/* -------------------------------------------------------------------------
+ *                               Background Children
+ * ------------------------------------------------------------------------- */
+
+/**
+ * @brief Registers a background child process to be reaped later.
+ * @param pid The child's process ID.
+ */
+void jobs_track(int pid);
+
+/**
+ * @brief Reaps tracked children that have exited.
+ * @param block Non-zero to wait for all of them.
+ */
+void jobs_reap(int block);
+
+/**
+ * @brief Waits for any child to exit.
+ * @param status Receives its exit status (128 + signal if killed).
+ * @return The child's pid, or -1 if there are no children.
+ */
+int jobs_wait_any(int *status);
+
+/**
+ * @brief Waits for one of the children in `pids` to exit, handing any
+ *        other exited child to the job table.
+ * @param status Receives its exit status (128 + signal if killed).
+ * @return The child's pid, or -1 if there are no children.
+ */
+int jobs_wait_for(const int *pids, int n, int *status);
+
+/**
+ * @brief `fork()`, counted and timed in the shell's metrics, with a
+ *        `spawn` probe naming `what` the child runs.
+ * @return As `fork()`.
+ */
+int jobs_fork(const char *what);
+
+/** @brief Non-zero in the child of a libmyshell call. */
+extern int jobs_embedded;
+
+/**
+ * @brief Flushes the shell's output (only stdout and stderr when
+ *        embedded) before a fork, an exec or an exit.
+ */
+void jobs_flush();
+
+/**
+ * @brief Flushes output and exits; uses `_exit()` when embedded, so the
+ *        caller's atexit handlers do not run in the child.
+ */
+void jobs_exit(int status);
+
+/* -------------------------------------------------------------------------
+ *                                  Metrics
+ * ------------------------------------------------------------------------- */
+
+/** @brief Counters kept by stats.c. */
+enum stat_counter {
+  STAT_BUILTINS,       /**< Built-in commands run. */
+  STAT_EXTERNALS,      /**< External commands run. */
+  STAT_FUNCTIONS,      /**< Shell functions called. */
+  STAT_FORKS,          /**< Processes forked. */
+  STAT_SPAWNS,         /**< Programs executed. */
+  STAT_STAGES,         /**< Pipeline stages started. */
+  STAT_BUILTIN_BYTES,  /**< Bytes read or copied by built-ins. */
+  STAT_SCRIPT_HITS,    /**< Compiled programs found in the cache. */
+  STAT_SCRIPT_MISSES,  /**< Compiled programs not in the cache. */
+  STAT_MEMO_HITS,      /**< `memo` results replayed. */
+  STAT_MEMO_MISSES,    /**< `memo` results computed. */
+  NUM_STAT_COUNTERS
+};
+
+/** @brief Latency histograms kept by stats.c. */
+enum stat_timer {
+  STAT_PARSE, /**< Compiling a script or command line. */
+  STAT_SPAWN, /**< Forking a child. */
+  STAT_WAIT,  /**< Waiting for foreground children. */
+  NUM_STAT_TIMERS
+};
+
+/** @brief Tail latency histograms kept by stats.c (besides the durations
+ *  of each command name). */
+enum stat_latency {
+  STAT_LAUNCH, /**< From fork() to a successful exec() of a program. */
+  STAT_PROMPT, /**< From reading a command to showing the next prompt. */
+  NUM_STAT_LATENCIES
+};
+
+/**
+ * @brief Returns the monotonic time in nanoseconds.
+ */
+uint64_t stats_now();
+
+/**
+ * @brief Adds `n` to a counter (thread-safe).
+ */
+void stats_add(enum stat_counter c, uint64_t n);
+
+/**
+ * @brief Returns the value of a counter.
+ */
+uint64_t stats_get(enum stat_counter c);
+
+/**
+ * @brief Records a latency sample of `ns` nanoseconds (thread-safe).
+ */
+void stats_time(enum stat_timer t, uint64_t ns);
+
+/**
+ * @brief Records a tail latency sample of `ns` nanoseconds.
+ */
+void stats_latency(enum stat_latency l, uint64_t ns);
+
+/**
+ * @brief Records that command `name` took `ns` nanoseconds.
+ */
+void stats_command(const char *name, uint64_t ns);
+
+/**
+ * @brief Exports the metrics to `$MYSHELL_METRICS_FILE` if an export is
+ *        due.
+ * @param force Non-zero to export regardless of the interval.
+ */
+void stats_export(int force);
+
+/**
+ * @brief Stops exporting in a forked child (its parent exports).
+ */
+void stats_child();
+
+/* -------------------------------------------------------------------------
+ *                                  Profiler
+ * ------------------------------------------------------------------------- */
+
+/**
+ * @brief Starts profiling script lines and functions.
+ * @param path Where the JSON profile goes (the folded stacks go next to it);
+ *        a relative path is resolved against the current directory now.
+ * @return int 0 on success, -1 if out of memory.
+ */
+int profile_start(const char *path);
+
+/**
+ * @brief Stops profiling and writes the profile and the report.
+ */
+void profile_stop();
+
+/**
+ * @brief Returns non-zero while profiling.
+ */
+int profile_active();
+
+/**
+ * @brief Starts measuring a command on line `line` of `p`.
+ * @param text The command, for the report (may be NULL).
+ */
+void profile_enter(struct program *p, int line, const char *text);
+
+/**
+ * @brief Stops measuring the command of the last profile_enter().
+ */
+void profile_leave();
+
+/**
+ * @brief Starts measuring a call of function `name`.
+ */
+void profile_call(const char *name);
+
+/**
+ * @brief Stops measuring the call of the last profile_call().
+ */
+void profile_return();
+
+/**
+ * @brief Stops profiling in a forked child (its parent keeps measuring).
+ */
+void profile_child();
+
+/* -------------------------------------------------------------------------
+ *                               Worker Pool
+ * ------------------------------------------------------------------------- */
+
+/**
+ * @brief Returns the number of online CPUs (at least 1).
+ */
+int pool_cpu_count();
+
+/**
+ * @brief Runs `fn(idx, ctx)` for every idx in [0, njobs) on worker threads.
+ *
+ * @param njobs Number of jobs to run.
+ * @param fn Function executed once per job index.
+ * @param ctx Opaque pointer forwarded to `fn`.
+ * @param nthreads Maximum concurrency; values < 1 mean "one per CPU".
+ */
+void pool_run(int njobs, void (*fn)(int idx, void *ctx), void *ctx,
+              int nthreads);
+
 /* -------------------------------------------------------------------------
  *                               Utilities
  * ------------------------------------------------------------------------- */
@@ -234,4 +1237,16 @@ void type_prompt();
  */
 void read_line(char **line, size_t *len);
 
+/**
+ * @brief Reads one more line of an unfinished command and appends it.
+ * @return 1 if a line was read, 0 at end of input.
+ */
+int read_continuation(char **line, size_t *len);
+
+/**
+ * @brief Reads a whole script file into memory.
+ * @return The text (free it), or NULL after printing an error.
+ */
+char *read_script(const char *path);
+
 #endif /* SHELL_H */
@@ -0,0 +1,625 @@
+/**
+ * @file stats.c
+ * @brief Runtime metrics of the shell: counters, latency histograms, the
+ *        `stats` built-in and the Prometheus textfile exporter.
+ *
+ * Counters and histograms are plain arrays updated with relaxed atomic
+ * adds (built-ins such as `count` update them from worker threads), so
+ * recording costs a few nanoseconds and no locks. Latencies are measured
+ * with the monotonic clock and kept in decade buckets (1 µs to 10 s),
+ * which map directly onto Prometheus histogram buckets.
+ *
+ * Tail latencies (how long external commands take to reach `exec()`, how
+ * long each command takes, per name, and how long a line takes before the
+ * next prompt) need finer buckets than averages hide: they go into
+ * log-linear "HDR" histograms of fixed size, with values kept to within
+ * 1/16, which `stats -l` turns into percentiles.
+ *
+ * Export: when `$MYSHELL_METRICS_FILE` names a file (typically in the
+ * node_exporter textfile directory), the shell adds what it counted since
+ * its last export to the totals in that file. This happens at most every
+ * `$MYSHELL_METRICS_INTERVAL` seconds (default 60) between commands, and
+ * when the shell or script ends. Many shells share one file: each export
+ * is done under a lock (`file.lock`), and the file is replaced with
+ * `rename()`, so node_exporter never reads half of it. The totals are
+ * host-wide counters, which is what dashboards aggregate.
+ *
+ * @author Abdelhamid
+ * @date 2025-12-14
+ */
+
+#include "shell.h"
+#include <time.h>
+#ifndef _WIN32
+#include <sys/file.h>
+#endif
+
+#ifdef _WIN32
+#define stat_add(p, n) (*(p) += (n))
+#define stat_load(p) (*(p))
+#else
+#define stat_add(p, n) __atomic_fetch_add((p), (n), __ATOMIC_RELAXED)
+#define stat_load(p) __atomic_load_n((p), __ATOMIC_RELAXED)
+#endif
+
+/** @brief Number of histogram buckets (the last one is +Inf). */
+#define STAT_BUCKETS 9
+
+/** @brief Upper bounds of the buckets, in nanoseconds (1 µs to 10 s). */
+static const uint64_t bucket_ns[STAT_BUCKETS - 1] = {
+    1000ull,      10000ull,      100000ull,      1000000ull,
+    10000000ull, 100000000ull, 1000000000ull, 10000000000ull};
+
+/** @brief Bucket bounds as Prometheus `le` labels. */
+static const char *const bucket_le[STAT_BUCKETS] = {
+    "1e-06", "1e-05", "0.0001", "0.001", "0.01", "0.1", "1", "10", "+Inf"};
+
+/**
+ * @brief A latency histogram.
+ */
+struct histogram {
+  uint64_t buckets[STAT_BUCKETS]; /**< Samples per bucket (not cumulative). */
+  uint64_t count;                 /**< Number of samples. */
+  uint64_t sum_ns;                /**< Sum of the samples. */
+};
+
+/**
+ * @brief All metrics of the process.
+ */
+struct stats {
+  uint64_t counters[NUM_STAT_COUNTERS]; /**< See `enum stat_counter`. */
+  struct histogram timers[NUM_STAT_TIMERS]; /**< See `enum stat_timer`. */
+};
+
+/** @brief What this process recorded. */
+static struct stats current;
+
+/** @brief What had been recorded at the last export. */
+static struct stats exported;
+
+/** @brief Monotonic time of the last export (0: never). */
+static uint64_t last_export = 0;
+
+/**
+ * @brief Non-zero in a forked child: what it inherited was counted by its
+ *        parent, which exports it.
+ */
+static int stats_forked = 0;
+
+/**
+ * @brief How a counter is exported: metric name and labels.
+ */
+struct counter_info {
+  const char *metric; /**< Prometheus metric name. */
+  const char *labels; /**< Labels (without braces), or "". */
+  const char *label;  /**< Name in the `stats` report. */
+};
+
+/** @brief Export names of the counters, in `enum stat_counter` order. */
+static const struct counter_info counter_info[NUM_STAT_COUNTERS] = {
+    {"myshell_commands_total", "kind=\"builtin\"", "built-in commands"},
+    {"myshell_commands_total", "kind=\"external\"", "external commands"},
+    {"myshell_commands_total", "kind=\"function\"", "function calls"},
+    {"myshell_forks_total", "", "forks"},
+    {"myshell_spawns_total", "", "programs spawned"},
+    {"myshell_pipeline_stages_total", "", "pipeline stages"},
+    {"myshell_builtin_bytes_total", "", "bytes moved by built-ins"},
+    {"myshell_cache_requests_total", "cache=\"script\",result=\"hit\"",
+     "script cache hits"},
+    {"myshell_cache_requests_total", "cache=\"script\",result=\"miss\"",
+     "script cache misses"},
+    {"myshell_cache_requests_total", "cache=\"memo\",result=\"hit\"",
+     "memo hits"},
+    {"myshell_cache_requests_total", "cache=\"memo\",result=\"miss\"",
+     "memo misses"}};
+
+/** @brief Export names of the timers, in `enum stat_timer` order. */
+static const struct counter_info timer_info[NUM_STAT_TIMERS] = {
+    {"myshell_parse_seconds", "", "parse"},
+    {"myshell_spawn_seconds", "", "spawn (fork)"},
+    {"myshell_wait_seconds", "", "wait for children"}};
+
+/**
+ * @brief Returns the monotonic time in nanoseconds.
+ */
+uint64_t stats_now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * @brief Adds `n` to a counter.
+ */
+void stats_add(enum stat_counter c, uint64_t n) {
+  stat_add(&current.counters[c], n);
+}
+
+/**
+ * @brief Returns the value of a counter.
+ */
+uint64_t stats_get(enum stat_counter c) {
+  return stat_load(&current.counters[c]);
+}
+
+/**
+ * @brief Records one latency sample.
+ *
+ * @param t The timer.
+ * @param ns The latency in nanoseconds.
+ */
+void stats_time(enum stat_timer t, uint64_t ns) {
+  struct histogram *h = &current.timers[t];
+  int b = 0;
+  while (b < STAT_BUCKETS - 1 && ns > bucket_ns[b])
+    b++;
+  stat_add(&h->buckets[b], 1);
+  stat_add(&h->count, 1);
+  stat_add(&h->sum_ns, ns);
+}
+
+/**
+ * @brief Receives one metric line: its key (name and labels) and value.
+ */
+typedef void (*metric_fn)(const char *key, double value, void *ctx);
+
+/**
+ * @brief Produces every metric line of `s` (in Prometheus terms), plus the
+ *        history gauge.
+ */
+static void each_metric(const struct stats *s, metric_fn fn, void *ctx) {
+  char key[256];
+
+  for (int i = 0; i < NUM_STAT_COUNTERS; i++) {
+    const struct counter_info *ci = &counter_info[i];
+    if (ci->labels[0])
+      snprintf(key, sizeof(key), "%s{%s}", ci->metric, ci->labels);
+    else
+      snprintf(key, sizeof(key), "%s", ci->metric);
+    fn(key, (double)s->counters[i], ctx);
+  }
+  for (int t = 0; t < NUM_STAT_TIMERS; t++) {
+    const struct histogram *h = &s->timers[t];
+    uint64_t cumulative = 0;
+    for (int b = 0; b < STAT_BUCKETS; b++) {
+      cumulative += h->buckets[b];
+      snprintf(key, sizeof(key), "%s_bucket{le=\"%s\"}", timer_info[t].metric,
+               bucket_le[b]);
+      fn(key, (double)cumulative, ctx);
+    }
+    snprintf(key, sizeof(key), "%s_sum", timer_info[t].metric);
+    fn(key, (double)h->sum_ns / 1e9, ctx);
+    snprintf(key, sizeof(key), "%s_count", timer_info[t].metric);
+    fn(key, (double)h->count, ctx);
+  }
+}
+
+/**
+ * @brief Prints the `# TYPE` line of a metric the first time it appears.
+ */
+static void print_type(FILE *fp, const char *key, const char **last) {
+  size_t len = strcspn(key, "{");
+  const char *type = "counter";
+  char name[128];
+
+  snprintf(name, sizeof(name), "%.*s", (int)len, key);
+  for (int t = 0; t < NUM_STAT_TIMERS; t++) {
+    size_t n = strlen(timer_info[t].metric);
+    if (strncmp(name, timer_info[t].metric, n) == 0) {
+      name[n] = '\0';
+      type = "histogram";
+    }
+  }
+  if (strcmp(name, "myshell_history_entries") == 0)
+    type = "gauge";
+  if (*last && strcmp(*last, name) == 0)
+    return;
+  fprintf(fp, "# TYPE %s %s\n", name, type);
+  free((char *)*last);
+  *last = strdup(name);
+}
+
+/**
+ * @brief Context of print_metric().
+ */
+struct print_ctx {
+  FILE *fp;         /**< Output. */
+  const char *last; /**< Last metric whose type was printed. */
+};
+
+/**
+ * @brief Prints one metric line in the Prometheus text format.
+ */
+static void print_metric(const char *key, double value, void *ctx) {
+  struct print_ctx *pc = ctx;
+  print_type(pc->fp, key, &pc->last);
+  fprintf(pc->fp, "%s %.15g\n", key, value);
+}
+
+/**
+ * @brief Prints metrics in the Prometheus text format.
+ */
+static void print_prometheus(FILE *fp, const struct stats *s, long history) {
+  struct print_ctx pc = {fp, NULL};
+  each_metric(s, print_metric, &pc);
+  print_metric("myshell_history_entries", (double)history, &pc);
+  free((char *)pc.last);
+}
+
+/**
+ * @brief Returns the number of history entries.
+ */
+static long history_size() {
+  long n = 0;
+  while (history_entry((int)n))
+    n++;
+  return n;
+}
+
+/**
+ * @brief Copies the current metrics (each value is read atomically).
+ */
+static void snapshot(struct stats *s) {
+  uint64_t *dst = (uint64_t *)s;
+  uint64_t *src = (uint64_t *)&current;
+  for (size_t i = 0; i < sizeof(*s) / sizeof(uint64_t); i++)
+    dst[i] = stat_load(&src[i]);
+}
+
+#ifndef _WIN32
+/**
+ * @brief A metric read back from the export file.
+ */
+struct total {
+  char *key;    /**< Name and labels. */
+  double value; /**< Host-wide total. */
+};
+
+/**
+ * @brief Totals of the export file, and what this export adds to them.
+ */
+struct merge {
+  struct total *totals; /**< Lines of the file. */
+  int len;              /**< Entries in `totals`. */
+  FILE *fp;             /**< The new file. */
+  const char *last;     /**< Last metric whose type was printed. */
+};
+
+/**
+ * @brief Writes one metric of the new file: its previous total plus what
+ *        this process recorded since its last export.
+ */
+static void merge_metric(const char *key, double delta, void *ctx) {
+  struct merge *m = ctx;
+  double value = delta;
+  for (int i = 0; i < m->len; i++) {
+    if (strcmp(m->totals[i].key, key) == 0) {
+      value += m->totals[i].value;
+      break;
+    }
+  }
+  print_type(m->fp, key, &m->last);
+  fprintf(m->fp, "%s %.15g\n", key, value);
+}
+
+/**
+ * @brief Reads the totals of an export file.
+ */
+static void read_totals(const char *path, struct merge *m) {
+  char line[512];
+  FILE *fp = fopen(path, "r");
+  if (!fp)
+    return;
+  while (fgets(line, sizeof(line), fp)) {
+    char *space = strrchr(line, ' ');
+    if (line[0] == '#' || !space)
+      continue;
+    *space = '\0';
+    struct total *t = realloc(m->totals, (m->len + 1) * sizeof(struct total));
+    if (!t)
+      break;
+    m->totals = t;
+    m->totals[m->len].key = strdup(line);
+    m->totals[m->len].value = atof(space + 1);
+    m->len++;
+  }
+  fclose(fp);
+}
+
+/**
+ * @brief Adds what was recorded since the last export to the export file.
+ */
+static void export_now(const char *path) {
+  char lock_path[4200], tmp[4200];
+  struct stats now, delta;
+  struct merge m = {NULL, 0, NULL, NULL};
+
+  snprintf(lock_path, sizeof(lock_path), "%s.lock", path);
+  int lock = open(lock_path, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+  if (lock < 0 || flock(lock, LOCK_EX) != 0) {
+    if (lock >= 0)
+      close(lock);
+    return;
+  }
+  snapshot(&now);
+  uint64_t *d = (uint64_t *)&delta;
+  uint64_t *a = (uint64_t *)&now, *b = (uint64_t *)&exported;
+  for (size_t i = 0; i < sizeof(delta) / sizeof(uint64_t); i++)
+    d[i] = a[i] - b[i];
+
+  read_totals(path, &m);
+  snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid());
+  m.fp = fopen(tmp, "w");
+  if (m.fp) {
+    each_metric(&delta, merge_metric, &m);
+    // A gauge: the latest shell to export sets it
+    print_type(m.fp, "myshell_history_entries", &m.last);
+    fprintf(m.fp, "myshell_history_entries %ld\n", history_size());
+    if (fclose(m.fp) == 0 && rename(tmp, path) == 0)
+      exported = now;
+    else
+      unlink(tmp);
+  }
+  for (int i = 0; i < m.len; i++)
+    free(m.totals[i].key);
+  free(m.totals);
+  free((char *)m.last);
+  close(lock);
+}
+#endif
+
+/**
+ * @brief Exports the metrics if an export is due.
+ *
+ * Called between commands; cheap when nothing is due.
+ *
+ * @param force Non-zero to export now (when the shell ends, including by
+ *        exec'ing its last command).
+ */
+void stats_export(int force) {
+#ifdef _WIN32
+  (void)force;
+#else
+  const char *path = getenv("MYSHELL_METRICS_FILE");
+  if (!path || !*path || stats_forked)
+    return;
+  uint64_t now = stats_now();
+  if (!force) {
+    const char *env = getenv("MYSHELL_METRICS_INTERVAL");
+    uint64_t interval = env && *env ? strtoull(env, NULL, 10) : 60;
+    if (last_export == 0)
+      last_export = now; // the first interval starts with the shell
+    if (now - last_export < interval * 1000000000ull)
+      return;
+  }
+  last_export = now;
+  export_now(path);
+#endif
+}
+
+/**
+ * @brief Stops a forked child from exporting: its counters start with its
+ *        parent's, and the parent counts what matters of the child.
+ */
+void stats_child() { stats_forked = 1; }
+
+/* =========================================================================
+ *                          Tail Latency (HDR Histograms)
+ * ========================================================================= */
+
+/** @brief Sub-buckets per power of two: values are kept to within 1/16. */
+#define HDR_SUB_BITS 4
+#define HDR_SUB (1 << HDR_SUB_BITS)
+
+/** @brief Largest value kept exactly, as a power of two of nanoseconds
+ *  (2^42 ns is 73 minutes; longer samples count as that). */
+#define HDR_MAX_BITS 42
+
+/** @brief Buckets of a tail latency histogram. */
+#define HDR_BUCKETS ((HDR_MAX_BITS - HDR_SUB_BITS + 1) * HDR_SUB)
+
+/** @brief Command names with their own duration histogram; the others
+ *  share one more. */
+#define HDR_COMMANDS 32
+
+/**
+ * @brief A log-linear ("HDR") histogram: below 16 ns one bucket per
+ *        nanosecond, then 16 buckets per power of two. Fixed size, so
+ *        recording is an index computation and an atomic add.
+ */
+struct hdr {
+  uint64_t buckets[HDR_BUCKETS]; /**< Samples per bucket. */
+  uint64_t count;                /**< Number of samples. */
+  uint64_t max;                  /**< Largest sample. */
+};
+
+/**
+ * @brief Duration histogram of one command name.
+ */
+struct command_hdr {
+  char name[32];  /**< Command name (truncated), or "" if the slot is free. */
+  struct hdr hdr; /**< Its durations. */
+};
+
+/** @brief Histograms of `enum stat_latency`. */
+static struct hdr latency[NUM_STAT_LATENCIES];
+
+/** @brief Durations per command name; the last slot takes the rest. */
+static struct command_hdr commands[HDR_COMMANDS + 1];
+
+/** @brief Report names of `enum stat_latency`. */
+static const char *const latency_label[NUM_STAT_LATENCIES] = {
+    "launch (fork to exec)", "line to next prompt"};
+
+/**
+ * @brief Returns the bucket of a value.
+ */
+static int hdr_index(uint64_t v) {
+  if (v >= 1ull << HDR_MAX_BITS)
+    v = (1ull << HDR_MAX_BITS) - 1;
+  if (v < HDR_SUB)
+    return (int)v;
+#ifdef _WIN32
+  int k = HDR_SUB_BITS;
+  while (v >> (k + 1))
+    k++;
+#else
+  int k = 63 - __builtin_clzll(v); // v is in [2^k, 2^(k+1))
+#endif
+  int sub = (int)(v >> (k - HDR_SUB_BITS)) & (HDR_SUB - 1);
+  return (k - HDR_SUB_BITS + 1) * HDR_SUB + sub;
+}
+
+/**
+ * @brief Returns the largest value of a bucket.
+ */
+static uint64_t hdr_value(int i) {
+  if (i < HDR_SUB)
+    return (uint64_t)i;
+  int k = i / HDR_SUB + HDR_SUB_BITS - 1;
+  uint64_t low = (uint64_t)(HDR_SUB + i % HDR_SUB) << (k - HDR_SUB_BITS);
+  return low + (1ull << (k - HDR_SUB_BITS)) - 1;
+}
+
+/**
+ * @brief Records a sample.
+ */
+static void hdr_record(struct hdr *h, uint64_t ns) {
+  stat_add(&h->buckets[hdr_index(ns)], 1);
+  stat_add(&h->count, 1);
+#ifdef _WIN32
+  if (ns > h->max)
+    h->max = ns;
+#else
+  uint64_t max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+  while (ns > max && !__atomic_compare_exchange_n(&h->max, &max, ns, 1,
+                                                  __ATOMIC_RELAXED,
+                                                  __ATOMIC_RELAXED))
+    ;
+#endif
+}
+
+/**
+ * @brief Returns the value below which a fraction `q` of the samples
+ *        fall (to within the bucket width).
+ */
+static uint64_t hdr_percentile(const struct hdr *h, double q) {
+  uint64_t rank = (uint64_t)(q * (double)h->count + 0.999999);
+  uint64_t seen = 0;
+  if (rank == 0)
+    rank = 1;
+  for (int i = 0; i < HDR_BUCKETS; i++) {
+    seen += h->buckets[i];
+    if (seen >= rank)
+      return hdr_value(i) < h->max ? hdr_value(i) : h->max;
+  }
+  return h->max;
+}
+
+void stats_latency(enum stat_latency l, uint64_t ns) {
+  hdr_record(&latency[l], ns);
+}
+
+/**
+ * @brief Records how long a command took, under its name.
+ *
+ * Slots are claimed by the first names seen; only the shell's main
+ * thread runs commands, so claiming needs no lock.
+ */
+void stats_command(const char *name, uint64_t ns) {
+  unsigned h = (unsigned)hash_bytes(HASH_SEED, name, strlen(name));
+  struct command_hdr *slot = &commands[HDR_COMMANDS];
+
+  for (int i = 0; i < HDR_COMMANDS; i++) {
+    struct command_hdr *c = &commands[(h + i) % HDR_COMMANDS];
+    if (c->name[0] == '\0')
+      snprintf(c->name, sizeof(c->name), "%s", name);
+    if (strncmp(c->name, name, sizeof(c->name) - 1) == 0) {
+      slot = c;
+      break;
+    }
+  }
+  hdr_record(&slot->hdr, ns);
+}
+
+/**
+ * @brief Prints one row of the percentile report.
+ */
+static void print_percentiles(const char *label, const struct hdr *h) {
+  static const double q[] = {0.5, 0.9, 0.99, 0.999};
+  printf("%-26s %8llu", label, (unsigned long long)h->count);
+  for (int i = 0; i < 4; i++)
+    printf(" %9.3f", hdr_percentile(h, q[i]) / 1e6);
+  printf(" %9.3f\n", h->max / 1e6);
+}
+
+/**
+ * @brief Prints the tail latency report.
+ */
+static void print_latencies() {
+  printf("%-26s %8s %9s %9s %9s %9s %9s\n", "latency (ms)", "count", "p50",
+         "p90", "p99", "p99.9", "max");
+  for (int l = 0; l < NUM_STAT_LATENCIES; l++)
+    print_percentiles(latency_label[l], &latency[l]);
+  for (int i = 0; i <= HDR_COMMANDS; i++) {
+    char label[64];
+    if (commands[i].hdr.count == 0)
+      continue;
+    snprintf(label, sizeof(label), "command %.31s",
+             i < HDR_COMMANDS ? commands[i].name : "(other)");
+    print_percentiles(label, &commands[i].hdr);
+  }
+}
+
+/* =========================================================================
+ *                          Built-in Command Implementation
+ * ========================================================================= */
+
+/**
+ * @brief Prints the metrics of this shell.
+ *
+ * Usage: `stats [-p | -l | -r]`. Without options, prints a readable
+ * report; with `-p`, the Prometheus text format (as exported, but for
+ * this process only); with `-l`, the tail latencies (p50 to p99.9);
+ * with `-r`, clears the tail latencies (the counters, which are exported,
+ * keep counting).
+ *
+ * @param args Null-terminated array of arguments.
+ * @return int Always returns 1 to continue execution.
+ */
+int shell_stats(char **args) {
+  struct stats s;
+
+  if (args[1] && !args[2] && strcmp(args[1], "-l") == 0) {
+    print_latencies();
+    return 1;
+  }
+  if (args[1] && !args[2] && strcmp(args[1], "-r") == 0) {
+    memset(latency, 0, sizeof(latency));
+    memset(commands, 0, sizeof(commands));
+    return 1;
+  }
+  snapshot(&s);
+  if (args[1] && strcmp(args[1], "-p") == 0) {
+    print_prometheus(stdout, &s, history_size());
+    return 1;
+  }
+  if (args[1]) {
+    fprintf(stderr, "stats: usage: stats [-p | -l | -r]\n");
+    last_status = 2;
+    return 1;
+  }
+  for (int i = 0; i < NUM_STAT_COUNTERS; i++) {
+    printf("%-26s %12llu\n", counter_info[i].label,
+           (unsigned long long)s.counters[i]);
+  }
+  printf("%-26s %12ld\n", "history entries", history_size());
+  printf("%-26s %12s %12s %12s\n", "latency", "count", "total ms", "mean us");
+  for (int t = 0; t < NUM_STAT_TIMERS; t++) {
+    const struct histogram *h = &s.timers[t];
+    printf("%-26s %12llu %12.3f %12.1f\n", timer_info[t].label,
+           (unsigned long long)h->count, (double)h->sum_ns / 1e6,
+           h->count ? (double)h->sum_ns / 1e3 / (double)h->count : 0.0);
+  }
+  return 1;
+}
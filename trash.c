@@ -0,0 +1,413 @@
+/**
+ * @file trash.c
+ * @brief Recursive and deferred (asynchronous) deletion for `rm`.
+ *
+ * `rm --async` does not delete anything at the prompt. Instead the target is
+ * renamed into a trash directory on the same filesystem, which is a single
+ * O(1) `rename()` no matter how large the tree is. A background thread with
+ * idle CPU and I/O priority then deletes the trash contents while the user
+ * keeps working.
+ *
+ * Trash directories are called `.shell_trash`. The one in the home directory
+ * is used whenever the target lives on the same filesystem; otherwise one is
+ * created at the top of the target's filesystem (or, if that is not
+ * writable, next to the target). Those extra locations are remembered in
+ * `~/.shell_trash_dirs` so work left over when the shell exits is resumed by
+ * `trash_resume()` at the next start.
+ *
+ * @author Abdelhamid
+ * @date 2025-12-14
+ */
+
+#define _GNU_SOURCE /* SCHED_IDLE, RENAME_NOREPLACE */
+#include "shell.h"
+#include <time.h>
+
+/** @brief Name of a trash directory. */
+#define TRASH_DIR ".shell_trash"
+
+/** @brief File (in $HOME) listing trash directories outside $HOME's fs. */
+#define TRASH_REGISTRY ".shell_trash_dirs"
+
+/** @brief Maximum number of trash directories tracked by one shell. */
+#define TRASH_MAX_DIRS 32
+
+#ifndef _WIN32
+#include <pthread.h>
+#include <sched.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+/** @brief Known trash directories (absolute paths). */
+static char *trash_dirs[TRASH_MAX_DIRS];
+
+/** @brief Number of entries in `trash_dirs`. */
+static int trash_num_dirs = 0;
+
+/** @brief Set when new work was queued for the purge thread. */
+static int trash_pending = 0;
+
+/** @brief Set once the purge thread has been started. */
+static int trash_started = 0;
+
+static pthread_mutex_t trash_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t trash_cond = PTHREAD_COND_INITIALIZER;
+
+/**
+ * @brief Deletes `name` (a file or a whole tree) relative to `dirfd`.
+ *
+ * Directories are opened with O_NOFOLLOW and walked through their own
+ * descriptor, so every entry is unlinked with `unlinkat()` relative to its
+ * parent: no path is ever resolved twice and symbolic links are removed,
+ * never followed.
+ *
+ * @param dirfd Directory `name` is relative to (or AT_FDCWD).
+ * @param name Entry to delete.
+ * @return int 0 on success, -1 on failure (errno is set).
+ */
+static int remove_at(int dirfd, const char *name) {
+  if (unlinkat(dirfd, name, 0) == 0 || errno == ENOENT)
+    return 0;
+  if (errno != EISDIR && errno != EPERM)
+    return -1;
+
+  int fd = openat(dirfd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+  if (fd < 0)
+    return -1;
+  DIR *dp = fdopendir(fd);
+  if (!dp) {
+    close(fd);
+    return -1;
+  }
+
+  struct dirent *entry;
+  int rc = 0;
+  while ((entry = readdir(dp)) != NULL) {
+    if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+      continue;
+    if (remove_at(fd, entry->d_name) != 0)
+      rc = -1;
+  }
+  closedir(dp);
+
+  if (unlinkat(dirfd, name, AT_REMOVEDIR) != 0 && errno != ENOENT)
+    rc = -1;
+  return rc;
+}
+
+/**
+ * @brief Deletes a file or a whole directory tree.
+ *
+ * Relative paths are resolved against the shell's cached working
+ * directory descriptor.
+ *
+ * @param path File or directory to delete.
+ * @return int 0 on success, -1 on failure (errno is set).
+ */
+int remove_tree(const char *path) { return remove_at(fs_cwd(), path); }
+
+/**
+ * @brief Lowers the calling thread to idle CPU and I/O priority.
+ *
+ * Uses SCHED_IDLE and the idle I/O class on Linux; elsewhere the thread
+ * just gets the weakest nice value. Failures are ignored: the purge still
+ * works, it is only less polite.
+ */
+static void trash_lower_priority() {
+#if defined(__linux__)
+  struct sched_param param = {0};
+  pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+#if defined(SYS_ioprio_set)
+  // IOPRIO_WHO_PROCESS (1) on our thread id, IOPRIO_CLASS_IDLE (3) << 13
+  syscall(SYS_ioprio_set, 1, (int)syscall(SYS_gettid), 3 << 13);
+#endif
+#else
+  nice(19);
+#endif
+}
+
+/**
+ * @brief Deletes everything inside one trash directory.
+ * @param dir Absolute path of the trash directory.
+ */
+static void trash_purge_dir(const char *dir) {
+  DIR *dp = opendir(dir);
+  struct dirent *entry;
+  char path[4096];
+
+  if (!dp)
+    return;
+  while ((entry = readdir(dp)) != NULL) {
+    if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+      continue;
+    snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+    remove_at(AT_FDCWD, path);
+  }
+  closedir(dp);
+}
+
+/**
+ * @brief Purge thread body: empties all trash directories whenever woken.
+ * @param arg Unused.
+ * @return void* Never returns while the shell runs.
+ */
+static void *trash_worker(void *arg) {
+  (void)arg;
+  trash_lower_priority();
+
+  for (;;) {
+    char *dirs[TRASH_MAX_DIRS];
+    int n;
+
+    pthread_mutex_lock(&trash_lock);
+    while (!trash_pending)
+      pthread_cond_wait(&trash_cond, &trash_lock);
+    trash_pending = 0;
+    n = trash_num_dirs;
+    memcpy(dirs, trash_dirs, n * sizeof(char *));
+    pthread_mutex_unlock(&trash_lock);
+
+    for (int i = 0; i < n; i++)
+      trash_purge_dir(dirs[i]);
+  }
+  return NULL;
+}
+
+/**
+ * @brief Queues a purge pass, starting the background thread if needed.
+ */
+static void trash_wakeup() {
+  pthread_mutex_lock(&trash_lock);
+  trash_pending = 1;
+  if (!trash_started) {
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, trash_worker, NULL) == 0) {
+      pthread_detach(tid);
+      trash_started = 1;
+    }
+  }
+  pthread_cond_signal(&trash_cond);
+  pthread_mutex_unlock(&trash_lock);
+}
+
+/**
+ * @brief Adds a trash directory to the in-memory list (if not present).
+ * @param dir Absolute path of the trash directory.
+ * @return int 1 if it was newly added, 0 otherwise.
+ */
+static int trash_track(const char *dir) {
+  int added = 0;
+  pthread_mutex_lock(&trash_lock);
+  int i;
+  for (i = 0; i < trash_num_dirs; i++) {
+    if (strcmp(trash_dirs[i], dir) == 0)
+      break;
+  }
+  if (i == trash_num_dirs && trash_num_dirs < TRASH_MAX_DIRS) {
+    trash_dirs[trash_num_dirs++] = strdup(dir);
+    added = 1;
+  }
+  pthread_mutex_unlock(&trash_lock);
+  return added;
+}
+
+/**
+ * @brief Builds the path of a file in the home directory.
+ * @return int 0 on success, -1 if $HOME is unknown.
+ */
+static int home_path(char *buf, size_t size, const char *name) {
+  char *home = getenv("HOME");
+  if (!home)
+    return -1;
+  snprintf(buf, size, "%s/%s", home, name);
+  return 0;
+}
+
+/**
+ * @brief Remembers a trash directory outside $HOME for `trash_resume()`.
+ * @param dir Absolute path of the trash directory.
+ */
+static void trash_register(const char *dir) {
+  char path[1024];
+  char line[4096];
+  FILE *fp;
+
+  if (home_path(path, sizeof(path), TRASH_REGISTRY) != 0)
+    return;
+  fp = fopen(path, "a+");
+  if (!fp)
+    return;
+  rewind(fp);
+  while (fgets(line, sizeof(line), fp)) {
+    line[strcspn(line, "\n")] = 0;
+    if (strcmp(line, dir) == 0) {
+      fclose(fp);
+      return;
+    }
+  }
+  fprintf(fp, "%s\n", dir);
+  fclose(fp);
+}
+
+/**
+ * @brief Builds (and creates) the trash directory inside `base`.
+ * @return int 0 on success, -1 on failure (errno is set; ENAMETOOLONG if
+ *         the path does not fit in `dir`).
+ */
+static int trash_dir_in(const char *base, char *dir, size_t size) {
+  int n = snprintf(dir, size, "%s/%s", strcmp(base, "/") == 0 ? "" : base,
+                   TRASH_DIR);
+  if (n < 0 || (size_t)n >= size) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  return mkdir(dir, 0700) == 0 || errno == EEXIST ? 0 : -1;
+}
+
+/**
+ * @brief Picks (and creates) the trash directory for a target.
+ *
+ * Preference order: `$HOME/.shell_trash` if it shares the target's
+ * filesystem, then `.shell_trash` at the top of the target's filesystem,
+ * then `.shell_trash` in the target's parent directory.
+ *
+ * @param target Path being deleted.
+ * @param dir Output buffer receiving the absolute trash directory path.
+ * @param size Size of `dir`.
+ * @return int 0 on success, -1 on failure (errno is set).
+ */
+static int trash_dir_for(const char *target, char *dir, size_t size) {
+  struct stat tst, st;
+  char parent[4096];
+  char up[4096];
+
+  if (fs_stat(target, &tst, AT_SYMLINK_NOFOLLOW) != 0)
+    return -1;
+
+  // Home trash when on the same filesystem
+  char *home = getenv("HOME");
+  if (home && stat(home, &st) == 0 && st.st_dev == tst.st_dev &&
+      trash_dir_in(home, dir, size) == 0)
+    return 0;
+
+  // Absolute parent directory of the target
+  snprintf(up, sizeof(up), "%s", target);
+  char *slash = strrchr(up, '/');
+  if (slash == up)
+    up[1] = '\0';
+  else if (slash)
+    *slash = '\0';
+  else
+    strcpy(up, ".");
+  if (!realpath(up, parent))
+    return -1;
+
+  // Climb to the top-most ancestor still on the same filesystem
+  strcpy(up, parent);
+  for (;;) {
+    char next[4096];
+    slash = strrchr(up, '/');
+    if (!slash || slash == up)
+      strcpy(next, "/");
+    else
+      snprintf(next, (size_t)(slash - up) + 1, "%s", up);
+    if (strcmp(next, up) == 0 || stat(next, &st) != 0 ||
+        st.st_dev != tst.st_dev)
+      break;
+    strcpy(up, next);
+  }
+
+  if (trash_dir_in(up, dir, size) == 0)
+    return 0;
+  return trash_dir_in(parent, dir, size);
+}
+
+/**
+ * @brief Moves a file or tree to the trash and schedules its deletion.
+ *
+ * The rename is atomic: the target disappears from its directory
+ * immediately, and the background thread deletes it later.
+ *
+ * @param path File or directory to delete.
+ * @return int 0 on success, -1 on failure (errno is set).
+ */
+int trash_path(const char *path) {
+  static unsigned counter = 0;
+  char dir[4096];
+  char dest[4200];
+
+  if (trash_dir_for(path, dir, sizeof(dir)) != 0)
+    return -1;
+
+  snprintf(dest, sizeof(dest), "%s/%ld.%d.%u", dir, (long)time(NULL),
+           (int)getpid(), counter++);
+#ifdef RENAME_NOREPLACE
+  if (fs_rename(path, dest, RENAME_NOREPLACE) != 0)
+    return -1;
+#else
+  if (fs_rename(path, dest, 0) != 0)
+    return -1;
+#endif
+
+  char home_trash[1024];
+  if (trash_track(dir) &&
+      (home_path(home_trash, sizeof(home_trash), TRASH_DIR) != 0 ||
+       strcmp(home_trash, dir) != 0)) {
+    trash_register(dir);
+  }
+  trash_wakeup();
+  return 0;
+}
+
+/**
+ * @brief Resumes deletion of trash left behind by earlier sessions.
+ *
+ * Called once at startup. Looks at `$HOME/.shell_trash` and every directory
+ * listed in `~/.shell_trash_dirs`, and wakes the purge thread if any of
+ * them still has entries.
+ */
+void trash_resume() {
+  char path[1024];
+  char line[4096];
+  int work = 0;
+
+  if (home_path(path, sizeof(path), TRASH_DIR) == 0 && rmdir(path) != 0 &&
+      errno != ENOENT) {
+    trash_track(path);
+    work = 1;
+  }
+
+  if (home_path(path, sizeof(path), TRASH_REGISTRY) == 0) {
+    FILE *fp = fopen(path, "r");
+    if (fp) {
+      while (fgets(line, sizeof(line), fp)) {
+        line[strcspn(line, "\n")] = 0;
+        if (line[0] && rmdir(line) != 0 && errno != ENOENT) {
+          trash_track(line);
+          work = 1;
+        }
+      }
+      fclose(fp);
+    }
+  }
+
+  if (work)
+    trash_wakeup();
+}
+
+#else
+
+/* Windows: no background deletion; `rm --async` deletes synchronously. */
+
+int remove_tree(const char *path) {
+  if (remove(path) == 0)
+    return 0;
+  return _rmdir(path);
+}
+
+int trash_path(const char *path) { return remove_tree(path); }
+
+void trash_resume() {}
+
+#endif
@@ -4,7 +4,8 @@
  *
  * This file contains functions that handle user interface elements,
  * specifically generating and displaying the command prompt and
- * reading user input from the standard input stream.
+ * reading user input from the standard input stream, and reading whole
+ * script files (for the shell and for libmyshell alike).
  *
  * @author Abdelhamid
  * @date 2025-12-14
@@ -50,11 +51,80 @@ void type_prompt() {
   printf("\033[1;32m%s@%s\033[0m:\033[1;34m%s\033[0m$ ", user, host, cwd);
 }
 
+/**
+ * @brief Reads the here-document bodies announced on a command line.
+ *
+ * For every `<<WORD` / `<<-WORD` on the line, keeps reading lines from
+ * `stream` up to and including the delimiter line and appends them to the
+ * command text, so the parser finds each body right after the command.
+ * A `> ` continuation prompt is shown when reading from a terminal.
+ *
+ * @param line Pointer to the allocated command text (may be reallocated).
+ * @param len Pointer to the size of the buffer.
+ * @param stream The input stream.
+ * @param pos Where the newly read text starts in `*line`.
+ */
+static void read_heredoc_bodies(char **line, size_t *len, FILE *stream,
+                                int pos) {
+  char delims[8][256];
+  int strip[8];
+  int pending = 0;
+  struct token tok;
+
+  // Collect the delimiters, in order
+  while (lex_token(*line, &pos, &tok) != TOK_END && pending < 8) {
+    if (tok.type == TOK_OP &&
+        (strcmp(tok.op, "<<") == 0 || strcmp(tok.op, "<<-") == 0)) {
+      int dash = tok.op[2] == '-';
+      if (lex_token(*line, &pos, &tok) == TOK_WORD) {
+        heredoc_delimiter(*line + tok.start, tok.len, delims[pending],
+                          sizeof(delims[pending]));
+        strip[pending++] = dash;
+      }
+    }
+  }
+
+  char *next = NULL;
+  size_t next_len = 0;
+  size_t used = strlen(*line);
+  for (int d = 0; d < pending; d++) {
+    for (;;) {
+      if (isatty(fileno(stream))) {
+        printf("> ");
+        fflush(stdout);
+      }
+      if (getline(&next, &next_len, stream) == -1)
+        break; // EOF ends the document, like other shells
+      size_t n = strlen(next);
+      if (used + n + 1 > *len) {
+        *len = (used + n + 1) * 2;
+        *line = realloc(*line, *len);
+        if (!*line) {
+          fprintf(stderr, "shell: allocation error\n");
+          exit(EXIT_FAILURE);
+        }
+      }
+      memcpy(*line + used, next, n + 1);
+      used += n;
+
+      char *text = next;
+      while (strip[d] && *text == '\t')
+        text++;
+      text[strcspn(text, "\n")] = '\0';
+      if (strcmp(text, delims[d]) == 0)
+        break;
+    }
+  }
+  free(next);
+}
+
 /**
  * @brief Reads a line of input from standard input.
  *
  * This function handles reading a full line of text from the user.
- * It detects End-Of-File (EOF) to gracefully exit the shell.
+ * It detects End-Of-File (EOF) to gracefully exit the shell. If the line
+ * starts here-documents (`<<EOF`), their bodies are read too and appended
+ * to the line.
  *
  * @note This implementation relies on `getline`, which is a POSIX standard.
  * On Windows systems without MinGW/Cygwin, a replacement or fallback
@@ -74,4 +144,84 @@ void read_line(char **line, size_t *len) {
       exit(EXIT_FAILURE);
     }
   }
+
+  if (strstr(*line, "<<")) {
+    read_heredoc_bodies(line, len, stdin, 0);
+  }
+}
+
+/**
+ * @brief Reads one more line of an unfinished command and appends it.
+ *
+ * Used while a command is incomplete (an `if` without `fi`, an open
+ * quote...). Shows a `> ` prompt when reading from a terminal.
+ *
+ * @param line Pointer to the command text so far (may be reallocated).
+ * @param len Pointer to the size of the buffer.
+ * @return int 1 if a line was appended, 0 at end of input.
+ */
+int read_continuation(char **line, size_t *len) {
+  char *next = NULL;
+  size_t next_len = 0;
+
+  if (isatty(fileno(stdin))) {
+    printf("> ");
+    fflush(stdout);
+  }
+  if (getline(&next, &next_len, stdin) == -1) {
+    free(next);
+    return 0;
+  }
+  size_t used = strlen(*line);
+  size_t n = strlen(next);
+  if (used + n + 1 > *len) {
+    *len = (used + n + 1) * 2;
+    *line = realloc(*line, *len);
+    if (!*line) {
+      fprintf(stderr, "shell: allocation error\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  memcpy(*line + used, next, n + 1);
+  free(next);
+  if (strstr(*line + used, "<<")) {
+    read_heredoc_bodies(line, len, stdin, (int)used);
+  }
+  return 1;
+}
+
+/**
+ * @brief Reads a whole script file into memory.
+ *
+ * @param path The script.
+ * @return char* The text (free it), or NULL after printing an error.
+ */
+char *read_script(const char *path) {
+  FILE *fp = fopen(path, "rb");
+  char *text = NULL;
+  size_t len = 0, cap = 0, n;
+  char chunk[65536];
+
+  if (!fp) {
+    fprintf(stderr, "myshell: %s: %s\n", path, strerror(errno));
+    return NULL;
+  }
+  while ((n = fread(chunk, 1, sizeof(chunk), fp)) > 0) {
+    if (len + n + 1 > cap) {
+      cap = (len + n + 1) * 2;
+      text = realloc(text, cap);
+      if (!text) {
+        fprintf(stderr, "shell: allocation error\n");
+        exit(EXIT_FAILURE);
+      }
+    }
+    memcpy(text + len, chunk, n);
+    len += n;
+  }
+  fclose(fp);
+  if (!text)
+    text = calloc(1, 1);
+  else
+    text[len] = '\0';
+  return text;
 }
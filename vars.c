@@ -0,0 +1,481 @@
+/**
+ * @file vars.c
+ * @brief Shell variables, positional parameters and the last exit status.
+ *
+ * Shell variables live in a chained hash table. A variable may also be an
+ * array (`read -a`); its first element doubles as its scalar value. A
+ * variable that is
+ * exported (or that came from the environment) is mirrored with
+ * `setenv()`, so launched programs see it; all others stay private to the
+ * shell. Lookups fall back to the environment, which means inherited
+ * variables work without being copied into the table first.
+ *
+ * @author Abdelhamid
+ * @date 2025-12-14
+ */
+
+#include "shell.h"
+#include <ctype.h>
+
+/** @brief Number of hash buckets (power of two). */
+#define VAR_BUCKETS 256
+
+/**
+ * @brief One shell variable.
+ */
+struct var {
+  char *name;       /**< Variable name. */
+  char *value;      /**< Current value (element 0 of an array). */
+  char **items;     /**< Array elements, or NULL for a scalar. */
+  int num_items;    /**< Number of entries in `items`. */
+  int exported;     /**< Non-zero if mirrored into the environment. */
+  struct var *next; /**< Next variable in the same bucket. */
+};
+
+/** @brief The variable table. */
+static struct var *var_table[VAR_BUCKETS];
+
+/**
+ * @brief State of a variable before its first change inside a snapshot
+ *        (an in-process subshell).
+ */
+struct var_undo {
+  char *name;            /**< Variable name, or NULL for a local slot. */
+  struct var *saved;     /**< Copy of the variable, or NULL if unset. */
+  char *saved_env;       /**< Environment value, or NULL if not there. */
+  char **slot;           /**< The local slot (when `name` is NULL). */
+  char *slot_value;      /**< Previous value of the slot. */
+  int level;             /**< Snapshot level that recorded it. */
+  struct var_undo *next; /**< Older entry. */
+};
+
+/** @brief Undo entries, newest first. */
+static struct var_undo *undo_log = NULL;
+
+/** @brief Number of active snapshots (0: changes are not recorded). */
+static int snapshot_level = 0;
+
+/** @brief Exit status of the last command (`$?`). */
+int last_status = 0;
+
+/** @brief Non-zero for the interactive REPL, zero when running a script. */
+int interactive = 0;
+
+/** @brief `$?` as it was before the running built-in reset it (the
+ *  default status of `exit` and `return`). */
+int previous_status = 0;
+
+/** @brief Positional parameters `$1`..`$N` (not including `$0`). */
+char **shell_params = NULL;
+
+/** @brief Number of positional parameters (`$#`). */
+int shell_num_params = 0;
+
+/**
+ * @brief Bucket index for a name (FNV-1a).
+ */
+static unsigned var_bucket(const char *name) {
+  unsigned h = 2166136261u;
+  while (*name) {
+    h ^= (unsigned char)*name++;
+    h *= 16777619u;
+  }
+  return h & (VAR_BUCKETS - 1);
+}
+
+/**
+ * @brief Finds a variable in the table.
+ * @return struct var* The variable, or NULL.
+ */
+static struct var *var_find(const char *name) {
+  for (struct var *v = var_table[var_bucket(name)]; v; v = v->next) {
+    if (strcmp(v->name, name) == 0)
+      return v;
+  }
+  return NULL;
+}
+
+/**
+ * @brief Returns a deep copy of a variable (not linked into the table).
+ */
+static struct var *var_copy(const struct var *v) {
+  struct var *c = calloc(1, sizeof(struct var));
+  if (!c) {
+    fprintf(stderr, "shell: allocation error\n");
+    exit(EXIT_FAILURE);
+  }
+  c->name = strdup(v->name);
+  c->value = v->value ? strdup(v->value) : NULL;
+  c->exported = v->exported;
+  if (v->items) {
+    c->items = malloc((v->num_items > 0 ? v->num_items : 1) * sizeof(char *));
+    for (int i = 0; i < v->num_items; i++)
+      c->items[i] = strdup(v->items[i]);
+    c->num_items = v->num_items;
+  }
+  return c;
+}
+
+/**
+ * @brief Records the state of a variable before it changes, once per
+ *        snapshot (copy-on-write).
+ */
+static void var_remember(const char *name) {
+  if (snapshot_level == 0)
+    return;
+  for (struct var_undo *u = undo_log; u && u->level == snapshot_level;
+       u = u->next) {
+    if (u->name && strcmp(u->name, name) == 0)
+      return;
+  }
+  struct var_undo *u = calloc(1, sizeof(struct var_undo));
+  if (!u) {
+    fprintf(stderr, "shell: allocation error\n");
+    exit(EXIT_FAILURE);
+  }
+  struct var *v = var_find(name);
+  const char *env = getenv(name);
+  u->name = strdup(name);
+  u->saved = v ? var_copy(v) : NULL;
+  u->saved_env = env ? strdup(env) : NULL;
+  u->level = snapshot_level;
+  u->next = undo_log;
+  undo_log = u;
+}
+
+/**
+ * @brief Records the value of a local slot before it changes.
+ */
+static void slot_remember(char **slot) {
+  if (snapshot_level == 0)
+    return;
+  for (struct var_undo *u = undo_log; u && u->level == snapshot_level;
+       u = u->next) {
+    if (u->slot == slot)
+      return;
+  }
+  struct var_undo *u = calloc(1, sizeof(struct var_undo));
+  if (!u) {
+    fprintf(stderr, "shell: allocation error\n");
+    exit(EXIT_FAILURE);
+  }
+  u->slot = slot;
+  u->slot_value = *slot ? strdup(*slot) : NULL;
+  u->level = snapshot_level;
+  u->next = undo_log;
+  undo_log = u;
+}
+
+/**
+ * @brief Frees a variable that is not linked into the table.
+ */
+static void var_free(struct var *v) {
+  for (int i = 0; i < v->num_items; i++)
+    free(v->items[i]);
+  free(v->items);
+  free(v->name);
+  free(v->value);
+  free(v);
+}
+
+/**
+ * @brief Unlinks a variable from the table (the environment is untouched).
+ * @return struct var* The variable, or NULL if it was not there.
+ */
+static struct var *var_detach(const char *name) {
+  struct var **link = &var_table[var_bucket(name)];
+  while (*link) {
+    struct var *v = *link;
+    if (strcmp(v->name, name) == 0) {
+      *link = v->next;
+      return v;
+    }
+    link = &v->next;
+  }
+  return NULL;
+}
+
+/**
+ * @brief Starts recording variable changes, for `var_restore()`.
+ *
+ * Nothing is copied up front: a variable is saved the first time it
+ * changes, so a snapshot costs nothing for the variables left alone.
+ */
+void var_snapshot() { snapshot_level++; }
+
+/**
+ * @brief Undoes every variable change since the matching `var_snapshot()`.
+ */
+void var_restore() {
+  if (snapshot_level == 0)
+    return;
+  while (undo_log && undo_log->level == snapshot_level) {
+    struct var_undo *u = undo_log;
+    undo_log = u->next;
+    if (u->name) {
+      struct var *v = var_detach(u->name);
+      if (v)
+        var_free(v);
+      if (u->saved) {
+        unsigned b = var_bucket(u->name);
+        u->saved->next = var_table[b];
+        var_table[b] = u->saved;
+      }
+      if (u->saved_env)
+        setenv(u->name, u->saved_env, 1);
+      else
+        unsetenv(u->name);
+      free(u->name);
+      free(u->saved_env);
+    } else {
+      free(*u->slot);
+      *u->slot = u->slot_value;
+    }
+    free(u);
+  }
+  snapshot_level--;
+}
+
+/**
+ * @brief Checks whether `name` is a valid variable name.
+ * @return int 1 if valid, 0 otherwise.
+ */
+int valid_var_name(const char *name) {
+  if (!isalpha((unsigned char)*name) && *name != '_')
+    return 0;
+  for (name++; *name; name++) {
+    if (!isalnum((unsigned char)*name) && *name != '_')
+      return 0;
+  }
+  return 1;
+}
+
+/**
+ * @brief Returns the value of a variable.
+ *
+ * Locals of the running functions take precedence over shell
+ * variables, which take precedence over the environment.
+ *
+ * @param name Variable name.
+ * @return const char* The value, or NULL if unset.
+ */
+const char *var_get(const char *name) {
+  char **slot = local_slot(name);
+  if (slot)
+    return *slot;
+  struct var *v = var_find(name);
+  if (v)
+    return v->value;
+  return getenv(name);
+}
+
+/**
+ * @brief Sets a variable.
+ *
+ * Variables that are exported, or that exist in the environment, are
+ * updated there as well.
+ *
+ * @param name Variable name.
+ * @param value New value.
+ */
+void var_set(const char *name, const char *value) {
+  char **slot = local_slot(name);
+  if (slot) {
+    // A `local` of a running function hides the global variable
+    slot_remember(slot);
+    char *copy = strdup(value);
+    free(*slot);
+    *slot = copy;
+    return;
+  }
+  var_remember(name);
+  struct var *v = var_find(name);
+  if (!v) {
+    unsigned b = var_bucket(name);
+    v = calloc(1, sizeof(struct var));
+    if (!v) {
+      fprintf(stderr, "shell: allocation error\n");
+      exit(EXIT_FAILURE);
+    }
+    v->name = strdup(name);
+    v->exported = getenv(name) != NULL;
+    v->next = var_table[b];
+    var_table[b] = v;
+  }
+  char *copy = strdup(value);
+  free(v->value);
+  v->value = copy;
+  if (v->items) {
+    free(v->items[0]);
+    v->items[0] = strdup(value);
+  }
+  if (v->exported)
+    setenv(name, value, 1);
+}
+
+/**
+ * @brief Frees the elements of an array variable.
+ */
+static void free_items(struct var *v) {
+  for (int i = 0; i < v->num_items; i++)
+    free(v->items[i]);
+  free(v->items);
+  v->items = NULL;
+  v->num_items = 0;
+}
+
+/**
+ * @brief Replaces a variable with an array.
+ *
+ * @param name Variable name.
+ * @param items The elements (copied).
+ * @param n Number of elements.
+ */
+void var_set_array(const char *name, char **items, int n) {
+  struct var *v;
+
+  var_set(name, n > 0 ? items[0] : "");
+  v = var_find(name);
+  free_items(v);
+  v->items = malloc((n > 0 ? n : 1) * sizeof(char *));
+  if (!v->items) {
+    fprintf(stderr, "shell: allocation error\n");
+    exit(EXIT_FAILURE);
+  }
+  for (int i = 0; i < n; i++)
+    v->items[i] = strdup(items[i]);
+  v->num_items = n;
+}
+
+/**
+ * @brief Returns element `idx` of a variable.
+ *
+ * A scalar behaves like an array of one element.
+ *
+ * @return const char* The element, or NULL if unset.
+ */
+const char *var_get_index(const char *name, int idx) {
+  struct var *v = var_find(name);
+  if (v && v->items)
+    return idx >= 0 && idx < v->num_items ? v->items[idx] : NULL;
+  return idx == 0 ? var_get(name) : NULL;
+}
+
+/**
+ * @brief Returns the number of elements of a variable (0 if unset).
+ */
+int var_array_len(const char *name) {
+  struct var *v = var_find(name);
+  if (v && v->items)
+    return v->num_items;
+  return var_get(name) ? 1 : 0;
+}
+
+/**
+ * @brief Marks a variable as exported (copies it into the environment).
+ * @param name Variable name.
+ */
+void var_export(const char *name) {
+  const char *value = var_get(name);
+  struct var *v;
+
+  var_set(name, value ? value : "");
+  v = var_find(name);
+  v->exported = 1;
+  setenv(name, v->value, 1);
+}
+
+/**
+ * @brief Removes a variable from the shell and the environment.
+ * @param name Variable name.
+ */
+void var_unset(const char *name) {
+  var_remember(name);
+  struct var *v = var_detach(name);
+  if (v)
+    var_free(v);
+  unsetenv(name);
+}
+
+/**
+ * @brief Checks whether a word is an assignment (`NAME=value`).
+ * @param word A cooked word.
+ * @return int Length of NAME if it is an assignment, 0 otherwise.
+ */
+int is_assignment(const char *word) {
+  const char *eq = strchr(word, '=');
+  if (!eq || eq == word)
+    return 0;
+  if (!isalpha((unsigned char)*word) && *word != '_')
+    return 0;
+  for (const char *c = word + 1; c < eq; c++) {
+    if (!isalnum((unsigned char)*c) && *c != '_')
+      return 0;
+  }
+  return (int)(eq - word);
+}
+
+/**
+ * @brief Applies an assignment word (`NAME=value`).
+ * @param word The assignment.
+ */
+void var_assign(const char *word) {
+  int n = is_assignment(word);
+  char name[256];
+  if (n <= 0 || n >= (int)sizeof(name))
+    return;
+  memcpy(name, word, n);
+  name[n] = '\0';
+  var_set(name, word + n + 1);
+}
+
+/* =========================================================================
+ *                          Built-in Command Implementations
+ * ========================================================================= */
+
+/**
+ * @brief Exports variables to launched programs.
+ *
+ * Usage: `export NAME[=value]...`; with no arguments, lists the exported
+ * variables (the environment).
+ *
+ * @param args Null-terminated array of arguments.
+ * @return int Always returns 1 to continue execution.
+ */
+int shell_export(char **args) {
+  extern char **environ;
+
+  if (args[1] == NULL) {
+    for (char **e = environ; *e; e++)
+      printf("export %s\n", *e);
+    return 1;
+  }
+  for (int i = 1; args[i] != NULL; i++) {
+    int n = is_assignment(args[i]);
+    if (n > 0) {
+      var_assign(args[i]);
+      args[i][n] = '\0';
+      var_export(args[i]);
+      args[i][n] = '=';
+    } else if (valid_var_name(args[i])) {
+      var_export(args[i]);
+    } else {
+      fprintf(stderr, "shell: export: '%s': not a valid identifier\n",
+              args[i]);
+      last_status = 1;
+    }
+  }
+  return 1;
+}
+
+/**
+ * @brief Removes variables.
+ *
+ * @param args Null-terminated array of arguments (variable names).
+ * @return int Always returns 1 to continue execution.
+ */
+int shell_unset(char **args) {
+  for (int i = 1; args[i] != NULL; i++)
+    var_unset(args[i]);
+  return 1;
+}
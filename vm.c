@@ -0,0 +1,1309 @@
+/**
+ * @file vm.c
+ * @brief Runs compiled scripts (see compile.c): the dispatch loop, shell
+ *        functions, and the control built-ins (break, continue, return,
+ *        local, shift).
+ *
+ * The VM walks the instruction array of a `struct program`. Simple
+ * commands (OP_CMD) go to `execute_simple()`; everything else is a jump,
+ * a status tweak, or a push/pop on a small runtime stack that tracks the
+ * active loops, `case` subjects and compound-command redirections. The
+ * stack is what `break` and `continue` unwind.
+ *
+ * Built-ins cannot jump themselves: `break`, `continue` and `return` set a
+ * pending request that the loop checks after each command.
+ *
+ * Functions are stored by name with a reference to the program that
+ * defined them. A call gets its own positional parameters and a frame of
+ * `local` variables; the names declared with `local` in the body are known
+ * at compile time, so the frame is allocated in one go and `var_get()`
+ * only scans a short array before the global table.
+ *
+ * @author Abdelhamid
+ * @date 2025-12-14
+ */
+
+#include "shell.h"
+
+/** @brief Number of function table buckets (power of two). */
+#define FUNC_BUCKETS 64
+
+/** @brief Maximum depth of nested function calls. */
+#define MAX_CALL_DEPTH 1000
+
+/**
+ * @brief Kinds of runtime stack entries.
+ */
+enum entry_kind {
+  ENTRY_LOOP,  /**< An active while/until/for loop. */
+  ENTRY_CASE,  /**< The subject of an active case. */
+  ENTRY_REDIR  /**< A compound command's redirections. */
+};
+
+/**
+ * @brief One entry of the runtime stack.
+ */
+struct entry {
+  int kind;        /**< An `enum entry_kind`. */
+  int break_pc;    /**< Loops: where `break` goes (the OP_LOOP_END). */
+  int continue_pc; /**< Loops: where `continue` goes. */
+  int status;      /**< Loops: status of the last complete iteration. */
+  char **words;    /**< For loops: the words to iterate over. */
+  int owns_args;   /**< For loops: `words` came from `parse_input()`. */
+  int next;        /**< For loops: index of the next word. */
+  int jobs;        /**< For loops: parallel workers (0: serial, -1: this
+                        process is a worker running one iteration). */
+  char *subject;   /**< Case: the expanded subject. */
+};
+
+/**
+ * @brief The runtime stack of one `vm_exec()` activation.
+ */
+struct vm_stack {
+  struct entry *entries;
+  int depth;
+  int cap;
+};
+
+/**
+ * @brief A shell function.
+ */
+struct function {
+  char *name;            /**< Function name. */
+  struct program *prog;  /**< Program containing the body (referenced). */
+  int start;             /**< First instruction of the body. */
+  const char **locals;   /**< Names declared `local` (in the pool). */
+  int num_locals;        /**< Entries in `locals`. */
+  struct function *next; /**< Next function in the same bucket. */
+};
+
+/**
+ * @brief Local variables of one function call.
+ */
+struct frame {
+  const char **names; /**< Slot names. */
+  char **values;     /**< Slot values (NULL until declared `local`). */
+  int num_slots;     /**< Slots in use. */
+  int cap;           /**< Slots allocated. */
+  struct frame *up;  /**< The caller's frame. */
+};
+
+/** @brief The function table. */
+static struct function *func_table[FUNC_BUCKETS];
+
+/** @brief Frame of the innermost running function, or NULL. */
+static struct frame *current_frame = NULL;
+
+/** @brief Depth of nested function calls. */
+static int call_depth = 0;
+
+/**
+ * @brief Control transfers requested by built-ins.
+ */
+enum request {
+  REQUEST_NONE,
+  REQUEST_BREAK,
+  REQUEST_CONTINUE,
+  REQUEST_RETURN
+};
+
+/** @brief Pending control transfer. */
+static int request = REQUEST_NONE;
+
+/** @brief Loop count of a pending `break`/`continue`. */
+static int request_count = 0;
+
+/** @brief Number of loops active across all activations (for `break`). */
+static int loop_depth = 0;
+
+/** @brief Number of nested `vm_exec()` activations. */
+static int vm_nesting = 0;
+
+/**
+ * @brief vm_exec() nesting at which a command followed by OP_HALT is the
+ *        last thing the process runs, so it may replace the process (0:
+ *        never, as in the interactive shell).
+ */
+static int tail_nesting = 0;
+
+static int vm_exec(struct program *p, int pc);
+
+/* =========================================================================
+ *                          Runtime Stack
+ * ========================================================================= */
+
+/**
+ * @brief Pushes an entry of the given kind.
+ * @return struct entry* The new entry (zeroed).
+ */
+static struct entry *push(struct vm_stack *s, int kind) {
+  if (s->depth == s->cap) {
+    s->cap = s->cap ? s->cap * 2 : 8;
+    s->entries = realloc(s->entries, s->cap * sizeof(struct entry));
+    if (!s->entries) {
+      fprintf(stderr, "shell: allocation error\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  struct entry *e = &s->entries[s->depth++];
+  memset(e, 0, sizeof(*e));
+  e->kind = kind;
+  if (kind == ENTRY_LOOP)
+    loop_depth++;
+  return e;
+}
+
+/**
+ * @brief Pops the top entry, releasing what it holds.
+ */
+static void pop(struct vm_stack *s) {
+  struct entry *e = &s->entries[--s->depth];
+
+  if (e->kind == ENTRY_LOOP) {
+    if (e->jobs < 0) {
+      // A parallel iteration ends with its loop, however it is left
+      jobs_exit(last_status);
+    }
+    loop_depth--;
+    if (e->owns_args)
+      free_args(e->words);
+    else
+      free(e->words);
+  } else if (e->kind == ENTRY_CASE) {
+    free(e->subject);
+  } else {
+    redirect_pop();
+  }
+}
+
+/**
+ * @brief Pops entries down to (not including) index `keep`.
+ */
+static void unwind(struct vm_stack *s, int keep) {
+  while (s->depth > keep)
+    pop(s);
+}
+
+/**
+ * @brief Returns the index of the innermost entry of `kind`, or -1.
+ */
+static int find_entry(struct vm_stack *s, int kind) {
+  for (int i = s->depth - 1; i >= 0; i--) {
+    if (s->entries[i].kind == kind)
+      return i;
+  }
+  return -1;
+}
+
+/**
+ * @brief Carries out a pending `break` or `continue`.
+ *
+ * @return int The instruction to continue at, or -1 if the loop is not in
+ *         this activation (the request is then dropped).
+ */
+static int take_loop_request(struct vm_stack *s) {
+  int target = -1;
+  int count = request_count;
+
+  for (int i = s->depth - 1; i >= 0; i--) {
+    if (s->entries[i].kind != ENTRY_LOOP)
+      continue;
+    target = i;
+    if (--count == 0)
+      break; // `break 5` in 2 loops leaves them all
+  }
+  int kind = request;
+  request = REQUEST_NONE;
+  if (target < 0)
+    return -1;
+
+  struct entry *loop = &s->entries[target];
+  if (kind == REQUEST_BREAK) {
+    unwind(s, target + 1);
+    return loop->break_pc;
+  }
+  unwind(s, target + 1);
+  return loop->continue_pc;
+}
+
+/* =========================================================================
+ *                          Functions
+ * ========================================================================= */
+
+/**
+ * @brief Bucket index for a function name (FNV-1a).
+ */
+static unsigned func_bucket(const char *name) {
+  unsigned h = 2166136261u;
+  while (*name) {
+    h ^= (unsigned char)*name++;
+    h *= 16777619u;
+  }
+  return h & (FUNC_BUCKETS - 1);
+}
+
+/**
+ * @brief Finds a function by name.
+ */
+static struct function *find_function(const char *name) {
+  for (struct function *f = func_table[func_bucket(name)]; f; f = f->next) {
+    if (strcmp(f->name, name) == 0)
+      return f;
+  }
+  return NULL;
+}
+
+/**
+ * @brief Returns non-zero if `name` is a defined shell function.
+ */
+int is_function(const char *name) { return find_function(name) != NULL; }
+
+/**
+ * @brief Defines (or redefines) a function from an OP_FUNC instruction.
+ */
+static void define_function(struct program *p, struct insn *in, int start) {
+  const char *name = p->pool + in->a;
+  struct function *f = find_function(name);
+
+  if (!f) {
+    unsigned b = func_bucket(name);
+    f = calloc(1, sizeof(struct function));
+    if (!f) {
+      fprintf(stderr, "shell: allocation error\n");
+      exit(EXIT_FAILURE);
+    }
+    f->name = strdup(name);
+    f->next = func_table[b];
+    func_table[b] = f;
+  } else {
+    program_free(f->prog);
+    free(f->locals);
+    f->locals = NULL;
+    f->num_locals = 0;
+  }
+  p->refs++;
+  f->prog = p;
+  f->start = start;
+
+  // The names declared with `local` become the frame's slots; they are
+  // stored back to back in the pool, ending with an empty name
+  if (in->c >= 0) {
+    for (const char *s = p->pool + in->c; *s; s += strlen(s) + 1) {
+      f->locals = realloc(f->locals, (f->num_locals + 1) * sizeof(char *));
+      f->locals[f->num_locals++] = s;
+    }
+  }
+}
+
+/**
+ * @brief Adds a slot to a frame.
+ * @return int Index of the slot.
+ */
+static int add_slot(struct frame *fr, const char *name) {
+  if (fr->num_slots == fr->cap) {
+    fr->cap = fr->cap ? fr->cap * 2 : 4;
+    fr->names = realloc(fr->names, fr->cap * sizeof(char *));
+    fr->values = realloc(fr->values, fr->cap * sizeof(char *));
+    if (!fr->names || !fr->values) {
+      fprintf(stderr, "shell: allocation error\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  fr->names[fr->num_slots] = name;
+  fr->values[fr->num_slots] = NULL;
+  return fr->num_slots++;
+}
+
+/**
+ * @brief Returns the slot of a `local` variable of the running functions.
+ *
+ * Lookup is dynamic, as in other shells: a function sees the locals of
+ * the functions that called it.
+ *
+ * @param name Variable name.
+ * @return char** Pointer to the value, or NULL if `name` is not local.
+ */
+char **local_slot(const char *name) {
+  for (struct frame *fr = current_frame; fr; fr = fr->up) {
+    for (int i = 0; i < fr->num_slots; i++) {
+      if (fr->values[i] && strcmp(fr->names[i], name) == 0)
+        return &fr->values[i];
+    }
+  }
+  return NULL;
+}
+
+/**
+ * @brief Calls the shell function `args[0]` with arguments `args[1..]`.
+ *
+ * @param args Null-terminated array of arguments.
+ * @return int 1 to continue, 0 if the shell should exit.
+ */
+int call_function(char **args) {
+  struct function *f = find_function(args[0]);
+  if (!f)
+    return 1;
+  if (call_depth == MAX_CALL_DEPTH) {
+    fprintf(stderr, "shell: %s: maximum function nesting level exceeded\n",
+            args[0]);
+    last_status = 1;
+    return 1;
+  }
+
+  // The frame starts with one undeclared slot per compile-time local;
+  // their names live in the program's pool, which the call keeps alive
+  struct frame fr = {NULL, NULL, 0, 0, current_frame};
+  int fixed = f->num_locals;
+  for (int i = 0; i < fixed; i++)
+    add_slot(&fr, f->locals[i]);
+
+  char **saved_params = shell_params;
+  int saved_num = shell_num_params;
+  int saved_loops = loop_depth;
+  struct program *prog = f->prog;
+
+  prog->refs++; // the function may be redefined while it runs
+  shell_params = args + 1;
+  shell_num_params = 0;
+  while (args[shell_num_params + 1])
+    shell_num_params++;
+  current_frame = &fr;
+  call_depth++;
+  loop_depth = 0; // `break` cannot leave the function
+
+  last_status = 0;
+  profile_call(args[0]);
+  int result = vm_exec(prog, f->start);
+  profile_return();
+  if (request == REQUEST_RETURN)
+    request = REQUEST_NONE;
+
+  loop_depth = saved_loops;
+  call_depth--;
+  current_frame = fr.up;
+  shell_params = saved_params;
+  shell_num_params = saved_num;
+  program_free(prog);
+
+  for (int i = 0; i < fr.num_slots; i++) {
+    free(fr.values[i]);
+    if (i >= fixed)
+      free((char *)fr.names[i]); // added by `local` at run time
+  }
+  free(fr.names);
+  free(fr.values);
+  return result;
+}
+
+/* =========================================================================
+ *                          Dispatch Loop
+ * ========================================================================= */
+
+/**
+ * @brief Checks whether nothing but an OP_HALT follows `pc`.
+ *
+ * At the top level of a script, that is the end of the program; in a
+ * forked child, the end of its block.
+ */
+static int at_halt(struct program *p, int pc) {
+  int i = pc + 1;
+  for (int hops = 0; hops < 8 && i < p->len && p->code[i].op == OP_JMP;
+       hops++)
+    i = p->code[i].a;
+  return i < p->len && p->code[i].op == OP_HALT;
+}
+
+#ifndef _WIN32
+/**
+ * @brief Runs a block in a forked child, which exits with its status.
+ *
+ * The last command of the block replaces the child instead of being
+ * forked once more.
+ */
+static void run_child(struct program *p, int pc) {
+  tail_nesting = vm_nesting + 1;
+  loop_depth = 0;
+  vm_exec(p, pc);
+  jobs_exit(last_status);
+}
+#endif
+
+/**
+ * @brief Runs an OP_PIPE: each stage block in its own child.
+ *
+ * @param p The program.
+ * @param pc Index of the OP_PIPE.
+ */
+static void run_pipe(struct program *p, int pc) {
+#ifdef _WIN32
+  (void)p;
+  (void)pc;
+  fprintf(stderr, "Piping not supported on Windows mode.\n");
+  last_status = 1;
+#else
+  int n = p->code[pc].a;
+  int fds[2 * n];
+  pid_t pids[n];
+  int started;
+
+  read_sync();
+  jobs_flush();
+  for (int i = 0; i < n - 1; i++) {
+    if (pipe(fds + 2 * i) < 0) {
+      perror("pipe");
+      for (int j = 0; j < 2 * i; j++)
+        close(fds[j]);
+      last_status = 1;
+      return;
+    }
+  }
+  for (started = 0; started < n; started++) {
+    struct insn *stage = &p->code[pc + 1 + started];
+    pid_t pid = jobs_fork("(pipeline stage)");
+    if (pid == 0) {
+      if (started > 0)
+        dup2(fds[2 * (started - 1)], STDIN_FILENO);
+      if (started < n - 1)
+        dup2(fds[2 * started + 1], STDOUT_FILENO);
+      if (stage->b)
+        dup2(STDOUT_FILENO, STDERR_FILENO);
+      for (int j = 0; j < 2 * (n - 1); j++)
+        close(fds[j]);
+      run_child(p, stage->a);
+    } else if (pid < 0) {
+      perror("fork");
+      break;
+    }
+    pids[started] = pid;
+  }
+  for (int j = 0; j < 2 * (n - 1); j++)
+    close(fds[j]);
+
+  int status;
+  last_status = started < n ? 1 : 0;
+  for (int i = 0; i < started; i++) {
+    waitpid(pids[i], &status, 0);
+    status = WIFSIGNALED(status) ? 128 + WTERMSIG(status) : WEXITSTATUS(status);
+    SHELL_PROBE2(reap, pids[i], status);
+    if (i == n - 1)
+      last_status = status;
+  }
+#endif
+}
+
+#ifndef _WIN32
+/**
+ * @brief Iterations of a parallel `for` that may be started ahead of the
+ *        oldest one not copied out yet (each holds two temporary files).
+ */
+#define ITER_WINDOW 64
+
+/**
+ * @brief One iteration of a parallel `for`.
+ */
+struct iteration {
+  int pid;    /**< Its worker (0 once reaped). */
+  FILE *out;  /**< Its standard output, buffered until it is copied out. */
+  FILE *err;  /**< Its standard error, likewise. */
+  int status; /**< Exit status of the worker. */
+};
+
+/**
+ * @brief Copies a buffered stream of an iteration out, then closes it.
+ */
+static void copy_buffered(FILE **from, FILE *to) {
+  char buf[8192];
+  size_t n;
+
+  if (!*from)
+    return;
+  rewind(*from);
+  while ((n = fread(buf, 1, sizeof(buf), *from)) > 0)
+    fwrite(buf, 1, n, to);
+  fflush(to);
+  fclose(*from);
+  *from = NULL;
+}
+
+/**
+ * @brief Copies an iteration's buffered output to standard output and
+ *        standard error.
+ */
+static void copy_output(struct iteration *it) {
+  copy_buffered(&it->out, stdout);
+  copy_buffered(&it->err, stderr);
+}
+#endif
+
+/**
+ * @brief Runs the remaining iterations of a `for -j N` loop.
+ *
+ * Each iteration runs in a forked worker, at most `e->jobs` at a time.
+ * A worker writes its standard output and error to temporary files, which
+ * are copied out once it and every earlier iteration have finished, so
+ * outputs appear whole and in order. At most ITER_WINDOW iterations are
+ * started ahead of the oldest one not copied out; when temporary files
+ * run out, the loop waits for running workers instead. The loop status is
+ * that of the first failed iteration, or 0.
+ *
+ * @param e The loop entry.
+ * @param var The loop variable.
+ * @return int 1 in a worker, which goes on to run the body once (its loop
+ *         entry exits the process when popped); 0 in the shell once every
+ *         iteration has finished.
+ */
+static int run_iterations(struct entry *e, const char *var) {
+#ifdef _WIN32
+  (void)e;
+  (void)var;
+  return 0;
+#else
+  int n = 0;
+  while (e->words[e->next + n])
+    n++;
+  struct iteration *its = calloc(n > 0 ? n : 1, sizeof(struct iteration));
+  if (!its) {
+    fprintf(stderr, "shell: allocation error\n");
+    exit(EXIT_FAILURE);
+  }
+  int started = 0, running = 0, copied = 0;
+
+  e->status = 0;
+  while (started < n || running > 0) {
+    if (started < n && running < e->jobs && started - copied < ITER_WINDOW) {
+      struct iteration *it = &its[started];
+      it->out = tmpfile();
+      it->err = it->out ? tmpfile() : NULL;
+      if (it->err) {
+        read_sync();
+        jobs_flush();
+        pid_t pid = jobs_fork("(for -j)");
+        if (pid == 0) {
+          dup2(fileno(it->out), STDOUT_FILENO);
+          dup2(fileno(it->err), STDERR_FILENO);
+          var_set(var, e->words[e->next + started]);
+          e->next += started + 1;
+          e->words[e->next] = NULL; // just this one
+          e->jobs = -1;
+          return 1;
+        }
+        if (pid < 0) {
+          perror("fork");
+          copy_output(it);
+          it->status = 1;
+          n = started + 1; // start nothing more
+        } else {
+          it->pid = pid;
+          running++;
+        }
+        started++;
+        continue;
+      }
+      if (it->out)
+        fclose(it->out);
+      it->out = NULL;
+      if (running == 0) {
+        // Out of descriptors with nothing to wait for
+        perror("tmpfile");
+        it->status = 1;
+        n = ++started;
+        continue;
+      }
+      // Otherwise wait for a worker, then try again
+    }
+
+    int status;
+    int pid = jobs_wait_any(&status);
+    if (pid < 0)
+      break;
+    for (int i = copied; i < started; i++) {
+      if (its[i].pid == pid) {
+        its[i].pid = 0;
+        its[i].status = status;
+        running--;
+        break;
+      }
+    }
+    while (copied < started && its[copied].pid == 0) {
+      copy_output(&its[copied]);
+      if (e->status == 0)
+        e->status = its[copied].status;
+      copied++;
+    }
+  }
+  // Iterations that failed to start after the last worker finished
+  while (copied < started) {
+    copy_output(&its[copied]);
+    if (e->status == 0)
+      e->status = its[copied].status;
+    copied++;
+  }
+  free(its);
+  while (e->words[e->next])
+    e->next++;
+  return 0;
+#endif
+}
+
+/**
+ * @brief Checks whether a simple command (or pipeline) text only runs a
+ *        built-in that a subshell can run in the shell process, or only
+ *        assigns variables.
+ */
+static int command_is_pure(const char *text) {
+  // Built-ins whose effects the subshell snapshot does not cover
+  static const char *const unsafe[] = {"exec",   "local", "pushd",   "popd",
+                                       "source", ".",     "alias",   "unalias",
+                                       "set",    NULL};
+  struct token tok;
+  char word[64];
+  int pos = 0;
+
+  while (lex_token(text, &pos, &tok) != TOK_END) {
+    if (tok.type == TOK_OP) {
+      if (tok.op[0] == '\n')
+        break; // here-document bodies follow
+      if (tok.op[0] == '|')
+        return 0;
+      // A redirection: skip its target
+      if (lex_token(text, &pos, &tok) != TOK_WORD)
+        return 0;
+      continue;
+    }
+    if (tok.len >= (int)sizeof(word))
+      return 0;
+    memcpy(word, text + tok.start, tok.len);
+    word[tok.len] = '\0';
+    if (is_assignment(word))
+      continue;
+    // The command name must be known without running anything
+    if (strpbrk(word, "'\"\\$`") || !is_builtin(word) || is_function(word) ||
+        is_alias(word))
+      return 0;
+    for (int i = 0; unsafe[i]; i++) {
+      if (strcmp(word, unsafe[i]) == 0)
+        return 0;
+    }
+    return 1;
+  }
+  return 1;
+}
+
+/**
+ * @brief Checks whether a subshell body (instructions `from` to `to`) can
+ *        run in the shell process: only built-ins and assignments, no
+ *        function definitions, pipelines or background jobs.
+ */
+static int subshell_is_pure(struct program *p, int from, int to) {
+  for (int i = from; i < to; i++) {
+    switch (p->code[i].op) {
+    case OP_FUNC:
+    case OP_PIPE:
+    case OP_STAGE:
+    case OP_BG:
+      return 0;
+    case OP_CMD:
+      if (!command_is_pure(p->pool + p->code[i].a))
+        return 0;
+      break;
+    default:
+      break;
+    }
+  }
+  return 1;
+}
+
+/**
+ * @brief Runs an OP_SUBSHELL.
+ *
+ * A body made only of built-ins and assignments (`(cd dir; pwd)`) runs in
+ * the shell process: variables are recorded copy-on-write by
+ * `var_snapshot()`, and the positional parameters, working directory and
+ * `PWD`/`OLDPWD` are saved, then everything is put back afterwards. Its
+ * redirections are undone by the body itself, since `exec` is excluded.
+ * Any other body runs in a forked child, whose last command replaces it
+ * (`(cd dir && make)` forks once, like the plain command).
+ *
+ * @param p The program.
+ * @param pc Index of the OP_SUBSHELL.
+ */
+static void run_subshell(struct program *p, int pc) {
+  int end = p->code[pc].a;
+
+#ifndef _WIN32
+  if (!subshell_is_pure(p, pc + 1, end)) {
+    read_sync();
+    jobs_flush();
+    pid_t pid = jobs_fork("(subshell)");
+    if (pid == 0)
+      run_child(p, pc + 1);
+    if (pid < 0) {
+      perror("fork");
+      last_status = 1;
+      return;
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    last_status = WIFSIGNALED(status) ? 128 + WTERMSIG(status)
+                                      : WEXITSTATUS(status);
+    SHELL_PROBE2(reap, pid, last_status);
+    return;
+  }
+#endif
+  // In-process (always on Windows, where there is no fork)
+  char **params = shell_params;
+  int num_params = shell_num_params;
+  int saved_loops = loop_depth;
+  const char *env = getenv("PWD");
+  char *pwd = env ? strdup(env) : NULL;
+  env = getenv("OLDPWD");
+  char *oldpwd = env ? strdup(env) : NULL;
+  int cwd = fs_save_cwd();
+
+  var_snapshot();
+  loop_depth = 0; // `break` cannot leave the subshell
+  vm_exec(p, pc + 1); // `exit` only ends the subshell
+  request = REQUEST_NONE;
+  var_restore();
+
+  loop_depth = saved_loops;
+  shell_params = params;
+  shell_num_params = num_params;
+  if (fs_restore_cwd(cwd) != 0 && pwd)
+    fs_chdir(pwd);
+  if (pwd)
+    setenv("PWD", pwd, 1);
+  else
+    unsetenv("PWD");
+  if (oldpwd)
+    setenv("OLDPWD", oldpwd, 1);
+  else
+    unsetenv("OLDPWD");
+  free(pwd);
+  free(oldpwd);
+}
+
+/**
+ * @brief Runs a program from instruction `pc` until OP_HALT or OP_RET.
+ *
+ * @param p The program.
+ * @param pc First instruction.
+ * @return int 1 to continue, 0 if the shell should exit.
+ */
+static int vm_exec(struct program *p, int pc) {
+  struct vm_stack s = {NULL, 0, 0};
+  int result = 1;
+
+  vm_nesting++;
+  while (pc < p->len) {
+    struct insn *in = &p->code[pc];
+    struct entry *e;
+    int i;
+
+    switch (in->op) {
+    case OP_CMD:
+      profile_enter(p, in->line, p->pool + in->a);
+      // The last command of a script or child may replace it (no fork),
+      // unless the profile still has to be written
+      if (vm_nesting == tail_nesting && s.depth == 0 && at_halt(p, pc) &&
+          !profile_active())
+        result = execute_tail(p->pool + in->a);
+      else
+        result = execute_simple(p->pool + in->a);
+      profile_leave();
+      if (result == 0)
+        goto out;
+      pc++;
+      if (request == REQUEST_RETURN)
+        goto out;
+      if (request != REQUEST_NONE) {
+        int target = take_loop_request(&s);
+        if (target >= 0)
+          pc = target;
+      }
+      break;
+
+    case OP_JMP:
+      pc = in->a;
+      break;
+
+    case OP_JZ:
+      pc = last_status == 0 ? in->a : pc + 1;
+      break;
+
+    case OP_JNZ:
+      pc = last_status != 0 ? in->a : pc + 1;
+      break;
+
+    case OP_NOT:
+      last_status = last_status == 0;
+      pc++;
+      break;
+
+    case OP_TRUE:
+      last_status = 0;
+      pc++;
+      break;
+
+    case OP_LOOP:
+      e = push(&s, ENTRY_LOOP);
+      e->break_pc = in->a;
+      e->continue_pc = in->b;
+      pc++;
+      break;
+
+    case OP_SAVE:
+      i = find_entry(&s, ENTRY_LOOP);
+      if (i >= 0)
+        s.entries[i].status = last_status;
+      pc++;
+      break;
+
+    case OP_LOOP_END:
+      i = find_entry(&s, ENTRY_LOOP);
+      if (i >= 0) {
+        last_status = s.entries[i].status;
+        unwind(&s, i);
+      }
+      pc++;
+      break;
+
+    case OP_FOR_INIT:
+      e = &s.entries[find_entry(&s, ENTRY_LOOP)];
+      if (in->a >= 0) {
+        e->words = parse_input(p->pool + in->a);
+        e->owns_args = 1;
+      } else {
+        // "$@", copied: the body may `shift`
+        e->words = malloc((shell_num_params + 1) * sizeof(char *));
+        for (i = 0; i < shell_num_params; i++)
+          e->words[i] = shell_params[i];
+        e->words[i] = NULL;
+      }
+#ifndef _WIN32
+      if (in->b >= 0) { // (no fork on Windows: the loop stays serial)
+        const char *text = p->pool + in->b;
+        char *jobs = expand_text(text, strlen(text));
+        e->jobs = atoi(jobs);
+        free(jobs);
+        if (e->jobs <= 0)
+          e->jobs = pool_cpu_count();
+      }
+#endif
+      pc++;
+      break;
+
+    case OP_FOR_NEXT:
+      e = &s.entries[find_entry(&s, ENTRY_LOOP)];
+      if (e->jobs > 1) {
+        // Parallel: this is a worker, or every iteration is done
+        pc = run_iterations(e, p->pool + in->a) ? pc + 1 : in->b;
+        break;
+      }
+      if (e->words[e->next] == NULL) {
+        pc = in->b;
+      } else {
+        var_set(p->pool + in->a, e->words[e->next++]);
+        pc++;
+      }
+      break;
+
+    case OP_CASE: {
+      const char *text = p->pool + in->a;
+      e = push(&s, ENTRY_CASE);
+      e->subject = expand_text(text, strlen(text));
+      pc++;
+      break;
+    }
+
+    case OP_CASE_MATCH: {
+      const char *text = p->pool + in->a;
+      char *pattern = expand_text(text, strlen(text));
+      e = &s.entries[find_entry(&s, ENTRY_CASE)];
+      pc = pattern_match(pattern, e->subject) ? in->b : pc + 1;
+      free(pattern);
+      break;
+    }
+
+    case OP_CASE_END:
+      i = find_entry(&s, ENTRY_CASE);
+      if (i >= 0)
+        unwind(&s, i);
+      pc++;
+      break;
+
+    case OP_REDIR:
+      if (redirect_text(p->pool + in->a) != 0) {
+        // The command does not run if its redirections fail
+        last_status = 1;
+        pc = in->b + 1;
+      } else {
+        push(&s, ENTRY_REDIR);
+        pc++;
+      }
+      break;
+
+    case OP_UNREDIR:
+      i = find_entry(&s, ENTRY_REDIR);
+      if (i >= 0)
+        unwind(&s, i);
+      pc++;
+      break;
+
+    case OP_FUNC:
+      define_function(p, in, pc + 1);
+      last_status = 0;
+      pc = in->b;
+      break;
+
+    case OP_PIPE:
+      profile_enter(p, in->line, NULL);
+      run_pipe(p, pc);
+      profile_leave();
+      pc = in->b;
+      break;
+
+    case OP_BG:
+#ifdef _WIN32
+      // No fork: run it in the foreground
+      result = vm_exec(p, pc + 1);
+      if (result == 0)
+        goto out;
+#else
+      read_sync();
+      jobs_flush();
+      pid_t pid = jobs_fork("(background)");
+      if (pid == 0) {
+        run_child(p, pc + 1);
+      } else if (pid < 0) {
+        perror("fork");
+      } else {
+        jobs_track(pid);
+      }
+#endif
+      last_status = 0;
+      pc = in->a;
+      break;
+
+    case OP_SUBSHELL:
+      profile_enter(p, in->line, NULL);
+      run_subshell(p, pc);
+      profile_leave();
+      pc = in->a;
+      break;
+
+    case OP_STAGE:
+    case OP_RET:
+    case OP_HALT:
+    default:
+      goto out;
+    }
+  }
+out:
+  unwind(&s, 0);
+  free(s.entries);
+  vm_nesting--;
+  return result;
+}
+
+/**
+ * @brief Runs a compiled program from its first instruction.
+ *
+ * @param p The program.
+ * @return int 1 to continue, 0 if the shell should exit.
+ */
+int vm_run(struct program *p) {
+  int result = vm_exec(p, 0);
+  // A `return` outside of any function just ends the program
+  request = REQUEST_NONE;
+  return result;
+}
+
+/**
+ * @brief Compiles script text, or takes it from the script cache.
+ *
+ * @param text The script.
+ * @param use_cache Non-zero to use the compiled script cache.
+ * @return struct program* The program (release with `program_free()`), or
+ *         NULL after printing a syntax error.
+ */
+static struct program *load_program(const char *text, int use_cache) {
+  size_t len = strlen(text);
+  struct program *p = use_cache ? cache_load(text, len) : NULL;
+
+  if (use_cache)
+    stats_add(p ? STAT_SCRIPT_HITS : STAT_SCRIPT_MISSES, 1);
+  if (!p) {
+    int incomplete;
+    p = compile_script(text, &incomplete);
+    if (!p) {
+      if (incomplete)
+        fprintf(stderr, "%s: syntax error: unexpected end of file\n",
+                shell_name);
+      return NULL;
+    }
+    if (use_cache)
+      cache_store(text, len, p);
+  }
+  return p;
+}
+
+/**
+ * @brief Runs a whole script file (or `-c` text) non-interactively.
+ *
+ * With `use_cache`, the compiled program is taken from the on-disk cache
+ * when possible (see cache.c), and stored there after compiling.
+ *
+ * @param text The script.
+ * @param use_cache Non-zero to use the compiled script cache.
+ * @return int The exit status of the script.
+ */
+int run_script_text(const char *text, int use_cache) {
+  struct program *p = load_program(text, use_cache);
+
+  if (!p)
+    return 2;
+  run_program(p);
+  program_free(p);
+  return last_status;
+}
+
+/**
+ * @brief Runs a file in the current shell (`source`, `.` and the rc file).
+ *
+ * The file is compiled once per content: its compiled form is kept in the
+ * script cache (see cache.c), so a large rc file costs a lookup, not a
+ * parse, at each start. Functions and variables it defines stay defined;
+ * a `return` at its top level ends it.
+ *
+ * @param path The file.
+ * @param params Positional parameters while it runs, or NULL to keep the
+ *        current ones.
+ * @return int 1 to continue, 0 if the shell should exit.
+ */
+int source_file(const char *path, char **params) {
+  char *text = read_script(path);
+  if (!text) {
+    last_status = 1;
+    return 1;
+  }
+  struct program *p = load_program(text, 1);
+  free(text);
+  if (!p) {
+    last_status = 2;
+    return 1;
+  }
+  p->source = strdup(path);
+
+  char **saved_params = shell_params;
+  int saved_num = shell_num_params;
+  int saved_loops = loop_depth;
+  if (params) {
+    shell_params = params;
+    shell_num_params = 0;
+    while (params[shell_num_params])
+      shell_num_params++;
+  }
+  loop_depth = 0; // `break` cannot leave the file
+
+  last_status = 0;
+  int result = vm_exec(p, 0);
+  if (request == REQUEST_RETURN)
+    request = REQUEST_NONE;
+
+  loop_depth = saved_loops;
+  if (params) {
+    shell_params = saved_params;
+    shell_num_params = saved_num;
+  }
+  program_free(p);
+  return result;
+}
+
+/**
+ * @brief Runs a compiled script as the whole of this process: its last
+ *        command replaces the process.
+ *
+ * @param p The program.
+ * @return int The exit status of the script (unless it was replaced).
+ */
+int run_program(struct program *p) {
+  tail_nesting = 1;
+  vm_run(p);
+  return last_status;
+}
+
+/**
+ * @brief Runs script text as the rest of a forked child, then exits.
+ *
+ * Used by built-ins that run shell commands in children (`dag`). As with
+ * other forked blocks, the last command replaces the child.
+ *
+ * @param text The commands.
+ */
+void run_child_text(const char *text) {
+  int incomplete;
+  struct program *p = compile_script(text, &incomplete);
+
+  if (!p) {
+    if (incomplete)
+      fprintf(stderr, "%s: syntax error: unexpected end of input\n",
+              shell_name);
+    jobs_exit(2);
+  }
+#ifdef _WIN32
+  vm_run(p);
+  jobs_exit(last_status);
+#else
+  run_child(p, 0);
+#endif
+}
+
+/* =========================================================================
+ *                          Built-in Command Implementations
+ * ========================================================================= */
+
+/**
+ * @brief Parses the optional loop count of `break`/`continue`.
+ * @return int The count (>= 1), or 0 after printing an error.
+ */
+static int loop_count(char **args) {
+  if (args[1] == NULL)
+    return 1;
+  int n = atoi(args[1]);
+  if (n < 1) {
+    fprintf(stderr, "shell: %s: %s: loop count out of range\n", args[0],
+            args[1]);
+    last_status = 1;
+    return 0;
+  }
+  return n;
+}
+
+/**
+ * @brief Leaves the innermost (or the Nth innermost) loop.
+ *
+ * Usage: `break [n]`
+ *
+ * @param args Null-terminated array of arguments.
+ * @return int Always returns 1 to continue execution.
+ */
+int shell_break(char **args) {
+  int n = loop_count(args);
+  if (n > 0 && loop_depth > 0) {
+    request = REQUEST_BREAK;
+    request_count = n;
+  }
+  return 1;
+}
+
+/**
+ * @brief Starts the next iteration of the innermost (or Nth) loop.
+ *
+ * Usage: `continue [n]`
+ *
+ * @param args Null-terminated array of arguments.
+ * @return int Always returns 1 to continue execution.
+ */
+int shell_continue(char **args) {
+  int n = loop_count(args);
+  if (n > 0 && loop_depth > 0) {
+    request = REQUEST_CONTINUE;
+    request_count = n;
+  }
+  return 1;
+}
+
+/**
+ * @brief Returns from the running function (or ends the script).
+ *
+ * Usage: `return [status]`; the default status is that of the last
+ * command.
+ *
+ * @param args Null-terminated array of arguments.
+ * @return int Always returns 1 to continue execution.
+ */
+int shell_return(char **args) {
+  last_status = args[1] ? atoi(args[1]) & 0xff : previous_status;
+  request = REQUEST_RETURN;
+  return 1;
+}
+
+/**
+ * @brief Declares variables local to the running function.
+ *
+ * Usage: `local NAME[=value]...`. A local without a value is empty. It
+ * hides any variable of the same name until the function returns.
+ *
+ * @param args Null-terminated array of arguments.
+ * @return int Always returns 1 to continue execution.
+ */
+int shell_local(char **args) {
+  if (!current_frame) {
+    fprintf(stderr, "shell: local: can only be used in a function\n");
+    last_status = 1;
+    return 1;
+  }
+  for (int i = 1; args[i] != NULL; i++) {
+    int n = is_assignment(args[i]);
+    char *name = n > 0 ? strndup(args[i], n) : strdup(args[i]);
+    const char *value = n > 0 ? args[i] + n + 1 : "";
+    if (!valid_var_name(name)) {
+      fprintf(stderr, "shell: local: '%s': not a valid identifier\n",
+              args[i]);
+      last_status = 1;
+      free(name);
+      continue;
+    }
+    int slot = -1;
+    for (int k = 0; k < current_frame->num_slots; k++) {
+      if (strcmp(current_frame->names[k], name) == 0) {
+        slot = k;
+        break;
+      }
+    }
+    if (slot < 0)
+      slot = add_slot(current_frame, strdup(name));
+    free(current_frame->values[slot]);
+    current_frame->values[slot] = strdup(value);
+    free(name);
+  }
+  return 1;
+}
+
+/**
+ * @brief Runs a file in the current shell.
+ *
+ * Usage: `source file [args...]` or `. file [args...]`; with arguments,
+ * they are the positional parameters while the file runs.
+ *
+ * @param args Null-terminated array of arguments.
+ * @return int 1 to continue execution, 0 if the file exits the shell.
+ */
+int shell_source(char **args) {
+  if (!args[1]) {
+    fprintf(stderr, "shell: %s: filename argument required\n", args[0]);
+    last_status = 2;
+    return 1;
+  }
+  return source_file(args[1], args[2] ? args + 2 : NULL);
+}
+
+/**
+ * @brief Shifts the positional parameters left.
+ *
+ * Usage: `shift [n]`
+ *
+ * @param args Null-terminated array of arguments.
+ * @return int Always returns 1 to continue execution.
+ */
+int shell_shift(char **args) {
+  int n = args[1] ? atoi(args[1]) : 1;
+  if (n < 0 || n > shell_num_params) {
+    last_status = 1;
+    return 1;
+  }
+  shell_params += n;
+  shell_num_params -= n;
+  return 1;
+}